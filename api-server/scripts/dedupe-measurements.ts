@@ -0,0 +1,174 @@
+#!/usr/bin/env tsx
+
+/**
+ * De-duplicate Measurements Script
+ *
+ * Prepares an existing database for the unique { deviceId, timestamp } index
+ * on measurements (see src/models/measurements/model.ts), then builds it.
+ * Mongoose's automatic index build cannot do this on its own: it fails while
+ * duplicates are stored, or while the older non-unique index of the same keys
+ * exists, and only logs the error, so resent uploads would still be stored
+ * twice.
+ *
+ * Steps:
+ *   1. Find measurements sharing a device and timestamp, keep the first stored
+ *      of each group (lowest _id) and delete the rest
+ *   2. Drop the non-unique { deviceId: 1, timestamp: -1 } index, if present
+ *   3. Build the unique index; if a device uploaded a duplicate in between,
+ *      de-duplicate again and retry
+ *
+ * Safe to run more than once. Run it before deploying the server with the
+ * unique index, or whenever the server logs that the index build failed.
+ *
+ * Usage:
+ *   npm run dedupe-measurements [-- --dry-run]
+ *
+ * Example:
+ *   npm run dedupe-measurements -- --dry-run   # Only report the duplicates
+ */
+
+import dotenv from 'dotenv';
+import { connectDatabase, disconnectDatabase, getMongoDbInstance } from '../src/config/database.js';
+
+// Load environment variables from .env file
+dotenv.config();
+
+const INDEX_KEYS = { deviceId: 1, timestamp: -1 } as const;
+const INDEX_NAME = 'deviceId_1_timestamp_-1';
+const DELETE_BATCH_SIZE = 1000;
+const MAX_ATTEMPTS = 3;
+
+type Collection = ReturnType<ReturnType<typeof getMongoDbInstance>['collection']>;
+
+interface DuplicateGroup {
+  _id: { deviceId: string; timestamp: Date };
+  ids: unknown[];
+}
+
+/**
+ * Delete every measurement but the first stored of each { deviceId, timestamp }
+ * group. Returns the number of groups and of documents deleted (or that would
+ * be, with dryRun).
+ */
+const removeDuplicates = async (measurements: Collection, dryRun: boolean) => {
+  const groups = measurements.aggregate<DuplicateGroup>(
+    [
+      { $sort: { _id: 1 } },
+      {
+        $group: {
+          _id: { deviceId: '$deviceId', timestamp: '$timestamp' },
+          ids: { $push: '$_id' },
+          count: { $sum: 1 },
+        },
+      },
+      { $match: { count: { $gt: 1 } } },
+    ],
+    { allowDiskUse: true }
+  );
+
+  let groupCount = 0;
+  let removed = 0;
+  let batch: unknown[] = [];
+  for await (const group of groups) {
+    groupCount++;
+    if (groupCount <= 5) {
+      console.log(
+        `   ${group._id.deviceId} at ${new Date(group._id.timestamp).toISOString()}: ${group.ids.length} copies`
+      );
+    }
+    batch.push(...group.ids.slice(1));
+    if (batch.length >= DELETE_BATCH_SIZE) {
+      removed += dryRun ? batch.length : (await measurements.deleteMany({ _id: { $in: batch } })).deletedCount;
+      batch = [];
+    }
+  }
+  if (batch.length > 0) {
+    removed += dryRun ? batch.length : (await measurements.deleteMany({ _id: { $in: batch } })).deletedCount;
+  }
+  if (groupCount > 5) console.log(`   ... and ${groupCount - 5} more`);
+
+  return { groupCount, removed };
+};
+
+const dedupeMeasurements = async (dryRun: boolean) => {
+  try {
+    console.log('🔌 Connecting to database...');
+    await connectDatabase();
+    console.log('✅ Database connected successfully\n');
+
+    const measurements = getMongoDbInstance().collection('measurements');
+
+    for (let attempt = 1; attempt <= MAX_ATTEMPTS; attempt++) {
+      console.log('🔍 Looking for measurements stored more than once (same device and timestamp)...');
+      const { groupCount, removed } = await removeDuplicates(measurements, dryRun);
+      if (groupCount === 0) {
+        console.log('✅ No duplicates found');
+      } else if (dryRun) {
+        console.log(`\n⚠️  ${groupCount} measurements stored more than once: ${removed} copies would be deleted`);
+      } else {
+        console.log(`\n🗑️  ${groupCount} measurements stored more than once: deleted ${removed} copies`);
+      }
+
+      if (dryRun) {
+        console.log('\n💡 Dry run: nothing was changed. Run without --dry-run to delete them and build the index');
+        return;
+      }
+
+      // The index of the same keys, without unique, from before
+      const existing = (await measurements.indexes()).find((index) => index.name === INDEX_NAME);
+      if (existing?.unique) {
+        console.log(`\n✅ Unique index ${INDEX_NAME} already exists`);
+        return;
+      }
+      if (existing) {
+        console.log(`\n🔄 Dropping the non-unique index ${INDEX_NAME}...`);
+        await measurements.dropIndex(INDEX_NAME);
+      }
+
+      try {
+        console.log(`\n🔄 Building the unique index ${INDEX_NAME}...`);
+        await measurements.createIndex(INDEX_KEYS, { name: INDEX_NAME, unique: true });
+        console.log(`\n✅ Success! Measurements are now unique per device and timestamp`);
+        return;
+      } catch (error) {
+        // A duplicate uploaded since the scan: scan again
+        if ((error as { code?: number })?.code !== 11000 || attempt === MAX_ATTEMPTS) throw error;
+        console.log('\n⚠️  A duplicate was stored while building the index, scanning again...\n');
+      }
+    }
+  } catch (error) {
+    console.error('\n❌ Error:', error instanceof Error ? error.message : error);
+
+    // Check if it's a MongoDB connection error
+    if (error instanceof Error && error.message.includes('ECONNREFUSED')) {
+      console.log('\n💡 Troubleshooting Steps:');
+      console.log('   1. Make sure MongoDB is running:');
+      console.log('      brew services start mongodb-community');
+      console.log('   2. Or check your .env file for correct MONGODB_URI');
+      console.log('   3. Verify MongoDB is accessible:');
+      console.log('      mongosh mongodb://localhost:27017');
+    }
+
+    process.exitCode = 1;
+  } finally {
+    try {
+      await disconnectDatabase();
+      console.log('\n🔌 Database connection closed');
+    } catch (e) {
+      // Ignore disconnect errors if connection never established
+    }
+  }
+};
+
+const args = process.argv.slice(2);
+const unknown = args.filter((arg) => arg !== '--dry-run');
+
+if (unknown.length > 0) {
+  console.error(`❌ Error: Unknown argument: ${unknown.join(' ')}`);
+  console.log('\nUsage:');
+  console.log('  npm run dedupe-measurements [-- --dry-run]');
+  process.exit(1);
+}
+
+// Run the script
+dedupeMeasurements(args.includes('--dry-run'));
@@ -31,6 +31,9 @@ import {
   updateDeviceConfigResponseSchema,
   // Measurement
   submitMeasurementRequestSchema,
+  submitMeasurementRecordRequestSchema,
+  submitMeasurementBatchRequestSchema,
+  submitMeasurementBatchResponseSchema,
   getMeasurementsQuerySchema,
   dailyAggregatesQuerySchema,
   submitMeasurementResponseSchema,
@@ -39,6 +42,9 @@ import {
   dailyMeasurementsResponseSchema,
   dailyAggregatesResponseSchema,
   deviceMeasurementsResponseSchema,
+  submitWaveformRequestSchema,
+  submitWaveformResponseSchema,
+  deviceWaveformsResponseSchema,
   // Params
   deviceIdParamSchema,
   dateParamSchema,
@@ -743,18 +749,26 @@ registry.registerPath({
   path: '/api/measurements',
   tags: ['Measurements'],
   summary: 'Submit measurement',
-  description: 'IoT device submits heart rate and SpO2 measurement (requires API key)',
+  description: 'IoT device submits heart rate and SpO2 measurement (requires API key). Readings are sent as JSON fields or as a compact base64 binary record.',
   security: [{ apiKeyAuth: [] }],
   request: {
     body: {
       content: {
         'application/json': {
-          schema: submitMeasurementRequestSchema
+          schema: z.union([submitMeasurementRequestSchema, submitMeasurementRecordRequestSchema])
         }
       }
     }
   },
   responses: {
+    200: {
+      description: 'Measurement was already stored (same device and timestamp); the stored one is returned',
+      content: {
+        'application/json': {
+          schema: submitMeasurementResponseSchema
+        }
+      }
+    },
     201: {
       description: 'Measurement submitted successfully',
       content: {
@@ -790,6 +804,58 @@ registry.registerPath({
   }
 });
 
+registry.registerPath({
+  method: 'post',
+  path: '/api/measurements/batch',
+  tags: ['Measurements'],
+  summary: 'Submit measurement batch',
+  description: 'IoT device uploads stored measurements as a base64 batch of delta-coded measurement blocks, or concatenated compact binary records (requires API key). Records that fail validation are skipped and counted as rejected; measurements already stored (same device and timestamp, e.g. a resent batch) are skipped and counted as duplicates.',
+  security: [{ apiKeyAuth: [] }],
+  request: {
+    body: {
+      content: {
+        'application/json': {
+          schema: submitMeasurementBatchRequestSchema
+        }
+      }
+    }
+  },
+  responses: {
+    201: {
+      description: 'Measurements submitted successfully',
+      content: {
+        'application/json': {
+          schema: submitMeasurementBatchResponseSchema
+        }
+      }
+    },
+    400: {
+      description: 'Invalid or undecodable records',
+      content: {
+        'application/json': {
+          schema: errorSchema
+        }
+      }
+    },
+    401: {
+      description: 'Invalid or missing API key',
+      content: {
+        'application/json': {
+          schema: errorSchema
+        }
+      }
+    },
+    403: {
+      description: 'Device ID mismatch or device is inactive',
+      content: {
+        'application/json': {
+          schema: errorSchema
+        }
+      }
+    }
+  }
+});
+
 registry.registerPath({
   method: 'get',
   path: '/api/measurements',
@@ -978,6 +1044,97 @@ registry.registerPath({
   }
 });
 
+registry.registerPath({
+  method: 'post',
+  path: '/api/measurements/waveform',
+  tags: ['Measurements'],
+  summary: 'Submit raw waveform part',
+  description: 'IoT device uploads one part of the raw red/IR trace recorded during a measurement (requires API key). The trace is decoded once all parts have arrived.',
+  security: [{ apiKeyAuth: [] }],
+  request: {
+    body: {
+      content: {
+        'application/json': {
+          schema: submitWaveformRequestSchema
+        }
+      }
+    }
+  },
+  responses: {
+    201: {
+      description: 'Waveform part accepted',
+      content: {
+        'application/json': {
+          schema: submitWaveformResponseSchema
+        }
+      }
+    },
+    400: {
+      description: 'Invalid or undecodable waveform data',
+      content: {
+        'application/json': {
+          schema: errorSchema
+        }
+      }
+    },
+    401: {
+      description: 'Invalid or missing API key',
+      content: {
+        'application/json': {
+          schema: errorSchema
+        }
+      }
+    },
+    403: {
+      description: 'Device ID mismatch or device is inactive',
+      content: {
+        'application/json': {
+          schema: errorSchema
+        }
+      }
+    }
+  }
+});
+
+registry.registerPath({
+  method: 'get',
+  path: '/api/measurements/device/{deviceId}/waveforms',
+  tags: ['Measurements'],
+  summary: 'Get device waveforms',
+  description: 'Get the most recent complete raw waveforms from a specific device',
+  security: [{ bearerAuth: [] }],
+  request: {
+    params: deviceIdParamSchema,
+    query: deviceMeasurementsQuerySchema
+  },
+  responses: {
+    200: {
+      description: 'Device waveforms retrieved successfully',
+      content: {
+        'application/json': {
+          schema: deviceWaveformsResponseSchema
+        }
+      }
+    },
+    401: {
+      description: 'Not authenticated',
+      content: {
+        'application/json': {
+          schema: errorSchema
+        }
+      }
+    },
+    404: {
+      description: 'Device not found',
+      content: {
+        'application/json': {
+          schema: errorSchema
+        }
+      }
+    }
+  }
+});
+
 // ============================================================================
 // PHYSICIAN PORTAL ENDPOINTS (ECE 513 Graduate Requirement)
 // ============================================================================
@@ -3,3 +3,4 @@
  */
 export * from './devices/index.js';
 export * from './measurements/index.js';
+export * from './waveforms/index.js';
@@ -55,7 +55,10 @@ const measurementSchema = new Schema<IMeasurement>(
  * Compound Indexes for efficient queries
  */
 measurementSchema.index({ userId: 1, timestamp: -1 });
-measurementSchema.index({ deviceId: 1, timestamp: -1 });
+// One measurement per device and timestamp: a resent upload is not stored twice.
+// The index is not built on a database that already holds duplicates, or the
+// older non-unique index of the same keys: run `npm run dedupe-measurements` first
+measurementSchema.index({ deviceId: 1, timestamp: -1 }, { unique: true });
 measurementSchema.index({ userId: 1, deviceId: 1, timestamp: -1 });
 
 /**
@@ -0,0 +1,7 @@
+/**
+ * Waveform Model Exports
+ * Centralized exports for waveform types and model
+ */
+
+export * from './types.js';
+export { Waveform } from './model.js';
@@ -0,0 +1,76 @@
+import mongoose, { Schema } from 'mongoose';
+import { IWaveform, IWaveformModel } from './types.js';
+
+/**
+ * Waveform Schema
+ */
+const waveformSchema = new Schema<IWaveform>(
+  {
+    userId: {
+      type: String,
+      required: [true, 'User ID is required'],
+      index: true,
+    },
+    deviceId: {
+      type: String,
+      required: [true, 'Device ID is required'],
+    },
+    timestamp: {
+      type: Date,
+      required: [true, 'Timestamp is required'],
+    },
+    sampleRate: {
+      type: Number,
+      required: [true, 'Sample rate is required'],
+      min: [1, 'Sample rate must be positive'],
+    },
+    parts: {
+      type: Number,
+      required: [true, 'Part count is required'],
+      min: [1, 'Part count must be at least 1'],
+    },
+    received: {
+      type: [{ _id: false, part: Number, data: String }],
+      default: [],
+    },
+    complete: {
+      type: Boolean,
+      default: false,
+    },
+    red: {
+      type: [Number],
+      default: [],
+    },
+    ir: {
+      type: [Number],
+      default: [],
+    },
+  },
+  {
+    timestamps: { createdAt: true, updatedAt: false }, // Only track creation time
+    collection: 'waveforms',
+  }
+);
+
+/**
+ * Indexes
+ * One waveform per device and measurement timestamp
+ */
+waveformSchema.index({ deviceId: 1, timestamp: -1 }, { unique: true });
+
+/**
+ * Static Methods
+ */
+
+// Get completed waveforms for a specific device
+waveformSchema.statics.findByDevice = function (deviceId: string, limit: number = 10) {
+  return this.find({ deviceId, complete: true })
+    .select('-received')
+    .sort({ timestamp: -1 })
+    .limit(limit);
+};
+
+/**
+ * Export Waveform Model
+ */
+export const Waveform = mongoose.model<IWaveform, IWaveformModel>('Waveform', waveformSchema);
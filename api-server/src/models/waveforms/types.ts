@@ -0,0 +1,34 @@
+import { Document, Model } from 'mongoose';
+
+/**
+ * One received part of an encoded waveform upload
+ */
+export interface IWaveformPart {
+  part: number;
+  data: string; // base64 of the encoded blocks
+}
+
+/**
+ * Waveform interface
+ * Raw red/IR trace recorded during a measurement.
+ * Identified by deviceId + timestamp (the measurement's timestamp).
+ */
+export interface IWaveform extends Document {
+  userId: string;
+  deviceId: string;
+  timestamp: Date;
+  sampleRate: number; // samples per second
+  parts: number; // parts expected for the upload
+  received: IWaveformPart[]; // parts waiting for the rest of the upload
+  complete: boolean;
+  red: number[];
+  ir: number[];
+  createdAt: Date;
+}
+
+/**
+ * Waveform Model interface with static methods
+ */
+export interface IWaveformModel extends Model<IWaveform> {
+  findByDevice(deviceId: string, limit?: number): Promise<IWaveform[]>;
+}
@@ -1,7 +1,20 @@
 import { Request, Response } from 'express';
 import { Measurement, IMeasurement } from '../../models/measurements/index.js';
 import { Device } from '../../models/devices/index.js';
+import { Waveform, IWaveform, IWaveformPart } from '../../models/waveforms/index.js';
 import { asyncHandler, AppError } from '../../middleware/error/index.js';
+import { decodeWaveform } from './waveform-codec.js';
+import { decodeMeasurementRecord, decodeMeasurementRecords } from './measurement-codec.js';
+
+// Largest batch accepted from a device (the device sends at most SYNC_BATCH_SIZE)
+const MAX_BATCH_MEASUREMENTS = 500;
+
+/**
+ * MongoDB duplicate key error (E11000), from a unique index
+ */
+function isDuplicateKeyError(error: unknown): boolean {
+  return (error as { code?: number })?.code === 11000;
+}
 
 /**
  * Format a Date to ISO string in a specific timezone
@@ -75,15 +88,37 @@ function getDateInTimezone(date: Date, timezone: string): string {
  *
  * Note: deviceId is required in request body for account-level API keys.
  * For device-specific keys, deviceId must match the authenticated device.
+ *
+ * The readings are sent either as JSON fields or as a compact base64
+ * binary record ({ deviceId, record }, see measurement-codec.ts).
+ * A measurement the device already sent (same device and timestamp) is not
+ * stored again: the stored one is returned with 200.
  */
 export const submitMeasurement = asyncHandler(async (req: Request, res: Response) => {
-  const { deviceId, heartRate, spO2, timestamp, quality, confidence } = req.body;
+  const { deviceId, record } = req.body;
+  let { heartRate, spO2, timestamp, quality, confidence } = req.body;
   const device = req.device; // Attached by authenticateApiKey middleware
 
   if (!device) {
     throw new AppError('Device not authenticated', 401, 'UNAUTHORIZED');
   }
 
+  // Compact record replaces the individual fields
+  if (record !== undefined) {
+    if (typeof record !== 'string') {
+      throw new AppError('Measurement record must be a base64 string', 400, 'INVALID_INPUT');
+    }
+    try {
+      ({ heartRate, spO2, timestamp, quality, confidence } = decodeMeasurementRecord(record));
+    } catch (error) {
+      throw new AppError(
+        `Invalid measurement record: ${error instanceof Error ? error.message : 'decode failed'}`,
+        400,
+        'INVALID_RECORD'
+      );
+    }
+  }
+
   // Validate required fields
   if (!deviceId || !heartRate || !spO2) {
     throw new AppError('Device ID, heart rate, and SpO2 are required', 400, 'INVALID_INPUT');
@@ -113,19 +148,140 @@ export const submitMeasurement = asyncHandler(async (req: Request, res: Response
     confidence: confidence !== undefined ? confidence : 1.0,
   });
 
-  await measurement.save();
+  // A device resends a measurement whose response it did not get (a dropped
+  // connection, a retried publish); the unique index keeps one copy
+  let stored: IMeasurement = measurement;
+  let created = true;
+  try {
+    await measurement.save();
+  } catch (error) {
+    const existing = isDuplicateKeyError(error)
+      ? await Measurement.findOne({ deviceId, timestamp: measurementTimestamp })
+      : null;
+    if (!existing) throw error;
+    stored = existing;
+    created = false;
+  }
 
-  res.status(201).json({
+  res.status(created ? 201 : 200).json({
     success: true,
     data: {
       measurement: {
+        id: stored._id,
+        heartRate: stored.heartRate,
+        spO2: stored.spO2,
+        timestamp: stored.timestamp,
+        quality: stored.quality,
+        confidence: stored.confidence,
+      },
+    },
+  });
+});
+
+/**
+ * Insert measurements unordered, skipping the ones already stored.
+ * A resent batch (its response was lost) fails the unique {deviceId,
+ * timestamp} index for the records stored the first time; those errors
+ * are counted as duplicates and the rest of the batch is still inserted.
+ * Any other write error is thrown.
+ */
+async function insertSkippingDuplicates(
+  docs: Partial<IMeasurement>[]
+): Promise<IMeasurement[] & { duplicates: number }> {
+  try {
+    const inserted = await Measurement.insertMany(docs, { ordered: false });
+    return Object.assign(inserted as IMeasurement[], { duplicates: 0 });
+  } catch (error) {
+    const bulkError = error as {
+      writeErrors?: { code?: number } | { code?: number }[];
+      insertedDocs?: IMeasurement[];
+    };
+    const writeErrors = ([] as { code?: number }[]).concat(bulkError.writeErrors ?? []);
+    if (writeErrors.length === 0 || !writeErrors.every(isDuplicateKeyError)) throw error;
+
+    return Object.assign(bulkError.insertedDocs ?? [], { duplicates: writeErrors.length });
+  }
+}
+
+/**
+ * Submit a batch of measurements from IoT device (offline backlog sync)
+ * POST /api/measurements/batch
+ * Requires: API key authentication
+ *
+ * Body: { deviceId, records } where records is base64 of a batch of
+ * delta-coded measurement blocks, or of concatenated compact binary records
+ * (see measurement-codec.ts). Measurements already stored (same device and
+ * timestamp, from a resent batch) are skipped and counted as duplicates.
+ */
+export const submitMeasurementBatch = asyncHandler(async (req: Request, res: Response) => {
+  const { deviceId, records } = req.body;
+  const device = req.device; // Attached by authenticateApiKey middleware
+
+  if (!device) {
+    throw new AppError('Device not authenticated', 401, 'UNAUTHORIZED');
+  }
+
+  // Validate required fields
+  if (!deviceId || typeof records !== 'string' || records.length === 0) {
+    throw new AppError('Device ID and records are required', 400, 'INVALID_INPUT');
+  }
+
+  // Verify deviceId matches authenticated device
+  if (device.deviceId !== deviceId) {
+    throw new AppError(
+      'Device ID mismatch: deviceId in request does not match authenticated device',
+      403,
+      'DEVICE_ID_MISMATCH'
+    );
+  }
+
+  let decoded;
+  try {
+    decoded = decodeMeasurementRecords(records);
+  } catch (error) {
+    throw new AppError(
+      `Invalid measurement records: ${error instanceof Error ? error.message : 'decode failed'}`,
+      400,
+      'INVALID_RECORD'
+    );
+  }
+
+  if (decoded.length > MAX_BATCH_MEASUREMENTS) {
+    throw new AppError(
+      `At most ${MAX_BATCH_MEASUREMENTS} measurements can be submitted at once`,
+      400,
+      'BATCH_TOO_LARGE'
+    );
+  }
+
+  // Insert all measurements in one round-trip. Unordered, so a record that
+  // fails validation is skipped instead of blocking the rest of the backlog.
+  const measurements = await insertSkippingDuplicates(
+    decoded.map(m => ({
+      userId: device.userId,
+      deviceId,
+      heartRate: m.heartRate,
+      spO2: m.spO2,
+      timestamp: m.timestamp,
+      quality: m.quality,
+      confidence: m.confidence !== undefined ? m.confidence : 1.0,
+    }))
+  );
+
+  res.status(201).json({
+    success: true,
+    data: {
+      count: measurements.length,
+      duplicates: measurements.duplicates,
+      rejected: decoded.length - measurements.length - measurements.duplicates,
+      measurements: measurements.map(measurement => ({
         id: measurement._id,
         heartRate: measurement.heartRate,
         spO2: measurement.spO2,
         timestamp: measurement.timestamp,
         quality: measurement.quality,
         confidence: measurement.confidence,
-      },
+      })),
     },
   });
 });
@@ -432,3 +588,168 @@ export const getDeviceMeasurements = asyncHandler(async (req: Request, res: Resp
     },
   });
 });
+
+/**
+ * Add one part to the waveform upload identified by filter, creating the
+ * upload with the insert fields if it does not exist yet.
+ * A single upsert, so parts arriving at the same time are all kept. Two
+ * first parts can both try to insert; the loser gets E11000 and retries
+ * once, when the document exists. A part for a trace that is already
+ * complete leaves it unchanged.
+ */
+async function addWaveformPart(
+  filter: { deviceId: string; timestamp: Date },
+  insert: { userId: string; sampleRate: number; parts: number },
+  part: IWaveformPart
+): Promise<IWaveform> {
+  for (let attempt = 0; ; attempt++) {
+    try {
+      const waveform = await Waveform.findOneAndUpdate(
+        { ...filter, complete: false },
+        { $setOnInsert: insert, $addToSet: { received: part } },
+        { upsert: true, new: true, runValidators: true, setDefaultsOnInsert: true }
+      );
+      return waveform!;
+    } catch (error) {
+      if (!isDuplicateKeyError(error) || attempt > 0) throw error;
+
+      // Complete already (the upsert found no incomplete trace to update)
+      const existing = await Waveform.findOne(filter);
+      if (existing?.complete) return existing;
+    }
+  }
+}
+
+/**
+ * Submit one part of a raw waveform upload from IoT device
+ * POST /api/measurements/waveform
+ * Requires: API key authentication
+ *
+ * Parts are stored until all have arrived, then decoded into red/IR samples.
+ * The timestamp matches the measurement the trace was recorded for.
+ */
+export const submitWaveform = asyncHandler(async (req: Request, res: Response) => {
+  const { deviceId, timestamp, sampleRate, part, parts, data } = req.body;
+  const device = req.device; // Attached by authenticateApiKey middleware
+
+  if (!device) {
+    throw new AppError('Device not authenticated', 401, 'UNAUTHORIZED');
+  }
+
+  // Validate required fields
+  if (!deviceId || !timestamp || !sampleRate || typeof data !== 'string') {
+    throw new AppError('Device ID, timestamp, sample rate, and data are required', 400, 'INVALID_INPUT');
+  }
+
+  const partIndex = Number(part ?? 0);
+  const partCount = Number(parts ?? 1);
+  if (!Number.isInteger(partCount) || partCount < 1 ||
+      !Number.isInteger(partIndex) || partIndex < 0 || partIndex >= partCount) {
+    throw new AppError('Invalid part number or part count', 400, 'INVALID_INPUT');
+  }
+
+  const waveformTimestamp = new Date(timestamp);
+  if (isNaN(waveformTimestamp.getTime())) {
+    throw new AppError('Invalid timestamp', 400, 'INVALID_INPUT');
+  }
+
+  // Verify deviceId matches authenticated device
+  if (device.deviceId !== deviceId) {
+    throw new AppError(
+      'Device ID mismatch: deviceId in request does not match authenticated device',
+      403,
+      'DEVICE_ID_MISMATCH'
+    );
+  }
+
+  // Add the part in one atomic upsert: parts of one trace can arrive together
+  const part = { part: partIndex, data };
+  let waveform = await addWaveformPart(
+    { deviceId, timestamp: waveformTimestamp },
+    { userId: device.userId, sampleRate, parts: partCount },
+    part
+  );
+
+  // Decode once every part has arrived
+  if (!waveform.complete) {
+    const parts = new Map<number, string>();
+    for (const p of waveform.received) {
+      if (!parts.has(p.part)) parts.set(p.part, p.data);
+    }
+
+    if (parts.size >= waveform.parts) {
+      const encoded = Buffer.concat(
+        [...parts.entries()]
+          .sort((a, b) => a[0] - b[0])
+          .map(([, partData]) => Buffer.from(partData, 'base64'))
+      );
+
+      let decoded;
+      try {
+        decoded = decodeWaveform(encoded);
+      } catch (error) {
+        throw new AppError(
+          `Invalid waveform data: ${error instanceof Error ? error.message : 'decode failed'}`,
+          400,
+          'INVALID_WAVEFORM'
+        );
+      }
+
+      // Only one request completes the trace; a concurrent one reads its result
+      waveform =
+        (await Waveform.findOneAndUpdate(
+          { _id: waveform._id, complete: false },
+          { $set: { red: decoded.red, ir: decoded.ir, received: [], complete: true } },
+          { new: true }
+        )) ?? (await Waveform.findById(waveform._id)) ?? waveform;
+    }
+  }
+
+  res.status(201).json({
+    success: true,
+    data: {
+      waveform: {
+        id: waveform._id,
+        timestamp: waveform.timestamp,
+        complete: waveform.complete,
+        partsReceived: waveform.complete
+          ? waveform.parts
+          : new Set(waveform.received.map(p => p.part)).size,
+        parts: waveform.parts,
+        samples: waveform.red.length,
+      },
+    },
+  });
+});
+
+/**
+ * Get raw waveforms for a specific device
+ * GET /api/measurements/device/:deviceId/waveforms?limit=10
+ * Requires: JWT authentication + device ownership
+ */
+export const getDeviceWaveforms = asyncHandler(async (req: Request, res: Response) => {
+  const userId = req.user?.id;
+  const { deviceId } = req.params;
+  const { limit = 10 } = req.query;
+
+  if (!userId) {
+    throw new AppError('User not authenticated', 401, 'UNAUTHORIZED');
+  }
+
+  // Verify device ownership
+  const device = await Device.findOne({ deviceId, userId });
+  if (!device) {
+    throw new AppError('Device not found or access denied', 404, 'DEVICE_NOT_FOUND');
+  }
+
+  const waveforms = await Waveform.findByDevice(deviceId, parseInt(limit as string));
+
+  res.status(200).json({
+    success: true,
+    data: {
+      deviceId,
+      waveforms,
+      count: waveforms.length,
+    },
+  });
+});
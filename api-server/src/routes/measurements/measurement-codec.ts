@@ -0,0 +1,204 @@
+/**
+ * Measurement Codec
+ * Decodes the compact binary measurement record sent by the IoT device
+ * (iot/src/measurement_record.h describes the format).
+ *
+ * Record layout (version 1, 9 bytes, little endian):
+ *   byte 0    format version
+ *   byte 1-4  Unix timestamp (seconds)
+ *   byte 5    heart rate (bpm)
+ *   byte 6    SpO2 (%)
+ *   byte 7    flags: bit 0 = valid, bit 1 = confidence present
+ *   byte 8    confidence (0-100 %)
+ *
+ * Batch layout (version 2, the offline backlog):
+ *   byte 0    format version
+ *   byte 1..  measurement blocks back to back (iot/src/measurement_block.h)
+ *
+ * Block layout (7 bytes header, little endian):
+ *   byte 0    entry count
+ *   byte 1-4  Unix timestamp of the first entry (seconds)
+ *   byte 5-6  measurement interval (seconds)
+ *   then the entries, bit-packed LSB first and padded with zero bits to a
+ *   whole byte. Each entry holds:
+ *     8 bits   heart rate (bpm)
+ *     3 bits   100 - SpO2 (%); 7 = escape, and SpO2 follows in 7 bits
+ *     1 bit    0 = valid and confidence as in the previous entry (not
+ *              valid, none before the first); 1 = valid (1 bit) and
+ *              confidence (7 bits, 0-100 %, 0 = none) follow
+ *     step     the zigzag-coded step from the previous timestamp plus the
+ *              interval: 0 + 8 bits; 10 + 5 bits (k - 1) + 8 bits for the
+ *              step less k intervals (k skipped prompts); 11 + 32 bits
+ */
+
+const RECORD_VERSION = 1;
+const RECORD_BYTES = 9;
+const FLAG_VALID = 0x01;
+const FLAG_CONFIDENCE = 0x02;
+
+const BATCH_VERSION = 2;
+const BLOCK_HEADER_BYTES = 7;
+const SPO2_ESCAPE = 7;
+
+export interface DecodedMeasurement {
+  heartRate: number;
+  spO2: number;
+  timestamp: Date;
+  quality: 'good' | 'poor';
+  confidence?: number;
+}
+
+/**
+ * Decode the record starting at offset
+ */
+function decodeRecordAt(bytes: Buffer, offset: number): DecodedMeasurement {
+  if (bytes[offset] !== RECORD_VERSION) {
+    throw new Error(`Unsupported measurement record version ${bytes[offset]}`);
+  }
+  if (offset + RECORD_BYTES > bytes.length) {
+    throw new Error('Measurement record is truncated');
+  }
+
+  const flags = bytes[offset + 7];
+
+  return {
+    timestamp: new Date(bytes.readUInt32LE(offset + 1) * 1000),
+    heartRate: bytes[offset + 5],
+    spO2: bytes[offset + 6],
+    quality: flags & FLAG_VALID ? 'good' : 'poor',
+    confidence: flags & FLAG_CONFIDENCE ? bytes[offset + 8] / 100 : undefined,
+  };
+}
+
+/**
+ * Decode a base64 measurement record
+ * Throws if the record is malformed or of an unknown version.
+ */
+export function decodeMeasurementRecord(record: string): DecodedMeasurement {
+  const bytes = Buffer.from(record, 'base64');
+
+  if (bytes.length < 1) {
+    throw new Error('Measurement record is empty');
+  }
+  if (bytes.length > RECORD_BYTES) {
+    throw new Error('Measurement record has the wrong length');
+  }
+
+  return decodeRecordAt(bytes, 0);
+}
+
+/**
+ * Reads the bit-packed entries of a block, LSB first
+ */
+class BitReader {
+  private position = 0;
+
+  constructor(private readonly bytes: Uint8Array, private readonly start: number) {}
+
+  read(width: number): number {
+    let value = 0;
+    for (let i = 0; i < width; i++, this.position++) {
+      const offset = this.start + (this.position >> 3);
+      if (offset >= this.bytes.length) {
+        throw new Error('Measurement block is truncated');
+      }
+      if (this.bytes[offset] & (1 << (this.position & 7))) {
+        value += 2 ** i;
+      }
+    }
+    return value;
+  }
+
+  /**
+   * Skip the padding after the last entry, which must be zero; returns the
+   * offset of the next block
+   */
+  end(): number {
+    if (this.position % 8 !== 0 && this.read(8 - (this.position % 8)) !== 0) {
+      throw new Error('Measurement block has stray bits');
+    }
+    return this.start + this.position / 8;
+  }
+}
+
+/**
+ * Undo zigzag coding (0, 1, 2, 3 ... -> 0, -1, 1, -2 ...)
+ */
+function unzigzag(value: number): number {
+  return value % 2 === 0 ? value / 2 : -(value + 1) / 2;
+}
+
+/**
+ * Decode the measurement blocks of a version 2 batch
+ */
+function decodeBlocks(bytes: Buffer): DecodedMeasurement[] {
+  const decoded: DecodedMeasurement[] = [];
+  let offset = 1;
+
+  while (offset < bytes.length) {
+    if (offset + BLOCK_HEADER_BYTES > bytes.length) {
+      throw new Error('Measurement block is truncated');
+    }
+    const count = bytes[offset];
+    if (count === 0) {
+      throw new Error('Measurement block is empty');
+    }
+    const interval = bytes.readUInt16LE(offset + 5);
+    let previous = (bytes.readUInt32LE(offset + 1) - interval) >>> 0;
+    const reader = new BitReader(bytes, offset + BLOCK_HEADER_BYTES);
+    let valid = false;
+    let confidence = 0;
+
+    for (let i = 0; i < count; i++) {
+      const heartRate = reader.read(8);
+      let spO2 = reader.read(3);
+      spO2 = spO2 === SPO2_ESCAPE ? reader.read(7) : 100 - spO2;
+      if (reader.read(1)) {
+        valid = reader.read(1) === 1;
+        confidence = reader.read(7);
+      }
+
+      let step: number;
+      if (reader.read(1) === 0) {
+        step = unzigzag(reader.read(8));
+      } else if (reader.read(1) === 0) {
+        const skipped = reader.read(5) + 1;
+        step = unzigzag(reader.read(8)) + skipped * interval;
+      } else {
+        step = unzigzag(reader.read(32));
+      }
+      const timestamp = (previous + interval + step) >>> 0;
+
+      decoded.push({
+        timestamp: new Date(timestamp * 1000),
+        heartRate,
+        spO2,
+        quality: valid ? 'good' : 'poor',
+        confidence: confidence > 0 ? confidence / 100 : undefined,
+      });
+      previous = timestamp;
+    }
+    offset = reader.end();
+  }
+
+  return decoded;
+}
+
+/**
+ * Decode a base64 batch upload: a version 2 batch of measurement blocks,
+ * or several concatenated version 1 records
+ * Throws if any block or record is malformed or of an unknown version.
+ */
+export function decodeMeasurementRecords(records: string): DecodedMeasurement[] {
+  const bytes = Buffer.from(records, 'base64');
+  if (bytes[0] === BATCH_VERSION) {
+    return decodeBlocks(bytes);
+  }
+
+  const decoded: DecodedMeasurement[] = [];
+  for (let offset = 0; offset < bytes.length; offset += RECORD_BYTES) {
+    decoded.push(decodeRecordAt(bytes, offset));
+  }
+
+  return decoded;
+}
@@ -1,11 +1,14 @@
 import { Router } from 'express';
 import {
   submitMeasurement,
+  submitMeasurementBatch,
   getUserMeasurements,
   getDailyMeasurements,
   getWeeklySummary,
   getDailyAggregates,
   getDeviceMeasurements,
+  submitWaveform,
+  getDeviceWaveforms,
 } from './controller.js';
 import { authenticate } from '../../middleware/auth/index.js';
 import { authenticateApiKey } from '../../middleware/device/index.js';
@@ -19,6 +22,12 @@ const router = Router();
 // Submit measurement from IoT device (requires API key)
 router.post('/', authenticateApiKey, submitMeasurement);
 
+// Submit a batch of stored measurements from IoT device (requires API key)
+router.post('/batch', authenticateApiKey, submitMeasurementBatch);
+
+// Submit raw waveform part from IoT device (requires API key)
+router.post('/waveform', authenticateApiKey, submitWaveform);
+
 // Get user's measurements with filtering (requires JWT auth)
 router.get('/', authenticate, getUserMeasurements);
 
@@ -34,4 +43,7 @@ router.get('/daily/:date', authenticate, getDailyMeasurements);
 // Get measurements for specific device (requires JWT auth)
 router.get('/device/:deviceId', authenticate, getDeviceMeasurements);
 
+// Get raw waveforms for specific device (requires JWT auth)
+router.get('/device/:deviceId/waveforms', authenticate, getDeviceWaveforms);
+
 export default router;
@@ -0,0 +1,113 @@
+/**
+ * Waveform Codec
+ * Decodes the raw red/IR blocks uploaded by the IoT device
+ * (iot/src/waveform_encoder.h describes the format).
+ *
+ * Block layout:
+ *   byte 0-1  sequence number (little endian)
+ *   byte 2    sample count n
+ *   byte 3    red delta width (0-18 bits)
+ *   byte 4    IR delta width (0-18 bits)
+ *   bits      red[0], ir[0] (18 bits each), n-1 red deltas, n-1 IR deltas
+ * Bits are LSB first; each block is padded to a whole byte. Deltas are
+ * zigzag-coded differences modulo 2^18.
+ */
+
+const SAMPLE_BITS = 18;
+const SAMPLE_MASK = (1 << SAMPLE_BITS) - 1;
+const BLOCK_HEADER = 5;
+
+export interface DecodedWaveform {
+  red: number[];
+  ir: number[];
+  blocks: number;
+}
+
+/**
+ * Reads LSB-first bit fields from a byte range
+ */
+class BitReader {
+  private position: number;
+  private bits = 0;
+  private bitCount = 0;
+
+  constructor(private readonly bytes: Uint8Array, start: number, private readonly end: number) {
+    this.position = start;
+  }
+
+  read(width: number): number {
+    while (this.bitCount < width) {
+      if (this.position >= this.end) {
+        throw new Error('Waveform block is truncated');
+      }
+      this.bits += this.bytes[this.position++] * 2 ** this.bitCount;
+      this.bitCount += 8;
+    }
+    const value = this.bits % 2 ** width;
+    this.bits = Math.floor(this.bits / 2 ** width);
+    this.bitCount -= width;
+    return value;
+  }
+}
+
+/**
+ * Undo zigzag coding (0, 1, 2, 3 ... -> 0, -1, 1, -2 ...)
+ */
+function unzigzag(value: number): number {
+  return value % 2 === 0 ? value / 2 : -(value + 1) / 2;
+}
+
+/**
+ * Decode a sequence of encoded blocks into red/IR sample arrays
+ * Throws if the data is malformed or blocks are out of sequence.
+ */
+export function decodeWaveform(bytes: Uint8Array): DecodedWaveform {
+  const red: number[] = [];
+  const ir: number[] = [];
+  let offset = 0;
+  let blocks = 0;
+  let expectedSequence: number | null = null;
+
+  while (offset < bytes.length) {
+    if (offset + BLOCK_HEADER > bytes.length) {
+      throw new Error('Waveform block header is truncated');
+    }
+
+    const sequence = bytes[offset] | (bytes[offset + 1] << 8);
+    const count = bytes[offset + 2];
+    const redWidth = bytes[offset + 3];
+    const irWidth = bytes[offset + 4];
+
+    if (count === 0 || redWidth > SAMPLE_BITS || irWidth > SAMPLE_BITS) {
+      throw new Error('Invalid waveform block header');
+    }
+    // The device keeps only the most recent blocks, so the first sequence may be > 0
+    if (expectedSequence !== null && sequence !== expectedSequence) {
+      throw new Error('Waveform blocks are out of sequence');
+    }
+    expectedSequence = (sequence + 1) & 0xffff;
+
+    const payloadBits = 2 * SAMPLE_BITS + (count - 1) * (redWidth + irWidth);
+    const end = offset + BLOCK_HEADER + Math.ceil(payloadBits / 8);
+    if (end > bytes.length) {
+      throw new Error('Waveform block is truncated');
+    }
+
+    const reader = new BitReader(bytes, offset + BLOCK_HEADER, end);
+    const blockRed = [reader.read(SAMPLE_BITS)];
+    const blockIr = [reader.read(SAMPLE_BITS)];
+    for (let i = 1; i < count; i++) {
+      blockRed.push((blockRed[i - 1] + unzigzag(reader.read(redWidth))) & SAMPLE_MASK);
+    }
+    for (let i = 1; i < count; i++) {
+      blockIr.push((blockIr[i - 1] + unzigzag(reader.read(irWidth))) & SAMPLE_MASK);
+    }
+
+    red.push(...blockRed);
+    ir.push(...blockIr);
+    offset = end;
+    blocks++;
+  }
+
+  return { red, ir, blocks };
+}
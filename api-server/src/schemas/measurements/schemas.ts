@@ -48,6 +48,24 @@ export const submitMeasurementRequestSchema = z.object({
   })
 }).openapi('SubmitMeasurementRequest');
 
+// Submit compact measurement record request (from IoT device)
+export const submitMeasurementRecordRequestSchema = z.object({
+  deviceId: deviceIdSchema,
+  record: z.string().openapi({
+    example: 'AZNYPGlIYgNf',
+    description: 'Base64 of the 9-byte binary measurement record (see iot/src/measurement_record.h)'
+  })
+}).openapi('SubmitMeasurementRecordRequest');
+
+// Submit measurement batch request (offline backlog from IoT device)
+export const submitMeasurementBatchRequestSchema = z.object({
+  deviceId: deviceIdSchema,
+  records: z.string().openapi({
+    example: 'AgPQwfVoCAdI4lwAS2JcKkfigP+yGw==',
+    description: 'Base64 of a version 2 batch of delta-coded measurement blocks, or of concatenated 9-byte binary measurement records'
+  })
+}).openapi('SubmitMeasurementBatchRequest');
+
 // Query parameters for getting measurements
 export const getMeasurementsQuerySchema = z.object({
   startDate: z.string().regex(/^\d{4}-\d{2}-\d{2}$/).optional().openapi({
@@ -114,6 +132,19 @@ export const submitMeasurementResponseSchema = z.object({
   })
 }).openapi('SubmitMeasurementResponse');
 
+// Submit measurement batch response
+export const submitMeasurementBatchResponseSchema = z.object({
+  success: z.literal(true),
+  data: z.object({
+    count: z.number().int().openapi({ example: 2, description: 'Measurements stored' }),
+    duplicates: z.number().int().openapi({ example: 0, description: 'Measurements already stored (same device and timestamp), skipped' }),
+    rejected: z.number().int().openapi({ example: 0, description: 'Records that failed validation' }),
+    measurements: z.array(measurementSchema.omit({ _id: true, deviceId: true }).extend({
+      id: z.string().openapi({ example: '507f1f77bcf86cd799439012' })
+    }))
+  })
+}).openapi('SubmitMeasurementBatchResponse');
+
 // Get measurements response
 export const getMeasurementsResponseSchema = z.object({
   success: z.literal(true),
@@ -159,3 +190,74 @@ export const deviceMeasurementsResponseSchema = z.object({
     count: z.number().int().openapi({ example: 150 })
   })
 }).openapi('DeviceMeasurementsResponse');
+
+// Submit waveform part request (from IoT device)
+export const submitWaveformRequestSchema = z.object({
+  deviceId: deviceIdSchema,
+  timestamp: timestampSchema,
+  sampleRate: z.number().int().min(1).openapi({
+    example: 25,
+    description: 'Samples per second'
+  }),
+  part: z.number().int().min(0).default(0).openapi({
+    example: 0,
+    description: 'Index of this part (0-based)'
+  }),
+  parts: z.number().int().min(1).default(1).openapi({
+    example: 3,
+    description: 'Total number of parts in the upload'
+  }),
+  data: z.string().openapi({
+    example: 'AAAZEhA...',
+    description: 'Base64 of the delta-encoded red/IR blocks (see iot/src/waveform_encoder.h)'
+  })
+}).openapi('SubmitWaveformRequest');
+
+// Waveform object
+export const waveformSchema = z.object({
+  _id: z.string().openapi({
+    example: '507f1f77bcf86cd799439013',
+    description: 'Waveform MongoDB ID'
+  }),
+  deviceId: deviceIdSchema,
+  timestamp: timestampSchema,
+  sampleRate: z.number().int().openapi({ example: 25 }),
+  parts: z.number().int().openapi({ example: 3 }),
+  complete: z.boolean().openapi({ example: true }),
+  red: z.array(z.number().int()).openapi({
+    example: [102345, 102360, 102372],
+    description: 'Raw red LED samples (18-bit)'
+  }),
+  ir: z.array(z.number().int()).openapi({
+    example: [98012, 98030, 98041],
+    description: 'Raw IR LED samples (18-bit)'
+  })
+}).openapi('Waveform');
+
+// Submit waveform part response
+export const submitWaveformResponseSchema = z.object({
+  success: z.literal(true),
+  data: z.object({
+    waveform: z.object({
+      id: z.string().openapi({ example: '507f1f77bcf86cd799439013' }),
+      timestamp: timestampSchema,
+      complete: z.boolean().openapi({ example: false }),
+      partsReceived: z.number().int().openapi({ example: 1 }),
+      parts: z.number().int().openapi({ example: 3 }),
+      samples: z.number().int().openapi({
+        example: 0,
+        description: 'Decoded samples per channel (0 until complete)'
+      })
+    })
+  })
+}).openapi('SubmitWaveformResponse');
+
+// Device waveforms response
+export const deviceWaveformsResponseSchema = z.object({
+  success: z.literal(true),
+  data: z.object({
+    deviceId: deviceIdSchema,
+    waveforms: z.array(waveformSchema),
+    count: z.number().int().openapi({ example: 10 })
+  })
+}).openapi('DeviceWaveformsResponse');
@@ -0,0 +1,12 @@
+/*
+ * Arduino.h - Host stand-in for the Arduino core header
+ *
+ * The SparkFun MAX3010x sources include it; on the host it is Particle.h.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include "Particle.h"
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,439 @@
+/*
+ * Particle.h - Host stand-in for the Device OS header
+ *
+ * The one host HAL every tool in iot/tools builds against (see
+ * CMakeLists.txt here). It provides enough of the Device OS API for the
+ * firmware sources (all of src/ but the .ino) and the SparkFun MAX3010x
+ * driver to build and run on Linux:
+ *   - a clock (see HOST_REAL_CLOCK below) and Thread/os_thread_delay_until()
+ *     on std::thread (priorities and stack sizes are ignored), and the
+ *     os_semaphore_*() calls
+ *   - a cloud that is reachable or not (hostOnline): each publish holds up
+ *     its caller for hostPublishBlock ms and is acknowledged
+ *     hostPublishLatency ms later (at once by default). A config fetch is
+ *     answered on the subscribed handler from Particle.process(), as Device
+ *     OS delivers events to the application thread; deliver() hands any
+ *     event to the subscriptions.
+ *   - TCPClient, to a stand-in API server or over real sockets (host_tcp.h)
+ *   - a MAX30102 (HostSensor, host_sensor.h) on the I2C bus (Wire.h), with
+ *     the A_FULL interrupt on MAX30102_INT, that can play a recorded trace
+ *     (host_trace.h)
+ *   - String, which allocates on the heap as it does on the device
+ *   - RGB, which counts the colour changes written, and an EEPROM that
+ *     starts erased and counts the writes to every byte
+ * Serial output goes to stderr when hostVerbose is set.
+ *
+ * BUILD OPTIONS (define as 0 or 1):
+ *   HOST_REAL_CLOCK  0: a simulated clock in microseconds that only moves
+ *                       through delay(), hostAdvance() and I2C traffic;
+ *                       the sensor samples as it passes
+ *                    1: the real clock, sped up hostSpeed times; delay()
+ *                       sleeps, so threads interleave as on the device.
+ *                       The sensor takes the samples due whenever it is
+ *                       accessed, and its interrupt fires on that thread.
+ *   HOST_SOCKETS     0: TCPClient talks to the stand-in API server
+ *                    1: TCPClient connects over POSIX sockets
+ */
+
+#ifndef HOST_PARTICLE_H
+#define HOST_PARTICLE_H
+
+#ifndef HOST_REAL_CLOCK
+#define HOST_REAL_CLOCK 0
+#endif
+
+#ifndef HOST_SOCKETS
+#define HOST_SOCKETS 0
+#endif
+
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// ============================================================================
+// Clock
+// ============================================================================
+
+inline uint32_t hostEpoch = 1760950800;          // Time.now() at millis() 0 (09:00 UTC)
+inline bool hostVerbose = false;
+
+#if HOST_REAL_CLOCK
+
+inline const std::chrono::steady_clock::time_point hostStart = std::chrono::steady_clock::now();
+inline int hostSpeed = 1;                        // Simulated ms per real ms (set before threads start)
+
+inline uint64_t hostMicros() {
+    auto elapsed = std::chrono::steady_clock::now() - hostStart;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() * hostSpeed;
+}
+
+inline void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::microseconds((uint64_t)ms * 1000 / hostSpeed));
+}
+
+#else
+
+inline uint64_t hostClock = 0;                   // µs
+
+inline uint64_t hostMicros() { return hostClock; }
+
+void hostAdvance(uint64_t micros);               // Defined with HostSensor (host_sensor.h)
+
+inline void delay(unsigned long ms) { hostAdvance((uint64_t)ms * 1000); }
+
+#endif
+
+inline unsigned long millis() { return hostMicros() / 1000; }
+inline unsigned long micros() { return hostMicros(); }
+
+// ============================================================================
+// Threads
+// ============================================================================
+
+typedef uint32_t system_tick_t;
+typedef uint8_t os_thread_prio_t;
+typedef void (*os_thread_fn_t)(void *param);
+
+#define OS_THREAD_PRIORITY_DEFAULT 2
+#define OS_THREAD_STACK_SIZE_DEFAULT 3072
+
+/*
+ * Thread - Starts function(param) on a std::thread. Device OS threads run
+ * until reset, so the thread is detached; a tool that starts threads exits
+ * with _exit(). Only with HOST_REAL_CLOCK: the simulated clock is not
+ * shared between threads.
+ */
+class Thread {
+public:
+    Thread(const char *name, os_thread_fn_t function, void *param = nullptr,
+           os_thread_prio_t priority = OS_THREAD_PRIORITY_DEFAULT,
+           size_t stackSize = OS_THREAD_STACK_SIZE_DEFAULT) {
+        std::thread(function, param).detach();
+    }
+};
+
+// Sleep until *previous + increment (ms), and advance *previous
+inline int os_thread_delay_until(system_tick_t *previous, system_tick_t increment) {
+    *previous += increment;
+    int32_t remaining = (int32_t)(*previous - (system_tick_t)millis());
+    if (remaining > 0) delay(remaining);
+    return 0;
+}
+
+/*
+ * HostSemaphore - A counting semaphore behind os_semaphore_t. With the
+ * simulated clock a take moves the clock on 1 ms at a time until the
+ * semaphore is given (from an interrupt the sensor fires on the way) or the
+ * timeout passes; with the real clock it blocks on a condition variable.
+ */
+struct HostSemaphore {
+    std::mutex lock;
+    std::condition_variable given;
+    unsigned count;
+    unsigned max;
+    
+    HostSemaphore(unsigned max, unsigned initial) : count(initial), max(max) {}
+};
+
+typedef HostSemaphore *os_semaphore_t;
+
+inline int os_semaphore_create(os_semaphore_t *semaphore, unsigned max, unsigned initial) {
+    *semaphore = new HostSemaphore(max, initial);
+    return 0;
+}
+
+// Take within timeout ms: 0 if taken, nonzero on timeout
+inline int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeout, bool reserved) {
+    std::unique_lock<std::mutex> lock(semaphore->lock);
+#if HOST_REAL_CLOCK
+    auto wait = std::chrono::microseconds((uint64_t)timeout * 1000 / hostSpeed);
+    if (!semaphore->given.wait_for(lock, wait, [semaphore] { return semaphore->count > 0; })) return 1;
+#else
+    unsigned long end = millis() + timeout;
+    while (semaphore->count == 0) {
+        if ((long)(end - millis()) <= 0) return 1;
+        lock.unlock();
+        delay(1);
+        lock.lock();
+    }
+#endif
+    semaphore->count--;
+    return 0;
+}
+
+// Give: 0, or nonzero if the count is already at its max
+inline int os_semaphore_give(os_semaphore_t semaphore, bool reserved) {
+    std::lock_guard<std::mutex> lock(semaphore->lock);
+    if (semaphore->count >= semaphore->max) return 1;
+    semaphore->count++;
+    semaphore->given.notify_one();
+    return 0;
+}
+
+// ============================================================================
+// Serial
+// ============================================================================
+
+inline std::mutex hostSerialLock;
+
+struct HostSerial {
+    void print(const char *text) {
+        if (!hostVerbose) return;
+        std::lock_guard<std::mutex> lock(hostSerialLock);
+        fputs(text, stderr);
+    }
+    void println(const char *text = "") {
+        if (!hostVerbose) return;
+        std::lock_guard<std::mutex> lock(hostSerialLock);
+        fprintf(stderr, "%s\n", text);
+    }
+    void printlnf(const char *format, ...) {
+        if (!hostVerbose) return;
+        std::lock_guard<std::mutex> lock(hostSerialLock);
+        va_list args;
+        va_start(args, format);
+        fprintf(stderr, "%8.3f  ", hostMicros() / 1e6);
+        vfprintf(stderr, format, args);
+        va_end(args);
+        fputc('\n', stderr);
+    }
+    int available() { return 0; }
+    int read() { return -1; }
+};
+inline HostSerial Serial;
+
+// ============================================================================
+// String
+// ============================================================================
+
+class String {
+public:
+    String(const char *text = "") { assign(text); }
+    String(const String &other) { assign(other.buffer); }
+    ~String() { free(buffer); }
+    String &operator=(const String &other) {
+        if (this != &other) {
+            free(buffer);
+            assign(other.buffer);
+        }
+        return *this;
+    }
+    const char *c_str() const { return buffer; }
+    unsigned length() const { return strlen(buffer); }
+
+private:
+    char *buffer;
+    
+    void assign(const char *text) {
+        size_t size = strlen(text) + 1;
+        buffer = (char *)malloc(size);
+        memcpy(buffer, text, size);
+    }
+};
+
+// ============================================================================
+// System, Time, WiFi and the cloud
+// ============================================================================
+
+struct HostSystem {
+    String deviceID() { return String("e00fce68a1b2c3d4e5f60718"); }
+    uint32_t ticks() { return hostMicros(); }
+    uint32_t ticksPerMicrosecond() { return 1; }
+};
+inline HostSystem System;
+
+struct HostTime {
+    uint32_t now() { return hostEpoch + millis() / 1000; }
+    bool isValid() { return true; }
+    int hour() { return now() / 3600 % 24; }
+    int minute() { return now() / 60 % 60; }
+};
+inline HostTime Time;
+
+inline std::atomic<bool> hostOnline(true);
+
+struct HostWiFi {
+    bool ready() { return hostOnline; }
+};
+inline HostWiFi WiFi;
+
+inline unsigned long hostPublishBlock = 0;        // ms each publish holds up its caller
+inline unsigned long hostPublishLatency = 0;      // ms until a publish is acknowledged
+inline std::atomic<int> hostPublishCount(0);
+inline std::atomic<int> hostRequestCount(0);      // HTTP requests answered
+inline const char *hostConfigResponse = "{\"success\":true,\"data\":{\"config\":"
+                                        "{\"measurementFrequency\":1800,"
+                                        "\"activeStartTime\":\"06:00\",\"activeEndTime\":\"22:00\"}}}";
+
+enum PublishScope { PRIVATE, MY_DEVICES };
+typedef void (*EventHandler)(const char *event, const char *data);
+
+namespace particle {
+template<class T> class Future {
+public:
+    Future() : value(), doneAt(0) {}
+    Future(T value, unsigned long doneAt) : value(value), doneAt(doneAt) {}
+    bool isDone() const { return (long)(millis() - doneAt) >= 0; }
+    bool isSucceeded() const { return isDone(); }
+    T result() const { return value; }
+
+private:
+    T value;
+    unsigned long doneAt;
+};
+}
+
+/*
+ * The cloud. Publishes may come from any thread; the webhook response to
+ * a config fetch is delivered by process().
+ */
+struct HostParticle {
+    bool connected() { return hostOnline; }
+    
+    particle::Future<bool> publish(const char *name, const char *data, PublishScope scope) {
+        hostPublishCount++;
+        if (hostPublishBlock > 0) delay(hostPublishBlock);
+    
+        unsigned long done = millis() + hostPublishLatency;
+        if (strcmp(name, "heartrate-getconfig") == 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            responseDue = true;
+            responseAt = done;
+        }
+        return particle::Future<bool>(hostOnline, done);
+    }
+    
+    bool subscribe(const char *prefix, EventHandler handler, PublishScope scope) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (subscriptionCount >= 4) return false;
+        snprintf(subscriptions[subscriptionCount].prefix, sizeof(subscriptions[0].prefix), "%s", prefix);
+        subscriptions[subscriptionCount++].handler = handler;
+        return true;
+    }
+    
+    // Hand an event to the first subscription whose prefix matches
+    void deliver(const char *event, const char *data) {
+        EventHandler handler = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int i = 0; i < subscriptionCount && handler == nullptr; i++) {
+                if (strncmp(event, subscriptions[i].prefix, strlen(subscriptions[i].prefix)) == 0) {
+                    handler = subscriptions[i].handler;
+                }
+            }
+        }
+        if (handler) handler(event, data);
+    }
+    
+    void process() {
+        bool due;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            due = responseDue && (long)(millis() - responseAt) >= 0;
+            if (due) responseDue = false;
+        }
+        if (due) deliver("hook-response/heartrate-getconfig/0", hostConfigResponse);
+    }
+
+private:
+    struct Subscription {
+        char prefix[64];
+        EventHandler handler;
+    };
+    
+    std::mutex mutex;
+    Subscription subscriptions[4];
+    int subscriptionCount = 0;
+    bool responseDue = false;
+    unsigned long responseAt = 0;
+};
+inline HostParticle Particle;
+
+#include "host_tcp.h"
+
+// ============================================================================
+// Hardware
+// ============================================================================
+
+inline std::atomic<int> hostColorWrites(0);
+
+struct HostRGB {
+    void control(bool take) {}
+    void brightness(uint8_t level) {}
+    void color(uint8_t red, uint8_t green, uint8_t blue) { hostColorWrites++; }
+};
+inline HostRGB RGB;
+
+#define HOST_EEPROM_SIZE 4096   // Photon 2 emulated EEPROM
+
+class HostEEPROM {
+public:
+    HostEEPROM() {
+        memset(data, 0xFF, sizeof(data));
+        memset(cellWrites, 0, sizeof(cellWrites));
+    }
+    
+    uint8_t read(int address) { return data[address]; }
+    
+    void write(int address, uint8_t value) {
+        data[address] = value;
+        cellWrites[address]++;
+        writes++;
+    }
+    
+    // Bytes written and the most writes to any one byte
+    uint64_t writes = 0;
+    uint32_t maxCellWrites() {
+        uint32_t most = 0;
+        for (int i = 0; i < HOST_EEPROM_SIZE; i++) {
+            if (cellWrites[i] > most) most = cellWrites[i];
+        }
+        return most;
+    }
+
+private:
+    uint8_t data[HOST_EEPROM_SIZE];
+    uint32_t cellWrites[HOST_EEPROM_SIZE];
+};
+inline HostEEPROM EEPROM;
+
+enum { D0, D1, D2, D3, D4, D5, D6, D7 };
+enum { INPUT, INPUT_PULLUP, OUTPUT };
+enum { LOW = 0, HIGH = 1 };
+enum InterruptMode { CHANGE, RISING, FALLING };
+
+inline void pinMode(int pin, int mode) {}
+
+#include "host_sensor.h"
+
+// MAX30102_INT is D2 (config.h)
+inline int digitalRead(int pin) {
+    return (pin == D2 && hostSensor.interruptLine()) ? LOW : HIGH;
+}
+
+template<class T> bool attachInterrupt(int pin, void (T::*handler)(), T *instance, InterruptMode mode) {
+    static void (T::*member)() = handler;
+    hostSensor.attach([](void *object) { (static_cast<T*>(object)->*member)(); }, instance);
+    return true;
+}
+
+#endif // HOST_PARTICLE_H
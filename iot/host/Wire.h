@@ -0,0 +1,82 @@
+/*
+ * Wire.h - Host stand-in for the I2C library
+ *
+ * Connects the driver to the MAX30102 model (HostSensor, host_sensor.h).
+ * Each write (through endTransmission()) and each requestFrom() is one
+ * transaction; every byte on the bus, the address byte of each transfer
+ * included, is counted. On the simulated clock each byte also moves the
+ * clock on by 9 bit times at the driver's 400 kHz: the time a burst read
+ * holds up its caller on the device. As on Device OS, requestFrom()
+ * returns no more than the receive buffer holds (hostWireBuffer: 32 bytes
+ * unless the tool enlarges it, as acquireWireBuffer() in the .ino does).
+ */
+
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include "Particle.h"
+
+inline std::atomic<long> hostI2CBytes(0);
+inline std::atomic<long> hostI2CTransactions(0);
+inline int hostWireBuffer = 32;
+
+struct TwoWire {
+    void begin() {}
+    void setClock(uint32_t speed) {}
+    
+    void beginTransmission(uint8_t address) {
+        length = 0;
+        transfer();
+    }
+    
+    size_t write(uint8_t value) {
+        if (length == 0) {
+            reg = value;
+        } else {
+            hostSensor.write(reg, value);
+        }
+        length++;
+        transfer();
+        return 1;
+    }
+    
+    uint8_t endTransmission(bool stop = true) {
+        hostI2CTransactions++;
+        return 0;
+    }
+    
+    int requestFrom(int address, int count) {
+        hostI2CTransactions++;
+        count = min(count, min(hostWireBuffer, (int)sizeof(received)));
+        transfer();
+        for (int i = 0; i < count; i++) {
+            received[i] = hostSensor.read(reg);
+            if (reg != 0x07) reg++;     // The register address auto-increments, except at FIFO_DATA
+            transfer();
+        }
+        receivedLength = count;
+        receivedOffset = 0;
+        return count;
+    }
+    
+    int available() { return receivedLength - receivedOffset; }
+    int read() { return available() > 0 ? received[receivedOffset++] : 0; }
+
+private:
+    uint8_t reg = 0;
+    int length = 0;
+    uint8_t received[512];
+    int receivedLength = 0;
+    int receivedOffset = 0;
+    
+    // One byte on the bus
+    void transfer() {
+        hostI2CBytes++;
+#if !HOST_REAL_CLOCK
+        hostAdvance(23);        // 9 bits at 400 kHz (22.5 µs)
+#endif
+    }
+};
+inline TwoWire Wire;
+
+#endif // HOST_WIRE_H
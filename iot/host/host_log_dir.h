@@ -0,0 +1,71 @@
+/*
+ * host_log_dir.h - FLASH_LOG_DIR redirection for the host HAL
+ *
+ * RecordLog keeps its segment files under FLASH_LOG_DIR, a directory of
+ * the device's flash. A tool that runs NetworkManager includes this header
+ * in its one source file: open(), mkdir() and unlink() calls under
+ * FLASH_LOG_DIR then go to a temporary directory, made by
+ * hostMakeLogDirectory() and removed by hostRemoveLogDirectory().
+ */
+
+#ifndef HOST_LOG_DIR_H
+#define HOST_LOG_DIR_H
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "config.h"
+
+inline char hostLogDirectory[64];
+
+inline const char *hostRedirect(const char *path, char *out, size_t size) {
+    size_t prefix = strlen(FLASH_LOG_DIR);
+    if (hostLogDirectory[0] == '\0' || strncmp(path, FLASH_LOG_DIR, prefix) != 0) return path;
+    snprintf(out, size, "%s%s", hostLogDirectory, path + prefix);
+    return out;
+}
+
+extern "C" int open(const char *path, int flags, ...) {
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list args;
+        va_start(args, flags);
+        mode = va_arg(args, int);
+        va_end(args);
+    }
+    char buffer[128];
+    return syscall(SYS_openat, AT_FDCWD, hostRedirect(path, buffer, sizeof(buffer)), flags, mode);
+}
+
+extern "C" int mkdir(const char *path, mode_t mode) {
+    char buffer[128];
+    return syscall(SYS_mkdirat, AT_FDCWD, hostRedirect(path, buffer, sizeof(buffer)), mode);
+}
+
+extern "C" int unlink(const char *path) {
+    char buffer[128];
+    return syscall(SYS_unlinkat, AT_FDCWD, hostRedirect(path, buffer, sizeof(buffer)), 0);
+}
+
+// Make /tmp/<tool>-XXXXXX and redirect FLASH_LOG_DIR to it
+inline bool hostMakeLogDirectory(const char *tool) {
+    snprintf(hostLogDirectory, sizeof(hostLogDirectory), "/tmp/%s-XXXXXX", tool);
+    if (mkdtemp(hostLogDirectory) != nullptr) return true;
+    perror("mkdtemp");
+    hostLogDirectory[0] = '\0';
+    return false;
+}
+
+inline void hostRemoveLogDirectory() {
+    if (hostLogDirectory[0] == '\0') return;
+    char command[96];
+    snprintf(command, sizeof(command), "rm -rf %s", hostLogDirectory);
+    if (system(command) != 0) fprintf(stderr, "could not remove %s\n", hostLogDirectory);
+}
+
+#endif // HOST_LOG_DIR_H
@@ -0,0 +1,249 @@
+/*
+ * host_sensor.h - MAX30102 model for the host HAL
+ *
+ * Included by Particle.h. Only what the SparkFun driver and SensorManager
+ * use: the FIFO pointers, OVF_COUNTER and data (red then IR, 3 bytes each,
+ * 18 bits), FIFO_CONFIG's A_FULL threshold, INT_STATUS_1/INT_ENABLE_1's
+ * A_FULL bit, MODE_CONFIG's reset and the part ID. As with
+ * FIFO_ROLLOVER_EN, a full FIFO keeps filling: each new sample overwrites
+ * the oldest unread one (an overrun), counted in OVF_COUNTER until the
+ * next sample is read.
+ *
+ * The sensor samples at 25 samples/s. With a finger on (fingerOn) the
+ * samples are a synthetic 72 bpm pulse; with counterSamples, sample n
+ * reads red = n and IR = n + IR_OFFSET, so a reader that skips, repeats
+ * or splits samples can be caught. While a trace plays (play(),
+ * tracePlaying), the samples are the recording's: each is the mean of the
+ * next `average` recorded samples, as the part's sample averaging
+ * (SMP_AVE) makes 25 samples/s of its 100. Once the trace has ended, or
+ * while it is paused, the sensor reads as if no finger were on. Samples are taken as the clock passes:
+ * by hostAdvance() on the simulated clock, and whenever the model is
+ * accessed on the real one. The A_FULL handler runs on the thread that
+ * raises the interrupt. All access goes through one lock, so the model
+ * itself never races.
+ */
+
+#ifndef HOST_SENSOR_H
+#define HOST_SENSOR_H
+
+class HostSensor {
+public:
+    static const uint64_t SAMPLE_PERIOD = 40000;   // µs (100 sps averaged by 4)
+    static const uint32_t IR_OFFSET = 0x10000;
+    
+    std::atomic<bool> fingerOn{false};
+    std::atomic<bool> counterSamples{false};
+    std::atomic<bool> countOverruns{false};
+    std::atomic<long> overruns{0};                 // Samples lost, while countOverruns
+    std::atomic<long> samplesRead{0};
+    std::atomic<int> peakUnread{0};                // Most samples waiting at a FIFO read, while countOverruns
+    std::atomic<uint64_t> interruptAt{0};          // hostMicros() when MAX30102_INT was last asserted
+    std::atomic<bool> tracePlaying{false};          // Samples come from the trace (see play())
+    
+    uint8_t read(uint8_t reg) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        catchUp();
+        switch (reg) {
+            case 0x00: {
+                uint8_t status = aFull ? 0x80 : 0;
+                aFull = false;
+                return status;
+            }
+            case 0x01: return 0;
+            case 0x04:
+                if (countOverruns) peakUnread = max<int>(peakUnread, count);
+                return writePointer;
+            case 0x05: return overflow;
+            case 0x06: return readPointer;
+            case 0x07: return readData();
+            case 0x09: return registers[0x09] & ~0x40;  // Reset completes at once
+            case 0xFE: return 0x03;
+            case 0xFF: return 0x15;
+            default: return registers[reg];
+        }
+    }
+    
+    void write(uint8_t reg, uint8_t value) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        catchUp();
+        registers[reg] = value;
+        if (reg == 0x09 && (value & 0x40)) {
+            memset(registers, 0, sizeof(registers));
+            writePointer = readPointer = 0;
+            count = overflow = 0;
+            byteInSample = 0;
+            aFull = false;
+        } else if (reg == 0x04) {
+            writePointer = value % 32;
+            count = (writePointer - readPointer + 32) % 32;
+        } else if (reg == 0x05) {
+            overflow = value & 0x1F;
+        } else if (reg == 0x06) {
+            readPointer = value % 32;
+            count = (writePointer - readPointer + 32) % 32;
+            byteInSample = 0;
+        }
+    }
+    
+    // MAX30102_INT is asserted (driven low)
+    bool interruptLine() {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        catchUp();
+        return aFull && (registers[0x02] & 0x80);
+    }
+    
+    // Unread samples in the FIFO (32 when full, with the pointers equal)
+    int unread() {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        catchUp();
+        return count;
+    }
+    
+    void attach(void (*handler)(void *instance), void *instance) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        this->handler = handler;
+        this->instance = instance;
+    }
+    
+    // Play a recorded trace from its start, `average` recorded samples to a
+    // sample (the vectors must outlive the playback)
+    void play(const std::vector<uint32_t> *red, const std::vector<uint32_t> *ir, int average) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        catchUp();
+        traceRed = red;
+        traceIR = ir;
+        traceAverage = max(average, 1);
+        tracePosition = 0;
+        tracePlaying = true;
+    }
+    
+    // The next recorded sample the sensor takes (its index in the trace)
+    size_t tracePoint() {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        catchUp();
+        return tracePosition;
+    }
+    
+    // Samples left in the trace (recorded samples / average)
+    size_t traceLeft() {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        catchUp();
+        if (traceRed == nullptr) return 0;
+        return (traceRed->size() - min(tracePosition, traceRed->size())) / traceAverage;
+    }
+    
+    // When the next sample is due (µs)
+    uint64_t nextDue() {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        return nextSample;
+    }
+    
+    // Take the samples due by now
+    void catchUp() {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        uint64_t now = hostMicros();
+        while (nextSample <= now) {
+            sample(nextSample);
+            nextSample += SAMPLE_PERIOD;
+        }
+    }
+
+private:
+    std::recursive_mutex mutex;
+    uint8_t registers[256] = {};
+    uint32_t red[32], ir[32];
+    uint8_t writePointer = 0, readPointer = 0;
+    int count = 0;
+    uint8_t overflow = 0;               // OVF_COUNTER
+    int byteInSample = 0;               // Next FIFO_DATA byte of the oldest sample
+    bool aFull = false;                 // A_FULL status, until INT_STATUS_1 is read
+    uint64_t nextSample = SAMPLE_PERIOD;
+    uint32_t samplesTaken = 0;
+    unsigned seed = 1;
+    
+    const std::vector<uint32_t> *traceRed = nullptr;
+    const std::vector<uint32_t> *traceIR = nullptr;
+    int traceAverage = 1;
+    size_t tracePosition = 0;
+    
+    void (*handler)(void *instance) = nullptr;
+    void *instance = nullptr;
+    
+    int threshold() { return 32 - (registers[0x08] & 0x0F); }
+    
+    void sample(uint64_t time) {
+        if (counterSamples) {
+            red[writePointer] = samplesTaken & 0x3FFFF;
+            ir[writePointer] = (samplesTaken + IR_OFFSET) & 0x3FFFF;
+        } else if (tracePlaying && traceRed != nullptr && tracePosition + traceAverage <= traceRed->size()) {
+            uint64_t redSum = 0, irSum = 0;
+            for (int i = 0; i < traceAverage; i++, tracePosition++) {
+                redSum += (*traceRed)[tracePosition];
+                irSum += (*traceIR)[tracePosition];
+            }
+            red[writePointer] = (redSum / traceAverage) & 0x3FFFF;
+            ir[writePointer] = (irSum / traceAverage) & 0x3FFFF;
+        } else {
+            double phase = fmod(time / 1e6 * 1.2, 1.0);     // 72 bpm
+            double pulse = exp(-pow(phase - 0.2, 2) / 0.01);
+            double noise = (int)(rand_r(&seed) % 21) - 10;
+            if (fingerOn && !tracePlaying) {
+                ir[writePointer] = 100000 - 1500 * pulse + noise;
+                red[writePointer] = 80000 - 600 * pulse + noise;
+            } else {
+                ir[writePointer] = 2000 + noise;
+                red[writePointer] = 1500 + noise;
+            }
+        }
+        samplesTaken++;
+        writePointer = (writePointer + 1) % 32;
+        if (count == 32) {
+            readPointer = writePointer;
+            byteInSample = 0;
+            overflow = min(overflow + 1, 0x1F);
+            if (countOverruns) overruns++;
+        } else {
+            count++;
+        }
+    
+        bool wasLow = aFull && (registers[0x02] & 0x80);
+        if (count == threshold()) aFull = true;
+        if (!wasLow && aFull && (registers[0x02] & 0x80)) {
+            interruptAt = time;
+            if (handler) handler(instance);
+        }
+    }
+    
+    uint8_t readData() {
+        uint32_t value = byteInSample < 3 ? red[readPointer] : ir[readPointer];
+        int shift = 16 - 8 * (byteInSample % 3);
+        uint8_t data = (value >> shift) & 0xFF;
+        if (++byteInSample == 6) {
+            byteInSample = 0;
+            if (count > 0) {
+                readPointer = (readPointer + 1) % 32;
+                count--;
+                overflow = 0;
+                samplesRead++;
+            }
+        }
+        return data;
+    }
+};
+inline HostSensor hostSensor;
+
+#if !HOST_REAL_CLOCK
+
+// Move the clock on, taking the sensor's samples on the way
+inline void hostAdvance(uint64_t micros) {
+    uint64_t end = hostClock + micros;
+    for (uint64_t due = hostSensor.nextDue(); due <= end; due = hostSensor.nextDue()) {
+        hostClock = due;
+        hostSensor.catchUp();
+    }
+    hostClock = end;
+}
+
+#endif
+
+#endif // HOST_SENSOR_H
@@ -0,0 +1,181 @@
+/*
+ * host_tcp.h - TCPClient for the host HAL
+ *
+ * Included by Particle.h. By default TCPClient talks to a stand-in API
+ * server that answers each request with 200 OK (hostConfigResponse for a
+ * GET, {"success":true} otherwise) and counts them in hostRequestCount.
+ *
+ * With HOST_SOCKETS it connects over POSIX sockets instead, and can
+ * emulate a network round-trip (emulatedRttMs): connecting takes one
+ * round-trip, and received data becomes readable one round-trip after the
+ * server sent it, so pipelined requests share the wait as they would on
+ * the network.
+ */
+
+#ifndef HOST_TCP_H
+#define HOST_TCP_H
+
+#if HOST_SOCKETS
+
+#include <errno.h>
+
+#include <deque>
+#include <string>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Emulated network round-trip applied by every TCPClient (ms)
+inline unsigned long emulatedRttMs = 0;
+
+class TCPClient {
+public:
+    TCPClient() : fd(-1) {}
+    ~TCPClient() { stop(); }
+    
+    int connect(const char *host, uint16_t port) {
+        stop();
+    
+        char service[8];
+        snprintf(service, sizeof(service), "%u", port);
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo *result = nullptr;
+        if (getaddrinfo(host, service, &hints, &result) != 0) return 0;
+    
+        for (struct addrinfo *ai = result; ai != nullptr; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) continue;
+            if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+            ::close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(result);
+        if (fd < 0) return 0;
+    
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        delay(emulatedRttMs);   // SYN / SYN-ACK
+        return 1;
+    }
+    
+    bool connected() {
+        if (fd < 0) return false;
+        if (!received.empty()) return true;
+        uint8_t c;
+        ssize_t result = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return result > 0 || (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+    }
+    
+    int available() {
+        if (fd < 0) return 0;
+        fill();
+        if (received.empty() || millis() < received.front().readyAt) return 0;
+        return (int)(received.front().data.size() - offset);
+    }
+    
+    int read() {
+        if (available() == 0) return -1;
+        int c = (uint8_t)received.front().data[offset++];
+        if (offset == received.front().data.size()) {
+            received.pop_front();
+            offset = 0;
+        }
+        return c;
+    }
+    
+    int write(const uint8_t *data, size_t length) {
+        if (fd < 0) return -1;
+        return (int)send(fd, data, length, MSG_NOSIGNAL);
+    }
+    
+    void stop() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        received.clear();
+        offset = 0;
+    }
+
+private:
+    // Data received from the server, readable from readyAt on
+    struct Arrival {
+        unsigned long readyAt;
+        std::string data;
+    };
+    
+    int fd;
+    std::deque<Arrival> received;
+    size_t offset = 0;          // Bytes of received.front() already read
+    
+    void fill() {
+        uint8_t buffer[1024];
+        ssize_t result;
+        while ((result = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+            received.push_back({millis() + emulatedRttMs, std::string((char *)buffer, result)});
+        }
+    }
+};
+
+#else
+
+class TCPClient {
+public:
+    int connect(const char *host, uint16_t port) {
+        open = hostOnline;
+        requestLength = 0;
+        responseLength = 0;
+        responseOffset = 0;
+        return open;
+    }
+    bool connected() { return open && hostOnline; }
+    void stop() { open = false; }
+    
+    int write(const uint8_t *data, size_t length) {
+        if (!connected()) return -1;
+        length = min(length, sizeof(request) - requestLength);
+        memcpy(request + requestLength, data, length);
+        requestLength += length;
+        answerRequests();
+        return length;
+    }
+    
+    int available() { return connected() ? responseLength - responseOffset : 0; }
+    int read() { return available() > 0 ? response[responseOffset++] : -1; }
+
+private:
+    bool open = false;
+    char request[4096];
+    size_t requestLength = 0;
+    char response[4096];
+    int responseLength = 0;
+    int responseOffset = 0;
+    
+    // Answer every complete request in the buffer
+    void answerRequests() {
+        while (true) {
+            request[min(requestLength, sizeof(request) - 1)] = '\0';
+            char *end = strstr(request, "\r\n\r\n");
+            if (end == nullptr) return;
+            char *field = strcasestr(request, "Content-Length:");
+            size_t total = end + 4 - request + (field != nullptr && field < end ? atoi(field + 15) : 0);
+            if (requestLength < total) return;
+    
+            hostRequestCount++;
+            if (responseOffset == responseLength) responseOffset = responseLength = 0;
+            const char *body = strncmp(request, "GET", 3) == 0 ? hostConfigResponse : "{\"success\":true}";
+            responseLength += snprintf(response + responseLength, sizeof(response) - responseLength,
+                                       "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%s",
+                                       (int)strlen(body), body);
+            memmove(request, request + total, requestLength - total);
+            requestLength -= total;
+        }
+    }
+};
+
+#endif
+
+#endif // HOST_TCP_H
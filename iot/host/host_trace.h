@@ -0,0 +1,97 @@
+/*
+ * host_trace.h - Recorded PPG trace files for the host tools
+ *
+ * A trace is red/IR samples at a fixed rate, in one of two formats:
+ *   CSV     one "red,ir" line per sample, as ppg-batch reads; lines that
+ *           are not two numbers (headers, blanks) are skipped. The file
+ *           does not give its rate: the reader passes it (25 samples/s,
+ *           the rate the sensor delivers, or a raw 100 Hz recording).
+ *   binary  "PPGT", a format version byte (1), a reserved byte, the rate
+ *           (uint16) and the sample count (uint32), then each sample's
+ *           red and IR as 3 bytes each (18-bit values). All little-endian.
+ *           6 bytes a sample, about half the CSV, and no parsing.
+ * hostLoadTrace() tells the two apart by the magic.
+ */
+
+#ifndef HOST_TRACE_H
+#define HOST_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+struct HostTrace {
+    std::vector<uint32_t> red;
+    std::vector<uint32_t> ir;
+    int rate = 25;                      // Samples/s
+};
+
+static const char HOST_TRACE_MAGIC[4] = {'P', 'P', 'G', 'T'};
+static const uint8_t HOST_TRACE_VERSION = 1;
+
+// Read a trace, CSV (at csvRate samples/s) or binary. False if unreadable.
+inline bool hostLoadTrace(const char *path, HostTrace &trace, int csvRate = 25) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) return false;
+    trace.red.clear();
+    trace.ir.clear();
+    
+    uint8_t header[12];
+    size_t length = fread(header, 1, sizeof(header), file);
+    if (length == sizeof(header) && memcmp(header, HOST_TRACE_MAGIC, 4) == 0) {
+        trace.rate = header[6] | header[7] << 8;
+        uint32_t count = header[8] | header[9] << 8 | header[10] << 16 | (uint32_t)header[11] << 24;
+        bool ok = header[4] == HOST_TRACE_VERSION && trace.rate > 0;
+        uint8_t sample[6];
+        for (uint32_t i = 0; ok && i < count; i++) {
+            ok = fread(sample, 1, sizeof(sample), file) == sizeof(sample);
+            trace.red.push_back(sample[0] | sample[1] << 8 | sample[2] << 16);
+            trace.ir.push_back(sample[3] | sample[4] << 8 | sample[5] << 16);
+        }
+        fclose(file);
+        return ok;
+    }
+    
+    trace.rate = csvRate;
+    rewind(file);
+    char line[64];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        char *end;
+        unsigned long red = strtoul(line, &end, 10);
+        if (end == line || *end != ',') continue;
+        char *irStart = end + 1;
+        unsigned long ir = strtoul(irStart, &end, 10);
+        if (end == irStart) continue;
+        trace.red.push_back(red);
+        trace.ir.push_back(ir);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+// Write a trace in the binary format. False on a write error.
+inline bool hostSaveTrace(const char *path, const HostTrace &trace) {
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) return false;
+    
+    uint32_t count = trace.red.size();
+    uint8_t header[12] = {0, 0, 0, 0, HOST_TRACE_VERSION, 0,
+                          (uint8_t)trace.rate, (uint8_t)(trace.rate >> 8),
+                          (uint8_t)count, (uint8_t)(count >> 8), (uint8_t)(count >> 16), (uint8_t)(count >> 24)};
+    memcpy(header, HOST_TRACE_MAGIC, 4);
+    fwrite(header, 1, sizeof(header), file);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t red = trace.red[i], ir = trace.ir[i];
+        uint8_t sample[6] = {(uint8_t)red, (uint8_t)(red >> 8), (uint8_t)(red >> 16),
+                             (uint8_t)ir, (uint8_t)(ir >> 8), (uint8_t)(ir >> 16)};
+        fwrite(sample, 1, sizeof(sample), file);
+    }
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+#endif // HOST_TRACE_H
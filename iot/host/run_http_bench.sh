@@ -0,0 +1,30 @@
+#!/bin/sh
+# Runs http-bench against the stand-in API server (the ctest run, see
+# CMakeLists.txt).
+#
+# USAGE:
+#   run_http_bench.sh <node> <stand_in_server.js> <http-bench> <port>
+
+node="$1"
+server="$2"
+bench="$3"
+port="$4"
+
+"$node" "$server" "$port" > /dev/null &
+pid=$!
+trap 'kill $pid 2> /dev/null' EXIT
+
+# Wait up to 5 s for the server to listen
+probe="require('net').connect($port, '127.0.0.1')
+    .on('connect', () => process.exit(0)).on('error', () => process.exit(1))"
+tries=0
+until "$node" -e "$probe"; do
+    tries=$((tries + 1))
+    if [ "$tries" -ge 50 ]; then
+        echo "stand-in server did not start on port $port" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+"$bench" -p "$port" -n 100
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Runs ppg-batch over recordings of very different lengths on 4 threads and
+# on one (the ctest run, see CMakeLists.txt). Recordings are dealt in name
+# order, so worker 0 gets both long ones and the others run out of work
+# first and must steal. Fails unless more than one worker processed
+# recordings, one was stolen, and both runs wrote the same results.
+#
+# USAGE:
+#   run_ppg_batch.sh <trace-writer> <ppg-batch> <work-dir>
+
+writer="$1"
+batch="$2"
+dir="$3"
+
+set -e
+rm -rf "$dir"
+mkdir -p "$dir/recordings"
+
+# 0 and 4 are four hours long, the rest a minute; some start without a finger
+for i in 0 1 2 3 4 5 6 7; do
+    case $i in
+        0|4) seconds=14400 ;;
+        *) seconds=60 ;;
+    esac
+    "$writer" "$dir/recordings/recording-$i.csv" -s $seconds -f $((i % 3 * 5))
+done
+
+"$batch" "$dir/recordings" "$dir/results-4" -j 4 > "$dir/report-4.txt"
+cat "$dir/report-4.txt"
+"$batch" "$dir/recordings" "$dir/results-1" -j 1 > /dev/null
+
+# "worker  N: R recordings (S stolen), ..."
+workers=$(awk '/^worker/ && $3 > 0' "$dir/report-4.txt" | wc -l)
+stolen=$(awk '/^worker/ { sub(/\(/, "", $5); total += $5 } END { print total + 0 }' "$dir/report-4.txt")
+if [ "$workers" -lt 2 ] || [ "$stolen" -lt 1 ]; then
+    echo "work not shared: $workers workers processed recordings, $stolen stolen" >&2
+    exit 1
+fi
+if ! diff -r "$dir/results-1" "$dir/results-4" > /dev/null; then
+    echo "results on 4 threads differ from those on one" >&2
+    exit 1
+fi
+echo "ppg-batch: $workers workers, $stolen stolen, results match one thread"
@@ -0,0 +1,78 @@
+/*
+ * trace_writer.cpp - Synthetic PPG Trace from the Host Sensor Model
+ *
+ * Writes the samples of the host HAL's MAX30102 (host_sensor.h), read from
+ * its FIFO as the driver would, as a trace at 25 samples/s (host_trace.h):
+ * a "red,ir" CSV, the recording format of ppg-batch, or the binary format
+ * if the file name ends in ".ppg". The finger goes on after -f seconds
+ * (at once by default). The ctest runs of ppg-batch and replay use it as
+ * their input.
+ *
+ * BUILD (from iot/host):
+ *   g++ -std=c++17 -O2 -I. trace_writer.cpp -pthread -o trace-writer
+ *
+ * USAGE:
+ *   ./trace-writer <file.csv|file.ppg> [-s seconds] [-f seconds]
+ *   -s  length of the trace (default 120)
+ *   -f  seconds without a finger before the finger goes on (default 0)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Particle.h"
+#include "host_trace.h"
+
+// One 18-bit value from FIFO_DATA
+static uint32_t readValue() {
+    uint32_t value = 0;
+    for (int i = 0; i < 3; i++) value = (value << 8) | hostSensor.read(0x07);
+    return value & 0x3FFFF;
+}
+
+static bool writeCSV(const char *path, const HostTrace &trace) {
+    FILE *file = fopen(path, "w");
+    if (file == nullptr) return false;
+    fprintf(file, "red,ir\n");
+    for (size_t i = 0; i < trace.red.size(); i++) {
+        fprintf(file, "%lu,%lu\n", (unsigned long)trace.red[i], (unsigned long)trace.ir[i]);
+    }
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+int main(int argc, char **argv) {
+    int seconds = 120;
+    int fingerAfter = 0;
+    int option;
+    while ((option = getopt(argc, argv, "s:f:")) != -1) {
+        switch (option) {
+            case 's': seconds = atoi(optarg); break;
+            case 'f': fingerAfter = atoi(optarg); break;
+            default: seconds = 0; break;
+        }
+    }
+    if (optind != argc - 1 || seconds <= 0 || fingerAfter < 0) {
+        fprintf(stderr, "usage: %s <file.csv|file.ppg> [-s seconds] [-f seconds]\n", argv[0]);
+        return 2;
+    }
+    const char *path = argv[optind];
+    
+    HostTrace trace;
+    for (int i = 0; i < seconds * 25; i++) {
+        hostSensor.fingerOn = i >= fingerAfter * 25;
+        hostAdvance(HostSensor::SAMPLE_PERIOD);
+        trace.red.push_back(readValue());
+        trace.ir.push_back(readValue());
+    }
+    
+    size_t length = strlen(path);
+    bool binary = length > 4 && strcmp(path + length - 4, ".ppg") == 0;
+    if (!(binary ? hostSaveTrace(path, trace) : writeCSV(path, trace))) {
+        perror(path);
+        return 1;
+    }
+    return 0;
+}
@@ -137,6 +137,14 @@ static const uint8_t MAX_30105_EXPECTEDPARTID = 0x15;
 
 MAX30105::MAX30105() {
   // Constructor
+  sense.head = 0;
+  sense.tail = 0;
+  overruns = 0;
+  i2cBufferLength = I2C_BUFFER_LENGTH;
+  almostFullSeen = false;
+  almostFullLevel = 32;
+  ringConsumed = false;
+  latest.red = latest.IR = latest.green = 0;
 }
 
 boolean MAX30105::begin(TwoWire &wirePort, uint32_t i2cSpeed, uint8_t i2caddr) {
@@ -167,8 +175,11 @@ boolean MAX30105::begin(TwoWire &wirePort, uint32_t i2cSpeed, uint8_t i2caddr) {
 //
 
 //Begin Interrupt configuration
+//Reading clears the status: an A_FULL seen here is kept for readFIFOCount()
 uint8_t MAX30105::getINT1(void) {
-  return (readRegister8(_i2caddr, MAX30105_INTSTAT1));
+  uint8_t status = readRegister8(_i2caddr, MAX30105_INTSTAT1);
+  if (status & MAX30105_INT_A_FULL_ENABLE) almostFullSeen = true;
+  return (status);
 }
 uint8_t MAX30105::getINT2(void) {
   return (readRegister8(_i2caddr, MAX30105_INTSTAT2));
@@ -223,6 +234,7 @@ void MAX30105::softReset(void) {
     if ((response & MAX30105_RESET) == 0) break; //We're done!
     delay(1); //Let's not over burden the I2C bus
   }
+  almostFullLevel = 32; //FIFO_A_FULL is back to 0
 }
 
 void MAX30105::shutDown(void) {
@@ -289,8 +301,6 @@ void MAX30105::setProximityThreshold(uint8_t threshMSB) {
 //Assigning a SLOT_RED_PILOT will ??
 void MAX30105::enableSlot(uint8_t slotNumber, uint8_t device) {
 
-  uint8_t originalContents;
-
   switch (slotNumber) {
     case (1):
       bitMask(MAX30105_MULTILEDCONFIG1, MAX30105_SLOT1_MASK, device);
@@ -331,6 +341,10 @@ void MAX30105::clearFIFO(void) {
   writeRegister8(_i2caddr, MAX30105_FIFOWRITEPTR, 0);
   writeRegister8(_i2caddr, MAX30105_FIFOOVERFLOW, 0);
   writeRegister8(_i2caddr, MAX30105_FIFOREADPTR, 0);
+
+  //An A_FULL raised before the clear says nothing about the empty FIFO
+  readRegister8(_i2caddr, MAX30105_INTSTAT1);
+  almostFullSeen = false;
 }
 
 //Enable roll over if FIFO over flows
@@ -348,6 +362,7 @@ void MAX30105::disableFIFORollover(void) {
 //Note it is reverse: 0x00 is 32 samples, 0x0F is 17 samples
 void MAX30105::setFIFOAlmostFull(uint8_t numberOfSamples) {
   bitMask(MAX30105_FIFOCONFIG, MAX30105_A_FULL_MASK, numberOfSamples);
+  almostFullLevel = 32 - (numberOfSamples & 0x0F); //Samples in the FIFO when A_FULL is raised
 }
 
 //Read the FIFO Write Pointer
@@ -360,6 +375,11 @@ uint8_t MAX30105::getReadPointer(void) {
   return (readRegister8(_i2caddr, MAX30105_FIFOREADPTR));
 }
 
+//Samples lost to FIFO rollover so far (safe to call from the consumer while check() runs elsewhere)
+uint32_t MAX30105::getOverrunCount(void) {
+  return (__atomic_load_n(&overruns, __ATOMIC_RELAXED));
+}
+
 
 // Die Temperature
 // Returns temp in C
@@ -519,20 +539,20 @@ void MAX30105::setup(byte powerLevel, byte sampleAverage, byte ledMode, int samp
 //
 
 //Tell caller how many samples are available
+//The acquire load of head makes the readings check() wrote before publishing it visible here
+//Either side may call it: the producer sees no more free slots than there are
 uint8_t MAX30105::available(void)
 {
-  int8_t numberOfSamples = sense.head - sense.tail;
-  if (numberOfSamples < 0) numberOfSamples += STORAGE_SIZE;
-
-  return (numberOfSamples);
+  byte head = __atomic_load_n(&sense.head, __ATOMIC_ACQUIRE);
+  return ((byte)(head - __atomic_load_n(&sense.tail, __ATOMIC_ACQUIRE)));
 }
 
 //Report the most recent red value
 uint32_t MAX30105::getRed(void)
 {
   //Check the sensor for new data for 250ms
-  if(safeCheck(250))
-    return (sense.red[sense.head]);
+  if(checkLatest())
+    return (latest.red);
   else
     return(0); //Sensor failed to find new data
 }
@@ -541,8 +561,8 @@ uint32_t MAX30105::getRed(void)
 uint32_t MAX30105::getIR(void)
 {
   //Check the sensor for new data for 250ms
-  if(safeCheck(250))
-    return (sense.IR[sense.head]);
+  if(checkLatest())
+    return (latest.IR);
   else
     return(0); //Sensor failed to find new data
 }
@@ -551,151 +571,254 @@ uint32_t MAX30105::getIR(void)
 uint32_t MAX30105::getGreen(void)
 {
   //Check the sensor for new data for 250ms
-  if(safeCheck(250))
-    return (sense.green[sense.head]);
+  if(checkLatest())
+    return (latest.green);
   else
     return(0); //Sensor failed to find new data
 }
 
-//Report the next Red value in the FIFO
+//Report the next Red value in the FIFO (the oldest unread sample, at the tail)
 uint32_t MAX30105::getFIFORed(void)
 {
-  return (sense.red[sense.tail]);
+  return (sense.reading[sense.tail % STORAGE_SIZE].red);
 }
 
 //Report the next IR value in the FIFO
 uint32_t MAX30105::getFIFOIR(void)
 {
-  return (sense.IR[sense.tail]);
+  return (sense.reading[sense.tail % STORAGE_SIZE].IR);
 }
 
 //Report the next Green value in the FIFO
 uint32_t MAX30105::getFIFOGreen(void)
 {
-  return (sense.green[sense.tail]);
+  return (sense.reading[sense.tail % STORAGE_SIZE].green);
 }
 
 //Advance the tail
+//The release store hands the slot back to check() only once the caller is done with it
 void MAX30105::nextSample(void)
 {
+  ringConsumed = true; //From now on the ring's entries are kept for this caller
+
   if(available()) //Only advance the tail if new data is available
   {
-    sense.tail++;
-    sense.tail %= STORAGE_SIZE; //Wrap condition
+    __atomic_store_n(&sense.tail, (byte)(sense.tail + 1), __ATOMIC_RELEASE);
   }
 }
 
 //Polls the sensor for new data
 //Call regularly
-//If new data is available, it updates the head and tail in the main struct
+//If new data is available, it fills the ring and advances its head
+//It never reads more samples than the ring has room for: the rest stay in the sensor's FIFO for the next call
 //Returns number of new samples obtained
 uint16_t MAX30105::check(void)
 {
-  //Read register FIDO_DATA in (3-byte * number of active LED) chunks
+  //Read register FIFO_DATA in (3-byte * number of active LED) chunks
   //Until FIFO_RD_PTR = FIFO_WR_PTR
 
-  byte readPointer = getReadPointer();
-  byte writePointer = getWritePointer();
+  byte overflow;
+  int numberOfSamples = readFIFOCount(overflow);
+
+  //Take no more than the ring has room for
+  byte head = sense.head;
+  int room = STORAGE_SIZE - (byte)(head - __atomic_load_n(&sense.tail, __ATOMIC_ACQUIRE));
+  if (numberOfSamples > room) numberOfSamples = room;
+  if (numberOfSamples == 0) return (0); //Nothing new, or ring full: OVF_COUNTER keeps counting until a sample is read
+
+  //Reading a sample clears OVF_COUNTER, so each loss is counted once
+  if (overflow > 0) __atomic_store_n(&overruns, overruns + overflow, __ATOMIC_RELAXED);
+  almostFullSeen = false;
 
-  int numberOfSamples = 0;
+  selectFIFOData();
 
-  //Do we have new data?
-  if (readPointer != writePointer)
+  int samplesLeft = numberOfSamples;
+  while (samplesLeft > 0)
   {
-    //Calculate the number of readings we need to get from sensor
-    numberOfSamples = writePointer - readPointer;
-    if (numberOfSamples < 0) numberOfSamples += 32; //Wrap condition
-
-    //We now have the number of readings, now calc bytes to read
-    //For this example we are just doing Red and IR (3 bytes each)
-    int bytesLeftToRead = numberOfSamples * activeLEDs * 3;
-
-    //Get ready to read a burst of data from the FIFO register
-    _i2cPort->beginTransmission(MAX30105_ADDRESS);
-    _i2cPort->write(MAX30105_FIFODATA);
-    _i2cPort->endTransmission();
-
-    //We may need to read as many as 288 bytes so we read in blocks no larger than I2C_BUFFER_LENGTH
-    //I2C_BUFFER_LENGTH changes based on the platform. 64 bytes for SAMD21, 32 bytes for Uno.
-    //Wire.requestFrom() is limited to BUFFER_LENGTH which is 32 on the Uno
-    while (bytesLeftToRead > 0)
+    int toGet = requestFIFOData(samplesLeft);
+
+    for (int i = 0; i < toGet; i++)
     {
-      int toGet = bytesLeftToRead;
-      if (toGet > I2C_BUFFER_LENGTH)
-      {
-        //If toGet is 32 this is bad because we read 6 bytes (Red+IR * 3 = 6) at a time
-        //32 % 6 = 2 left over. We don't want to request 32 bytes, we want to request 30.
-        //32 % 9 (Red+IR+GREEN) = 5 left over. We want to request 27.
+      sense_reading &reading = sense.reading[head % STORAGE_SIZE];
+      head++; //Advance the head of the storage struct (published below)
 
-        toGet = I2C_BUFFER_LENGTH - (I2C_BUFFER_LENGTH % (activeLEDs * 3)); //Trim toGet to be a multiple of the samples we need to read
-      }
+      reading.red = readFIFOValue(); //Store this reading into the sense array
+      if (activeLEDs > 1) reading.IR = readFIFOValue();
+      if (activeLEDs > 2) reading.green = readFIFOValue();
+    }
+
+    //Hand this block's readings to the consumer: the release store orders them before the new head
+    __atomic_store_n(&sense.head, head, __ATOMIC_RELEASE);
 
-      bytesLeftToRead -= toGet;
+    samplesLeft -= toGet;
+  }
+
+  latest = sense.reading[(byte)(head - 1) % STORAGE_SIZE]; //For getRed()/getIR()/getGreen()
 
-      //Request toGet number of bytes from sensor
-      _i2cPort->requestFrom(MAX30105_ADDRESS, toGet);
-      
-      while (toGet > 0)
+  return (numberOfSamples); //Let the world know how much new data we found
+}
+
+//Bulk read: up to maxSamples samples from the sensor's FIFO, oldest first, straight into the caller's arrays
+//Bypasses the ring, so use either this or check()/getFIFO*() on one sensor, not both
+//One pointer read, then one FIFO_DATA read per I2C buffer's worth: with setI2CBufferLength(192)
+//a full FIFO of Red+IR (32 * 6 bytes) arrives in a single transfer
+//IR is filled when two or more LEDs are active (it may be NULL otherwise); Green is read and dropped
+//Returns the number of samples read
+uint8_t MAX30105::readFIFO(uint32_t *red, uint32_t *IR, uint8_t maxSamples)
+{
+  byte overflow;
+  int numberOfSamples = readFIFOCount(overflow);
+  if (numberOfSamples > maxSamples) numberOfSamples = maxSamples;
+  if (numberOfSamples == 0) return (0);
+
+  if (overflow > 0) __atomic_store_n(&overruns, overruns + overflow, __ATOMIC_RELAXED);
+  almostFullSeen = false;
+
+  selectFIFOData();
+
+  int samplesRead = 0;
+  while (samplesRead < numberOfSamples)
+  {
+    int toGet = requestFIFOData(numberOfSamples - samplesRead);
+    int last = samplesRead + toGet;
+
+    if (activeLEDs == 2)
+    {
+      //The usual Red+IR case, without the per-channel tests
+      for (int i = samplesRead; i < last; i++)
       {
-        sense.head++; //Advance the head of the storage struct
-        sense.head %= STORAGE_SIZE; //Wrap condition
-
-        byte temp[sizeof(uint32_t)]; //Array of 4 bytes that we will convert into long
-        uint32_t tempLong;
-
-        //Burst read three bytes - RED
-        temp[3] = 0;
-        temp[2] = _i2cPort->read();
-        temp[1] = _i2cPort->read();
-        temp[0] = _i2cPort->read();
-
-        //Convert array to long
-        memcpy(&tempLong, temp, sizeof(tempLong));
-		
-		tempLong &= 0x3FFFF; //Zero out all but 18 bits
-
-        sense.red[sense.head] = tempLong; //Store this reading into the sense array
-
-        if (activeLEDs > 1)
-        {
-          //Burst read three more bytes - IR
-          temp[3] = 0;
-          temp[2] = _i2cPort->read();
-          temp[1] = _i2cPort->read();
-          temp[0] = _i2cPort->read();
-
-          //Convert array to long
-          memcpy(&tempLong, temp, sizeof(tempLong));
-
-		  tempLong &= 0x3FFFF; //Zero out all but 18 bits
-          
-		  sense.IR[sense.head] = tempLong;
-        }
-
-        if (activeLEDs > 2)
-        {
-          //Burst read three more bytes - Green
-          temp[3] = 0;
-          temp[2] = _i2cPort->read();
-          temp[1] = _i2cPort->read();
-          temp[0] = _i2cPort->read();
-
-          //Convert array to long
-          memcpy(&tempLong, temp, sizeof(tempLong));
-
-		  tempLong &= 0x3FFFF; //Zero out all but 18 bits
-
-          sense.green[sense.head] = tempLong;
-        }
-
-        toGet -= activeLEDs * 3;
+        red[i] = readFIFOValue();
+        IR[i] = readFIFOValue();
       }
+    }
+    else
+    {
+      for (int i = samplesRead; i < last; i++)
+      {
+        red[i] = readFIFOValue();
+        if (activeLEDs > 1) IR[i] = readFIFOValue();
+        if (activeLEDs > 2) readFIFOValue();
+      }
+    }
 
-    } //End while (bytesLeftToRead > 0)
+    samplesRead = last;
+  }
 
-  } //End readPtr != writePtr
+  return (numberOfSamples);
+}
 
-  return (numberOfSamples); //Let the world know how much new data we found
+//Set how many bytes one Wire.requestFrom() can return (the platform's I2C receive buffer)
+//FIFO reads are split into blocks of whole samples no larger than this
+//On Device OS the application can enlarge the buffer with acquireWireBuffer()
+void MAX30105::setI2CBufferLength(uint16_t length)
+{
+  i2cBufferLength = length;
+}
+
+//Samples waiting in the sensor's FIFO, from FIFO_WR_PTR, OVF_COUNTER and FIFO_RD_PTR (one 3 byte transfer)
+//overflow is set to the samples lost since the last one was read (OVF_COUNTER, saturating at 31)
+//Equal pointers mean an empty FIFO or a full one (32 samples). It is full if it overflowed, or if A_FULL
+//was raised since the last FIFO read: that sample came after the read's count, so it is still unread.
+//This needs A_FULL enabled (enableAFULL()); without it a full FIFO reads as empty until the next sample
+//overflows it
+//INT_STATUS_1 is read (getINT1(), which clears the status) only when that decides the count, or when the
+//samples about to be read raised A_FULL and nobody has read it yet, so it cannot be taken for a newer one.
+//INT_STATUS_2 (DIE_TEMP_RDY) is left alone
+int MAX30105::readFIFOCount(byte &overflow)
+{
+  _i2cPort->beginTransmission(MAX30105_ADDRESS);
+  _i2cPort->write(MAX30105_FIFOWRITEPTR);
+  _i2cPort->endTransmission(false);
+  _i2cPort->requestFrom((uint8_t)MAX30105_ADDRESS, (uint8_t)3);
+  byte writePointer = _i2cPort->read();
+  overflow = _i2cPort->read() & 0x1F;
+  byte readPointer = _i2cPort->read();
+
+  int numberOfSamples = writePointer - readPointer;
+  if (numberOfSamples < 0) numberOfSamples += 32; //Wrap condition
+  //Equal pointers (empty or full), or enough samples to have raised A_FULL, with A_FULL not read since the last
+  //FIFO read
+  if (!almostFullSeen && (numberOfSamples == 0 || numberOfSamples >= almostFullLevel || overflow > 0)) getINT1();
+  if (numberOfSamples == 0 && (overflow > 0 || almostFullSeen)) numberOfSamples = 32; //Full
+  return (numberOfSamples);
+}
+
+//Point the register address at FIFO_DATA, which does not auto-increment, for the reads that follow
+void MAX30105::selectFIFOData(void)
+{
+  _i2cPort->beginTransmission(MAX30105_ADDRESS);
+  _i2cPort->write(MAX30105_FIFODATA);
+  _i2cPort->endTransmission();
+}
+
+//Request the next block of up to samplesLeft samples from FIFO_DATA
+//The block is trimmed to whole samples: 32 % 6 (Red+IR) = 2 left over, so a 32 byte buffer takes 30 bytes
+//Returns the number of samples requested
+int MAX30105::requestFIFOData(int samplesLeft)
+{
+  int bytesPerSample = activeLEDs * 3;
+  int samplesPerBlock = i2cBufferLength / bytesPerSample;
+  if (samplesPerBlock < 1) samplesPerBlock = 1;
+
+  int toGet = samplesLeft < samplesPerBlock ? samplesLeft : samplesPerBlock;
+  _i2cPort->requestFrom((int)MAX30105_ADDRESS, toGet * bytesPerSample); //(int, int) is the overload every platform has
+  return (toGet);
+}
+
+//One 18 bit channel value: three bytes, MSB first
+uint32_t MAX30105::readFIFOValue(void)
+{
+  uint32_t value = (uint32_t)_i2cPort->read() << 16;
+  value |= (uint32_t)_i2cPort->read() << 8;
+  value |= _i2cPort->read();
+  return (value & 0x3FFFF); //Zero out all but 18 bits
+}
+
+//Wait up to 250ms for a new sample for getRed()/getIR()/getGreen(), which report the newest one (latest)
+//They never move the tail: only the ring's consumer (nextSample()) does. With the ring full there is no room
+//for a new sample. If nextSample() has been called, its caller has let the ring fill, and they return the
+//newest reading at once. Otherwise nobody reads the ring, and new samples are read past it (readPastRing())
+bool MAX30105::checkLatest(void)
+{
+  if (available() < STORAGE_SIZE) return (safeCheck(250));
+  if (ringConsumed) return (true);
+
+  uint32_t markTime = millis();
+  while (millis() - markTime <= 250)
+  {
+    if (readPastRing() > 0) return (true);
+    delay(1);
+  }
+  return (false);
+}
+
+//Read every sample waiting in the sensor's FIFO without storing it in the ring, keeping the newest in latest
+//Returns the number of samples read
+uint16_t MAX30105::readPastRing(void)
+{
+  byte overflow;
+  int numberOfSamples = readFIFOCount(overflow);
+  if (numberOfSamples == 0) return (0);
+  almostFullSeen = false;
+
+  selectFIFOData();
+
+  int samplesLeft = numberOfSamples;
+  while (samplesLeft > 0)
+  {
+    int toGet = requestFIFOData(samplesLeft);
+
+    for (int i = 0; i < toGet; i++)
+    {
+      latest.red = readFIFOValue();
+      if (activeLEDs > 1) latest.IR = readFIFOValue();
+      if (activeLEDs > 2) latest.green = readFIFOValue();
+    }
+
+    samplesLeft -= toGet;
+  }
+
+  return (numberOfSamples);
 }
 
 //Check for new data but give up after a certain amount of time
@@ -43,12 +43,26 @@
 
 #endif
 
+//Depth of the sample ring check() drains the hardware FIFO into: a power of two, at most 128
+//check() never reads more samples than the ring has room for; the rest wait in the sensor's FIFO
+//Beyond 32 samples the ring also absorbs stalls of the reader longer than the hardware FIFO lasts
+#ifndef MAX30105_STORAGE_SIZE
+  #if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+    #define MAX30105_STORAGE_SIZE 4 //Each sample is 12 bytes so limit this to fit on your micro
+  #else
+    #define MAX30105_STORAGE_SIZE 64 //2.56 s at 25 samples per second
+  #endif
+#endif
+
 class MAX30105 {
  public: 
   MAX30105(void);
 
   boolean begin(TwoWire &wirePort = Wire, uint32_t i2cSpeed = I2C_SPEED_STANDARD, uint8_t i2caddr = MAX30105_ADDRESS);
 
+  //The latest-value getters wait for a new sample and return it; they never move the ring's tail
+  //Once nextSample() has been called, a full ring is left alone: they return its newest reading at once
+  //They poll the sensor (check()), so call them only from the thread that runs check()
   uint32_t getRed(void); //Returns immediate red value
   uint32_t getIR(void); //Returns immediate IR value
   uint32_t getGreen(void); //Returns immediate green value
@@ -99,6 +113,8 @@ class MAX30105 {
   void setFIFOAlmostFull(uint8_t samples);
   
   //FIFO Reading
+  //check() is the ring's only producer and available()/getFIFO*()/nextSample() its only consumer,
+  //so one thread (or an ISR) may call check() while another consumes without a lock
   uint16_t check(void); //Checks for new data and fills FIFO
   uint8_t available(void); //Tells caller how many new samples are available (head - tail)
   void nextSample(void); //Advances the tail of the sense array
@@ -109,6 +125,11 @@ class MAX30105 {
   uint8_t getWritePointer(void);
   uint8_t getReadPointer(void);
   void clearFIFO(void); //Sets the read/write pointers to zero
+  uint32_t getOverrunCount(void); //Samples the sensor's FIFO dropped before check() read them, since begin()
+
+  //Bulk FIFO read, bypassing the ring: returns the number of samples put in red[] and IR[]
+  uint8_t readFIFO(uint32_t *red, uint32_t *IR, uint8_t maxSamples = 32);
+  void setI2CBufferLength(uint16_t length); //Bytes one requestFrom() can return (default I2C_BUFFER_LENGTH)
 
   //Proximity Mode Interrupt Threshold
   void setPROXINTTHRESH(uint8_t val);
@@ -139,18 +160,45 @@ class MAX30105 {
 
   void readRevisionID();
 
+  uint16_t i2cBufferLength; //Largest FIFO_DATA block per requestFrom()
+  bool almostFullSeen; //A_FULL read from INT_STATUS_1 since the last FIFO read
+  uint8_t almostFullLevel; //FIFO samples at which A_FULL is raised (setFIFOAlmostFull())
+
+  bool ringConsumed; //nextSample() has been called: getRed()/getIR()/getGreen() do not read past a full ring
+  bool checkLatest(void);
+  uint16_t readPastRing(void);
+
+  int readFIFOCount(byte &overflow);
+  void selectFIFOData(void);
+  int requestFIFOData(int samplesLeft);
+  uint32_t readFIFOValue(void);
+
   void bitMask(uint8_t reg, uint8_t mask, uint8_t thing);
  
-   #define STORAGE_SIZE 4 //Each long is 4 bytes so limit this to fit on your micro
+#define STORAGE_SIZE MAX30105_STORAGE_SIZE
+  static_assert(STORAGE_SIZE > 0 && STORAGE_SIZE <= 128 && (STORAGE_SIZE & (STORAGE_SIZE - 1)) == 0,
+                "MAX30105_STORAGE_SIZE must be a power of two, at most 128");
+
+  //The channels of one reading sit together, so a consumer touches one place per sample
+  typedef struct Reading
+  {
+    uint32_t red;
+    uint32_t IR;
+    uint32_t green;
+  } sense_reading;
+
+  //Single-producer/single-consumer ring of readings from the sensor
+  //head and tail run freely (wrapping at 256) and are masked into the array; head - tail is the fill
+  //check() writes readings before it publishes head, nextSample() is done with one before it publishes tail
   typedef struct Record
   {
-    uint32_t red[STORAGE_SIZE];
-    uint32_t IR[STORAGE_SIZE];
-    uint32_t green[STORAGE_SIZE];
-    byte head;
-    byte tail;
+    sense_reading reading[STORAGE_SIZE];
+    byte head; //Readings written (check() only)
+    byte tail; //Readings consumed (nextSample() only)
   } sense_struct; //This is our circular buffer of readings from the sensor
 
   sense_struct sense;
+  sense_reading latest; //Newest reading, for getRed()/getIR()/getGreen() (check() or readPastRing())
+  uint32_t overruns; //Samples lost to FIFO rollover, from OVF_COUNTER (check() only)
 
 };
@@ -57,55 +57,57 @@
 
 #include "heartRate.h"
 
-int16_t IR_AC_Max = 20;
-int16_t IR_AC_Min = -20;
-
-int16_t IR_AC_Signal_Current = 0;
-int16_t IR_AC_Signal_Previous;
-int16_t IR_AC_Signal_min = 0;
-int16_t IR_AC_Signal_max = 0;
-int16_t IR_Average_Estimated;
-
-int16_t positiveEdge = 0;
-int16_t negativeEdge = 0;
-int32_t ir_avg_reg = 0;
-
-int16_t cbuf[32];
-uint8_t offset = 0;
+//  State used by the functions that take no context
+//  Every field is given, matching initHeartRateContext()
+static heartRateContext_t defaultContext = {
+  20, -20,          // IR_AC_Max, IR_AC_Min
+  0, 0, 0, 0, 0,    // IR_AC_Signal_Current, _Previous, _min, _max, IR_Average_Estimated
+  0, 0, 0,          // positiveEdge, negativeEdge, ir_avg_reg
+  {0}, 0            // cbuf, offset
+};
 
 static const uint16_t FIRCoeffs[12] = {172, 321, 579, 927, 1360, 1858, 2390, 2916, 3391, 3768, 4012, 4096};
 
+//  Reset a context to its power-up state
+void initHeartRateContext(heartRateContext_t *ctx)
+{
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->IR_AC_Max = 20;
+  ctx->IR_AC_Min = -20;
+}
+
 //  Heart Rate Monitor functions takes a sample value and the sample number
 //  Returns true if a beat is detected
+//  Detector state is kept in *ctx (one context per channel)
 //  A running average of four samples is recommended for display on the screen.
-bool checkForBeat(int32_t sample)
+bool checkForBeat(heartRateContext_t *ctx, int32_t sample)
 {
   bool beatDetected = false;
 
   //  Save current state
-  IR_AC_Signal_Previous = IR_AC_Signal_Current;
+  ctx->IR_AC_Signal_Previous = ctx->IR_AC_Signal_Current;
   
   //This is good to view for debugging
   //Serial.print("Signal_Current: ");
-  //Serial.println(IR_AC_Signal_Current);
+  //Serial.println(ctx->IR_AC_Signal_Current);
 
   //  Process next data sample
-  IR_Average_Estimated = averageDCEstimator(&ir_avg_reg, sample);
-  IR_AC_Signal_Current = lowPassFIRFilter(sample - IR_Average_Estimated);
+  ctx->IR_Average_Estimated = averageDCEstimator(&ctx->ir_avg_reg, sample);
+  ctx->IR_AC_Signal_Current = lowPassFIRFilter(ctx, sample - ctx->IR_Average_Estimated);
 
   //  Detect positive zero crossing (rising edge)
-  if ((IR_AC_Signal_Previous < 0) & (IR_AC_Signal_Current >= 0))
+  if ((ctx->IR_AC_Signal_Previous < 0) & (ctx->IR_AC_Signal_Current >= 0))
   {
   
-    IR_AC_Max = IR_AC_Signal_max; //Adjust our AC max and min
-    IR_AC_Min = IR_AC_Signal_min;
+    ctx->IR_AC_Max = ctx->IR_AC_Signal_max; //Adjust our AC max and min
+    ctx->IR_AC_Min = ctx->IR_AC_Signal_min;
 
-    positiveEdge = 1;
-    negativeEdge = 0;
-    IR_AC_Signal_max = 0;
+    ctx->positiveEdge = 1;
+    ctx->negativeEdge = 0;
+    ctx->IR_AC_Signal_max = 0;
 
-    //if ((IR_AC_Max - IR_AC_Min) > 100 & (IR_AC_Max - IR_AC_Min) < 1000)
-    if ((IR_AC_Max - IR_AC_Min) > 20 & (IR_AC_Max - IR_AC_Min) < 1000)
+    //if ((ctx->IR_AC_Max - ctx->IR_AC_Min) > 100 & (ctx->IR_AC_Max - ctx->IR_AC_Min) < 1000)
+    if (((ctx->IR_AC_Max - ctx->IR_AC_Min) > 20) & ((ctx->IR_AC_Max - ctx->IR_AC_Min) < 1000))
     {
       //Heart beat!!!
       beatDetected = true;
@@ -113,28 +115,34 @@ bool checkForBeat(int32_t sample)
   }
 
   //  Detect negative zero crossing (falling edge)
-  if ((IR_AC_Signal_Previous > 0) & (IR_AC_Signal_Current <= 0))
+  if ((ctx->IR_AC_Signal_Previous > 0) & (ctx->IR_AC_Signal_Current <= 0))
   {
-    positiveEdge = 0;
-    negativeEdge = 1;
-    IR_AC_Signal_min = 0;
+    ctx->positiveEdge = 0;
+    ctx->negativeEdge = 1;
+    ctx->IR_AC_Signal_min = 0;
   }
 
   //  Find Maximum value in positive cycle
-  if (positiveEdge & (IR_AC_Signal_Current > IR_AC_Signal_Previous))
+  if (ctx->positiveEdge & (ctx->IR_AC_Signal_Current > ctx->IR_AC_Signal_Previous))
   {
-    IR_AC_Signal_max = IR_AC_Signal_Current;
+    ctx->IR_AC_Signal_max = ctx->IR_AC_Signal_Current;
   }
 
   //  Find Minimum value in negative cycle
-  if (negativeEdge & (IR_AC_Signal_Current < IR_AC_Signal_Previous))
+  if (ctx->negativeEdge & (ctx->IR_AC_Signal_Current < ctx->IR_AC_Signal_Previous))
   {
-    IR_AC_Signal_min = IR_AC_Signal_Current;
+    ctx->IR_AC_Signal_min = ctx->IR_AC_Signal_Current;
   }
   
   return(beatDetected);
 }
 
+//  Same as above, using the default context
+bool checkForBeat(int32_t sample)
+{
+  return checkForBeat(&defaultContext, sample);
+}
+
 //  Average DC Estimator
 int16_t averageDCEstimator(int32_t *p, uint16_t x)
 {
@@ -143,23 +151,29 @@ int16_t averageDCEstimator(int32_t *p, uint16_t x)
 }
 
 //  Low Pass FIR Filter
-int16_t lowPassFIRFilter(int16_t din)
+int16_t lowPassFIRFilter(heartRateContext_t *ctx, int16_t din)
 {  
-  cbuf[offset] = din;
+  ctx->cbuf[ctx->offset] = din;
 
-  int32_t z = mul16(FIRCoeffs[11], cbuf[(offset - 11) & 0x1F]);
+  int32_t z = mul16(FIRCoeffs[11], ctx->cbuf[(ctx->offset - 11) & 0x1F]);
   
   for (uint8_t i = 0 ; i < 11 ; i++)
   {
-    z += mul16(FIRCoeffs[i], cbuf[(offset - i) & 0x1F] + cbuf[(offset - 22 + i) & 0x1F]);
+    z += mul16(FIRCoeffs[i], ctx->cbuf[(ctx->offset - i) & 0x1F] + ctx->cbuf[(ctx->offset - 22 + i) & 0x1F]);
   }
 
-  offset++;
-  offset %= 32; //Wrap condition
+  ctx->offset++;
+  ctx->offset %= 32; //Wrap condition
 
   return(z >> 15);
 }
 
+//  Same as above, using the default context
+int16_t lowPassFIRFilter(int16_t din)
+{
+  return lowPassFIRFilter(&defaultContext, din);
+}
+
 //  Integer multiplier
 int32_t mul16(int16_t x, int16_t y)
 {
@@ -55,13 +55,43 @@
 * 
 */
 
+#ifndef HEARTRATE_H_
+#define HEARTRATE_H_
+
 #if (ARDUINO >= 100)
  #include "Arduino.h"
 #else
  #include "WProgram.h"
 #endif
 
+//  Beat detector state for one signal channel.
+//  Run several channels at once by giving each its own context;
+//  the functions without a context share a single default one.
+typedef struct {
+  int16_t IR_AC_Max;
+  int16_t IR_AC_Min;
+
+  int16_t IR_AC_Signal_Current;
+  int16_t IR_AC_Signal_Previous;
+  int16_t IR_AC_Signal_min;
+  int16_t IR_AC_Signal_max;
+  int16_t IR_Average_Estimated;
+
+  int16_t positiveEdge;
+  int16_t negativeEdge;
+  int32_t ir_avg_reg;
+
+  int16_t cbuf[32];
+  uint8_t offset;
+} heartRateContext_t;
+
+void initHeartRateContext(heartRateContext_t *ctx);
+bool checkForBeat(heartRateContext_t *ctx, int32_t sample);
+int16_t lowPassFIRFilter(heartRateContext_t *ctx, int16_t din);
+
 bool checkForBeat(int32_t sample);
 int16_t averageDCEstimator(int32_t *p, uint16_t x);
 int16_t lowPassFIRFilter(int16_t din);
 int32_t mul16(int16_t x, int16_t y);
+
+#endif /* HEARTRATE_H_ */
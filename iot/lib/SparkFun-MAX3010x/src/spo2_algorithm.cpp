@@ -60,15 +60,11 @@
 #include "Arduino.h"
 #include "spo2_algorithm.h"
 
-#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
-//Arduino Uno doesn't have enough SRAM to store 100 samples of IR led data and red led data in 32-bit format
-//To solve this problem, 16-bit MSB of the sampled data will be truncated.  Samples become 16-bit data.
-void maxim_heart_rate_and_oxygen_saturation(uint16_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint16_t *pun_red_buffer, int32_t *pn_spo2, int8_t *pch_spo2_valid, 
-                int32_t *pn_heart_rate, int8_t *pch_hr_valid)
-#else
-void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer, int32_t *pn_spo2, int8_t *pch_spo2_valid, 
+// working memory for the functions that take no context
+static maxim_spo2_context_t s_default_context;
+
+void maxim_heart_rate_and_oxygen_saturation(spo2_sample_t *pun_ir_buffer, int32_t n_ir_buffer_length, spo2_sample_t *pun_red_buffer, int32_t *pn_spo2, int8_t *pch_spo2_valid, 
                 int32_t *pn_heart_rate, int8_t *pch_hr_valid)
-#endif
 /**
 * \brief        Calculate the heart rate and SpO2 level
 * \par          Details
@@ -77,7 +73,7 @@ void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_i
 *               Thus, accurate SPO2 is precalculated and save longo uch_spo2_table[] per each an_ratio.
 *
 * \param[in]    *pun_ir_buffer           - IR sensor data buffer
-* \param[in]    n_ir_buffer_length      - IR sensor data buffer length
+* \param[in]    n_ir_buffer_length      - IR sensor data buffer length (MA4_SIZE+1 to BUFFER_SIZE)
 * \param[in]    *pun_red_buffer          - Red sensor data buffer
 * \param[out]    *pn_spo2                - Calculated SpO2 value
 * \param[out]    *pch_spo2_valid         - 1 if the calculated SpO2 value is valid
@@ -87,49 +83,146 @@ void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_i
 * \retval       None
 */
 {
+  // a linear buffer is a ring that starts at index 0
+  maxim_heart_rate_and_oxygen_saturation_ring(pun_ir_buffer, pun_red_buffer, n_ir_buffer_length, 0, 
+                pn_spo2, pch_spo2_valid, pn_heart_rate, pch_hr_valid);
+}
+
+static inline int32_t maxim_ring_index(int32_t n_pos, int32_t n_ring_start, int32_t n_ring_size)
+/**
+* \brief        Map a window position to a ring buffer index
+*
+* \retval       Index of window sample n_pos (0 = oldest) in the ring buffer
+*/
+{
+  int32_t n_idx = n_pos + n_ring_start;
+  if (n_idx >= n_ring_size) n_idx -= n_ring_size;
+  return n_idx;
+}
+
+void maxim_heart_rate_and_oxygen_saturation_ring(spo2_sample_t *pun_ir_ring, spo2_sample_t *pun_red_ring, int32_t n_ring_size, int32_t n_ring_start, 
+                int32_t *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid)
+/**
+* \brief        Calculate the heart rate and SpO2 level from circular buffers
+* \par          Details
+*               Same algorithm as maxim_heart_rate_and_oxygen_saturation(), but the samples are read in place
+*               from the ring buffers, so the caller never has to shift or linearize its window.
+*               Raw red/IR values for the SPO2 stage are read straight from the rings instead of being copied again.
+*               The window is the whole ring: n_ring_size samples, more than MA4_SIZE and at most BUFFER_SIZE
+*               (the working memory). Any other size gives no result (both outputs invalid).
+*
+* \param[in]    *pun_ir_ring             - IR sensor data ring buffer
+* \param[in]    *pun_red_ring            - Red sensor data ring buffer
+* \param[in]    n_ring_size             - Number of samples in each ring (window length, MA4_SIZE+1 to BUFFER_SIZE)
+* \param[in]    n_ring_start            - Ring index of the oldest sample
+* \param[out]    *pn_spo2                - Calculated SpO2 value
+* \param[out]    *pch_spo2_valid         - 1 if the calculated SpO2 value is valid
+* \param[out]    *pn_heart_rate          - Calculated heart rate value
+* \param[out]    *pch_hr_valid           - 1 if the calculated heart rate value is valid
+*
+* \retval       None
+*/
+{
+  maxim_heart_rate_and_oxygen_saturation_ring_ctx(&s_default_context, pun_ir_ring, pun_red_ring, n_ring_size, n_ring_start, 
+                pn_spo2, pch_spo2_valid, pn_heart_rate, pch_hr_valid);
+}
+
+void maxim_heart_rate_and_oxygen_saturation_ring_ctx(maxim_spo2_context_t *p_ctx, spo2_sample_t *pun_ir_ring, spo2_sample_t *pun_red_ring, int32_t n_ring_size, int32_t n_ring_start, 
+                int32_t *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid)
+/**
+* \brief        Calculate the heart rate and SpO2 level from circular buffers using the caller's context
+* \par          Details
+*               Same as maxim_heart_rate_and_oxygen_saturation_ring(). All working memory is in *p_ctx,
+*               so independent channels can run at the same time, each with its own context.
+*
+* \param[in]    *p_ctx                   - Working memory for this channel
+* \param[in]    *pun_ir_ring             - IR sensor data ring buffer
+* \param[in]    *pun_red_ring            - Red sensor data ring buffer
+* \param[in]    n_ring_size             - Number of samples in each ring (window length, MA4_SIZE+1 to BUFFER_SIZE)
+* \param[in]    n_ring_start            - Ring index of the oldest sample
+* \param[out]    *pn_spo2                - Calculated SpO2 value
+* \param[out]    *pch_spo2_valid         - 1 if the calculated SpO2 value is valid
+* \param[out]    *pn_heart_rate          - Calculated heart rate value
+* \param[out]    *pch_hr_valid           - 1 if the calculated heart rate value is valid
+*
+* \retval       None
+*/
+{
+  int32_t *an_x = p_ctx->an_x; //ir
   uint32_t un_ir_mean;
-  int32_t k, n_i_ratio_count;
-  int32_t i, n_exact_ir_valley_locs_count, n_middle_idx;
+  int32_t k, n_idx;
   int32_t n_th1, n_npks;   
+  int32_t n_x0, n_x1, n_x2, n_x3;
   int32_t an_ir_valley_locs[15] ;
-  int32_t n_peak_interval_sum;
-  
-  int32_t n_y_ac, n_x_ac;
-  int32_t n_spo2_calc; 
-  int32_t n_y_dc_max, n_x_dc_max; 
-  int32_t n_y_dc_max_idx = 0;
-  int32_t n_x_dc_max_idx = 0; 
-  int32_t an_ratio[5], n_ratio_average; 
-  int32_t n_nume, n_denom ;
 
-  // calculates DC mean and subtract DC from ir
+  // the window must fit in p_ctx->an_x and be longer than the moving average
+  if (n_ring_size <= MA4_SIZE || n_ring_size > BUFFER_SIZE) {
+    *pn_spo2 = -999;
+    *pch_spo2_valid = 0;
+    *pn_heart_rate = -999;
+    *pch_hr_valid = 0;
+    return;
+  }
+
+  // calculates DC mean and subtract DC from ir (sum does not depend on ring order)
   un_ir_mean =0; 
-  for (k=0 ; k<n_ir_buffer_length ; k++ ) un_ir_mean += pun_ir_buffer[k] ;
-  un_ir_mean =un_ir_mean/n_ir_buffer_length ;
-    
-  // remove DC and invert signal so that we can use peak detector as valley detector
-  for (k=0 ; k<n_ir_buffer_length ; k++ )  
-    an_x[k] = -1*(pun_ir_buffer[k] - un_ir_mean) ; 
+  for (k=0 ; k<n_ring_size ; k++ ) un_ir_mean += pun_ir_ring[k] ;
+  un_ir_mean =un_ir_mean/n_ring_size ;
     
-  // 4 pt Moving Average
-  for(k=0; k< BUFFER_SIZE-MA4_SIZE; k++){
-    an_x[k]=( an_x[k]+an_x[k+1]+ an_x[k+2]+ an_x[k+3])/(int)4;        
+  // single pass : remove DC and invert signal so that we can use peak detector as valley detector,
+  // 4 pt Moving Average and threshold sum. The last 4 inverted samples are kept in registers
+  // (n_x3 oldest), so an_x[k-3] is averaged as soon as sample k is read.
+  n_idx = n_ring_start;
+  n_x1 = n_x2 = n_x3 = 0;
+  n_th1 = 0;
+  for (k=0 ; k<n_ring_size-1 ; k++ ) {   // averages end at an_x[n_ring_size-MA4_SIZE-1]
+    n_x0 = -1*(pun_ir_ring[n_idx] - un_ir_mean) ; 
+    if (++n_idx == n_ring_size) n_idx = 0;
+    if (k >= MA4_SIZE-1) {
+      an_x[k-3]=( n_x3+n_x2+ n_x1+ n_x0)/(int)4;
+      n_th1 += an_x[k-3];
+    }
+    n_x3 = n_x2; n_x2 = n_x1; n_x1 = n_x0;
   }
-  // calculate threshold  
-  n_th1=0; 
-  for ( k=0 ; k<BUFFER_SIZE ;k++){
-    n_th1 +=  an_x[k];
+  // the last MA4_SIZE samples are not averaged
+  n_idx = maxim_ring_index(n_ring_size-MA4_SIZE, n_ring_start, n_ring_size);
+  for (k=n_ring_size-MA4_SIZE ; k<n_ring_size ; k++ ) {
+    an_x[k] = -1*(pun_ir_ring[n_idx] - un_ir_mean) ; 
+    if (++n_idx == n_ring_size) n_idx = 0;
+    n_th1 += an_x[k];
   }
-  n_th1=  n_th1/ ( BUFFER_SIZE);
+  n_th1=  n_th1/ ( n_ring_size);
   if( n_th1<30) n_th1=30; // min allowed
   if( n_th1>60) n_th1=60; // max allowed
 
   for ( k=0 ; k<15;k++) an_ir_valley_locs[k]=0;
   // since we flipped signal, we use peak detector as valley detector
-  maxim_find_peaks( an_ir_valley_locs, &n_npks, an_x, BUFFER_SIZE, n_th1, 4, 15 );//peak_height, peak_distance, max_num_peaks 
+  maxim_find_peaks( an_ir_valley_locs, &n_npks, an_x, n_ring_size, n_th1, 4, 15 );//peak_height, peak_distance, max_num_peaks 
+  maxim_heart_rate_from_valleys(an_ir_valley_locs, n_npks, pn_heart_rate, pch_hr_valid);
+  maxim_oxygen_saturation_from_valleys(pun_ir_ring, pun_red_ring, n_ring_size, n_ring_start, an_ir_valley_locs, n_npks, pn_spo2, pch_spo2_valid);
+}
+
+
+void maxim_heart_rate_from_valleys(int32_t *pn_valley_locs, int32_t n_npks, int32_t *pn_heart_rate, int8_t *pch_hr_valid)
+/**
+* \brief        Calculate the heart rate from IR valley locations
+* \par          Details
+*               Heart rate is the average distance between consecutive valleys.
+*
+* \param[in]    *pn_valley_locs          - Valley locations in ascending order
+* \param[in]    n_npks                  - Number of valleys
+* \param[out]    *pn_heart_rate          - Calculated heart rate value
+* \param[out]    *pch_hr_valid           - 1 if the calculated heart rate value is valid
+*
+* \retval       None
+*/
+{
+  int32_t k;
+  int32_t n_peak_interval_sum;
+
   n_peak_interval_sum =0;
   if (n_npks>=2){
-    for (k=1; k<n_npks; k++) n_peak_interval_sum += (an_ir_valley_locs[k] -an_ir_valley_locs[k -1] ) ;
+    for (k=1; k<n_npks; k++) n_peak_interval_sum += (pn_valley_locs[k] -pn_valley_locs[k -1] ) ;
     n_peak_interval_sum =n_peak_interval_sum/(n_npks-1);
     *pn_heart_rate =(int32_t)( (FreqS*60)/ n_peak_interval_sum );
     *pch_hr_valid  = 1;
@@ -138,24 +231,45 @@ void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_i
     *pn_heart_rate = -999; // unable to calculate because # of peaks are too small
     *pch_hr_valid  = 0;
   }
+}
 
-  //  load raw value again for SPO2 calculation : RED(=y) and IR(=X)
-  for (k=0 ; k<n_ir_buffer_length ; k++ )  {
-      an_x[k] =  pun_ir_buffer[k] ; 
-      an_y[k] =  pun_red_buffer[k] ; 
-  }
 
-  // find precise min near an_ir_valley_locs
+void maxim_oxygen_saturation_from_valleys(spo2_sample_t *pun_ir_ring, spo2_sample_t *pun_red_ring, int32_t n_ring_size, int32_t n_ring_start, 
+                int32_t *pn_valley_locs, int32_t n_npks, int32_t *pn_spo2, int8_t *pch_spo2_valid)
+/**
+* \brief        Calculate the SpO2 level from IR valley locations
+* \par          Details
+*               Uses the ratio between the AC and DC components of the raw red and IR signals between
+*               consecutive valleys. Raw samples are read in place from the ring buffers.
+*
+* \param[in]    *pun_ir_ring             - IR sensor data ring buffer
+* \param[in]    *pun_red_ring            - Red sensor data ring buffer
+* \param[in]    n_ring_size             - Number of samples in each ring (window length)
+* \param[in]    n_ring_start            - Ring index of the oldest sample
+* \param[in]    *pn_valley_locs          - Valley locations (window positions) in ascending order
+* \param[in]    n_npks                  - Number of valleys
+* \param[out]    *pn_spo2                - Calculated SpO2 value
+* \param[out]    *pch_spo2_valid         - 1 if the calculated SpO2 value is valid
+*
+* \retval       None
+*/
+{
+  int32_t k, n_i_ratio_count;
+  int32_t n_exact_ir_valley_locs_count;
+  int32_t an_ratio[5];
+
+  //  raw values for SPO2 calculation are read from the rings : RED(=y) and IR(=X)
+
+  // find precise min near pn_valley_locs
   n_exact_ir_valley_locs_count =n_npks; 
   
   //using exact_ir_valley_locs , find ir-red DC andir-red AC for SPO2 calibration an_ratio
   //finding AC/DC maximum of raw
 
-  n_ratio_average =0; 
   n_i_ratio_count = 0; 
   for(k=0; k< 5; k++) an_ratio[k]=0;
   for (k=0; k< n_exact_ir_valley_locs_count; k++){
-    if (an_ir_valley_locs[k] > BUFFER_SIZE ){
+    if (pn_valley_locs[k] > n_ring_size ){
       *pn_spo2 =  -999 ; // do not use SPO2 since valley loc is out of range
       *pch_spo2_valid  = 0; 
       return;
@@ -163,37 +277,215 @@ void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_i
   }
   // find max between two valley locations 
   // and use an_ratio betwen AC compoent of Ir & Red and DC compoent of Ir & Red for SPO2 
-  for (k=0; k< n_exact_ir_valley_locs_count-1; k++){
-    n_y_dc_max= -16777216 ; 
-    n_x_dc_max= -16777216; 
-    if (an_ir_valley_locs[k+1]-an_ir_valley_locs[k] >3){
-        for (i=an_ir_valley_locs[k]; i< an_ir_valley_locs[k+1]; i++){
-          if (an_x[i]> n_x_dc_max) {n_x_dc_max =an_x[i]; n_x_dc_max_idx=i;}
-          if (an_y[i]> n_y_dc_max) {n_y_dc_max =an_y[i]; n_y_dc_max_idx=i;}
-      }
-      n_y_ac= (an_y[an_ir_valley_locs[k+1]] - an_y[an_ir_valley_locs[k] ] )*(n_y_dc_max_idx -an_ir_valley_locs[k]); //red
-      n_y_ac=  an_y[an_ir_valley_locs[k]] + n_y_ac/ (an_ir_valley_locs[k+1] - an_ir_valley_locs[k])  ; 
-      n_y_ac=  an_y[n_y_dc_max_idx] - n_y_ac;    // subracting linear DC compoenents from raw 
-      n_x_ac= (an_x[an_ir_valley_locs[k+1]] - an_x[an_ir_valley_locs[k] ] )*(n_x_dc_max_idx -an_ir_valley_locs[k]); // ir
-      n_x_ac=  an_x[an_ir_valley_locs[k]] + n_x_ac/ (an_ir_valley_locs[k+1] - an_ir_valley_locs[k]); 
-      n_x_ac=  an_x[n_y_dc_max_idx] - n_x_ac;      // subracting linear DC compoenents from raw 
-      n_nume=( n_y_ac *n_x_dc_max)>>7 ; //prepare X100 to preserve floating value
-      n_denom= ( n_x_ac *n_y_dc_max)>>7;
-      if (n_denom>0  && n_i_ratio_count <5 &&  n_nume != 0)
-      {   
-        an_ratio[n_i_ratio_count]= (n_nume*100)/n_denom ; //formular is ( n_y_ac *n_x_dc_max) / ( n_x_ac *n_y_dc_max) ;
-        n_i_ratio_count++;
-      }
+  for (k=0; k< n_exact_ir_valley_locs_count-1 && n_i_ratio_count <5; k++){
+    if (maxim_valley_pair_ratio(pun_ir_ring, pun_red_ring, n_ring_size, n_ring_start, 
+                                pn_valley_locs[k], pn_valley_locs[k+1], &an_ratio[n_i_ratio_count]))
+      n_i_ratio_count++;
+  }
+  maxim_oxygen_saturation_from_ratios(an_ratio, n_i_ratio_count, pn_spo2, pch_spo2_valid);
+}
+
+
+int8_t maxim_valley_pair_ratio(spo2_sample_t *pun_ir_ring, spo2_sample_t *pun_red_ring, int32_t n_ring_size, int32_t n_ring_start, 
+                int32_t n_lo_loc, int32_t n_hi_loc, int32_t *pn_ratio)
+/**
+* \brief        Calculate the red/IR AC-DC ratio of one pulse
+* \par          Details
+*               The pulse lies between the valleys at window positions n_lo_loc and n_hi_loc. The result
+*               depends only on the raw samples from n_lo_loc to n_hi_loc, so a caller that slides the
+*               window may keep it for as long as both valleys stay in the window.
+*               Runs the kernel SPO2_KERNEL selects.
+*
+* \param[in]    *pun_ir_ring             - IR sensor data ring buffer
+* \param[in]    *pun_red_ring            - Red sensor data ring buffer
+* \param[in]    n_ring_size             - Number of samples in each ring (window length)
+* \param[in]    n_ring_start            - Ring index of the oldest sample
+* \param[in]    n_lo_loc                - Window position of the first valley
+* \param[in]    n_hi_loc                - Window position of the next valley
+* \param[out]    *pn_ratio               - Ratio x100, set only when valid
+*
+* \retval       1 if the pulse gives a ratio, 0 if not
+*/
+{
+#if SPO2_KERNEL == SPO2_KERNEL_WIDE
+  return maxim_valley_pair_ratio_wide(pun_ir_ring, pun_red_ring, n_ring_size, n_ring_start, n_lo_loc, n_hi_loc, pn_ratio);
+#else
+  return maxim_valley_pair_ratio_scalar(pun_ir_ring, pun_red_ring, n_ring_size, n_ring_start, n_lo_loc, n_hi_loc, pn_ratio);
+#endif
+}
+
+
+int8_t maxim_valley_pair_ratio_scalar(spo2_sample_t *pun_ir_ring, spo2_sample_t *pun_red_ring, int32_t n_ring_size, int32_t n_ring_start, 
+                int32_t n_lo_loc, int32_t n_hi_loc, int32_t *pn_ratio)
+/**
+* \brief        Calculate the red/IR AC-DC ratio of one pulse (portable kernel)
+* \par          Details
+*               The original int32 arithmetic, bit-exact with it on any host. Where the AC x DC products
+*               or the ratio x100 exceed 32 bits they wrap.
+*
+* \param[in]    *pun_ir_ring             - IR sensor data ring buffer
+* \param[in]    *pun_red_ring            - Red sensor data ring buffer
+* \param[in]    n_ring_size             - Number of samples in each ring (window length)
+* \param[in]    n_ring_start            - Ring index of the oldest sample
+* \param[in]    n_lo_loc                - Window position of the first valley
+* \param[in]    n_hi_loc                - Window position of the next valley
+* \param[out]    *pn_ratio               - Ratio x100, set only when valid
+*
+* \retval       1 if the pulse gives a ratio, 0 if not
+*/
+{
+  int32_t i, n_idx, n_lo_idx, n_hi_idx, n_max_idx;
+  int32_t n_y_ac, n_x_ac;
+  int32_t n_y_dc_max, n_x_dc_max; 
+  int32_t n_y_dc_max_idx = 0;
+  int32_t n_x_dc_max_idx = 0; 
+  int32_t n_nume, n_denom ;
+
+  if (n_hi_loc-n_lo_loc <=3) return 0;
+  n_y_dc_max= -16777216 ; 
+  n_x_dc_max= -16777216; 
+  n_idx = maxim_ring_index(n_lo_loc, n_ring_start, n_ring_size);
+  for (i=n_lo_loc; i< n_hi_loc; i++){
+    if ((int32_t)pun_ir_ring[n_idx]> n_x_dc_max) {n_x_dc_max =pun_ir_ring[n_idx]; n_x_dc_max_idx=i;}
+    if ((int32_t)pun_red_ring[n_idx]> n_y_dc_max) {n_y_dc_max =pun_red_ring[n_idx]; n_y_dc_max_idx=i;}
+    if (++n_idx == n_ring_size) n_idx = 0;
+  }
+  n_lo_idx = maxim_ring_index(n_lo_loc, n_ring_start, n_ring_size);
+  n_hi_idx = maxim_ring_index(n_hi_loc, n_ring_start, n_ring_size);
+  n_max_idx = maxim_ring_index(n_y_dc_max_idx, n_ring_start, n_ring_size);
+  n_y_ac= ((int32_t)pun_red_ring[n_hi_idx] - (int32_t)pun_red_ring[n_lo_idx] )*(n_y_dc_max_idx -n_lo_loc); //red
+  n_y_ac=  (int32_t)pun_red_ring[n_lo_idx] + n_y_ac/ (n_hi_loc - n_lo_loc)  ; 
+  n_y_ac=  (int32_t)pun_red_ring[n_max_idx] - n_y_ac;    // subracting linear DC compoenents from raw 
+  n_x_ac= ((int32_t)pun_ir_ring[n_hi_idx] - (int32_t)pun_ir_ring[n_lo_idx] )*(n_x_dc_max_idx -n_lo_loc); // ir
+  n_x_ac=  (int32_t)pun_ir_ring[n_lo_idx] + n_x_ac/ (n_hi_loc - n_lo_loc); 
+  n_x_ac=  (int32_t)pun_ir_ring[n_max_idx] - n_x_ac;      // subracting linear DC compoenents from raw 
+  n_nume=( n_y_ac *n_x_dc_max)>>7 ; //prepare X100 to preserve floating value
+  n_denom= ( n_x_ac *n_y_dc_max)>>7;
+  if (n_denom>0 &&  n_nume != 0)
+  {   
+    *pn_ratio= (n_nume*100)/n_denom ; //formular is ( n_y_ac *n_x_dc_max) / ( n_x_ac *n_y_dc_max) ;
+    return 1;
+  }
+  return 0;
+}
+
+
+static inline int32_t maxim_divide_by_reciprocal(int32_t n_value, uint32_t un_reciprocal)
+/**
+* \brief        Divide by d, truncating toward zero, as a multiply by un_reciprocal = ceil(2^32 / d)
+* \par          Details
+*               Exact for |n_value| < 2^25 and d <= 128: the reciprocal's error adds less than 1/128 to
+*               the quotient. One UMULL on Cortex-M.
+*
+* \retval       n_value / d
+*/
+{
+  uint32_t un_magnitude = n_value < 0 ? -n_value : n_value;
+  int32_t n_quotient = (int32_t)(((uint64_t)un_magnitude * un_reciprocal) >> 32);
+  return n_value < 0 ? -n_quotient : n_quotient;
+}
+
+int8_t maxim_valley_pair_ratio_wide(spo2_sample_t *pun_ir_ring, spo2_sample_t *pun_red_ring, int32_t n_ring_size, int32_t n_ring_start, 
+                int32_t n_lo_loc, int32_t n_hi_loc, int32_t *pn_ratio)
+/**
+* \brief        Calculate the red/IR AC-DC ratio of one pulse (64-bit kernel)
+* \par          Details
+*               The same steps as maxim_valley_pair_ratio_scalar(), in plain C. The maxima are searched
+*               over the (at most two) linear runs of the ring, without a wrap test per sample. The two
+*               divisions by the valley distance are multiplies by its reciprocal, and the AC x DC
+*               products are 64-bit, so they do not wrap. The result is the scalar kernel's wherever that
+*               one's arithmetic fits in 32 bits.
+*
+* \param[in]    *pun_ir_ring             - IR sensor data ring buffer
+* \param[in]    *pun_red_ring            - Red sensor data ring buffer
+* \param[in]    n_ring_size             - Number of samples in each ring (window length, at most 128)
+* \param[in]    n_ring_start            - Ring index of the oldest sample
+* \param[in]    n_lo_loc                - Window position of the first valley
+* \param[in]    n_hi_loc                - Window position of the next valley
+* \param[out]    *pn_ratio               - Ratio x100 (saturated to int32), set only when valid
+*
+* \retval       1 if the pulse gives a ratio, 0 if not
+*/
+{
+  int32_t i, n_pos, n_run, n_idx, n_lo_idx, n_hi_idx, n_max_idx;
+  int32_t n_y_ac, n_x_ac;
+  int32_t n_y_dc_max, n_x_dc_max; 
+  int32_t n_y_dc_max_idx, n_x_dc_max_idx; 
+  int64_t ll_nume, ll_denom, ll_ratio;
+  uint32_t un_reciprocal;
+  spo2_sample_t *pun_ir, *pun_red;
+
+  if (n_hi_loc-n_lo_loc <=3) return 0;
+  n_lo_idx = maxim_ring_index(n_lo_loc, n_ring_start, n_ring_size);
+  n_hi_idx = maxim_ring_index(n_hi_loc, n_ring_start, n_ring_size);
+
+  // the first sample starts both maxima; later ones replace them only if higher (the first maximum wins)
+  n_x_dc_max = pun_ir_ring[n_lo_idx];
+  n_y_dc_max = pun_red_ring[n_lo_idx];
+  n_x_dc_max_idx = n_y_dc_max_idx = n_lo_loc;
+  n_pos = n_lo_loc + 1;
+  n_idx = n_lo_idx + 1;
+  while (n_pos < n_hi_loc) {
+    if (n_idx == n_ring_size) n_idx = 0;
+    n_run = min(n_hi_loc - n_pos, n_ring_size - n_idx);
+    pun_ir = pun_ir_ring + n_idx;
+    pun_red = pun_red_ring + n_idx;
+    for (i=0; i< n_run; i++){
+      if ((int32_t)pun_ir[i]> n_x_dc_max) {n_x_dc_max =pun_ir[i]; n_x_dc_max_idx=n_pos+i;}
+      if ((int32_t)pun_red[i]> n_y_dc_max) {n_y_dc_max =pun_red[i]; n_y_dc_max_idx=n_pos+i;}
+    }
+    n_pos += n_run;
+    n_idx += n_run;
+  }
+
+  // one division for both baselines
+  un_reciprocal = 0xFFFFFFFFu / (uint32_t)(n_hi_loc - n_lo_loc) + 1;
+  n_max_idx = maxim_ring_index(n_y_dc_max_idx, n_ring_start, n_ring_size);
+  n_y_ac= ((int32_t)pun_red_ring[n_hi_idx] - (int32_t)pun_red_ring[n_lo_idx] )*(n_y_dc_max_idx -n_lo_loc); //red
+  n_y_ac=  (int32_t)pun_red_ring[n_lo_idx] + maxim_divide_by_reciprocal(n_y_ac, un_reciprocal); 
+  n_y_ac=  (int32_t)pun_red_ring[n_max_idx] - n_y_ac;    // subracting linear DC compoenents from raw 
+  n_x_ac= ((int32_t)pun_ir_ring[n_hi_idx] - (int32_t)pun_ir_ring[n_lo_idx] )*(n_x_dc_max_idx -n_lo_loc); // ir
+  n_x_ac=  (int32_t)pun_ir_ring[n_lo_idx] + maxim_divide_by_reciprocal(n_x_ac, un_reciprocal); 
+  n_x_ac=  (int32_t)pun_ir_ring[n_max_idx] - n_x_ac;      // subracting linear DC compoenents from raw 
+  ll_nume= ((int64_t)n_y_ac *n_x_dc_max)>>7 ; //prepare X100 to preserve floating value
+  ll_denom= ((int64_t)n_x_ac *n_y_dc_max)>>7;
+  if (ll_denom>0 &&  ll_nume != 0)
+  {   
+    if (ll_nume > -(INT32_MAX/100) && ll_nume < INT32_MAX/100 && ll_denom <= INT32_MAX)
+      *pn_ratio= (int32_t)(ll_nume*100)/(int32_t)ll_denom ; // 32-bit division, as nearly always
+    else {
+      ll_ratio= (ll_nume*100)/ll_denom ;
+      *pn_ratio= ll_ratio > INT32_MAX ? INT32_MAX : ll_ratio < INT32_MIN ? INT32_MIN : (int32_t)ll_ratio ;
     }
+    return 1;
   }
+  return 0;
+}
+
+void maxim_oxygen_saturation_from_ratios(int32_t *pn_ratios, int32_t n_ratio_count, int32_t *pn_spo2, int8_t *pch_spo2_valid)
+/**
+* \brief        Calculate the SpO2 level from pulse ratios
+* \par          Details
+*               Takes the median of the ratios from maxim_valley_pair_ratio() and looks it up in uch_spo2_table.
+*
+* \param[in]    *pn_ratios               - Up to 5 ratios, in pulse order (sorted in place); unused entries 0
+* \param[in]    n_ratio_count           - Number of ratios
+* \param[out]    *pn_spo2                - Calculated SpO2 value
+* \param[out]    *pch_spo2_valid         - 1 if the calculated SpO2 value is valid
+*
+* \retval       None
+*/
+{
+  int32_t n_middle_idx, n_ratio_average, n_spo2_calc;
+
   // choose median value since PPG signal may varies from beat to beat
-  maxim_sort_ascend(an_ratio, n_i_ratio_count);
-  n_middle_idx= n_i_ratio_count/2;
+  maxim_sort_ascend(pn_ratios, n_ratio_count);
+  n_middle_idx= n_ratio_count/2;
 
   if (n_middle_idx >1)
-    n_ratio_average =( an_ratio[n_middle_idx-1] +an_ratio[n_middle_idx])/2; // use median
+    n_ratio_average =( pn_ratios[n_middle_idx-1] +pn_ratios[n_middle_idx])/2; // use median
   else
-    n_ratio_average = an_ratio[n_middle_idx ];
+    n_ratio_average = pn_ratios[n_middle_idx ];
 
   if( n_ratio_average>2 && n_ratio_average <184){
     n_spo2_calc= uch_spo2_table[n_ratio_average] ;
@@ -238,7 +530,8 @@ void maxim_peaks_above_min_height( int32_t *pn_locs, int32_t *n_npks,  int32_t
       n_width = 1;
       while (i+n_width < n_size && pn_x[i] == pn_x[i+n_width])  // find flat peaks
         n_width++;
-      if (pn_x[i] > pn_x[i+n_width] && (*n_npks) < 15 ){      // find right edge of peaks
+      // a flat run that reaches the end of the buffer has no right edge (do not read past pn_x[n_size-1])
+      if (i+n_width < n_size && pn_x[i] > pn_x[i+n_width] && (*n_npks) < 15 ){      // find right edge of peaks
         pn_locs[(*n_npks)++] = i;    
         // for flat peaks, peak location is left edge
         i += n_width+1;
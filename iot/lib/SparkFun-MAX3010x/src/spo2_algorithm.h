@@ -80,18 +80,50 @@ const uint8_t uch_spo2_table[184]={ 95, 95, 95, 96, 96, 96, 97, 97, 97, 97, 97,
               49, 48, 47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 31, 30, 29, 
               28, 27, 26, 25, 23, 22, 21, 20, 19, 17, 16, 15, 14, 12, 11, 10, 9, 7, 6, 5, 
               3, 2, 1 } ;
-static  int32_t an_x[ BUFFER_SIZE]; //ir
-static  int32_t an_y[ BUFFER_SIZE]; //red
 
 
+//SPO2 pulse ratio kernel (see maxim_valley_pair_ratio_wide()); SCALAR unless set on the compiler command line
+#define SPO2_KERNEL_SCALAR 0
+#define SPO2_KERNEL_WIDE 1
+#ifndef SPO2_KERNEL
+#define SPO2_KERNEL SPO2_KERNEL_SCALAR
+#endif
+
 #if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
 //Arduino Uno doesn't have enough SRAM to store 100 samples of IR led data and red led data in 32-bit format
 //To solve this problem, 16-bit MSB of the sampled data will be truncated.  Samples become 16-bit data.
-void maxim_heart_rate_and_oxygen_saturation(uint16_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint16_t *pun_red_buffer, int32_t *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid);
+typedef uint16_t spo2_sample_t;
 #else
-void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer, int32_t *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid);
+typedef uint32_t spo2_sample_t;
 #endif
 
+//Working memory for one signal pipeline. Each concurrent caller (sensor, replay, worker thread) uses its own context;
+//the functions without a context share a single default one and are not reentrant.
+typedef struct {
+  int32_t an_x[ BUFFER_SIZE]; //ir
+} maxim_spo2_context_t;
+
+void maxim_heart_rate_and_oxygen_saturation(spo2_sample_t *pun_ir_buffer, int32_t n_ir_buffer_length, spo2_sample_t *pun_red_buffer, int32_t *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid);
+
+//Same as above, but reads the samples in place from circular buffers of n_ring_size entries.
+//The oldest sample is at n_ring_start; the window wraps at the end of the buffers. The window is the whole ring, of
+//MA4_SIZE+1 to BUFFER_SIZE samples; other sizes give no result (both outputs invalid).
+void maxim_heart_rate_and_oxygen_saturation_ring(spo2_sample_t *pun_ir_ring, spo2_sample_t *pun_red_ring, int32_t n_ring_size, int32_t n_ring_start, int32_t *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid);
+//Reentrant form of the ring function: all working memory is in *p_ctx
+void maxim_heart_rate_and_oxygen_saturation_ring_ctx(maxim_spo2_context_t *p_ctx, spo2_sample_t *pun_ir_ring, spo2_sample_t *pun_red_ring, int32_t n_ring_size, int32_t n_ring_start, int32_t *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid);
+
+//Stages shared by the functions above and by streaming callers that locate the IR valleys themselves
+void maxim_heart_rate_from_valleys(int32_t *pn_valley_locs, int32_t n_npks, int32_t *pn_heart_rate, int8_t *pch_hr_valid);
+void maxim_oxygen_saturation_from_valleys(spo2_sample_t *pun_ir_ring, spo2_sample_t *pun_red_ring, int32_t n_ring_size, int32_t n_ring_start, int32_t *pn_valley_locs, int32_t n_npks, int32_t *pn_spo2, int8_t *pch_spo2_valid);
+
+//Pieces of the SPO2 stage: the ratio of one pulse between two valleys (1 if there is one), and the SpO2 from up to 5 ratios
+int8_t maxim_valley_pair_ratio(spo2_sample_t *pun_ir_ring, spo2_sample_t *pun_red_ring, int32_t n_ring_size, int32_t n_ring_start, int32_t n_lo_loc, int32_t n_hi_loc, int32_t *pn_ratio);
+//Pulse ratio kernels: both are always built, and SPO2_KERNEL picks the one maxim_valley_pair_ratio() (and so every
+//function above) runs. SCALAR is the original int32 arithmetic, bit-exact on any host. WIDE takes the AC x DC products
+//in 64 bits and divides once per pulse; it differs only where the scalar's 32-bit arithmetic wraps.
+int8_t maxim_valley_pair_ratio_scalar(spo2_sample_t *pun_ir_ring, spo2_sample_t *pun_red_ring, int32_t n_ring_size, int32_t n_ring_start, int32_t n_lo_loc, int32_t n_hi_loc, int32_t *pn_ratio);
+int8_t maxim_valley_pair_ratio_wide(spo2_sample_t *pun_ir_ring, spo2_sample_t *pun_red_ring, int32_t n_ring_size, int32_t n_ring_start, int32_t n_lo_loc, int32_t n_hi_loc, int32_t *pn_ratio);
+void maxim_oxygen_saturation_from_ratios(int32_t *pn_ratios, int32_t n_ratio_count, int32_t *pn_spo2, int8_t *pch_spo2_valid);
 void maxim_find_peaks(int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height, int32_t n_min_distance, int32_t n_max_num);
 void maxim_peaks_above_min_height(int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height);
 void maxim_remove_close_peaks(int32_t *pn_locs, int32_t *pn_npks, int32_t *pn_x, int32_t n_min_distance);
@@ -80,6 +80,66 @@
 #define MAX30102_SDA D0          // I2C Data line
 #define MAX30102_SCL D1          // I2C Clock line
 #define STATUS_LED D7            // Onboard status LED (if used)
+#define MAX30102_INT D2          // Sensor interrupt line (active low, open drain)
+
+// ============================================================================
+// SENSOR ACQUISITION CONFIGURATION
+// ============================================================================
+// 
+// How samples are pulled from the MAX30102 FIFO.
+// With the interrupt enabled, the sensor raises MAX30102_INT once the FIFO is
+// almost full and the whole FIFO is drained in one I2C burst. Otherwise the
+// FIFO is polled (without waiting) on every loop iteration. The Wire buffer
+// is enlarged (acquireWireBuffer) so that burst is a single transfer.
+// USE_SENSOR_INTERRUPT can also be set from the compiler command line
+// (tools/drain-bench is built both ways).
+//
+#ifndef USE_SENSOR_INTERRUPT
+#define USE_SENSOR_INTERRUPT true  // true = A_FULL interrupt, false = poll each loop
+#endif
+#define SENSOR_FIFO_ALMOST_FULL 0x0F // A_FULL trigger: 0x00 = 32 samples, 0x0F = 17 samples
+#define SENSOR_FIFO_WATERMARK (32 - SENSOR_FIFO_ALMOST_FULL) // Samples queued at A_FULL
+#define SENSOR_SAMPLE_PERIOD 40    // ms per FIFO sample (100 sps averaged by 4, see SensorManager::begin)
+#define SENSOR_I2C_BUFFER_SIZE 192 // Wire receive buffer: a full FIFO of Red+IR (32 x 6 bytes) per transfer
+
+// ============================================================================
+// SPO2 WINDOW CONFIGURATION
+// ============================================================================
+// 
+// Sliding window fed to the SpO2 algorithm.
+// A new reading is calculated every SPO2_HOP_SIZE samples over the most
+// recent SPO2_WINDOW_SIZE samples. The Maxim algorithm expects a
+// 100-sample (4 second) window at 25 samples per second.
+//
+#define SPO2_WINDOW_SIZE 100       // Samples per window (at most BUFFER_SIZE)
+#define SPO2_HOP_SIZE 25           // New samples between calculations
+
+// ============================================================================
+// MEASUREMENT ENCODING CONFIGURATION
+// ============================================================================
+//
+// Format used to upload measurements.
+// Compact mode sends a 9-byte binary record (12 chars as base64, see
+// measurement_record.h) instead of a JSON document. In webhook mode the
+// event is 'heartrate-record' and carries only the record; the webhook adds
+// the device ID and API key (see WEBHOOK_SETUP.md).
+//
+#define COMPACT_MEASUREMENTS true  // true = binary record, false = JSON fields
+
+// ============================================================================
+// RAW WAVEFORM STREAMING CONFIGURATION
+// ============================================================================
+//
+// Upload the raw red/IR trace of each measurement along with the result,
+// so it can be reviewed and re-analysed on the server.
+// Samples are delta-encoded in 1-second blocks (at most 18 bits per sample).
+// Webhook mode publishes 'heartrate-waveform' events in chunks that fit the
+// 1024-byte publish limit; HTTP mode sends one POST /api/measurements/waveform.
+//
+#define STREAM_RAW_WAVEFORM false  // true = upload the raw trace with each measurement
+#define WAVEFORM_BLOCK_SAMPLES SPO2_HOP_SIZE // Samples per encoded block (max 255)
+#define WAVEFORM_MAX_BLOCKS 30     // Most recent blocks kept (30 s at 25 samples/s)
+#define WAVEFORM_CHUNK_BYTES 540   // Encoded bytes per publish (720 chars as base64)
 
 // ============================================================================
 // MEASUREMENT TIMING CONFIGURATION
@@ -128,6 +188,23 @@
 #define MAX_NETWORK_RETRY 3              // Retry count for failed transmissions
 #define CONFIG_FETCH_INTERVAL_MS 3600000 // Fetch config from server: every hour
 
+// Direct HTTP mode keeps one connection open between requests (HTTP/1.1
+// keep-alive). It is reopened after HTTP_KEEPALIVE_IDLE_MS idle, just below
+// the API server's 5 second keep-alive timeout.
+#define HTTP_RESPONSE_TIMEOUT_MS 5000    // Wait for an HTTP response: 5 seconds
+#define HTTP_KEEPALIVE_IDLE_MS 4000      // Reopen connections idle longer than this
+#define HTTP_MAX_PIPELINE 8              // Requests sent before reading responses
+
+// Network requests are queued and driven from NetworkManager::update(), so
+// loop() never waits for the network. Webhook publishes are paced by a token
+// bucket: PUBLISH_BURST may go out back to back, then one per
+// PUBLISH_INTERVAL_MS (Particle Cloud allows about 1 publish/second, with
+// short bursts).
+#define NETWORK_QUEUE_SIZE 12            // Requests queued or in flight
+#define NETWORK_RETRY_DELAY_MS 1000      // Wait before retrying a failed measurement upload
+#define PUBLISH_INTERVAL_MS 1100         // One publish token refilled per interval
+#define PUBLISH_BURST 4                  // Most tokens held (publishes in a burst)
+
 // ============================================================================
 // LED PATTERN TIMING
 // ============================================================================
@@ -137,15 +214,83 @@
 #define LED_BLINK_SLOW 1000        // Slow blink interval (ms) - waiting for user
 #define LED_BLINK_FAST 250         // Fast blink interval (ms) - errors
 #define LED_FLASH_DURATION 200     // Single flash duration (ms) - success/warning
+#define LED_PULSE_PERIOD 1000      // Pulse fade up and back down (ms) - stabilizing
+#define LED_FRAME_INTERVAL 10      // Refresh interval while pulsing or fading (ms)
+
+// Flashes and other effects are queued and played from update() over the
+// current pattern, which returns when they end. A full queue refuses new
+// effects.
+#define LED_EFFECT_QUEUE_SIZE 4    // Effects playing or waiting
+#define LED_EFFECT_MAX_STEPS 8     // Steps in one effect (a blink of 4 is 8 steps)
+
+// ============================================================================
+// TASK SCHEDULER
+// ============================================================================
+//
+// loop() runs a module only when it has work. Each module reports the
+// millis() of its next deadline (getNextUpdate()); the modules that are due
+// run, then the loop sleeps until the earliest deadline. Work that comes
+// while it sleeps - the sensor interrupt, the network thread's results
+// (THREADED_MODE) - ends the sleep through TaskScheduler::wake(). Cloud
+// events are handled by Particle.process() after each pass, so a pass never
+// sleeps longer than SCHEDULER_MAX_SLEEP.
+//
+#define SCHEDULER_MAX_SLEEP 100       // Longest sleep in one pass, bounding the wait for cloud events (ms)
+#define SCHEDULER_POLL_INTERVAL 10    // Pass interval while waiting on I/O (HTTP, publishes)
+#define SCHEDULER_IDLE_WAKEUP 60000   // Deadline reported by a module with nothing scheduled (ms ahead)
+
+// ============================================================================
+// THREADED MODE
+// ============================================================================
+//
+// With THREADED_MODE, sensor acquisition and network I/O leave the main
+// (application) thread:
+//   - an acquisition thread, above the application thread's priority,
+//     drains the MAX30102 FIFO into the driver's lock-free sample ring
+//     (MAX30105_STORAGE_SIZE in MAX30105.h: 64 samples, 2.56 s)
+//   - a network thread runs NetworkManager, taking measurements and
+//     timeouts from a command queue and returning results (state changes,
+//     LED flashes, config) through an event queue
+// The state machine, sample processing and LED stay on the main thread.
+// Off by default; can also be set from the compiler command line
+// (-DTHREADED_MODE=true, as tools/thread-stress does).
+//
+#ifndef THREADED_MODE
+#define THREADED_MODE false
+#endif
+#define ACQUISITION_THREAD_PRIORITY 4      // Application thread is 2 (OS_THREAD_PRIORITY_DEFAULT)
+#define ACQUISITION_THREAD_STACK 2048      // Bytes
+#define NETWORK_THREAD_PRIORITY 2          // Same as the application thread
+#define NETWORK_THREAD_STACK 6144          // Bytes (payloads are built on the manager, not the stack)
+#define NETWORK_COMMAND_QUEUE_SIZE 4       // Measurements/timeouts to the network thread (power of two)
+#define NETWORK_EVENT_QUEUE_SIZE 8         // Results back to the main thread (power of two)
+#define NETWORK_THREAD_MAX_SLEEP 50        // Network thread checks for new commands at least this often (ms)
 
 // ============================================================================
 // OFFLINE STORAGE CONFIGURATION
 // ============================================================================
 // 
-// EEPROM-based storage for measurements when offline.
-// Stored measurements are automatically synced when connectivity is restored.
+// Measurements and timeout notifications are appended to a record log when
+// offline, and synced automatically when connectivity is restored. The log
+// is split into segments that are erased in turn; when all are in use, the
+// oldest is erased and any unsynced records in it are lost.
 //
-#define MAX_STORED_MEASUREMENTS 48 // Max offline storage (24h at 30-min intervals)
+// The log is kept in files on the LittleFS flash file system, or in EEPROM.
+// Measurements are stored in delta-coded blocks of MEASUREMENT_BLOCK_SIZE
+// (measurement_block.h), about 3.2 bytes each: the flash log holds over
+// 60,000 (six years of 30-min prompts), the EEPROM log about 750 (four weeks).
+//
+#define OFFLINE_LOG_ON_FLASH true        // true = flash file system, false = EEPROM
+#define FLASH_LOG_DIR "/usr/offline"     // Flash: directory of the segment files
+#define FLASH_LOG_SEGMENT_SIZE 4096      // Flash: bytes per segment file
+#define FLASH_LOG_SEGMENTS 64            // Flash: segment files (256 KB)
+#define EEPROM_LOG_SEGMENT_SIZE 256      // EEPROM: bytes per segment (erased as a unit)
+#define EEPROM_LOG_SEGMENTS 14           // EEPROM: segments (3584 bytes)
+#define MEASUREMENT_BLOCK_SIZE 32        // Stored measurements per block (max 255)
+
+// With COMPACT_MEASUREMENTS the backlog is uploaded as batches of whole
+// blocks, one publish or POST /api/measurements/batch per batch.
+#define SYNC_BATCH_SIZE 96         // Stored measurements per upload
 
 // ============================================================================
 // EEPROM ADDRESS LAYOUT
@@ -155,7 +300,9 @@
 //
 #define EEPROM_CONFIG_ADDR 0              // Config storage start address
 #define EEPROM_CONFIG_VALID_MARKER 0xABCD // Marker for valid config
-#define EEPROM_MEASUREMENTS_ADDR 64       // Measurement storage start address
+#define EEPROM_LOG_ADDR 64                // Offline record log start address (3584 bytes)
+#define EEPROM_LOG_CURSOR_ADDR 3648       // Offline log head/tail cursors (13 bytes)
+#define EEPROM_LOG_STAGE_ADDR 3664        // Offline log staging slots (2 x 148 bytes)
 
 // ============================================================================
 // DEBUG MODE
@@ -166,4 +313,14 @@
 //
 #define DEBUG_MODE true
 
+// Print heap statistics (free, largest free block, high-water mark) each
+// time a measurement cycle returns to IDLE. tools/heap-check counts the
+// firmware's allocations per cycle on a host.
+#define HEAP_REPORT false
+
+// Print each scheduler task's run count, latency (how long after its
+// deadline it ran) and jitter each time a measurement cycle returns to IDLE.
+// tools/sched-sim reports the same on a host.
+#define SCHEDULER_REPORT false
+
 #endif // CONFIG_H
@@ -0,0 +1,354 @@
+/*
+ * config_parser.cpp - Streaming JSON Parser for Config Responses
+ *
+ * A byte-at-a-time JSON tokenizer with a fixed footprint: the nesting is
+ * a bit per level, strings keep at most CONFIG_TOKEN_SIZE bytes (enough for
+ * the keys and times of interest) and numbers are validated and converted
+ * as their digits arrive. See config_parser.h for the settings extracted.
+ */
+
+#include "config_parser.h"
+
+ConfigParser::ConfigParser() {
+    begin();
+}
+
+void ConfigParser::begin() {
+    state = TOKEN_VALUE;
+    depth = 0;
+    arrays = 0;
+    readingKey = false;
+    field = FIELD_NONE;
+    tokenLength = 0;
+    tokenOverflow = false;
+    literal = nullptr;
+    unicodeDigits = 0;
+    numberPart = NUMBER_INTEGER;
+    numberValue = 0;
+    frequencyFound = false;
+    frequency = 0;
+    startTime[0] = '\0';
+    endTime[0] = '\0';
+}
+
+void ConfigParser::feed(const char *data) {
+    while (*data) feed(*data++);
+}
+
+void ConfigParser::feed(char c) {
+    switch (state) {
+        case TOKEN_STRING:
+            if (c == '"') {
+                endString();
+            } else if (c == '\\') {
+                state = TOKEN_ESCAPE;
+            } else if ((unsigned char)c < 0x20) {
+                state = TOKEN_ERROR;    // Control characters must be escaped
+            } else {
+                appendToken(c);
+            }
+            return;
+    
+        case TOKEN_ESCAPE:
+            // Escaped strings never match a key or a time: mark the token unusable
+            tokenOverflow = true;
+            if (c == 'u') {
+                unicodeDigits = 4;
+                state = TOKEN_UNICODE;
+            } else if (c != '\0' && strchr("\"\\/bfnrt", c) != nullptr) {
+                state = TOKEN_STRING;
+            } else {
+                state = TOKEN_ERROR;
+            }
+            return;
+    
+        case TOKEN_UNICODE:
+            if (!isxdigit((unsigned char)c)) {
+                state = TOKEN_ERROR;
+            } else if (--unicodeDigits == 0) {
+                state = TOKEN_STRING;
+            }
+            return;
+    
+        case TOKEN_NUMBER:
+            if (feedNumber(c)) return;
+            if (state == TOKEN_ERROR) return;
+            // The number ended at c: handle c after it
+            break;
+    
+        case TOKEN_LITERAL:
+            if (c != literal[tokenLength]) {
+                state = TOKEN_ERROR;
+            } else if (literal[++tokenLength] == '\0') {
+                endValue();
+            }
+            return;
+    
+        case TOKEN_ERROR:
+            return;
+    
+        default:
+            break;
+    }
+    
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') return;
+    
+    switch (state) {
+        case TOKEN_VALUE:
+            startValue(c);
+            break;
+    
+        case TOKEN_VALUE_OR_END:
+            if (c == ']') {
+                pop(true);
+            } else {
+                startValue(c);
+            }
+            break;
+    
+        case TOKEN_KEY_OR_END:
+            if (c == '}') {
+                pop(false);
+                break;
+            }
+            // Fall through - a key
+        case TOKEN_KEY:
+            if (c == '"') {
+                readingKey = true;
+                tokenLength = 0;
+                tokenOverflow = false;
+                state = TOKEN_STRING;
+            } else {
+                state = TOKEN_ERROR;
+            }
+            break;
+    
+        case TOKEN_COLON:
+            state = (c == ':') ? TOKEN_VALUE : TOKEN_ERROR;
+            break;
+    
+        case TOKEN_AFTER_VALUE: {
+            bool inArray = arrays & (1UL << (depth - 1));
+            if (c == ',') {
+                state = inArray ? TOKEN_VALUE : TOKEN_KEY;
+            } else if (c == '}' || c == ']') {
+                pop(c == ']');
+            } else {
+                state = TOKEN_ERROR;
+            }
+            break;
+        }
+    
+        default:
+            // TOKEN_DONE: only whitespace may follow the value
+            state = TOKEN_ERROR;
+            break;
+    }
+}
+
+bool ConfigParser::isComplete() {
+    return state == TOKEN_DONE;
+}
+
+bool ConfigParser::hasError() {
+    return state == TOKEN_ERROR;
+}
+
+bool ConfigParser::hasValues() {
+    return isComplete() && (frequency > 0 || startTime[0] != '\0' || endTime[0] != '\0');
+}
+
+int ConfigParser::getFrequency() {
+    return isComplete() ? frequency : 0;
+}
+
+const char* ConfigParser::getStartTime() {
+    return isComplete() ? startTime : "";
+}
+
+const char* ConfigParser::getEndTime() {
+    return isComplete() ? endTime : "";
+}
+
+/*
+ * First byte of a value. The setting named by its key only applies to a
+ * string or number; nested keys name their own.
+ */
+void ConfigParser::startValue(char c) {
+    if (c == '{' || c == '[') {
+        field = FIELD_NONE;
+        push(c == '[');
+    } else if (c == '"') {
+        readingKey = false;
+        tokenLength = 0;
+        tokenOverflow = false;
+        state = TOKEN_STRING;
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+        numberPart = (c == '-') ? NUMBER_SIGN : (c == '0') ? NUMBER_ZERO : NUMBER_INTEGER;
+        numberValue = (c == '-') ? -1 : c - '0';
+        state = TOKEN_NUMBER;
+    } else if (c == 't' || c == 'f' || c == 'n') {
+        literal = (c == 't') ? "true" : (c == 'f') ? "false" : "null";
+        tokenLength = 1;
+        state = TOKEN_LITERAL;
+    } else {
+        state = TOKEN_ERROR;
+    }
+}
+
+/*
+ * Next byte of a number: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+ * Returns true if c belongs to the number. Otherwise the number is ended
+ * (or, if it cannot end here, the response is invalid).
+ */
+bool ConfigParser::feedNumber(char c) {
+    bool digit = c >= '0' && c <= '9';
+    
+    switch (numberPart) {
+        case NUMBER_SIGN:
+            if (!digit) break;
+            numberPart = (c == '0') ? NUMBER_ZERO : NUMBER_INTEGER;
+            return true;
+    
+        case NUMBER_ZERO:
+        case NUMBER_INTEGER:
+            if (digit && numberPart == NUMBER_INTEGER) {
+                if (numberValue >= 0) {
+                    numberValue = numberValue * 10 + (c - '0');
+                    if (numberValue > CONFIG_FREQUENCY_MAX) numberValue = CONFIG_FREQUENCY_MAX;
+                }
+                return true;
+            }
+            if (digit) break;           // Leading zero
+            if (c == '.' || c == 'e' || c == 'E') {
+                numberPart = (c == '.') ? NUMBER_POINT : NUMBER_E;
+                numberValue = -1;
+                return true;
+            }
+            endNumber();
+            return false;
+    
+        case NUMBER_POINT:
+            if (!digit) break;
+            numberPart = NUMBER_FRACTION;
+            return true;
+    
+        case NUMBER_FRACTION:
+            if (digit) return true;
+            if (c == 'e' || c == 'E') {
+                numberPart = NUMBER_E;
+                return true;
+            }
+            endNumber();
+            return false;
+    
+        case NUMBER_E:
+            if (c == '+' || c == '-') {
+                numberPart = NUMBER_EXPONENT_SIGN;
+                return true;
+            }
+            // Fall through - a digit must follow
+        case NUMBER_EXPONENT_SIGN:
+            if (!digit) break;
+            numberPart = NUMBER_EXPONENT;
+            return true;
+    
+        case NUMBER_EXPONENT:
+            if (digit) return true;
+            endNumber();
+            return false;
+    }
+    
+    state = TOKEN_ERROR;
+    return false;
+}
+
+/*
+ * A number ended. Only a plain non-negative integer sets the frequency.
+ */
+void ConfigParser::endNumber() {
+    if (field == FIELD_FREQUENCY && numberValue >= 0 && !frequencyFound) {
+        frequency = numberValue;
+        frequencyFound = true;
+    }
+    endValue();
+}
+
+/*
+ * A string ended: a key selects the setting for its value, and a value is
+ * kept if its key named a time setting not yet found.
+ */
+void ConfigParser::endString() {
+    token[tokenLength] = '\0';
+    
+    if (readingKey) {
+        readingKey = false;
+        field = FIELD_NONE;
+        if (!tokenOverflow) {
+            if (strcmp(token, "measurementFrequency") == 0 || strcmp(token, "f") == 0) {
+                field = FIELD_FREQUENCY;
+            } else if (strcmp(token, "activeStartTime") == 0 || strcmp(token, "s") == 0) {
+                field = FIELD_START_TIME;
+            } else if (strcmp(token, "activeEndTime") == 0 || strcmp(token, "e") == 0) {
+                field = FIELD_END_TIME;
+            }
+        }
+        state = TOKEN_COLON;
+        return;
+    }
+    
+    char *time = (field == FIELD_START_TIME) ? startTime : (field == FIELD_END_TIME) ? endTime : nullptr;
+    if (time != nullptr && time[0] == '\0' && !tokenOverflow && tokenLength < CONFIG_TIME_SIZE) {
+        memcpy(time, token, tokenLength + 1);
+    }
+    endValue();
+}
+
+/*
+ * A value (of any type) ended.
+ */
+void ConfigParser::endValue() {
+    field = FIELD_NONE;
+    state = (depth == 0) ? TOKEN_DONE : TOKEN_AFTER_VALUE;
+}
+
+/*
+ * Open an object or array.
+ */
+void ConfigParser::push(bool array) {
+    if (depth >= CONFIG_PARSER_MAX_DEPTH) {
+        state = TOKEN_ERROR;
+        return;
+    }
+    if (array) {
+        arrays |= 1UL << depth;
+    } else {
+        arrays &= ~(1UL << depth);
+    }
+    depth++;
+    state = array ? TOKEN_VALUE_OR_END : TOKEN_KEY_OR_END;
+}
+
+/*
+ * Close an object or array; it must be the one open.
+ */
+void ConfigParser::pop(bool array) {
+    bool openArray = arrays & (1UL << (depth - 1));
+    if (openArray != array) {
+        state = TOKEN_ERROR;
+        return;
+    }
+    depth--;
+    endValue();
+}
+
+/*
+ * Keep a string byte, as far as the token buffer goes.
+ */
+void ConfigParser::appendToken(char c) {
+    if (tokenLength < CONFIG_TOKEN_SIZE - 1) {
+        token[tokenLength++] = c;
+    } else {
+        tokenOverflow = true;
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * config_parser.h - Streaming JSON Parser for Config Responses
+ *
+ * Reads a config response one byte at a time, as it arrives from the HTTP
+ * connection or in webhook event parts, and picks out the three settings
+ * in a single pass, without buffering the response:
+ *   measurementFrequency or f   integer seconds
+ *   activeStartTime or s        "HH:MM"
+ *   activeEndTime or e          "HH:MM"
+ *
+ * Both response formats go through the same pass, since keys are matched
+ * at any depth:
+ *   Full API response:  {"success":true,"data":{"config":{"measurementFrequency":1800,...}}}
+ *   Webhook template:   {"f":1800,"s":"06:00","e":"22:00"}
+ * The first usable value of each setting is kept: a plain non-negative
+ * integer for the frequency, a non-empty string of up to 7 characters
+ * without escapes for the times. Keys containing escapes match nothing.
+ *
+ * The tokenizer checks the JSON structure (objects, arrays, strings with
+ * escapes, numbers and literals, nested up to CONFIG_PARSER_MAX_DEPTH).
+ * Values are only reported once a whole JSON value has been read without
+ * error, so a truncated or malformed response applies nothing.
+ */
+
+#ifndef CONFIG_PARSER_H
+#define CONFIG_PARSER_H
+
+#include "Particle.h"
+
+#define CONFIG_TIME_SIZE 8              // "HH:MM"; longer strings are ignored
+#define CONFIG_TOKEN_SIZE 24            // Longest key kept: "measurementFrequency"
+#define CONFIG_PARSER_MAX_DEPTH 32      // Nesting of objects and arrays
+#define CONFIG_FREQUENCY_MAX 1000000000 // Larger frequencies are clamped to this
+
+/*
+ * ConfigParser - One-pass extraction of the config settings
+ */
+class ConfigParser {
+public:
+    ConfigParser();
+    
+    /*
+     * Start a new response, forgetting any previous one.
+     */
+    void begin();
+    
+    /*
+     * Consume response bytes. Bytes after the end of the JSON value
+     * (other than whitespace) or after an error make the response invalid.
+     */
+    void feed(char c);
+    void feed(const char *data);    // NUL-terminated
+    
+    bool isComplete();              // A whole JSON value was read without error
+    bool hasError();                // Malformed, too deeply nested or trailing bytes
+    bool hasValues();               // Complete, with at least one setting
+    
+    int getFrequency();             // Seconds, 0 if absent
+    const char* getStartTime();     // "HH:MM", empty if absent
+    const char* getEndTime();       // "HH:MM", empty if absent
+
+private:
+    /*
+     * TokenState - Tokenizer position
+     */
+    enum TokenState {
+        TOKEN_VALUE,                // Before a value
+        TOKEN_VALUE_OR_END,         // After '[': a value or ']'
+        TOKEN_KEY,                  // After ',' in an object: a key
+        TOKEN_KEY_OR_END,           // After '{': a key or '}'
+        TOKEN_COLON,                // After a key
+        TOKEN_AFTER_VALUE,          // After a value: ',', '}', ']' or the end
+        TOKEN_STRING,               // Inside a string
+        TOKEN_ESCAPE,               // After '\' in a string
+        TOKEN_UNICODE,              // In the 4 hex digits of a \u escape
+        TOKEN_NUMBER,               // Inside a number
+        TOKEN_LITERAL,              // Inside true, false or null
+        TOKEN_DONE,                 // Whole value read
+        TOKEN_ERROR
+    };
+    
+    /*
+     * ConfigField - Setting the current key names
+     */
+    enum ConfigField {
+        FIELD_NONE,
+        FIELD_FREQUENCY,
+        FIELD_START_TIME,
+        FIELD_END_TIME
+    };
+    
+    /*
+     * NumberPart - Position inside a number
+     */
+    enum NumberPart {
+        NUMBER_SIGN,                // After '-'
+        NUMBER_ZERO,                // Integer part "0"
+        NUMBER_INTEGER,             // Integer part [1-9][0-9]*
+        NUMBER_POINT,               // After '.'
+        NUMBER_FRACTION,            // Fraction digits
+        NUMBER_E,                   // After 'e' or 'E'
+        NUMBER_EXPONENT_SIGN,       // After the exponent's sign
+        NUMBER_EXPONENT             // Exponent digits
+    };
+    
+    TokenState state;
+    int depth;
+    uint32_t arrays;                // Bit per nesting level: set for an array, clear for an object
+    bool readingKey;                // The string being read is a key
+    ConfigField field;              // Setting named by the last key, for its value
+    
+    // Current token
+    char token[CONFIG_TOKEN_SIZE];
+    int tokenLength;
+    bool tokenOverflow;             // Too long, or contains an escape
+    const char *literal;            // "true", "false" or "null" while in TOKEN_LITERAL
+    int unicodeDigits;              // Hex digits left in a \u escape
+    NumberPart numberPart;
+    long numberValue;               // Value so far (clamped), -1 unless a plain non-negative integer
+    
+    // Settings found
+    bool frequencyFound;
+    int frequency;
+    char startTime[CONFIG_TIME_SIZE];
+    char endTime[CONFIG_TIME_SIZE];
+    
+    void startValue(char c);
+    bool feedNumber(char c);
+    void endNumber();
+    void endString();
+    void endValue();
+    void push(bool array);
+    void pop(bool array);
+    void appendToken(char c);
+};
+
+#endif // CONFIG_PARSER_H
@@ -19,8 +19,8 @@
  * 
  * OFFLINE MODE:
  *   When WiFi is not available, the device operates in offline mode:
- *   - Measurements are stored locally in EEPROM (up to 48 measurements)
- *   - Timeout notifications are stored locally (up to 24 timeouts)
+ *   - Measurements are stored locally in a record log on flash (over 60,000 measurements)
+ *   - Timeout notifications are stored locally in the same log
  *   - All stored data is automatically synced when WiFi reconnects
  *   - Yellow LED flash indicates data stored locally
  * 
@@ -46,6 +46,7 @@
 #include "sensor_manager.h"
 #include "led_controller.h"
 #include "network_manager.h"
+#include "task_scheduler.h"
 
 /*
  * SYSTEM_MODE(SEMI_AUTOMATIC)
@@ -58,11 +59,75 @@
  */
 SYSTEM_MODE(SEMI_AUTOMATIC);
 
+/*
+ * acquireWireBuffer() - Larger I2C receive buffer
+ * 
+ * Device OS calls this before setup() to size Wire's buffers. The default
+ * 32 bytes holds five Red+IR samples, so a drained FIFO took several
+ * transfers; SENSOR_I2C_BUFFER_SIZE holds all 32 and it arrives in one.
+ * Transmit stays small: only register writes go out.
+ */
+hal_i2c_config_t acquireWireBuffer() {
+    static uint8_t rxBuffer[SENSOR_I2C_BUFFER_SIZE];
+    static uint8_t txBuffer[32];
+    hal_i2c_config_t config = {
+        .size = sizeof(hal_i2c_config_t),
+        .version = HAL_I2C_CONFIG_VERSION_1,
+        .rx_buffer = rxBuffer,
+        .rx_buffer_size = SENSOR_I2C_BUFFER_SIZE,
+        .tx_buffer = txBuffer,
+        .tx_buffer_size = sizeof(txBuffer)
+    };
+    return config;
+}
+
 // Global module instances
 StateMachine stateMachine;
 SensorManager sensorManager;
 LEDController ledController;
 NetworkManager networkManager;
+TaskScheduler scheduler;
+
+/*
+ * Measurement handoff task
+ * 
+ * When the state machine enters TRANSMITTING (SensorManager has a complete
+ * measurement), pass the measurement to NetworkManager. The upload runs
+ * from networkManager.update(); it handles the transition back to IDLE
+ * when it completes.
+ */
+static bool isMeasurementReady() {
+    return stateMachine.getCurrentState() == STATE_TRANSMITTING &&
+           sensorManager.isMeasurementComplete() && !networkManager.isTransmitting();
+}
+
+static void handOffMeasurement(void *context) {
+    if (isMeasurementReady()) {
+        MeasurementData data = sensorManager.getMeasurement();
+        networkManager.transmitMeasurement(data);
+    }
+}
+
+static unsigned long nextHandoff(void *context) {
+    return millis() + (isMeasurementReady() ? 0 : SCHEDULER_IDLE_WAKEUP);
+}
+
+#if THREADED_MODE
+/*
+ * Network events task (THREADED_MODE)
+ * 
+ * NetworkManager::update() runs on the network thread. The results it
+ * posts (back to IDLE, LED flashes, a new config) are applied here, on the
+ * main thread with the state machine and LED.
+ */
+static void applyNetworkEvents(void *context) {
+    networkManager.processEvents();
+}
+
+static unsigned long nextNetworkEvent(void *context) {
+    return networkManager.getNextEvent();
+}
+#endif
 
 /*
  * setup() - Device initialization
@@ -72,8 +137,9 @@ NetworkManager networkManager;
  *   2. LED controller for visual feedback
  *   3. WiFi connection (30 second timeout, enters offline mode if fails)
  *   4. Particle Cloud connection (for time sync and webhooks)
- *   5. MAX30102 sensor initialization
- *   6. Network manager (loads stored measurements/timeouts, sets up webhooks)
+ *   5. MAX30102 sensor initialization (starts the acquisition thread with THREADED_MODE)
+ *   6. Network manager (loads stored measurements/timeouts, sets up webhooks;
+ *      starts the network thread with THREADED_MODE)
  *   7. State machine (schedules first measurement)
  * 
  * Note: If WiFi connection fails, device operates in offline mode.
@@ -151,7 +217,10 @@ void setup() {
     if (!sensorManager.begin()) {
         Serial.println("FATAL: Sensor failed!");
         ledController.setPattern(DEVICE_LED_BLINK_RED);
-        while (1) delay(1000);  // Halt on sensor failure
+        while (1) {             // Halt on sensor failure, still blinking
+            ledController.update();
+            delay(10);
+        }
     }
     
     // ===== Network & State Machine Initialization =====
@@ -160,51 +229,118 @@ void setup() {
     networkManager.begin();
     stateMachine.begin();
     
+    // ===== Task Scheduler =====
+    // Order within a pass: a measurement completed by the sensor is handed
+    // off and its upload started in the same pass
+    scheduler.addTask("state", &stateMachine);
+    scheduler.addTask("sensor", &sensorManager);
+    scheduler.addTask("handoff", nullptr, handOffMeasurement, nextHandoff);
+    #if THREADED_MODE
+    scheduler.addTask("network", nullptr, applyNetworkEvents, nextNetworkEvent);
+    #else
+    scheduler.addTask("network", &networkManager);
+    #endif
+    scheduler.addTask("led", &ledController);
+    
     // Ready - turn off LED
     ledController.setPattern(DEVICE_LED_OFF);
     Serial.println("\n>>> System Ready <<<\n");
 }
 
+#if HEAP_REPORT
+/*
+ * reportHeap() - Print heap statistics after a measurement cycle
+ * 
+ * The network path builds its payloads in fixed buffers, so free heap
+ * should not drift from cycle to cycle. max_used_heap is the high-water
+ * mark since boot.
+ */
+static void reportHeap() {
+    static uint32_t lastFree = 0;
+    
+    runtime_info_t info;
+    memset(&info, 0, sizeof(info));
+    info.size = sizeof(info);
+    HAL_Core_Runtime_Info(&info, nullptr);
+    
+    Serial.printlnf("Heap: %lu free (%ld since last cycle), largest block %lu, high-water %lu of %lu",
+                    (unsigned long)info.freeheap,
+                    lastFree > 0 ? (long)info.freeheap - (long)lastFree : 0L,
+                    (unsigned long)info.largest_free_block_heap,
+                    (unsigned long)info.max_used_heap, (unsigned long)info.total_heap);
+    lastFree = info.freeheap;
+}
+#endif
+
+#if SCHEDULER_REPORT
+/*
+ * reportSchedule() - Print scheduler statistics after a measurement cycle
+ * 
+ * Latency is how long after its deadline a task ran; jitter is the
+ * standard deviation of that latency. Counts restart after each report.
+ */
+static void reportSchedule() {
+    uint32_t elapsed = scheduler.getElapsedTime();
+    Serial.printlnf("Scheduler: %lu passes in %lu ms, %lu%% asleep",
+                    (unsigned long)scheduler.getPassCount(), (unsigned long)elapsed,
+                    elapsed > 0 ? (unsigned long)((uint64_t)scheduler.getSleepTime() * 100 / elapsed) : 0UL);
+    
+    for (int i = 0; i < scheduler.getTaskCount(); i++) {
+        const TaskStats &stats = scheduler.getStats(i);
+        Serial.printlnf("  %-8s %6lu runs, latency %.1f ms (max %lu), jitter %.1f ms, longest run %lu us",
+                        stats.name, (unsigned long)stats.runs, scheduler.getMeanLatency(i),
+                        (unsigned long)stats.maxLatency, scheduler.getJitter(i),
+                        (unsigned long)stats.maxRunTime);
+    }
+    Serial.printlnf("  sensor FIFO overruns: %lu samples since boot", (unsigned long)sensorManager.getOverrunCount());
+    scheduler.resetStats();
+}
+#endif
+
 /*
  * loop() - Main execution loop
  * 
  * Called continuously by the Particle OS.
- * Each module's update() handles its responsibilities:
+ * Each pass of the scheduler runs the modules whose next deadline has come,
+ * then sleeps until the earliest one (see task_scheduler.h):
  *   - stateMachine: State transitions, scheduling, timeouts
- *   - sensorManager: Sample collection, measurement processing
- *   - ledController: LED pattern animations
+ *   - sensorManager: Sample collection at the FIFO watermark, measurement processing
+ *   - handoff: Passes a completed measurement to the network manager
  *   - networkManager: Connection monitoring, config fetching, offline data sync
+ *   - ledController: LED pattern animations and effects
+ * 
+ * With THREADED_MODE the sensor's I2C bursts run on an acquisition thread
+ * and networkManager.update() on a network thread; the sensor task then
+ * only processes queued samples, and the network task applies the network
+ * thread's results.
  * 
  * NetworkManager handles:
+ *   - Queued uploads and config fetches (non-blocking, advanced each pass)
  *   - Syncing stored measurements when WiFi reconnects
  *   - Syncing stored timeout notifications when WiFi reconnects
  *   - Periodic config fetching from server
- * 
- * Special handling for TRANSMITTING state to coordinate between
- * SensorManager (measurement complete) and NetworkManager (transmission).
  */
 void loop() {
-    // Update all modules
-    stateMachine.update();
-    sensorManager.update();
-    ledController.update();
-    networkManager.update();
-    
-    // Handle measurement transmission
-    // When state machine enters TRANSMITTING state, check if measurement is ready
-    if (stateMachine.getCurrentState() == STATE_TRANSMITTING) {
-        if (sensorManager.isMeasurementComplete()) {
-            MeasurementData data = sensorManager.getMeasurement();
-            networkManager.transmitMeasurement(data);
-            // transmitMeasurement() handles transition back to IDLE
-        }
+    // Run the modules that are due, then sleep until the next deadline
+    scheduler.run();
+    
+    #if HEAP_REPORT || SCHEDULER_REPORT
+    // Report each time a measurement cycle ends
+    static DeviceState lastState = STATE_IDLE;
+    DeviceState state = stateMachine.getCurrentState();
+    if (state == STATE_IDLE && lastState != STATE_IDLE) {
+        #if HEAP_REPORT
+        reportHeap();
+        #endif
+        #if SCHEDULER_REPORT
+        reportSchedule();
+        #endif
     }
+    lastState = state;
+    #endif
     
     // Process Particle Cloud events (for webhooks)
     if (Particle.connected()) {
         Particle.process();
     }
-    
-    // Small delay to prevent tight loop
-    delay(10);
 }
@@ -0,0 +1,340 @@
+/*
+ * http_connection.cpp - Persistent, Non-blocking HTTP/1.1 Connection Implementation
+ *
+ * Requests and responses are handled in fixed buffers, without String.
+ * Responses are parsed one byte at a time as they arrive, so poll() never
+ * waits for data. See http_connection.h for the reuse and pipelining rules.
+ */
+
+#include "http_connection.h"
+
+/*
+ * Case-insensitive check for token in a header value.
+ */
+static bool containsIgnoreCase(const char *text, const char *token) {
+    int tokenLength = strlen(token);
+    for (; *text; text++) {
+        int i = 0;
+        while (i < tokenLength && text[i] && tolower(text[i]) == token[i]) i++;
+        if (i == tokenLength) return true;
+    }
+    return false;
+}
+
+HttpConnection::HttpConnection(const char *host, int port) {
+    this->host = host;
+    this->port = port;
+    lastActivity = 0;
+    pending = 0;
+    reused = false;
+    stale = false;
+    burstBytes = 0;
+    connectCount = 0;
+    requestCount = 0;
+    responseCount = 0;
+    headerLength = 0;
+    body = nullptr;
+    bodyLength = 0;
+    written = 0;
+    oldest = 0;
+    status = 0;
+    startResponse();
+}
+
+bool HttpConnection::isReusable() {
+    return client.connected() && (pending > 0 || millis() - lastActivity < HTTP_KEEPALIVE_IDLE_MS);
+}
+
+bool HttpConnection::connect() {
+    close();
+    
+    if (!client.connect(host, port)) {
+        if (DEBUG_MODE) Serial.printlnf("HTTP: connection to %s:%d failed", host, port);
+        return false;
+    }
+    
+    connectCount++;
+    responseCount = 0;
+    lastActivity = millis();
+    return true;
+}
+
+bool HttpConnection::canSend() {
+    return !isSending() && pending < HTTP_MAX_PIPELINE && isReusable();
+}
+
+bool HttpConnection::send(const char *method, const char *path, const char *body, ConfigParser *parser) {
+    stale = false;
+    if (!canSend()) return false;
+    
+    int length = body ? strlen(body) : 0;
+    headerLength = snprintf(header, sizeof(header),
+                            "%s %s HTTP/1.1\r\n"
+                            "Host: %s:%d\r\n"
+                            "X-API-Key: %s\r\n"
+                            "%s"
+                            "Content-Length: %d\r\n"
+                            "Connection: keep-alive\r\n"
+                            "\r\n",
+                            method, path, host, port, API_KEY,
+                            length > 0 ? "Content-Type: application/json\r\n" : "",
+                            length);
+    if (headerLength >= (int)sizeof(header)) {
+        headerLength = 0;
+        return false;
+    }
+    
+    // A burst starts when the connection was idle; a server-side close is
+    // only recognisable before any of its responses arrive
+    if (pending == 0) {
+        reused = responseCount > 0;
+        burstBytes = 0;
+    }
+    
+    this->body = body;
+    bodyLength = length;
+    written = 0;
+    parsers[(oldest + pending) % HTTP_MAX_PIPELINE] = parser;
+    pending++;
+    requestCount++;
+    lastActivity = millis();
+    return true;
+}
+
+bool HttpConnection::isSending() {
+    return written < headerLength + bodyLength;
+}
+
+HttpEvent HttpConnection::poll() {
+    if (pending == 0) return HTTP_BUSY;
+    
+    if (isSending() && !writeSome()) return fail();
+    
+    while (client.available()) {
+        int c = client.read();
+        if (c < 0) break;
+        lastActivity = millis();
+        burstBytes++;
+    
+        bool complete = false;
+        if (!readByte(c, complete)) return fail();
+        if (complete) {
+            pending--;
+            oldest = (oldest + 1) % HTTP_MAX_PIPELINE;
+            responseCount++;
+            // Outstanding pipelined requests then fail on the next poll
+            if (!keepAlive) client.stop();
+            startResponse();
+            return HTTP_RESPONSE;
+        }
+    }
+    
+    if (!client.connected()) {
+        // Reading until close: a closed connection is the end of the body
+        if (state == RESPONSE_UNTIL_CLOSE) {
+            pending--;
+            oldest = (oldest + 1) % HTTP_MAX_PIPELINE;
+            responseCount++;
+            startResponse();
+            return HTTP_RESPONSE;
+        }
+        return fail();
+    }
+    
+    if (millis() - lastActivity >= HTTP_RESPONSE_TIMEOUT_MS) {
+        if (DEBUG_MODE) Serial.println("HTTP: response timeout");
+        return fail();
+    }
+    
+    return HTTP_BUSY;
+}
+
+HttpPhase HttpConnection::getPhase() {
+    return (state == RESPONSE_STATUS || state == RESPONSE_HEADERS) ? HTTP_AWAIT_HEADERS : HTTP_READ_BODY;
+}
+
+int HttpConnection::getStatus() {
+    return status;
+}
+
+bool HttpConnection::isStale() {
+    return stale;
+}
+
+void HttpConnection::close() {
+    client.stop();
+    pending = 0;
+    oldest = 0;
+    reused = false;
+    headerLength = 0;
+    bodyLength = 0;
+    written = 0;
+    startResponse();
+}
+
+int HttpConnection::getPendingCount() {
+    return pending;
+}
+
+uint32_t HttpConnection::getConnectCount() {
+    return connectCount;
+}
+
+uint32_t HttpConnection::getRequestCount() {
+    return requestCount;
+}
+
+/*
+ * Write as much of the current request as the socket accepts.
+ * Returns false on a write error.
+ */
+bool HttpConnection::writeSome() {
+    int total = headerLength + bodyLength;
+    while (written < total) {
+        const char *data;
+        int length;
+        if (written < headerLength) {
+            data = header + written;
+            length = headerLength - written;
+        } else {
+            data = body + (written - headerLength);
+            length = total - written;
+        }
+    
+        int sent = client.write((const uint8_t *)data, length);
+        if (sent < 0) return false;
+        if (sent == 0) break;  // Socket buffer full - continue on the next poll
+        written += sent;
+        lastActivity = millis();
+    }
+    return true;
+}
+
+/*
+ * Reset the response parser for the next response. The status of the
+ * previous one stays readable until its status line arrives.
+ */
+void HttpConnection::startResponse() {
+    state = RESPONSE_STATUS;
+    lineLength = 0;
+    remaining = -1;
+    chunked = false;
+    keepAlive = true;
+    bodyParser = nullptr;
+}
+
+/*
+ * Feed one response byte to the parser. Sets complete at the end of the
+ * response. Returns false if the response is malformed.
+ */
+bool HttpConnection::readByte(int c, bool &complete) {
+    switch (state) {
+        case RESPONSE_BODY:
+            feedBody(c);
+            if (--remaining == 0) complete = true;
+            return true;
+    
+        case RESPONSE_UNTIL_CLOSE:
+            feedBody(c);
+            return true;
+    
+        case RESPONSE_CHUNK_DATA:
+            feedBody(c);
+            if (--remaining == 0) state = RESPONSE_CHUNK_END;
+            return true;
+    
+        default:
+            // Line-based states; lines end with CR LF
+            if (c == '\n') {
+                line[lineLength] = '\0';
+                lineLength = 0;
+                return handleLine(complete);
+            }
+            if (c != '\r' && lineLength < HTTP_LINE_SIZE - 1) line[lineLength++] = c;
+            return true;
+    }
+}
+
+/*
+ * Handle one complete line (without CR LF).
+ */
+bool HttpConnection::handleLine(bool &complete) {
+    switch (state) {
+        case RESPONSE_STATUS: {
+            // "HTTP/1.1 201 Created"
+            const char *space = strchr(line, ' ');
+            if (strncmp(line, "HTTP/1.", 7) != 0 || space == nullptr) return false;
+            status = atoi(space + 1);
+            bodyParser = parsers[oldest];
+            if (bodyParser != nullptr) bodyParser->begin();
+            state = RESPONSE_HEADERS;
+            return true;
+        }
+    
+        case RESPONSE_HEADERS:
+            if (line[0] == '\0') return finishHeaders(complete);
+            if (strncasecmp(line, "Content-Length:", 15) == 0) {
+                remaining = atol(line + 15);
+            } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+                chunked = containsIgnoreCase(line + 18, "chunked");
+            } else if (strncasecmp(line, "Connection:", 11) == 0) {
+                keepAlive = !containsIgnoreCase(line + 11, "close");
+            }
+            return true;
+    
+        case RESPONSE_CHUNK_SIZE:
+            // "<hex size>" ... "0", then optional trailers and a blank line
+            remaining = strtol(line, nullptr, 16);
+            if (remaining < 0) return false;
+            state = (remaining == 0) ? RESPONSE_TRAILERS : RESPONSE_CHUNK_DATA;
+            return true;
+    
+        case RESPONSE_CHUNK_END:
+            state = RESPONSE_CHUNK_SIZE;
+            return true;
+    
+        case RESPONSE_TRAILERS:
+            if (line[0] == '\0') complete = true;
+            return true;
+    
+        default:
+            return false;
+    }
+}
+
+/*
+ * Headers done: choose how the body is delimited.
+ */
+bool HttpConnection::finishHeaders(bool &complete) {
+    if (status == 204 || status == 304) {
+        complete = true;
+    } else if (chunked) {
+        state = RESPONSE_CHUNK_SIZE;
+    } else if (remaining >= 0) {
+        if (remaining == 0) complete = true;
+        state = RESPONSE_BODY;
+    } else {
+        // No length: the body ends when the server closes the connection
+        state = RESPONSE_UNTIL_CLOSE;
+        keepAlive = false;
+    }
+    return true;
+}
+
+/*
+ * Pass one body byte to the request's parser, if it has one.
+ */
+void HttpConnection::feedBody(int c) {
+    if (bodyParser != nullptr) bodyParser->feed((char)c);
+}
+
+/*
+ * Drop the connection after an error. The error is stale (safe to retry)
+ * when the server closed a reused connection before answering anything.
+ */
+HttpEvent HttpConnection::fail() {
+    stale = reused && burstBytes == 0 && !client.connected();
+    if (DEBUG_MODE && !stale) Serial.println("HTTP: connection error");
+    close();
+    return HTTP_ERROR;
+}
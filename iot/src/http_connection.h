@@ -0,0 +1,185 @@
+/*
+ * http_connection.h - Persistent, Non-blocking HTTP/1.1 Connection
+ *
+ * Keep-alive client for direct HTTP mode (USE_WEBHOOK false), shared by all
+ * NetworkManager requests (measurements, batches, timeouts, waveforms and
+ * config fetches), so a TCP handshake is only paid when the connection has
+ * to be (re)opened.
+ *
+ * NON-BLOCKING USE:
+ *   Nothing here waits. The caller drives each request through its states:
+ *     CONNECTING     connect() when isReusable() is false
+ *     SENDING        send() starts the request; poll() writes it
+ *     AWAIT_HEADERS  poll() reads the status line and headers
+ *     READ_BODY      poll() reads the body (Content-Length, chunked or
+ *                    until close)
+ *   and calls poll() from its update() until it reports HTTP_RESPONSE or
+ *   HTTP_ERROR. TCPClient::connect() itself blocks for the TCP handshake;
+ *   with keep-alive that is only paid when the connection is (re)opened.
+ *
+ * CONNECTION REUSE:
+ *   - Requests are sent with "Connection: keep-alive"
+ *   - The connection is reopened if it was idle longer than
+ *     HTTP_KEEPALIVE_IDLE_MS (below the server's keep-alive timeout), if the
+ *     server closed it, or after any error
+ *   - isStale() reports an error on a reused connection before any response
+ *     byte arrived (the server closed it just before the request did), so
+ *     the caller can safely retry those requests on a fresh connection
+ *
+ * PIPELINING:
+ *   A new request can be sent as soon as the previous one has been written
+ *   (canSend()); responses are read in order. Up to HTTP_MAX_PIPELINE
+ *   requests may be outstanding.
+ *
+ * Responses with Content-Length or chunked bodies keep the connection open;
+ * "Connection: close" or a body without a length closes it.
+ *
+ * RESPONSE BODIES:
+ *   Bodies are not buffered. A request sent with a ConfigParser has its
+ *   response body fed to the parser byte by byte as it is read (config
+ *   fetches); other bodies are discarded.
+ */
+
+#ifndef HTTP_CONNECTION_H
+#define HTTP_CONNECTION_H
+
+#include "Particle.h"
+#include "config.h"
+#include "config_parser.h"
+
+// Request line plus headers (the API key alone is 68 characters)
+#define HTTP_HEADER_SIZE 384
+
+// Longest status or header line kept; longer lines are truncated
+#define HTTP_LINE_SIZE 128
+
+/*
+ * HttpEvent - Result of one poll()
+ */
+enum HttpEvent {
+    HTTP_BUSY,          // Nothing completed
+    HTTP_RESPONSE,      // Oldest outstanding response complete (getStatus)
+    HTTP_ERROR          // Connection failed or timed out; all outstanding requests are lost
+};
+
+/*
+ * HttpPhase - Progress of the oldest outstanding response
+ */
+enum HttpPhase {
+    HTTP_AWAIT_HEADERS, // Status line and headers
+    HTTP_READ_BODY      // Body
+};
+
+/*
+ * HttpConnection - One persistent connection to the API server
+ */
+class HttpConnection {
+public:
+    HttpConnection(const char *host, int port);
+    
+    /*
+     * True if requests can go out on the open connection without connect():
+     * it is open and either busy or idle for less than HTTP_KEEPALIVE_IDLE_MS.
+     */
+    bool isReusable();
+    
+    /*
+     * Open a new connection, closing the current one.
+     * Returns false if the server could not be reached.
+     */
+    bool connect();
+    
+    /*
+     * True if send() may be called: the connection is open, no request is
+     * being written, and fewer than HTTP_MAX_PIPELINE are outstanding.
+     */
+    bool canSend();
+    
+    /*
+     * Start a request. body may be nullptr (e.g. GET) and must stay valid
+     * until isSending() is false. If parser is given, the response body is
+     * fed to it (begin() is called when the response starts).
+     * Returns false if the request cannot be sent.
+     */
+    bool send(const char *method, const char *path, const char *body, ConfigParser *parser = nullptr);
+    
+    /*
+     * True while the last request sent is still being written.
+     */
+    bool isSending();
+    
+    /*
+     * Write and read whatever is possible without waiting.
+     * Returns HTTP_RESPONSE once per completed response, in request order.
+     */
+    HttpEvent poll();
+    
+    HttpPhase getPhase();           // Progress of the oldest outstanding response
+    int getStatus();                // Status of the response poll() just completed
+    bool isStale();                 // Last HTTP_ERROR was a server-closed reused connection
+    
+    /*
+     * Close the connection. Outstanding requests are discarded.
+     */
+    void close();
+    
+    int getPendingCount();
+    uint32_t getConnectCount();     // TCP connections opened since boot
+    uint32_t getRequestCount();     // Requests sent since boot
+
+private:
+    /*
+     * ResponseState - Response parser position
+     */
+    enum ResponseState {
+        RESPONSE_STATUS,            // Status line
+        RESPONSE_HEADERS,           // Header lines up to the blank line
+        RESPONSE_BODY,              // Content-Length body
+        RESPONSE_UNTIL_CLOSE,       // Body without a length
+        RESPONSE_CHUNK_SIZE,        // Chunk size line
+        RESPONSE_CHUNK_DATA,        // Chunk data
+        RESPONSE_CHUNK_END,         // CR LF after chunk data
+        RESPONSE_TRAILERS           // Trailer lines after the last chunk
+    };
+    
+    TCPClient client;
+    const char *host;
+    int port;
+    unsigned long lastActivity;     // millis() of the last byte sent or received
+    int pending;                    // Requests sent, responses not yet complete
+    bool reused;                    // Current requests went out on an already used connection
+    bool stale;                     // Last error was a server-closed reused connection
+    uint32_t burstBytes;            // Response bytes since the connection was last idle
+    uint32_t connectCount;
+    uint32_t requestCount;
+    uint32_t responseCount;         // Responses completed on this connection
+    
+    // Request being written
+    char header[HTTP_HEADER_SIZE];
+    int headerLength;
+    const char *body;
+    int bodyLength;
+    int written;                    // Bytes of header + body written so far
+    ConfigParser *parsers[HTTP_MAX_PIPELINE];  // Body parser of each outstanding request
+    int oldest;                     // parsers index of the oldest outstanding request
+    
+    // Response being read
+    ResponseState state;
+    char line[HTTP_LINE_SIZE];
+    int lineLength;
+    int status;
+    long remaining;                 // Body or chunk bytes still to read
+    bool chunked;
+    bool keepAlive;
+    ConfigParser *bodyParser;       // Fed the body being read, or nullptr
+    
+    bool writeSome();
+    void startResponse();
+    bool readByte(int c, bool &complete);
+    bool handleLine(bool &complete);
+    bool finishHeaders(bool &complete);
+    void feedBody(int c);
+    HttpEvent fail();
+};
+
+#endif // HTTP_CONNECTION_H
@@ -7,19 +7,30 @@
  * PATTERN TIMING:
  *   - Slow blink: 1000ms on/off (waiting for user)
  *   - Fast blink: 250ms on/off (error states)
- *   - Pulse: Smooth fade over ~1 second
+ *   - Pulse: Smooth fade up and down over 1 second
  *   - Flash: 200ms single color burst
+ * 
+ * Blink and pulse are computed from the time since the pattern was set, so
+ * update() can be called at any rate. Effects are step lists: the step
+ * showing is found from the time since the effect started, and the effect
+ * ends once all steps have run.
  */
 
 #include "led_controller.h"
-#include "config.h"
+#include "task_scheduler.h"
 
 LEDController::LEDController() {
     currentPattern = DEVICE_LED_OFF;
-    lastUpdate = 0;
-    ledState = false;
-    pulseValue = 0;
-    pulseDirection = true;
+    patternStart = 0;
+    renderPending = false;
+    lastRender = 0;
+    effectHead = 0;
+    effectCount = 0;
+    effectStarted = false;
+    effectStart = 0;
+    shownRed = 0;
+    shownGreen = 0;
+    shownBlue = 0;
 }
 
 /*
@@ -29,14 +40,85 @@ LEDController::LEDController() {
 void LEDController::begin() {
     RGB.control(true);      // Take control from Particle OS
     RGB.brightness(50);     // 50% brightness to reduce glare
-    setColor(0, 0, 0);      // Start with LED off
+    RGB.color(0, 0, 0);     // Start with LED off
+    shownRed = 0;
+    shownGreen = 0;
+    shownBlue = 0;
 }
 
 /*
  * Update LED pattern animation.
- * Called from main loop to animate blink and pulse patterns.
+ * Plays the queued effect, if any, dropping effects that have run their
+ * time; otherwise shows the current pattern.
  */
 void LEDController::update() {
+    unsigned long now = millis();
+    lastRender = now;
+    renderPending = false;
+    
+    while (effectCount > 0) {
+        if (!effectStarted) {
+            effectStart = now;
+            effectStarted = true;
+        }
+        const LEDEffect &effect = effects[effectHead];
+        if (now - effectStart < effect.length) {
+            renderEffect(effect, now - effectStart);
+            return;
+        }
+        // Expired: the next effect starts now
+        effectHead = (effectHead + 1) % LED_EFFECT_QUEUE_SIZE;
+        effectCount--;
+        effectStarted = false;
+    }
+    
+    renderPattern(now - patternStart);
+}
+
+/*
+ * Next time the colour changes. Solid patterns and held steps change only
+ * when something new is set or queued.
+ */
+unsigned long LEDController::getNextUpdate() {
+    unsigned long now = millis();
+    if (renderPending || (effectCount > 0 && !effectStarted)) return now;
+    
+    if (effectCount > 0) {
+        // End of the step showing, or the next frame of a fade
+        const LEDEffect &effect = effects[effectHead];
+        unsigned long stepEnd = effectStart;
+        for (int i = 0; i < effect.stepCount; i++) {
+            stepEnd += effect.steps[i].duration;
+            if ((long)(now - stepEnd) < 0) {
+                if (effect.steps[i].fade) return earliestDeadline(stepEnd, lastRender + LED_FRAME_INTERVAL);
+                return stepEnd;
+            }
+        }
+        return now;
+    }
+    
+    unsigned long elapsed = now - patternStart;
+    switch (currentPattern) {
+        case DEVICE_LED_BLINK_BLUE:
+            return now + LED_BLINK_SLOW - elapsed % LED_BLINK_SLOW;
+            
+        case DEVICE_LED_BLINK_GREEN:
+        case DEVICE_LED_BLINK_YELLOW:
+        case DEVICE_LED_BLINK_RED:
+            return now + LED_BLINK_FAST - elapsed % LED_BLINK_FAST;
+            
+        case DEVICE_LED_PULSE_BLUE:
+            return lastRender + LED_FRAME_INTERVAL;
+            
+        default:
+            return now + SCHEDULER_IDLE_WAKEUP;
+    }
+}
+
+/*
+ * Show the current pattern.
+ */
+void LEDController::renderPattern(unsigned long elapsed) {
     switch (currentPattern) {
         case DEVICE_LED_OFF:
             setColor(0, 0, 0);
@@ -64,126 +146,207 @@ void LEDController::update() {
             
         case DEVICE_LED_BLINK_BLUE:
             // Slow blink for waiting for user state
-            updateBlink(LED_BLINK_SLOW);
-            if (ledState) setColor(0, 0, 255);
-            else setColor(0, 0, 0);
+            renderBlink(elapsed, LED_BLINK_SLOW, 0, 0, 255);
             break;
             
         case DEVICE_LED_BLINK_GREEN:
             // Fast blink (less common)
-            updateBlink(LED_BLINK_FAST);
-            if (ledState) setColor(0, 255, 0);
-            else setColor(0, 0, 0);
+            renderBlink(elapsed, LED_BLINK_FAST, 0, 255, 0);
             break;
             
         case DEVICE_LED_BLINK_YELLOW:
             // Fast yellow blink
-            updateBlink(LED_BLINK_FAST);
-            if (ledState) setColor(255, 255, 0);
-            else setColor(0, 0, 0);
+            renderBlink(elapsed, LED_BLINK_FAST, 255, 255, 0);
             break;
             
         case DEVICE_LED_BLINK_RED:
             // Fast red blink for fatal errors
-            updateBlink(LED_BLINK_FAST);
-            if (ledState) setColor(255, 0, 0);
-            else setColor(0, 0, 0);
+            renderBlink(elapsed, LED_BLINK_FAST, 255, 0, 0);
             break;
             
-        case DEVICE_LED_PULSE_BLUE:
-            // Smooth blue pulse for stabilizing state
-            updatePulse();
-            setColor(0, 0, pulseValue);
+        case DEVICE_LED_PULSE_BLUE: {
+            // Smooth blue pulse for stabilizing state: a triangle wave
+            unsigned long half = LED_PULSE_PERIOD / 2;
+            unsigned long phase = elapsed % LED_PULSE_PERIOD;
+            if (phase >= half) phase = LED_PULSE_PERIOD - phase;
+            setColor(0, 0, phase * 255 / half);
             break;
+        }
             
         case DEVICE_LED_FLASH_GREEN:
         case DEVICE_LED_FLASH_YELLOW:
         case DEVICE_LED_FLASH_RED:
-            // Flash patterns are one-shot, handled by flash methods
+            // Never current: setPattern() queues these as effects
             break;
     }
 }
 
 /*
- * Set the current LED pattern.
- * Resets animation state for blink/pulse patterns.
+ * Show a blink: off for the first interval, then on, and so on.
  */
-void LEDController::setPattern(DeviceLEDPattern pattern) {
-    currentPattern = pattern;
-    lastUpdate = millis();
-    ledState = false;
+void LEDController::renderBlink(unsigned long elapsed, uint16_t interval,
+                                uint8_t red, uint8_t green, uint8_t blue) {
+    if ((elapsed / interval) % 2 == 1) setColor(red, green, blue);
+    else setColor(0, 0, 0);
 }
 
 /*
- * Update blink pattern timing.
- * Toggles ledState at specified interval.
+ * Show the step of an effect that elapsed falls in. A fading step blends
+ * from the previous step's colour (or off) to its own.
  */
-void LEDController::updateBlink(uint16_t interval) {
-    unsigned long now = millis();
-    if (now - lastUpdate >= interval) {
-        ledState = !ledState;
-        lastUpdate = now;
+void LEDController::renderEffect(const LEDEffect &effect, unsigned long elapsed) {
+    uint8_t fromRed = 0, fromGreen = 0, fromBlue = 0;
+    
+    for (int i = 0; i < effect.stepCount; i++) {
+        const LEDStep &step = effect.steps[i];
+        if (elapsed >= step.duration) {
+            elapsed -= step.duration;
+            fromRed = step.red;
+            fromGreen = step.green;
+            fromBlue = step.blue;
+            continue;
+        }
+        
+        if (!step.fade) {
+            setColor(step.red, step.green, step.blue);
+        } else {
+            setColor(fromRed + ((int)step.red - fromRed) * (long)elapsed / step.duration,
+                     fromGreen + ((int)step.green - fromGreen) * (long)elapsed / step.duration,
+                     fromBlue + ((int)step.blue - fromBlue) * (long)elapsed / step.duration);
+        }
+        return;
     }
 }
 
 /*
- * Update pulse pattern animation.
- * Smoothly fades pulseValue from 0 to 255 and back.
+ * Set the current LED pattern.
+ * Restarts blink/pulse timing; FLASH_* patterns queue a flash instead.
  */
-void LEDController::updatePulse() {
-    unsigned long now = millis();
-    if (now - lastUpdate >= 10) {  // Update every 10ms for smooth animation
-        if (pulseDirection) {
-            pulseValue += 5;
-            if (pulseValue >= 255) {
-                pulseValue = 255;
-                pulseDirection = false;
-            }
-        } else {
-            pulseValue -= 5;
-            if (pulseValue <= 0) {
-                pulseValue = 0;
-                pulseDirection = true;
-            }
-        }
-        lastUpdate = now;
+void LEDController::setPattern(DeviceLEDPattern pattern) {
+    switch (pattern) {
+        case DEVICE_LED_FLASH_GREEN:
+            flashSuccess();
+            return;
+        case DEVICE_LED_FLASH_YELLOW:
+            flashWarning();
+            return;
+        case DEVICE_LED_FLASH_RED:
+            flashError();
+            return;
+        default:
+            break;
     }
+    
+    currentPattern = pattern;
+    patternStart = millis();
+    renderPending = true;
 }
 
 /*
  * Flash green to indicate successful transmission.
- * Blocking call - delays for flash duration.
+ * Queued - the flash plays from update().
  */
 void LEDController::flashSuccess() {
-    setColor(0, 255, 0);
-    delay(LED_FLASH_DURATION);
-    setPattern(DEVICE_LED_OFF);
+    flash(0, 255, 0, LED_FLASH_DURATION);
 }
 
 /*
  * Flash yellow to indicate measurement stored offline.
- * Blocking call - delays for flash duration.
+ * Queued - the flash plays from update().
  */
 void LEDController::flashWarning() {
-    setColor(255, 255, 0);
-    delay(LED_FLASH_DURATION);
-    setPattern(DEVICE_LED_OFF);
+    flash(255, 255, 0, LED_FLASH_DURATION);
 }
 
 /*
  * Flash red to indicate error.
- * Blocking call - delays for flash duration.
+ * Queued - the flash plays from update().
  */
 void LEDController::flashError() {
-    setColor(255, 0, 0);
-    delay(LED_FLASH_DURATION);
-    setPattern(DEVICE_LED_OFF);
+    flash(255, 0, 0, LED_FLASH_DURATION);
+}
+
+/*
+ * Queue a single flash of a colour.
+ */
+bool LEDController::flash(uint8_t red, uint8_t green, uint8_t blue, uint16_t duration) {
+    LEDStep step = {red, green, blue, duration, false};
+    return playSequence(&step, 1);
+}
+
+/*
+ * Queue count blinks: on, then off, for interval ms each.
+ */
+bool LEDController::blink(uint8_t red, uint8_t green, uint8_t blue, int count, uint16_t interval) {
+    if (count <= 0 || count * 2 > LED_EFFECT_MAX_STEPS) return false;
+    
+    LEDStep steps[LED_EFFECT_MAX_STEPS];
+    for (int i = 0; i < count; i++) {
+        steps[i * 2] = {red, green, blue, interval, false};
+        steps[i * 2 + 1] = {0, 0, 0, interval, false};
+    }
+    return playSequence(steps, count * 2);
+}
+
+/*
+ * Queue count pulses: a fade up to the colour and back to off, over
+ * period ms each.
+ */
+bool LEDController::pulse(uint8_t red, uint8_t green, uint8_t blue, int count, uint16_t period) {
+    if (count <= 0 || count * 2 > LED_EFFECT_MAX_STEPS) return false;
+    
+    LEDStep steps[LED_EFFECT_MAX_STEPS];
+    uint16_t half = period / 2;
+    for (int i = 0; i < count; i++) {
+        steps[i * 2] = {red, green, blue, half, true};
+        steps[i * 2 + 1] = {0, 0, 0, (uint16_t)(period - half), true};
+    }
+    return playSequence(steps, count * 2);
+}
+
+/*
+ * Queue a sequence of steps, played in order.
+ */
+bool LEDController::playSequence(const LEDStep *steps, int count) {
+    if (count <= 0 || count > LED_EFFECT_MAX_STEPS) return false;
+    
+    LEDEffect *effect = queueEffect();
+    if (effect == nullptr) return false;
+    
+    effect->stepCount = count;
+    effect->length = 0;
+    for (int i = 0; i < count; i++) {
+        effect->steps[i] = steps[i];
+        effect->length += steps[i].duration;
+    }
+    return true;
+}
+
+bool LEDController::isEffectActive() {
+    return effectCount > 0;
+}
+
+/*
+ * Reserve the slot after the last queued effect.
+ */
+LEDController::LEDEffect* LEDController::queueEffect() {
+    if (effectCount >= LED_EFFECT_QUEUE_SIZE) {
+        if (DEBUG_MODE) Serial.println("LED effect queue full, effect dropped");
+        return nullptr;
+    }
+    LEDEffect *effect = &effects[(effectHead + effectCount) % LED_EFFECT_QUEUE_SIZE];
+    effectCount++;
+    return effect;
 }
 
 /*
- * Set RGB LED color directly.
- * Uses Particle RGB.color() API.
+ * Set RGB LED color.
+ * Uses Particle RGB.color() API, only when the colour changes.
  */
 void LEDController::setColor(uint8_t red, uint8_t green, uint8_t blue) {
+    if (red == shownRed && green == shownGreen && blue == shownBlue) return;
     RGB.color(red, green, blue);
+    shownRed = red;
+    shownGreen = green;
+    shownBlue = blue;
 }
@@ -14,12 +14,20 @@
  *   - FLASH_YELLOW: Measurement stored offline (no connection)
  *   - FLASH_RED:   Error condition
  *   - BLINK_RED:   Fatal error (sensor not found)
+ * 
+ * EFFECTS:
+ *   Flashes, blinks, pulses and step sequences are queued as effects and
+ *   played from update() over the current pattern, one after another.
+ *   Nothing blocks: each effect ends when its steps have run their time,
+ *   and the LED then returns to the pattern (which keeps its own timing).
+ *   The FLASH_* patterns queue a flash rather than replacing the pattern.
  */
 
 #ifndef LED_CONTROLLER_H
 #define LED_CONTROLLER_H
 
 #include "Particle.h"
+#include "config.h"
 
 /*
  * DeviceLEDPattern - Available LED patterns
@@ -42,10 +50,23 @@ enum DeviceLEDPattern {
 };
 
 /*
- * LEDController - Manages RGB LED patterns
+ * LEDStep - One step of an effect: a colour shown for a duration
+ */
+struct LEDStep {
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint16_t duration;        // ms
+    bool fade;                // Fade in from the previous step's colour (off for the first step)
+};
+
+/*
+ * LEDController - Manages RGB LED patterns and effects
  * 
  * Uses Particle's RGB.control() for direct LED control.
- * Patterns are updated in the update() method called from main loop.
+ * Patterns and effects are rendered in the update() method called from
+ * main loop, from the time elapsed since they started; the LED is only
+ * written when its colour changes.
  */
 class LEDController {
 public:
@@ -58,13 +79,20 @@ public:
     void begin();
     
     /*
-     * Update LED pattern animation.
+     * Update LED pattern animation and play queued effects.
      * Call from main loop.
      */
     void update();
     
     /*
-     * Set the current LED pattern.
+     * millis() at which update() next changes the colour: a blink or step
+     * boundary, the next fade frame, or at once after a new pattern or effect.
+     */
+    unsigned long getNextUpdate();
+    
+    /*
+     * Set the current LED pattern. A FLASH_* pattern queues a flash of
+     * that colour and leaves the current pattern as it is.
      */
     void setPattern(DeviceLEDPattern pattern);
     
@@ -83,27 +111,71 @@ public:
      */
     void flashError();
     
+    /*
+     * Queue effects. Each returns false (and queues nothing) if the effect
+     * queue is full or the effect needs more than LED_EFFECT_MAX_STEPS steps.
+     */
+    bool flash(uint8_t red, uint8_t green, uint8_t blue, uint16_t duration);
+    bool blink(uint8_t red, uint8_t green, uint8_t blue, int count, uint16_t interval);
+    bool pulse(uint8_t red, uint8_t green, uint8_t blue, int count, uint16_t period);
+    bool playSequence(const LEDStep *steps, int count);
+    
+    /*
+     * True while an effect is playing or waiting.
+     */
+    bool isEffectActive();
+    
 private:
+    /*
+     * LEDEffect - A queued effect
+     */
+    struct LEDEffect {
+        LEDStep steps[LED_EFFECT_MAX_STEPS];
+        int stepCount;
+        unsigned long length;   // Sum of the step durations (ms)
+    };
+    
     DeviceLEDPattern currentPattern;
-    unsigned long lastUpdate;
-    bool ledState;              // For blink patterns
-    uint8_t pulseValue;         // For pulse patterns (0-255)
-    bool pulseDirection;        // Pulse direction (true = increasing)
+    unsigned long patternStart; // millis() when the pattern was set
+    bool renderPending;         // Pattern set or effect queued since the last update()
+    unsigned long lastRender;   // millis() of the last update(), for fade frames
+    
+    // Effect queue (ring buffer); the effect at effectHead is playing
+    LEDEffect effects[LED_EFFECT_QUEUE_SIZE];
+    int effectHead;
+    int effectCount;
+    bool effectStarted;         // effectStart is valid for the head effect
+    unsigned long effectStart;  // millis() when the head effect started
+    
+    // Colour last written to the LED
+    uint8_t shownRed;
+    uint8_t shownGreen;
+    uint8_t shownBlue;
     
     /*
-     * Set RGB LED color directly.
+     * Set RGB LED color, if it differs from the one shown.
      */
     void setColor(uint8_t red, uint8_t green, uint8_t blue);
     
     /*
-     * Update blink pattern animation.
+     * Show the current pattern at elapsed ms since it was set.
+     */
+    void renderPattern(unsigned long elapsed);
+    
+    /*
+     * Show an effect at elapsed ms since it started.
+     */
+    void renderEffect(const LEDEffect &effect, unsigned long elapsed);
+    
+    /*
+     * Show color while a blink of the given interval is in its on phase.
      */
-    void updateBlink(uint16_t interval);
+    void renderBlink(unsigned long elapsed, uint16_t interval, uint8_t red, uint8_t green, uint8_t blue);
     
     /*
-     * Update pulse pattern animation.
+     * Reserve the next queue slot, or nullptr if the queue is full.
      */
-    void updatePulse();
+    LEDEffect* queueEffect();
 };
 
 #endif // LED_CONTROLLER_H
@@ -0,0 +1,250 @@
+/*
+ * measurement_block.cpp - Delta-coded Block of Stored Measurements
+ *
+ * See measurement_block.h for the format.
+ */
+
+#include "measurement_block.h"
+
+/*
+ * Round a reading to the nearest integer in 0..most.
+ */
+static uint32_t toField(float value, uint32_t most) {
+    if (!(value > 0)) return 0;     // Also NaN
+    if (value >= most) return most;
+    return (uint32_t)(value + 0.5f);
+}
+
+static uint32_t readWord(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static void writeWord(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out[i] = (value >> (8 * i)) & 0xFF;
+}
+
+/*
+ * Set width bits (at most 32) at bit position of out, LSB first. The bits
+ * there must be zero.
+ */
+static void writeBits(uint8_t *out, int position, uint32_t value, int width) {
+    for (int i = 0; i < width; i++, position++) {
+        if (value & (1UL << i)) out[position >> 3] |= 1 << (position & 7);
+    }
+}
+
+static uint32_t readBits(const uint8_t *in, int position, int width) {
+    uint32_t value = 0;
+    for (int i = 0; i < width; i++, position++) {
+        if (in[position >> 3] & (1 << (position & 7))) value |= 1UL << i;
+    }
+    return value;
+}
+
+static uint32_t zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// Valid bit and confidence, compared with the previous entry's
+static uint8_t qualityOf(const MeasurementData &data) {
+    return (data.valid ? 0x80 : 0) | toField(data.confidence * 100, 100);
+}
+
+MeasurementBlock::MeasurementBlock(int capacity) {
+    this->capacity = capacity;
+    clear();
+}
+
+void MeasurementBlock::clear() {
+    memset(bytes, 0, sizeof(bytes));
+    length = 0;
+    bitLength = 0;
+    lastTimestamp = 0;
+    lastQuality = 0;
+    rewind();
+}
+
+bool MeasurementBlock::add(const MeasurementData &data, uint16_t interval) {
+    int count = getCount();
+    if (count >= capacity) return false;
+    if (count > 0 && interval != getInterval()) return false;
+    
+    // Step against the schedule; the first entry is the block's timestamp
+    uint32_t previous = (count > 0) ? lastTimestamp : data.timestamp - interval;
+    int32_t step = (int32_t)(data.timestamp - previous - interval);
+    
+    // Fields of the entry, as (value, width) pairs
+    uint32_t fields[8][2];
+    int fieldCount = 0;
+    int bits = 0;
+    auto field = [&](uint32_t value, int width) {
+        fields[fieldCount][0] = value;
+        fields[fieldCount][1] = width;
+        fieldCount++;
+        bits += width;
+    };
+    
+    field(toField(data.heartRate, 255), 8);
+    uint32_t spO2 = toField(data.spO2, 127);
+    if (spO2 > 100 - MEASUREMENT_SPO2_ESCAPE && spO2 <= 100) {
+        field(100 - spO2, 3);
+    } else {
+        field(MEASUREMENT_SPO2_ESCAPE, 3);
+        field(spO2, 7);
+    }
+    
+    uint8_t quality = qualityOf(data);
+    if (count > 0 && quality == lastQuality) {
+        field(0, 1);
+    } else {
+        field(1 | ((quality >> 7) << 1) | ((uint32_t)(quality & 0x7F) << 2), 9);
+    }
+    
+    // Skipped prompts: the nearest whole number of intervals
+    int64_t skipped = (step > 0 && interval > 0) ? ((int64_t)step + interval / 2) / interval : 0;
+    if (zigzag(step) < 256) {
+        field(zigzag(step) << 1, 9);
+    } else if (skipped >= 1 && skipped <= MEASUREMENT_MAX_SKIPPED &&
+               zigzag(step - (int32_t)skipped * interval) < 256) {
+        field(1 | ((uint32_t)(skipped - 1) << 2), 7);
+        field(zigzag(step - (int32_t)skipped * interval), 8);
+    } else {
+        field(3, 2);
+        field(zigzag(step), 32);
+    }
+    
+    int newLength = MEASUREMENT_BLOCK_HEADER + (bitLength + bits + 7) / 8;
+    if (newLength > MEASUREMENT_BLOCK_MAX_BYTES) return false;
+    
+    if (count == 0) {
+        writeWord(bytes + 1, data.timestamp);
+        bytes[5] = interval & 0xFF;
+        bytes[6] = interval >> 8;
+    }
+    uint8_t *entries = bytes + MEASUREMENT_BLOCK_HEADER;
+    for (int i = 0; i < fieldCount; i++) {
+        writeBits(entries, bitLength, fields[i][0], fields[i][1]);
+        bitLength += fields[i][1];
+    }
+    bytes[0] = count + 1;
+    length = newLength;
+    lastTimestamp = data.timestamp;
+    lastQuality = quality;
+    return true;
+}
+
+bool MeasurementBlock::load(const uint8_t *block, int length) {
+    clear();
+    if (length <= MEASUREMENT_BLOCK_HEADER || length > MEASUREMENT_BLOCK_MAX_BYTES || block[0] == 0) {
+        return false;
+    }
+    
+    memcpy(bytes, block, length);
+    this->length = length;
+    bitLength = (length - MEASUREMENT_BLOCK_HEADER) * 8;
+    rewind();
+    
+    // Every entry must decode, and the last must end in the last byte,
+    // followed only by zero padding
+    MeasurementData data;
+    while (next(data)) {
+        lastTimestamp = data.timestamp;
+        lastQuality = readQuality;
+    }
+    uint8_t *entries = bytes + MEASUREMENT_BLOCK_HEADER;
+    if (readIndex != getCount() || (readBit + 7) / 8 != length - MEASUREMENT_BLOCK_HEADER ||
+        readBits(entries, readBit, bitLength - readBit) != 0) {
+        clear();
+        return false;
+    }
+    bitLength = readBit;
+    rewind();
+    return true;
+}
+
+int MeasurementBlock::getCount() {
+    return bytes[0];
+}
+
+int MeasurementBlock::getLength() {
+    return length;
+}
+
+const uint8_t* MeasurementBlock::getBytes() {
+    return bytes;
+}
+
+uint32_t MeasurementBlock::getFirstTimestamp() {
+    return (getCount() > 0) ? readWord(bytes + 1) : 0;
+}
+
+void MeasurementBlock::rewind() {
+    readIndex = 0;
+    readBit = 0;
+    readTimestamp = getFirstTimestamp() - getInterval();
+    readQuality = 0;
+}
+
+bool MeasurementBlock::next(MeasurementData &data) {
+    if (readIndex >= getCount()) return false;
+    if (!decodeEntry(&readBit, bitLength, readTimestamp, &readQuality, data)) return false;
+    
+    readIndex++;
+    readTimestamp = data.timestamp;
+    return true;
+}
+
+int MeasurementBlock::getInterval() {
+    return (getCount() > 0) ? (bytes[5] | (bytes[6] << 8)) : 0;
+}
+
+bool MeasurementBlock::decodeEntry(int *position, int bitLimit, uint32_t previous, uint8_t *quality,
+                                   MeasurementData &data) {
+    const uint8_t *entries = bytes + MEASUREMENT_BLOCK_HEADER;
+    int at = *position;
+    bool cutOff = false;
+    auto take = [&](int width) -> uint32_t {
+        if (cutOff || at + width > bitLimit) {
+            cutOff = true;
+            return 0;
+        }
+        uint32_t value = readBits(entries, at, width);
+        at += width;
+        return value;
+    };
+    
+    uint32_t heartRate = take(8);
+    uint32_t spO2 = take(3);
+    spO2 = (spO2 == MEASUREMENT_SPO2_ESCAPE) ? take(7) : 100 - spO2;
+    
+    uint8_t entryQuality = *quality;
+    if (take(1)) {
+        entryQuality = take(1) << 7;
+        entryQuality |= take(7);
+    }
+    
+    int interval = getInterval();
+    int32_t step;
+    if (take(1) == 0) {
+        step = unzigzag(take(8));
+    } else if (take(1) == 0) {
+        int32_t skipped = take(5) + 1;
+        step = unzigzag(take(8)) + skipped * interval;
+    } else {
+        step = unzigzag(take(32));
+    }
+    if (cutOff) return false;
+    
+    data.timestamp = previous + interval + (uint32_t)step;
+    data.heartRate = heartRate;
+    data.spO2 = spO2;
+    data.valid = (entryQuality & 0x80) != 0;
+    data.confidence = (entryQuality & 0x7F) / 100.0f;
+    *position = at;
+    *quality = entryQuality;
+    return true;
+}
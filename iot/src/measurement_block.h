@@ -0,0 +1,114 @@
+/*
+ * measurement_block.h - Delta-coded Block of Stored Measurements
+ *
+ * Offline measurements are kept in blocks rather than one record each: the
+ * timestamps are coded against the measurement interval and the readings
+ * are bit-packed against the previous entry, so a block of 32 takes about
+ * 3.2 bytes per measurement in the offline log (a record per measurement
+ * took 14, the fixed EEPROM arrays 16). The same blocks are uploaded
+ * unchanged in a batch (see MEASUREMENT_BATCH_VERSION in
+ * measurement_record.h), and the API server decodes them
+ * (api-server/src/routes/measurements/measurement-codec.ts).
+ *
+ * BLOCK FORMAT (7 bytes header, little endian):
+ *   byte 0    entry count n
+ *   byte 1-4  Unix timestamp of the first entry (seconds)
+ *   byte 5-6  measurement interval (seconds)
+ *   then n entries, bit-packed LSB first and back to back; the block is
+ *   padded with zero bits to a whole byte
+ *
+ * ENTRY FORMAT (21 bits for a typical entry, at most 61):
+ *   8 bits    heart rate (bpm, rounded, 0-255)
+ *   3 bits    100 - SpO2 (%, rounded) for SpO2 94-100; 7 = escape, and
+ *             SpO2 (0-127) follows in 7 bits
+ *   1 bit     0 = valid and confidence as in the previous entry (not
+ *             valid, no confidence before the first); 1 = valid (1 bit)
+ *             and confidence (7 bits, 0-100 %, 0 = none) follow
+ *   step      the timestamp minus the previous entry's timestamp minus
+ *             the interval (0 for the first entry), zigzag-coded
+ *             (0, -1, 1, -2, ... -> 0, 1, 2, 3, ...):
+ *               0  + 8 bits           step 0-255
+ *               10 + 5 bits + 8 bits  k - 1 and the step less k intervals,
+ *                                     for k = 1-32 skipped prompts (a
+ *                                     timeout, or the night passed)
+ *               11 + 32 bits          any other step
+ *   Timestamps are exact.
+ */
+
+#ifndef MEASUREMENT_BLOCK_H
+#define MEASUREMENT_BLOCK_H
+
+#include "Particle.h"
+#include "measurement_data.h"
+
+#define MEASUREMENT_BLOCK_HEADER 7
+#define MEASUREMENT_BLOCK_MAX_BYTES 144     // Fits a record log payload
+#define MEASUREMENT_ENTRY_MAX_BITS 61
+#define MEASUREMENT_ENTRY_MAX_BYTES 8       // Most bytes one entry can add to a block
+#define MEASUREMENT_SPO2_ESCAPE 7
+#define MEASUREMENT_MAX_SKIPPED 32
+
+/*
+ * MeasurementBlock - Builds and decodes one block, in a fixed buffer
+ */
+class MeasurementBlock {
+public:
+    /*
+     * capacity: most entries in the block (at most 255).
+     */
+    MeasurementBlock(int capacity);
+    
+    void clear();
+    
+    /*
+     * Append a measurement taken on a schedule of interval seconds.
+     * Returns false, leaving the block unchanged, if it is full, the entry
+     * does not fit in MEASUREMENT_BLOCK_MAX_BYTES, or the block holds
+     * entries of another interval.
+     */
+    bool add(const MeasurementData &data, uint16_t interval);
+    
+    /*
+     * Take over an encoded block (read from storage). Returns false, and
+     * leaves the block empty, if it does not decode.
+     */
+    bool load(const uint8_t *block, int length);
+    
+    int getCount();
+    int getLength();
+    const uint8_t* getBytes();
+    uint32_t getFirstTimestamp();
+    
+    /*
+     * Decode the entries in order: rewind(), then next() until it returns
+     * false.
+     */
+    void rewind();
+    bool next(MeasurementData &data);
+
+private:
+    uint8_t bytes[MEASUREMENT_BLOCK_MAX_BYTES];
+    int capacity;
+    int length;
+    int bitLength;                      // Entry bits after the header
+    uint32_t lastTimestamp;             // Of the last entry added
+    uint8_t lastQuality;                // Valid bit and confidence of the last entry
+    
+    // Decoding position
+    int readIndex;
+    int readBit;
+    uint32_t readTimestamp;
+    uint8_t readQuality;
+    
+    int getInterval();
+    
+    /*
+     * Decode the entry at bit *position of the entry bits (bitLimit of
+     * them), which follows an entry taken at previous with quality.
+     * Returns false if it is cut off.
+     */
+    bool decodeEntry(int *position, int bitLimit, uint32_t previous, uint8_t *quality,
+                     MeasurementData &data);
+};
+
+#endif // MEASUREMENT_BLOCK_H
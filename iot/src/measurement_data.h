@@ -0,0 +1,25 @@
+/*
+ * measurement_data.h - Measurement Result
+ *
+ * The readings of one measurement, as produced by SensorManager and
+ * uploaded or stored by NetworkManager. Kept apart from sensor_manager.h
+ * so the encoders can be built without the sensor driver.
+ */
+
+#ifndef MEASUREMENT_DATA_H
+#define MEASUREMENT_DATA_H
+
+#include "Particle.h"
+
+/*
+ * MeasurementData - Container for sensor readings
+ */
+struct MeasurementData {
+    float heartRate;      // Heart rate in BPM
+    float spO2;           // Blood oxygen saturation (%)
+    uint32_t timestamp;   // Unix timestamp of measurement
+    bool valid;           // True if reading passed validation
+    float confidence;     // Confidence level (0.0 - 1.0)
+};
+
+#endif // MEASUREMENT_DATA_H
@@ -0,0 +1,40 @@
+/*
+ * measurement_record.cpp - Compact Binary Measurement Record Implementation
+ *
+ * See measurement_record.h for the format.
+ */
+
+#include "measurement_record.h"
+
+/*
+ * Round a reading to the nearest integer that fits one byte.
+ */
+static uint8_t toByte(float value) {
+    if (value <= 0) return 0;
+    if (value >= 255) return 255;
+    return (uint8_t)(value + 0.5f);
+}
+
+int MeasurementRecord::encode(const MeasurementData &data, uint8_t *out) {
+    uint8_t flags = 0;
+    if (data.valid) flags |= MEASUREMENT_FLAG_VALID;
+    if (data.confidence > 0) flags |= MEASUREMENT_FLAG_CONFIDENCE;
+    
+    out[0] = MEASUREMENT_RECORD_VERSION;
+    out[1] = data.timestamp & 0xFF;
+    out[2] = (data.timestamp >> 8) & 0xFF;
+    out[3] = (data.timestamp >> 16) & 0xFF;
+    out[4] = (data.timestamp >> 24) & 0xFF;
+    out[5] = toByte(data.heartRate);
+    out[6] = toByte(data.spO2);
+    out[7] = flags;
+    out[8] = toByte(min(data.confidence, 1.0f) * 100);
+    
+    return MEASUREMENT_RECORD_BYTES;
+}
+
+int MeasurementRecord::encodeBase64(const MeasurementData &data, char *out) {
+    uint8_t record[MEASUREMENT_RECORD_BYTES];
+    encode(data, record);
+    return WaveformEncoder::base64Encode(record, MEASUREMENT_RECORD_BYTES, out);
+}
@@ -0,0 +1,63 @@
+/*
+ * measurement_record.h - Compact Binary Measurement Record
+ *
+ * Fixed-layout encoding of one measurement for upload
+ * (COMPACT_MEASUREMENTS in config.h). The record is built in a caller
+ * buffer without heap allocation and sent base64-encoded; the API server
+ * decodes it (api-server/src/routes/measurements/measurement-codec.ts).
+ *
+ * RECORD FORMAT (version 1, 9 bytes, little endian):
+ *   byte 0    format version (MEASUREMENT_RECORD_VERSION)
+ *   byte 1-4  Unix timestamp (seconds)
+ *   byte 5    heart rate (bpm, rounded, 0-255)
+ *   byte 6    SpO2 (%, rounded, 0-255)
+ *   byte 7    flags: bit 0 = valid (quality "good", else "poor"),
+ *                    bit 1 = confidence present
+ *   byte 8    confidence (0-100 %)
+ *
+ * BATCH FORMAT (version 2, offline backlog):
+ *   byte 0    format version (MEASUREMENT_BATCH_VERSION)
+ *   byte 1..  measurement blocks back to back, as stored offline (see
+ *             measurement_block.h; each block's count gives its length)
+ *   Batches of version 1 records (concatenated) are still accepted by the
+ *   server.
+ *
+ * The device ID and API key are not part of the record. In webhook mode
+ * the webhook adds them from PARTICLE_DEVICE_ID and its own header; in
+ * HTTP mode they travel in the request body and X-API-Key header.
+ */
+
+#ifndef MEASUREMENT_RECORD_H
+#define MEASUREMENT_RECORD_H
+
+#include "Particle.h"
+#include "sensor_manager.h"
+
+#define MEASUREMENT_RECORD_VERSION 1
+#define MEASUREMENT_BATCH_VERSION 2
+#define MEASUREMENT_RECORD_BYTES 9
+#define MEASUREMENT_RECORD_BASE64_CHARS 12   // 4 * ceil(9 / 3), no padding
+
+#define MEASUREMENT_FLAG_VALID 0x01
+#define MEASUREMENT_FLAG_CONFIDENCE 0x02
+
+/*
+ * MeasurementRecord - Encodes MeasurementData in the compact upload format
+ */
+class MeasurementRecord {
+public:
+    /*
+     * Encode a measurement into out (MEASUREMENT_RECORD_BYTES).
+     * Returns the number of bytes written.
+     */
+    static int encode(const MeasurementData &data, uint8_t *out);
+    
+    /*
+     * Encode a measurement as base64 into out
+     * (MEASUREMENT_RECORD_BASE64_CHARS + 1 chars).
+     * Returns the number of characters written, excluding the terminator.
+     */
+    static int encodeBase64(const MeasurementData &data, char *out);
+};
+
+#endif // MEASUREMENT_RECORD_H
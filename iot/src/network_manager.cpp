@@ -6,35 +6,61 @@
  * DIRECT HTTP MODE (USE_WEBHOOK false):
  *   - Used for local development with api-server running on your computer
  *   - Device connects directly via TCP to API_SERVER_HOST:API_SERVER_PORT
- *   - Makes standard HTTP requests with X-API-Key header
+ *   - Makes standard HTTP requests with X-API-Key header over one
+ *     keep-alive connection (HttpConnection); stored timeouts are pipelined
  *   - Endpoints: POST /api/measurements, GET /api/devices/{id}/config
+ *     (and POST /api/measurements/batch with COMPACT_MEASUREMENTS)
+ *     (and POST /api/measurements/waveform with STREAM_RAW_WAVEFORM)
  * 
  * WEBHOOK MODE (USE_WEBHOOK true):
  *   - Used for production with Vercel-hosted HTTPS API
  *   - Device publishes events to Particle Cloud
  *   - Webhooks configured in Particle Console forward to Vercel
  *   - Events: heartrate-measurement, heartrate-timeout, heartrate-getconfig
+ *     (heartrate-record and heartrate-batch instead of heartrate-measurement
+ *     with COMPACT_MEASUREMENTS, and heartrate-waveform with STREAM_RAW_WAVEFORM)
  * 
  * OFFLINE MODE:
- *   When WiFi/Cloud is unavailable, data is stored locally in EEPROM:
- *   - Measurements: Up to 48 stored (circular buffer, ~24h at 30-min intervals)
- *   - Timeout notifications: Up to 24 stored (circular buffer)
+ *   When WiFi/Cloud is unavailable, data is appended to a record log
+ *   (RecordLog) in flash files or EEPROM (OFFLINE_LOG_ON_FLASH):
+ *   - Measurements (in delta-coded blocks) and timeout notifications: over
+ *     60,000 measurements fit in flash, about 750 in EEPROM; when full, the
+ *     oldest are erased first
+ *   - Storing or syncing a record writes only that record's bytes
  *   - Auto-sync: Stored data transmitted automatically when connection restored
+ *     (measurements in batches of SYNC_BATCH_SIZE with COMPACT_MEASUREMENTS)
  *   - Persistence: Data survives device reboot
  * 
+ * REQUEST QUEUE:
+ *   Uploads and config fetches are queued and advanced by processQueue()
+ *   from update(); nothing waits for the network. Publishes complete through
+ *   Particle.publish() futures, HTTP requests through HttpConnection::poll().
+ * 
+ * THREADS:
+ *   Work from the main thread arrives through submit() and results for it
+ *   leave through postEvent(). With THREADED_MODE these are the queues to
+ *   and from the network thread (runNetwork()); otherwise they call
+ *   runCommand() and handleEvent() directly.
+ * 
  * See WEBHOOK_SETUP.md for webhook configuration instructions.
  */
 
 #include "network_manager.h"
+#include "task_scheduler.h"
 #include "config.h"
 #include "led_controller.h"
 #include "state_machine.h"
 
+#include <time.h>
+
 extern LEDController ledController;
 extern StateMachine stateMachine;
+extern SensorManager sensorManager;
+
+// Persistent connection for direct HTTP requests (used when USE_WEBHOOK is false)
+HttpConnection httpConnection(API_SERVER_HOST, API_SERVER_PORT);
 
-// TCP client for direct HTTP connections (used when USE_WEBHOOK is false)
-TCPClient httpClient;
+static void formatTimestamp(uint32_t timestamp, char *out, int size);
 
 // Global pointer for static webhook callback
 NetworkManager* networkManagerInstance = nullptr;
@@ -47,33 +73,72 @@ NetworkManager* networkManagerInstance = nullptr;
 void configWebhookHandler(const char *event, const char *data) {
     if (networkManagerInstance != nullptr) {
         networkManagerInstance->handleConfigResponse(event, data);
+        TaskScheduler::wake();  // The response may have made work
     }
 }
 
-NetworkManager::NetworkManager() {
+NetworkManager::NetworkManager() : openBlock(STORED_BLOCK_SIZE) {
     wifiConnected = false;
     wasWifiConnected = false;
-    retryCount = 0;
     lastConnectionCheck = 0;
     lastConfigFetch = 0;
     configFetchPending = false;
     configFetchedSuccessfully = false;
     configFetchAttempts = 0;
     configRequestTime = 0;
-    storageIndex = 0;
-    storedCount = 0;
-    timeoutStorageIndex = 0;
-    storedTimeoutCount = 0;
+    lastUpdate = 0;
+    deviceID[0] = '\0';
+    measurementInterval = MEASUREMENT_INTERVAL_MS / 1000;
+    measurementsInFlight = 0;
+    #if THREADED_MODE
+    networkThread = nullptr;
+    #endif
+    
+    for (int i = 0; i < NETWORK_QUEUE_SIZE; i++) {
+        queue[i].state = REQUEST_FREE;
+    }
+    nextSequence = 0;
+    requestBody[0] = '\0';
+    #if USE_WEBHOOK
+    publishingSlot = -1;
+    #else
+    inFlightCount = 0;
+    #endif
+    #if COMPACT_MEASUREMENTS
+    batchCount = 0;
+    #else
+    storedBlock = -1;
+    storedEntry = 0;
+    #endif
+    #if STREAM_RAW_WAVEFORM
+    waveformLength = 0;
+    waveformParts = 0;
+    waveformTimestamp = 0;
+    #endif
 }
 
 /*
  * Initialize the network manager.
- * - Loads any stored measurements from EEPROM
+ * - Scans the offline record log
  * - Sets up webhook subscriptions (if USE_WEBHOOK is true)
  * - Prints connection mode information to serial
  */
 void NetworkManager::begin() {
-    loadFromEEPROM();
+    offlineLog.begin();
+    loadStoredMeasurements();
+    if (DEBUG_MODE) {
+        int measurements = countStoredMeasurements();
+        int timeouts = offlineLog.getPendingCount(LOG_RECORD_TIMEOUT);
+        if (measurements > 0) {
+            Serial.printlnf("Loaded %d measurements from offline log (pending sync)", measurements);
+        }
+        if (timeouts > 0) {
+            Serial.printlnf("Loaded %d timeout notifications from offline log (pending sync)", timeouts);
+        }
+    }
+    
+    // Cache the device ID so payloads can be built without allocation
+    snprintf(deviceID, sizeof(deviceID), "%.24s", System.deviceID().c_str());  // 24 hex digits
     
     // Set global instance pointer for static callback
     networkManagerInstance = this;
@@ -90,7 +155,12 @@ void NetworkManager::begin() {
         Serial.println("Mode: Particle Webhooks (HTTPS via Particle Cloud)");
         Serial.printlnf("Target: https://%s", API_SERVER_HOST);
         Serial.println("Webhook events:");
+        #if COMPACT_MEASUREMENTS
+        Serial.println("  'heartrate-record' -> POST /api/measurements");
+        Serial.println("  'heartrate-batch' -> POST /api/measurements/batch");
+        #else
         Serial.println("  'heartrate-measurement' -> POST /api/measurements");
+        #endif
         Serial.println("  'heartrate-timeout' -> POST /api/notifications");
         Serial.println("  'heartrate-getconfig' -> GET /api/devices/{id}/config");
         Serial.println("\n*** IMPORTANT: Configure webhooks in Particle Console! ***");
@@ -112,13 +182,14 @@ void NetworkManager::begin() {
     // 2. "hook-response/heartrate-getconfig" (all devices)
     // We subscribe to both to handle either configuration.
     
-    String deviceSpecificTopic = System.deviceID() + "/hook-response/heartrate-getconfig";
+    char deviceSpecificTopic[64];
+    snprintf(deviceSpecificTopic, sizeof(deviceSpecificTopic), "%s/hook-response/heartrate-getconfig", deviceID);
     Particle.subscribe(deviceSpecificTopic, configWebhookHandler, MY_DEVICES);
     Particle.subscribe("hook-response/heartrate-getconfig", configWebhookHandler, MY_DEVICES);
     
     if (DEBUG_MODE) {
         Serial.println("Subscribed to config webhook responses:");
-        Serial.printlnf("  - %s", deviceSpecificTopic.c_str());
+        Serial.printlnf("  - %s", deviceSpecificTopic);
         Serial.println("  - hook-response/heartrate-getconfig");
     }
     #endif
@@ -132,6 +203,11 @@ void NetworkManager::begin() {
         Serial.println("Config will be fetched from server (max 3 attempts)");
         Serial.println("If fetch fails, default configuration will be used");
     }
+    
+    #if THREADED_MODE
+    // From here on update() runs on the network thread
+    networkThread = new Thread("network", runNetwork, this, NETWORK_THREAD_PRIORITY, NETWORK_THREAD_STACK);
+    #endif
 }
 
 /*
@@ -141,9 +217,18 @@ void NetworkManager::begin() {
  *   - Syncing stored measurements when reconnected
  *   - Webhook response timeout detection
  *   - Periodic and initial config fetching
+ *   - Advancing queued and in-flight requests
  */
 void NetworkManager::update() {
+    #if THREADED_MODE
+    NetworkCommand command;
+    while (commandQueue.pop(command)) {
+        runCommand(command);
+    }
+    #endif
+    
     unsigned long now = millis();
+    lastUpdate = now;
     
     // Check WiFi connection state every 5 seconds
     if (now - lastConnectionCheck > 5000) {
@@ -165,12 +250,12 @@ void NetworkManager::update() {
         lastConnectionCheck = now;
         
         // Sync stored measurements when connected
-        if (wifiConnected && storedCount > 0) {
+        if (wifiConnected && (offlineLog.getPendingCount(LOG_RECORD_MEASUREMENTS) > 0 || openBlock.getCount() > 0)) {
             syncStoredMeasurements();
         }
         
         // Sync stored timeout notifications when connected
-        if (wifiConnected && storedTimeoutCount > 0) {
+        if (wifiConnected && offlineLog.getPendingCount(LOG_RECORD_TIMEOUT) > 0) {
             syncStoredTimeouts();
         }
     }
@@ -214,6 +299,50 @@ void NetworkManager::update() {
         fetchDeviceConfig();
         lastConfigFetch = now;
     }
+    
+    processQueue();
+}
+
+/*
+ * Next time update() has work. Mirrors the timers in update() and
+ * processQueue().
+ */
+unsigned long NetworkManager::getNextUpdate() {
+    #if THREADED_MODE
+    if (!commandQueue.isEmpty()) return millis();
+    #endif
+    
+    unsigned long next = lastConnectionCheck + 5000 + 1;
+    
+    for (int i = 0; i < NETWORK_QUEUE_SIZE; i++) {
+        if (queue[i].state == REQUEST_FREE) continue;
+        if (queue[i].state != REQUEST_QUEUED) {
+            // Publishing, connecting or awaiting a response: poll
+            return lastUpdate + SCHEDULER_POLL_INTERVAL;
+        }
+        unsigned long ready = queue[i].notBefore;
+        #if USE_WEBHOOK
+        unsigned long token = millis() + publishScheduler.getWaitTime();
+        if ((long)(token - ready) > 0) ready = token;
+        #endif
+        next = earliestDeadline(next, ready);
+    }
+    
+    #if USE_WEBHOOK
+    if (configFetchPending) {
+        next = earliestDeadline(next, configRequestTime + 10000 + 1);
+    }
+    #endif
+    
+    if (isConnected() && !configFetchPending) {
+        if (!configFetchedSuccessfully && configFetchAttempts < MAX_CONFIG_FETCH_ATTEMPTS) {
+            next = earliestDeadline(next, lastConfigFetch + 5000);
+        } else if (configFetchedSuccessfully) {
+            next = earliestDeadline(next, lastConfigFetch + CONFIG_FETCH_INTERVAL_MS);
+        }
+    }
+    
+    return next;
 }
 
 /*
@@ -231,164 +360,654 @@ bool NetworkManager::isConnected() {
 
 /*
  * Transmit a measurement to the API server.
- * If offline, stores measurement locally for later sync.
- * Updates state machine and LED feedback on completion.
+ * Hands it to runCommand(), which uploads it or stores it if offline.
+ * The state machine returns to IDLE when EVENT_MEASUREMENT_DONE is handled.
  */
 bool NetworkManager::transmitMeasurement(MeasurementData data) {
-    if (!isConnected()) {
-        if (DEBUG_MODE) {
-            Serial.println("No connection - storing measurement locally");
-            Serial.println("Measurement will be sent when connection is restored");
+    NetworkCommand command = {};
+    command.type = COMMAND_MEASUREMENT;
+    command.data = data;
+    command.interval = stateMachine.getMeasurementInterval() / 1000;
+    
+    measurementsInFlight++;
+    if (!submit(command)) {
+        measurementsInFlight--;
+        if (DEBUG_MODE) Serial.println("Network thread busy - measurement handed over later");
+        return false;
+    }
+    return true;
+}
+
+bool NetworkManager::isTransmitting() {
+    return measurementsInFlight > 0;
+}
+
+// ============================================================================
+// Commands and Events - Between the Main and Network Threads
+// ============================================================================
+
+bool NetworkManager::submit(const NetworkCommand &command) {
+    #if THREADED_MODE
+    return commandQueue.push(command);
+    #else
+    runCommand(command);
+    return true;
+    #endif
+}
+
+/*
+ * Carry out a command from the main thread.
+ * A measurement or timeout is queued for upload, or stored locally if
+ * offline; completeRequest() posts the results of an upload.
+ */
+bool NetworkManager::runCommand(const NetworkCommand &command) {
+    switch (command.type) {
+        case COMMAND_MEASUREMENT: {
+            measurementInterval = command.interval;
+            NetworkRequest *request = isConnected() ? enqueue(REQUEST_MEASUREMENT) : nullptr;
+            
+            if (request == nullptr) {
+                if (DEBUG_MODE) {
+                    Serial.println("No connection - storing measurement locally");
+                    Serial.println("Measurement will be sent when connection is restored");
+                }
+                storeMeasurement(command.data);
+                postEvent(EVENT_FLASH_WARNING);  // Yellow flash = stored offline
+                if (DEBUG_MODE) {
+                    Serial.printlnf("Measurement STORED locally (%d pending)", countStoredMeasurements());
+                }
+                postEvent(EVENT_MEASUREMENT_DONE);
+                return false;
+            }
+            
+            request->data = command.data;
+            return true;
         }
-        storeMeasurement(data);
-        ledController.flashWarning();  // Yellow flash = stored offline
-        if (DEBUG_MODE) {
-            Serial.printlnf("Measurement STORED locally (%d/%d)", storedCount, MAX_STORED_MEASUREMENTS);
+        
+        case COMMAND_TIMEOUT: {
+            NetworkRequest *request = isConnected() ? enqueue(REQUEST_TIMEOUT) : nullptr;
+            
+            if (request == nullptr) {
+                if (DEBUG_MODE) {
+                    Serial.println("No connection - storing timeout notification locally");
+                    Serial.println("Timeout will be sent when connection is restored");
+                }
+                storeTimeoutNotification(command.timestamp);
+                postEvent(EVENT_FLASH_WARNING);  // Yellow flash = stored offline
+                if (DEBUG_MODE) {
+                    Serial.printlnf("Timeout STORED locally (%d pending)",
+                                    offlineLog.getPendingCount(LOG_RECORD_TIMEOUT));
+                }
+                return false;
+            }
+            
+            request->timestamp = command.timestamp;
+            return true;
         }
-        stateMachine.setState(STATE_IDLE);
-        stateMachine.scheduleNextMeasurement();
-        return false;
+        
+        case COMMAND_CONFIG_RECEIVED:
+            configFetchPending = false;
+            if (command.applied) configFetchedSuccessfully = true;
+            return false;
     }
-    
-    String payload = createJSON(data);
-    
-    if (DEBUG_MODE) {
-        Serial.println("Posting measurement:");
-        Serial.println(payload);
+    return false;
+}
+
+void NetworkManager::postEvent(const NetworkEvent &event) {
+    #if THREADED_MODE
+    // The main thread drains the queue every pass; only a stalled main
+    // thread keeps it full
+    while (!eventQueue.push(event)) {
+        delay(SCHEDULER_POLL_INTERVAL);
+    }
+    TaskScheduler::wake();
+    #else
+    handleEvent(event);
+    #endif
+}
+
+void NetworkManager::postEvent(NetworkEventType type) {
+    NetworkEvent event = {};
+    event.type = type;
+    postEvent(event);
+}
+
+/*
+ * Apply a result from the network side to the state machine or LED.
+ */
+void NetworkManager::handleEvent(const NetworkEvent &event) {
+    switch (event.type) {
+        case EVENT_MEASUREMENT_DONE:
+            if (measurementsInFlight > 0) measurementsInFlight--;
+            stateMachine.setState(STATE_IDLE);
+            stateMachine.scheduleNextMeasurement();
+            break;
+        
+        case EVENT_FLASH_SUCCESS:
+            ledController.flashSuccess();
+            break;
+        
+        case EVENT_FLASH_ERROR:
+            ledController.flashError();
+            break;
+        
+        case EVENT_FLASH_WARNING:
+            ledController.flashWarning();
+            break;
+        
+        case EVENT_CONFIG:
+            stateMachine.applyConfiguration(event.frequency, event.startTime, event.endTime);
+            if (DEBUG_MODE) {
+                Serial.println("✓ Configuration applied successfully from server");
+                Serial.printlnf("  Frequency: %d seconds", event.frequency);
+                Serial.printlnf("  Active: %s - %s", event.startTime, event.endTime);
+            }
+            break;
     }
+}
+
+#if THREADED_MODE
+void NetworkManager::processEvents() {
+    NetworkEvent event;
+    while (eventQueue.pop(event)) {
+        handleEvent(event);
+    }
+}
+
+unsigned long NetworkManager::getNextEvent() {
+    return millis() + (eventQueue.isEmpty() ? SCHEDULER_IDLE_WAKEUP : 0);
+}
+
+/*
+ * Network thread. A publish or HTTP exchange in progress holds up only
+ * this thread; the main thread and the acquisition thread carry on.
+ */
+void NetworkManager::runNetwork(void *manager) {
+    NetworkManager *network = static_cast<NetworkManager*>(manager);
     
-    bool success = postMeasurement(payload);
-    
-    if (success) {
-        ledController.flashSuccess();  // Green flash = sent successfully
-        if (DEBUG_MODE) Serial.println("Measurement posted successfully");
-    } else {
-        ledController.flashError();    // Red flash = error
-        if (DEBUG_MODE) Serial.println("Failed to post measurement");
+    while (true) {
+        network->update();
         
-        // Retry logic with local storage fallback
-        if (retryCount >= MAX_NETWORK_RETRY) {
-            storeMeasurement(data);
-            retryCount = 0;
-        } else {
-            retryCount++;
-            delay(1000);
-            return transmitMeasurement(data);  // Recursive retry
-        }
+        unsigned long now = millis();
+        unsigned long wake = earliestDeadline(network->getNextUpdate(), now + NETWORK_THREAD_MAX_SLEEP);
+        if ((long)(wake - now) > 0) delay(wake - now);
     }
-    
-    stateMachine.setState(STATE_IDLE);
-    stateMachine.scheduleNextMeasurement();
-    return success;
 }
+#endif
 
 // ============================================================================
-// POST Measurement - Dual Mode Implementation
+// Request Queue - Dual Mode Implementation
 // ============================================================================
 
 /*
- * Post measurement JSON to API server.
+ * Send order between queued requests (lower first): live data before
+ * backlog sync, config polls last.
+ */
+static int requestPriority(const NetworkRequest &request) {
+    switch (request.type) {
+        case REQUEST_MEASUREMENT:
+            return 0;
+        case REQUEST_TIMEOUT:
+            return request.index < 0 ? 1 : 3;   // Live, or stored
+        case REQUEST_WAVEFORM:
+            return 2;
+        case REQUEST_STORED_MEASUREMENT:
+        case REQUEST_BATCH:
+            return 3;
+        default:
+            return 4;
+    }
+}
+
+/*
+ * Add a request to the queue.
+ * Returns nullptr if all NETWORK_QUEUE_SIZE slots are in use.
  * 
- * WEBHOOK MODE: Publishes to 'heartrate-measurement' event.
- *   Particle Cloud forwards to configured webhook URL.
+ * Batches, config fetches and waveforms are coalesced. Their payload is
+ * built when they are sent, so one that is still waiting already covers a
+ * newer request (a batch picks up measurements stored meanwhile). One that
+ * has started sending cannot take more, and nullptr is returned.
+ */
+NetworkRequest* NetworkManager::enqueue(NetworkRequestType type) {
+    if (type == REQUEST_BATCH || type == REQUEST_CONFIG || type == REQUEST_WAVEFORM) {
+        for (int i = 0; i < NETWORK_QUEUE_SIZE; i++) {
+            if (queue[i].state == REQUEST_FREE || queue[i].type != type) continue;
+            bool started = queue[i].state != REQUEST_QUEUED || queue[i].index > 0;
+            return started ? nullptr : &queue[i];
+        }
+    }
+    
+    for (int i = 0; i < NETWORK_QUEUE_SIZE; i++) {
+        if (queue[i].state != REQUEST_FREE) continue;
+        
+        queue[i].type = type;
+        queue[i].state = REQUEST_QUEUED;
+        queue[i].sequence = nextSequence++;
+        queue[i].notBefore = millis();
+        queue[i].attempts = 0;
+        queue[i].index = -1;
+        queue[i].timestamp = 0;
+        return &queue[i];
+    }
+    
+    if (DEBUG_MODE) Serial.println("Network queue full - request not queued");
+    return nullptr;
+}
+
+bool NetworkManager::isQueued(NetworkRequestType type, bool storedOnly) {
+    for (int i = 0; i < NETWORK_QUEUE_SIZE; i++) {
+        if (queue[i].state == REQUEST_FREE || queue[i].type != type) continue;
+        if (storedOnly && queue[i].index < 0) continue;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Highest priority queued request whose retry delay has passed; the oldest
+ * among equals.
+ */
+NetworkRequest* NetworkManager::nextReadyRequest() {
+    unsigned long now = millis();
+    NetworkRequest *next = nullptr;
+    int nextPriority = 0;
+    
+    for (int i = 0; i < NETWORK_QUEUE_SIZE; i++) {
+        if (queue[i].state != REQUEST_QUEUED) continue;
+        if ((long)(now - queue[i].notBefore) < 0) continue;
+        
+        int priority = requestPriority(queue[i]);
+        if (next == nullptr || priority < nextPriority ||
+            (priority == nextPriority && (int32_t)(queue[i].sequence - next->sequence) < 0)) {
+            next = &queue[i];
+            nextPriority = priority;
+        }
+    }
+    return next;
+}
+
+/*
+ * Advance the request queue without waiting.
+ * 
+ * WEBHOOK MODE: One publish at a time. Particle.publish() returns a future;
+ *   the request completes when the cloud acknowledges it. Each publish
+ *   takes a PublishScheduler token; without one, the request waits for a
+ *   later pass. A request dropped before publishing (no cloud connection,
+ *   nothing to send) does not use one.
  * 
- * HTTP MODE: Makes direct TCP connection and sends HTTP POST.
- *   Connects to API_SERVER_HOST:API_SERVER_PORT.
+ * HTTP MODE: Requests go out in priority order over the persistent connection.
+ *   A new request is written as soon as the previous one has been, up to
+ *   HTTP_MAX_PIPELINE outstanding; responses complete them in order.
  */
-bool NetworkManager::postMeasurement(String jsonPayload) {
+void NetworkManager::processQueue() {
+    static char target[64];
+    
     #if USE_WEBHOOK
-    // ===== WEBHOOK MODE: Publish to Particle Cloud =====
-    // The Particle Cloud will forward this event to the webhook URL
-    // configured in Particle Console (heartrate-measurement -> POST /api/measurements)
+    // ===== WEBHOOK MODE =====
+    if (publishingSlot >= 0) {
+        if (!publishResult.isDone()) return;
+        
+        NetworkRequest &request = queue[publishingSlot];
+        publishingSlot = -1;
+        bool success = publishResult.isSucceeded() && publishResult.result();
+        if (DEBUG_MODE) {
+            Serial.printlnf("Webhook publish '%s': %s", target, success ? "success" : "failed");
+        }
+        completeRequest(request, success);
+    }
+    
+    // Wait for a token, but take it only once the publish is sure to go out
+    NetworkRequest *request = nextReadyRequest();
+    if (request == nullptr || publishScheduler.getWaitTime() > 0) return;
     
     if (!Particle.connected()) {
         if (DEBUG_MODE) Serial.println("Not connected to Particle Cloud");
-        return false;
+        completeRequest(*request, false);
+        return;
     }
     
-    if (DEBUG_MODE) {
-        Serial.println("Publishing to webhook 'heartrate-measurement'...");
+    if (!buildRequest(*request, target, sizeof(target))) {
+        request->state = REQUEST_FREE;
+        return;
     }
     
     // Particle.publish has a 1024 byte limit for data
-    bool success = Particle.publish("heartrate-measurement", jsonPayload, PRIVATE);
-    
-    if (DEBUG_MODE) {
-        Serial.printlnf("Webhook publish: %s", success ? "success" : "failed");
-    }
-    
-    // Delay to prevent rate limiting (max 1 publish/sec per device)
-    delay(1100);
-    
-    return success;
+    publishScheduler.tryAcquire();
+    publishResult = Particle.publish(target, requestBody, PRIVATE);
+    request->state = REQUEST_PUBLISHING;
+    publishingSlot = request - queue;
     
     #else
-    // ===== HTTP MODE: Direct TCP connection =====
-    // Connect directly to the API server and send HTTP POST request
-    
-    if (!WiFi.ready()) return false;
+    // ===== HTTP MODE =====
+    HttpEvent event = httpConnection.poll();
     
-    if (DEBUG_MODE) {
-        Serial.printlnf("Connecting to %s:%d (HTTP)...", API_SERVER_HOST, API_SERVER_PORT);
+    if (event == HTTP_RESPONSE && inFlightCount > 0) {
+        // Oldest request sent is the one answered
+        NetworkRequest &request = queue[inFlight[0]];
+        inFlightCount--;
+        memmove(inFlight, inFlight + 1, inFlightCount * sizeof(inFlight[0]));
+        
+        int status = httpConnection.getStatus();
+        if (DEBUG_MODE) {
+            Serial.printlnf("Response: %d (connections opened: %lu)", status,
+                            (unsigned long)httpConnection.getConnectCount());
+        }
+        completeRequest(request, status == 200 || (status == 201 && request.type != REQUEST_CONFIG));
+    } else if (event == HTTP_ERROR) {
+        // Everything outstanding is lost. When the server had closed the
+        // kept-alive connection first, none of it was processed: resend.
+        // Otherwise some may have been stored before the connection dropped;
+        // failing them is still safe, as the server keeps one measurement
+        // per device and timestamp and ignores the copies a retry sends.
+        bool stale = httpConnection.isStale();
+        if (DEBUG_MODE && stale) Serial.println("HTTP: kept-alive connection was closed, reconnecting");
+        
+        int count = inFlightCount;
+        inFlightCount = 0;
+        for (int i = 0; i < count; i++) {
+            NetworkRequest &request = queue[inFlight[i]];
+            if (stale) {
+                request.state = REQUEST_QUEUED;
+            } else {
+                completeRequest(request, false);
+            }
+        }
     }
     
-    // Connect to API server
-    if (!httpClient.connect(API_SERVER_HOST, API_SERVER_PORT)) {
-        if (DEBUG_MODE) Serial.println("Connection failed!");
-        return false;
+    // Mirror connection progress in the in-flight requests
+    for (int i = 0; i < inFlightCount; i++) {
+        NetworkRequest &request = queue[inFlight[i]];
+        if (i == inFlightCount - 1 && httpConnection.isSending()) {
+            request.state = REQUEST_SENDING;
+        } else if (i == 0 && httpConnection.getPhase() == HTTP_READ_BODY) {
+            request.state = REQUEST_READ_BODY;
+        } else {
+            request.state = REQUEST_AWAIT_HEADERS;
+        }
     }
     
-    // Build HTTP POST request
-    String httpRequest = "";
-    httpRequest += "POST /api/measurements HTTP/1.1\r\n";
-    httpRequest += "Host: " + String(API_SERVER_HOST) + ":" + String(API_SERVER_PORT) + "\r\n";
-    httpRequest += "Content-Type: application/json\r\n";
-    httpRequest += "X-API-Key: " + String(API_KEY) + "\r\n";
-    httpRequest += "Content-Length: " + String(jsonPayload.length()) + "\r\n";
-    httpRequest += "Connection: close\r\n";
-    httpRequest += "\r\n";
-    httpRequest += jsonPayload;
-    
-    // Send request
-    httpClient.print(httpRequest);
-    
-    if (DEBUG_MODE) {
-        Serial.println("Request sent, waiting for response...");
+    // Start the next request. A new connection is opened on its own pass
+    // (CONNECTING), as TCPClient::connect() blocks for the handshake.
+    NetworkRequest *request = nullptr;
+    for (int i = 0; i < NETWORK_QUEUE_SIZE; i++) {
+        if (queue[i].state == REQUEST_CONNECTING) request = &queue[i];
     }
     
-    // Wait for response (5 second timeout)
-    unsigned long timeout = millis() + 5000;
-    while (!httpClient.available() && millis() < timeout) {
-        delay(10);
+    if (request != nullptr) {
+        if (!WiFi.ready() || !httpConnection.connect()) {
+            completeRequest(*request, false);
+            return;
+        }
+    } else {
+        if (httpConnection.isSending() || inFlightCount >= HTTP_MAX_PIPELINE) return;
+        
+        request = nextReadyRequest();
+        if (request == nullptr) return;
+        
+        if (!httpConnection.isReusable()) {
+            request->state = REQUEST_CONNECTING;
+            return;
+        }
     }
     
-    if (!httpClient.available()) {
-        if (DEBUG_MODE) Serial.println("Response timeout!");
-        httpClient.stop();
-        return false;
+    if (!buildRequest(*request, target, sizeof(target))) {
+        request->state = REQUEST_FREE;
+        return;
     }
     
-    // Read and parse response
-    bool success = false;
-    String statusLine = httpClient.readStringUntil('\n');
-    
+    const char *method = (request->type == REQUEST_CONFIG) ? "GET" : "POST";
     if (DEBUG_MODE) {
-        Serial.printlnf("Response: %s", statusLine.c_str());
+        Serial.printlnf("%s http://%s:%d%s", method, API_SERVER_HOST, API_SERVER_PORT, target);
     }
     
-    // Check for success status codes (200, 201)
-    if (statusLine.indexOf("200") > 0 || statusLine.indexOf("201") > 0) {
-        success = true;
+    bool config = request->type == REQUEST_CONFIG;
+    if (!httpConnection.send(method, target, config ? nullptr : requestBody, config ? &configParser : nullptr)) {
+        completeRequest(*request, false);
+        return;
     }
-    
-    // Drain remaining response
-    while (httpClient.available()) {
-        httpClient.read();
+    request->state = REQUEST_SENDING;
+    inFlight[inFlightCount++] = request - queue;
+    #endif
+}
+
+/*
+ * Build a request's payload into requestBody, and its HTTP path or webhook
+ * event name into target.
+ */
+bool NetworkManager::buildRequest(NetworkRequest &request, char *target, int targetSize) {
+    requestBody[0] = '\0';
+    
+    switch (request.type) {
+        case REQUEST_MEASUREMENT:
+        case REQUEST_STORED_MEASUREMENT: {
+            MeasurementData data = request.data;
+            if (request.type == REQUEST_STORED_MEASUREMENT && !offlineLog.isPending(request.index)) {
+                return false;
+            }
+            
+            #if COMPACT_MEASUREMENTS
+            createRecordPayload(data, requestBody, sizeof(requestBody));
+            #else
+            createJSON(data, requestBody, sizeof(requestBody));
+            #endif
+            
+            #if USE_WEBHOOK
+            snprintf(target, targetSize, "%s", COMPACT_MEASUREMENTS ? "heartrate-record" : "heartrate-measurement");
+            #else
+            snprintf(target, targetSize, "/api/measurements");
+            #endif
+            
+            if (DEBUG_MODE) {
+                Serial.println(request.type == REQUEST_MEASUREMENT ? "Posting measurement:"
+                                                                   : "Syncing stored measurement to server...");
+                Serial.println(requestBody);
+            }
+            return true;
+        }
+        
+        #if COMPACT_MEASUREMENTS
+        case REQUEST_BATCH: {
+            int measurements = buildBatchPayload(requestBody, sizeof(requestBody));
+            if (measurements == 0) return false;
+            
+            #if USE_WEBHOOK
+            snprintf(target, targetSize, "heartrate-batch");
+            #else
+            snprintf(target, targetSize, "/api/measurements/batch");
+            #endif
+            
+            if (DEBUG_MODE) {
+                Serial.printlnf("Syncing %d stored measurement(s) to server...", measurements);
+            }
+            return true;
+        }
+        #endif
+        
+        case REQUEST_TIMEOUT:
+            if (request.index >= 0 && !offlineLog.isPending(request.index)) return false;
+            createTimeoutJSON(request.timestamp, requestBody, sizeof(requestBody));
+            
+            #if USE_WEBHOOK
+            snprintf(target, targetSize, "heartrate-timeout");
+            #else
+            snprintf(target, targetSize, "/api/notifications");
+            #endif
+            
+            if (DEBUG_MODE) {
+                Serial.println(request.index < 0 ? "Sending user timeout notification:"
+                                                 : "Syncing stored timeout notification to server...");
+                Serial.println(requestBody);
+            }
+            return true;
+        
+        #if STREAM_RAW_WAVEFORM
+        case REQUEST_WAVEFORM:
+            buildWaveformPayload(request.index, requestBody, sizeof(requestBody));
+            
+            #if USE_WEBHOOK
+            snprintf(target, targetSize, "heartrate-waveform");
+            #else
+            snprintf(target, targetSize, "/api/measurements/waveform");
+            #endif
+            return true;
+        #endif
+        
+        case REQUEST_CONFIG:
+            if (DEBUG_MODE) {
+                Serial.printlnf("Fetching device configuration (attempt %d/%d)...",
+                                configFetchAttempts, MAX_CONFIG_FETCH_ATTEMPTS);
+            }
+            
+            #if USE_WEBHOOK
+            // The webhook makes a GET request to /api/devices/{deviceId}/config
+            // and returns the response via hook-response event
+            snprintf(requestBody, sizeof(requestBody), "{\"deviceId\":\"%s\",\"apiKey\":\"%s\"}",
+                     deviceID, API_KEY);
+            snprintf(target, targetSize, "heartrate-getconfig");
+            #else
+            snprintf(target, targetSize, "/api/devices/%s/config", deviceID);
+            #endif
+            return true;
+        
+        default:
+            return false;
+    }
+}
+
+/*
+ * Apply the result of a finished request.
+ * Most requests free their slot here; failed measurement uploads and
+ * unfinished waveforms go back to the queue.
+ */
+void NetworkManager::completeRequest(NetworkRequest &request, bool success) {
+    switch (request.type) {
+        case REQUEST_MEASUREMENT:
+            if (success) {
+                postEvent(EVENT_FLASH_SUCCESS);  // Green flash = sent successfully
+                if (DEBUG_MODE) Serial.println("Measurement posted successfully");
+                
+                #if STREAM_RAW_WAVEFORM
+                transmitWaveform(request.data.timestamp);
+                #endif
+            } else {
+                postEvent(EVENT_FLASH_ERROR);    // Red flash = error
+                if (DEBUG_MODE) Serial.println("Failed to post measurement");
+                
+                // Retry after a delay, then fall back to local storage
+                if (request.attempts < MAX_NETWORK_RETRY) {
+                    request.attempts++;
+                    request.state = REQUEST_QUEUED;
+                    request.notBefore = millis() + NETWORK_RETRY_DELAY_MS;
+                    return;
+                }
+                storeMeasurement(request.data);
+            }
+            
+            postEvent(EVENT_MEASUREMENT_DONE);
+            break;
+        
+        #if !COMPACT_MEASUREMENTS
+        case REQUEST_STORED_MEASUREMENT:
+            if (success && offlineLog.isPending(request.index)) {
+                // The block is done once its last measurement is sent
+                uint8_t count = 0;
+                offlineLog.read(request.index, &count, 1);
+                if (++storedEntry >= count) {
+                    offlineLog.markDone(request.index);
+                    storedEntry = 0;
+                }
+                if (DEBUG_MODE) {
+                    Serial.printlnf("Stored measurement synced successfully (%d remaining)",
+                                    countStoredMeasurements());
+                }
+                postEvent(EVENT_FLASH_SUCCESS);  // Green flash = sync success
+            }
+            break;
+        #endif
+        
+        #if COMPACT_MEASUREMENTS
+        case REQUEST_BATCH:
+            if (success) {
+                for (int i = 0; i < batchCount; i++) {
+                    offlineLog.markDone(batchIndex[i]);
+                }
+                
+                if (DEBUG_MODE) {
+                    Serial.printlnf("Stored measurements synced successfully (%d remaining)",
+                                    countStoredMeasurements());
+                }
+                postEvent(EVENT_FLASH_SUCCESS);  // Green flash = sync success
+            }
+            batchCount = 0;
+            break;
+        #endif
+        
+        case REQUEST_TIMEOUT:
+            if (request.index < 0) {
+                if (success) {
+                    if (DEBUG_MODE) Serial.println("Timeout notification sent successfully");
+                } else {
+                    // Failed to send - store for later
+                    if (DEBUG_MODE) Serial.println("Failed to send timeout - storing locally for later");
+                    storeTimeoutNotification(request.timestamp);
+                }
+            } else if (success && offlineLog.markDone(request.index)) {
+                if (DEBUG_MODE) {
+                    Serial.printlnf("Stored timeout synced successfully (%d remaining)",
+                                    offlineLog.getPendingCount(LOG_RECORD_TIMEOUT));
+                }
+                postEvent(EVENT_FLASH_SUCCESS);  // Green flash = sync success
+            }
+            break;
+        
+        #if STREAM_RAW_WAVEFORM
+        case REQUEST_WAVEFORM:
+            if (!success) {
+                if (DEBUG_MODE) Serial.printlnf("Waveform part %d/%d failed - trace dropped",
+                                                request.index + 1, waveformParts);
+                break;
+            }
+            if (++request.index < waveformParts) {
+                request.state = REQUEST_QUEUED;  // Next part
+                return;
+            }
+            if (DEBUG_MODE) Serial.println("Waveform uploaded");
+            break;
+        #endif
+        
+        case REQUEST_CONFIG:
+            #if USE_WEBHOOK
+            // Published: the config arrives in handleConfigResponse()
+            if (success) {
+                configRequestTime = millis();
+                if (DEBUG_MODE) Serial.println("Waiting for webhook response...");
+            } else {
+                configFetchPending = false;
+            }
+            #else
+            configFetchPending = false;
+            if (success) {
+                // The body was parsed as it arrived (configParser)
+                NetworkEvent config;
+                configFetchedSuccessfully = readParsedConfig(config);
+                if (configFetchedSuccessfully) postEvent(config);
+                if (DEBUG_MODE && !configFetchedSuccessfully) {
+                    Serial.println("Could not parse config values from response");
+                }
+            } else if (DEBUG_MODE) {
+                Serial.println("Config fetch failed");
+                if (configFetchAttempts >= MAX_CONFIG_FETCH_ATTEMPTS) {
+                    Serial.println("Max attempts reached - using default configuration");
+                }
+            }
+            #endif
+            break;
+        
+        default:
+            break;
     }
     
-    httpClient.stop();
-    return success;
-    #endif
+    request.state = REQUEST_FREE;
 }
 
 // ============================================================================
@@ -397,142 +1016,87 @@ bool NetworkManager::postMeasurement(String jsonPayload) {
 
 /*
  * Send notification when user doesn't respond to measurement prompt.
- * Posts to /api/notifications endpoint.
- * If offline, stores timeout for later transmission.
+ * Hands it to runCommand(), which queues a POST to /api/notifications
+ * endpoint, or stores the timeout for later transmission if offline.
  */
 bool NetworkManager::sendTimeoutNotification() {
-    uint32_t currentTimestamp = Time.now();
+    NetworkCommand command = {};
+    command.type = COMMAND_TIMEOUT;
+    command.timestamp = Time.now();
     
-    if (!isConnected()) {
-        if (DEBUG_MODE) {
-            Serial.println("No connection - storing timeout notification locally");
-            Serial.println("Timeout will be sent when connection is restored");
-        }
-        storeTimeoutNotification(currentTimestamp);
-        ledController.flashWarning();  // Yellow flash = stored offline
-        if (DEBUG_MODE) {
-            Serial.printlnf("Timeout STORED locally (%d/%d)", storedTimeoutCount, MAX_STORED_TIMEOUTS);
-        }
+    if (!submit(command)) {
+        if (DEBUG_MODE) Serial.println("Network thread busy - timeout notification dropped");
         return false;
     }
-    
-    String deviceID = System.deviceID();
-    String timestampISO = Time.format(currentTimestamp, TIME_FORMAT_ISO8601_FULL);
-    
-    // Create JSON payload for timeout notification
-    String jsonPayload = "{";
-    jsonPayload += "\"deviceId\":\"" + deviceID + "\",";
-    jsonPayload += "\"type\":\"user_timeout\",";
-    jsonPayload += "\"message\":\"User did not place finger on sensor within timeout period\",";
-    jsonPayload += "\"timestamp\":\"" + timestampISO + "\"";
-    #if USE_WEBHOOK
-    // Include API key in payload for webhook mode (webhook extracts for header)
-    jsonPayload += ",\"apiKey\":\"" + String(API_KEY) + "\"";
-    #endif
-    jsonPayload += "}";
-    
-    if (DEBUG_MODE) {
-        Serial.println("Sending user timeout notification:");
-        Serial.println(jsonPayload);
-    }
-    
-    bool success = postTimeoutNotification(jsonPayload);
-    
-    if (success) {
-        if (DEBUG_MODE) {
-            Serial.println("Timeout notification sent successfully");
-        }
-    } else {
-        // Failed to send - store for later
-        if (DEBUG_MODE) {
-            Serial.println("Failed to send timeout - storing locally for later");
-        }
-        storeTimeoutNotification(currentTimestamp);
-    }
-    
-    return success;
+    return true;
 }
 
+#if STREAM_RAW_WAVEFORM
+// ============================================================================
+// Raw Waveform Upload
+// ============================================================================
+
 /*
- * Post timeout notification to server.
- * Internal function used by sendTimeoutNotification and syncStoredTimeouts.
+ * Queue upload of the raw trace of the measurement just transmitted.
+ * The encoded blocks are concatenated and sent base64-encoded in numbered
+ * parts; the server joins the parts of a measurement (deviceId + timestamp)
+ * in order and decodes them. Traces are not stored offline.
  */
-bool NetworkManager::postTimeoutNotification(String jsonPayload) {
-    #if USE_WEBHOOK
-    // ===== WEBHOOK MODE =====
-    if (!Particle.connected()) {
-        if (DEBUG_MODE) Serial.println("Not connected to Particle Cloud");
-        return false;
+void NetworkManager::transmitWaveform(uint32_t timestamp) {
+    // A trace still waiting to be sent is replaced by this one
+    NetworkRequest *request = enqueue(REQUEST_WAVEFORM);
+    if (request == nullptr) {
+        if (DEBUG_MODE) Serial.println("Previous waveform still uploading - trace dropped");
+        return;
     }
     
-    bool success = Particle.publish("heartrate-timeout", jsonPayload, PRIVATE);
+    WaveformEncoder& waveform = sensorManager.getWaveform();
+    waveform.flush();
     
-    if (DEBUG_MODE) {
-        Serial.printlnf("Timeout webhook: %s", success ? "success" : "failed");
+    waveformLength = 0;
+    for (int i = 0; i < waveform.getBlockCount(); i++) {
+        int length;
+        const uint8_t* block = waveform.getBlock(i, length);
+        memcpy(waveformData + waveformLength, block, length);
+        waveformLength += length;
     }
-    
-    delay(1100);  // Rate limiting
-    return success;
-    
-    #else
-    // ===== HTTP MODE =====
-    if (!httpClient.connect(API_SERVER_HOST, API_SERVER_PORT)) {
-        if (DEBUG_MODE) Serial.println("Timeout notification: connection failed");
-        return false;
+    if (waveformLength == 0) {
+        request->state = REQUEST_FREE;
+        return;
     }
     
-    // Build HTTP POST request
-    String httpRequest = "";
-    httpRequest += "POST /api/notifications HTTP/1.1\r\n";
-    httpRequest += "Host: " + String(API_SERVER_HOST) + ":" + String(API_SERVER_PORT) + "\r\n";
-    httpRequest += "Content-Type: application/json\r\n";
-    httpRequest += "X-API-Key: " + String(API_KEY) + "\r\n";
-    httpRequest += "Content-Length: " + String(jsonPayload.length()) + "\r\n";
-    httpRequest += "Connection: close\r\n";
-    httpRequest += "\r\n";
-    httpRequest += jsonPayload;
-    
-    httpClient.print(httpRequest);
-    
-    // Wait for response
-    unsigned long timeout = millis() + 5000;
-    while (!httpClient.available() && millis() < timeout) {
-        delay(10);
-    }
+    waveformParts = (waveformLength + WAVEFORM_PART_BYTES - 1) / WAVEFORM_PART_BYTES;
+    waveformTimestamp = timestamp;
     
-    bool success = false;
-    if (httpClient.available()) {
-        String statusLine = httpClient.readStringUntil('\n');
-        if (DEBUG_MODE) {
-            Serial.printlnf("Timeout notification response: %s", statusLine.c_str());
-        }
-        success = (statusLine.indexOf("200") > 0 || statusLine.indexOf("201") > 0);
-        
-        // Drain remaining response
-        while (httpClient.available()) {
-            httpClient.read();
-        }
-    } else {
-        if (DEBUG_MODE) Serial.println("Timeout notification: response timeout");
+    if (DEBUG_MODE) {
+        Serial.printlnf("Uploading waveform: %d blocks, %d bytes, %d part(s)",
+                        waveform.getBlockCount(), waveformLength, waveformParts);
     }
     
-    httpClient.stop();
-    return success;
-    #endif
-}
-
-// Legacy methods - route to unified implementation
-bool NetworkManager::sendDirectHTTP(String jsonPayload, const char* host, int port, bool useHttps) {
-    return postMeasurement(jsonPayload);
-}
-
-bool NetworkManager::sendToProxy(String jsonPayload) {
-    return postMeasurement(jsonPayload);
+    request->index = 0;
 }
 
-bool NetworkManager::sendToServer(String jsonPayload) {
-    return postMeasurement(jsonPayload);
+/*
+ * Build the JSON payload for one waveform part.
+ */
+void NetworkManager::buildWaveformPayload(int part, char *out, int size) {
+    int offset = part * WAVEFORM_PART_BYTES;
+    int length = min(WAVEFORM_PART_BYTES, waveformLength - offset);
+    char timestampISO[TIMESTAMP_ISO_SIZE];
+    formatTimestamp(waveformTimestamp, timestampISO, sizeof(timestampISO));
+    
+    int written = snprintf(out, size,
+                           "{\"deviceId\":\"%s\",\"timestamp\":\"%s\",\"sampleRate\":%d,"
+                           "\"part\":%d,\"parts\":%d,\"data\":\"",
+                           deviceID, timestampISO, FreqS, part, waveformParts);
+    written += WaveformEncoder::base64Encode(waveformData + offset, length, out + written);
+    #if USE_WEBHOOK
+    snprintf(out + written, size - written, "\",\"apiKey\":\"%s\"}", API_KEY);
+    #else
+    snprintf(out + written, size - written, "\"}");
+    #endif
 }
+#endif
 
 void NetworkManager::webhookResponseHandler(const char *event, const char *data) {
     if (DEBUG_MODE) {
@@ -548,173 +1112,32 @@ void NetworkManager::webhookResponseHandler(const char *event, const char *data)
  * Fetch device configuration from server.
  * Gets measurement frequency, active time window, etc.
  * 
- * WEBHOOK MODE: Publishes 'heartrate-getconfig' event, waits for response.
- * HTTP MODE: Makes GET request to /api/devices/{deviceId}/config
+ * WEBHOOK MODE: Queues a 'heartrate-getconfig' publish; the response
+ *   arrives in handleConfigResponse().
+ * HTTP MODE: Queues a GET request to /api/devices/{deviceId}/config
  */
 void NetworkManager::fetchDeviceConfig() {
-    if (!isConnected()) {
-        if (DEBUG_MODE) Serial.println("Cannot fetch config - not connected");
-        configFetchAttempts++;
+    configFetchAttempts++;
+    
+    // A fetch already waiting in the queue is reused
+    if (!isConnected() || enqueue(REQUEST_CONFIG) == nullptr) {
+        if (DEBUG_MODE) Serial.println("Cannot fetch config now");
         if (configFetchAttempts >= MAX_CONFIG_FETCH_ATTEMPTS) {
             if (DEBUG_MODE) Serial.println("Max config fetch attempts reached - using defaults");
         }
         return;
     }
     
-    String deviceID = System.deviceID();
-    
-    if (DEBUG_MODE) {
-        Serial.printlnf("Fetching device configuration (attempt %d/%d)...", 
-                        configFetchAttempts + 1, MAX_CONFIG_FETCH_ATTEMPTS);
-        Serial.printlnf("Device ID: %s", deviceID.c_str());
-    }
-    
-    configFetchAttempts++;
-    
-    #if USE_WEBHOOK
-    // ===== WEBHOOK MODE: Publish config request =====
-    // The webhook makes a GET request to /api/devices/{deviceId}/config
-    // and returns the response via hook-response event
-    
-    if (!Particle.connected()) {
-        if (DEBUG_MODE) Serial.println("Not connected to Particle Cloud");
-        return;
-    }
-    
-    // Create JSON with device ID and API key for the webhook
-    String jsonPayload = "{";
-    jsonPayload += "\"deviceId\":\"" + deviceID + "\",";
-    jsonPayload += "\"apiKey\":\"" + String(API_KEY) + "\"";
-    jsonPayload += "}";
-    
-    if (DEBUG_MODE) {
-        Serial.println("Publishing to webhook 'heartrate-getconfig'...");
-        Serial.println(jsonPayload);
-    }
-    
     configFetchPending = true;
     configRequestTime = millis();
-    
-    bool published = Particle.publish("heartrate-getconfig", jsonPayload, PRIVATE);
-    
-    if (DEBUG_MODE) {
-        Serial.printlnf("Config request published: %s", published ? "success" : "failed");
-        if (published) {
-            Serial.println("Waiting for webhook response...");
-        }
-    }
-    
-    if (!published) {
-        configFetchPending = false;
-    }
-    
-    delay(1100);  // Rate limiting
-    
-    #else
-    // ===== HTTP MODE: Direct GET request =====
-    
-    if (DEBUG_MODE) {
-        Serial.printlnf("GET http://%s:%d/api/devices/%s/config", 
-                        API_SERVER_HOST, API_SERVER_PORT, deviceID.c_str());
-    }
-    
-    configFetchPending = true;
-    
-    // Connect to API server
-    if (!httpClient.connect(API_SERVER_HOST, API_SERVER_PORT)) {
-        if (DEBUG_MODE) {
-            Serial.println("Config fetch: connection failed");
-            if (configFetchAttempts >= MAX_CONFIG_FETCH_ATTEMPTS) {
-                Serial.println("Max attempts reached - using default configuration");
-            }
-        }
-        configFetchPending = false;
-        return;
-    }
-    
-    // Build GET request
-    String httpRequest = "";
-    httpRequest += "GET /api/devices/" + deviceID + "/config HTTP/1.1\r\n";
-    httpRequest += "Host: " + String(API_SERVER_HOST) + ":" + String(API_SERVER_PORT) + "\r\n";
-    httpRequest += "X-API-Key: " + String(API_KEY) + "\r\n";
-    httpRequest += "Connection: close\r\n";
-    httpRequest += "\r\n";
-    
-    if (DEBUG_MODE) {
-        Serial.println("--- HTTP Request ---");
-        Serial.print(httpRequest);
-        Serial.println("--- End Request ---");
-    }
-    
-    httpClient.print(httpRequest);
-    
-    // Wait for response
-    unsigned long timeout = millis() + 5000;
-    while (!httpClient.available() && millis() < timeout) {
-        delay(10);
-    }
-    
-    if (!httpClient.available()) {
-        if (DEBUG_MODE) {
-            Serial.println("Config fetch: timeout");
-            if (configFetchAttempts >= MAX_CONFIG_FETCH_ATTEMPTS) {
-                Serial.println("Max attempts reached - using default configuration");
-            }
-        }
-        httpClient.stop();
-        configFetchPending = false;
-        return;
-    }
-    
-    // Read status line
-    String statusLine = httpClient.readStringUntil('\n');
-    bool httpSuccess = (statusLine.indexOf("200") > 0);
-    
-    if (!httpSuccess) {
-        if (DEBUG_MODE) {
-            Serial.printlnf("Config fetch: HTTP error - %s", statusLine.c_str());
-            if (configFetchAttempts >= MAX_CONFIG_FETCH_ATTEMPTS) {
-                Serial.println("Max attempts reached - using default configuration");
-            }
-        }
-        while (httpClient.available()) httpClient.read();
-        httpClient.stop();
-        configFetchPending = false;
-        return;
-    }
-    
-    // Skip HTTP headers (find empty line)
-    bool headersEnded = false;
-    while (httpClient.available() && !headersEnded) {
-        String line = httpClient.readStringUntil('\n');
-        if (line == "\r" || line.length() == 0) {
-            headersEnded = true;
-        }
-    }
-    
-    // Read JSON body
-    String jsonBody = "";
-    while (httpClient.available()) {
-        jsonBody += (char)httpClient.read();
-    }
-    
-    httpClient.stop();
-    configFetchPending = false;
-    
-    if (DEBUG_MODE) {
-        Serial.println("Config response:");
-        Serial.println(jsonBody);
-    }
-    
-    // Parse and apply configuration
-    parseAndApplyConfig(jsonBody);
-    #endif
 }
 
 /*
  * Handle webhook response for config fetch.
- * Called when Particle receives hook-response/heartrate-getconfig event.
- * Parses the response and applies configuration to state machine.
+ * Called when Particle receives hook-response/heartrate-getconfig/<part>.
+ * Responses longer than an event arrive in numbered parts; each is fed to
+ * the config parser as it arrives, and the configuration is applied to the
+ * state machine once the whole JSON response has been read.
  */
 void NetworkManager::handleConfigResponse(const char *event, const char *data) {
     if (DEBUG_MODE) {
@@ -723,51 +1146,53 @@ void NetworkManager::handleConfigResponse(const char *event, const char *data) {
         Serial.printlnf("Data: %s", data);
     }
     
-    configFetchPending = false;
-    
-    if (data == nullptr || strlen(data) == 0) {
-        if (DEBUG_MODE) {
-            Serial.println("Empty config response");
-        }
-        return;
-    }
-    
-    String jsonBody = String(data);
-    
-    // Parse configuration from response.
-    // Supports two formats:
+    // Parses either format in one pass:
     // 1. Compact (from webhook response template): {"f":1800,"s":"06:00","e":"22:00"}
     // 2. Full API response: {"success":true,"data":{"config":{...}}}
+    const char *part = strrchr(event, '/');
+    if (part == nullptr || atoi(part + 1) == 0) {
+        configParser.begin();
+    }
+    if (data != nullptr) {
+        configParser.feed(data);
+    }
     
-    // Try compact format first
-    int frequency = extractJsonInt(jsonBody, "f");
-    String startTime = extractJsonValue(jsonBody, "s");
-    String endTime = extractJsonValue(jsonBody, "e");
-    
-    // If compact format not found, try full format
-    if (frequency == 0 && startTime.length() == 0) {
-        frequency = extractJsonInt(jsonBody, "measurementFrequency");
-        startTime = extractJsonValue(jsonBody, "activeStartTime");
-        endTime = extractJsonValue(jsonBody, "activeEndTime");
+    if (!configParser.isComplete() && !configParser.hasError()) {
+        if (DEBUG_MODE) Serial.println("Config response incomplete - waiting for next part");
+        return;
     }
     
-    if (frequency > 0 || startTime.length() > 0 || endTime.length() > 0) {
-        stateMachine.applyConfiguration(frequency, startTime, endTime);
-        configFetchedSuccessfully = true;
-        if (DEBUG_MODE) {
-            Serial.println("✓ Configuration applied successfully from server");
-            Serial.printlnf("  Frequency: %d seconds", frequency);
-            Serial.printlnf("  Active: %s - %s", startTime.c_str(), endTime.c_str());
-        }
-    } else {
+    // Already on the main thread: apply the config here, and tell the
+    // network side the fetch is over
+    NetworkCommand command = {};
+    command.type = COMMAND_CONFIG_RECEIVED;
+    NetworkEvent config;
+    command.applied = readParsedConfig(config);
+    
+    if (command.applied) {
+        handleEvent(config);
+    } else if (DEBUG_MODE) {
         // Response received but couldn't parse
-        if (DEBUG_MODE) {
-            Serial.println("Could not parse config values from response");
-            if (jsonBody.indexOf("error") >= 0 || jsonBody.indexOf("401") >= 0) {
-                Serial.println("Server returned an error - check API key and device registration");
-            }
+        Serial.println("Could not parse config values from response");
+        if (data != nullptr && (strstr(data, "error") != nullptr || strstr(data, "401") != nullptr)) {
+            Serial.println("Server returned an error - check API key and device registration");
         }
     }
+    submit(command);
+}
+
+/*
+ * Take the settings found by the config parser.
+ * Returns true if any value was found.
+ */
+bool NetworkManager::readParsedConfig(NetworkEvent &event) {
+    if (!configParser.hasValues()) return false;
+    
+    event.type = EVENT_CONFIG;
+    event.frequency = configParser.getFrequency();
+    snprintf(event.startTime, sizeof(event.startTime), "%s", configParser.getStartTime());
+    snprintf(event.endTime, sizeof(event.endTime), "%s", configParser.getEndTime());
+    return true;
 }
 
 bool NetworkManager::isConfigFetched() {
@@ -786,365 +1211,317 @@ void NetworkManager::configResponseHandler(const char *event, const char *data)
     handleConfigResponse(event, data);
 }
 
-/*
- * Parse and apply configuration from JSON response (HTTP mode).
- */
-void parseAndApplyConfig(String jsonBody) {
-    extern StateMachine stateMachine;
-    
-    if (jsonBody.length() == 0) return;
-    
-    // Check if response indicates success
-    bool jsonSuccess = (jsonBody.indexOf("\"success\":true") >= 0);
-    
-    if (jsonSuccess || jsonBody.indexOf("measurementFrequency") >= 0) {
-        int frequency = 0;
-        String startTime = "";
-        String endTime = "";
-        
-        // Parse measurementFrequency
-        int freqIdx = jsonBody.indexOf("\"measurementFrequency\":");
-        if (freqIdx >= 0) {
-            int startIdx = freqIdx + 23;
-            int endIdx = startIdx;
-            while (endIdx < (int)jsonBody.length()) {
-                char c = jsonBody.charAt(endIdx);
-                if (c == ',' || c == '}') break;
-                endIdx++;
-            }
-            frequency = jsonBody.substring(startIdx, endIdx).toInt();
-        }
-        
-        // Parse activeStartTime
-        int startIdx = jsonBody.indexOf("\"activeStartTime\":\"");
-        if (startIdx >= 0) {
-            startIdx += 19;
-            int endIdx = jsonBody.indexOf("\"", startIdx);
-            if (endIdx > startIdx) {
-                startTime = jsonBody.substring(startIdx, endIdx);
-            }
-        }
-        
-        // Parse activeEndTime
-        int endTimeIdx = jsonBody.indexOf("\"activeEndTime\":\"");
-        if (endTimeIdx >= 0) {
-            endTimeIdx += 17;
-            int endIdx = jsonBody.indexOf("\"", endTimeIdx);
-            if (endIdx > endTimeIdx) {
-                endTime = jsonBody.substring(endTimeIdx, endIdx);
-            }
-        }
-        
-        if (frequency > 0 || startTime.length() > 0 || endTime.length() > 0) {
-            stateMachine.applyConfiguration(frequency, startTime, endTime);
-            if (DEBUG_MODE) {
-                Serial.println("✓ Configuration applied successfully from server");
-            }
-        }
-    }
-}
 
 // ============================================================================
 // JSON Creation
 // ============================================================================
 
+/*
+ * Format a Unix timestamp as ISO 8601 UTC ("2025-10-20T05:00:00Z") into
+ * out (TIMESTAMP_ISO_SIZE), without the String that Time.format() returns.
+ */
+static void formatTimestamp(uint32_t timestamp, char *out, int size) {
+    time_t seconds = timestamp;
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    strftime(out, size, "%Y-%m-%dT%H:%M:%SZ", &utc);
+}
+
 /*
  * Create JSON payload for measurement submission.
  * Includes all required fields for POST /api/measurements.
  * In webhook mode, also includes apiKey (webhook extracts for header).
  */
-String NetworkManager::createJSON(MeasurementData data) {
-    String deviceID = System.deviceID();
-    String timestampISO = Time.format(data.timestamp, TIME_FORMAT_ISO8601_FULL);
-    String quality = data.valid ? "good" : "poor";
+void NetworkManager::createJSON(const MeasurementData &data, char *out, int size) {
+    char timestampISO[TIMESTAMP_ISO_SIZE];
+    formatTimestamp(data.timestamp, timestampISO, sizeof(timestampISO));
     
-    String json = "{";
-    json += "\"deviceId\":\"" + deviceID + "\",";
-    json += "\"heartRate\":" + String((int)round(data.heartRate)) + ",";
-    json += "\"spO2\":" + String((int)round(data.spO2)) + ",";
-    json += "\"timestamp\":\"" + timestampISO + "\"";
+    int written = snprintf(out, size,
+                           "{\"deviceId\":\"%s\",\"heartRate\":%d,\"spO2\":%d,\"timestamp\":\"%s\"",
+                           deviceID, (int)round(data.heartRate), (int)round(data.spO2), timestampISO);
     
     #if USE_WEBHOOK
     // Include API key in payload for webhook mode
     // The webhook template extracts this and puts it in the X-API-Key header
-    json += ",\"apiKey\":\"" + String(API_KEY) + "\"";
+    written += snprintf(out + written, size - written, ",\"apiKey\":\"%s\"", API_KEY);
     #endif
     
-    if (quality.length() > 0) {
-        json += ",\"quality\":\"" + quality + "\"";
-    }
+    written += snprintf(out + written, size - written, ",\"quality\":\"%s\"", data.valid ? "good" : "poor");
     
     if (data.confidence > 0) {
-        json += ",\"confidence\":" + String(data.confidence, 2);
+        written += snprintf(out + written, size - written, ",\"confidence\":%.2f", data.confidence);
     }
     
-    json += "}";
+    snprintf(out + written, size - written, "}");
+}
+
+/*
+ * Create compact payload for measurement submission.
+ * The record carries the readings; in webhook mode the webhook adds the
+ * device ID ({{{PARTICLE_DEVICE_ID}}}) and the X-API-Key header.
+ */
+void NetworkManager::createRecordPayload(const MeasurementData &data, char *out, int size) {
+    char record[MEASUREMENT_RECORD_BASE64_CHARS + 1];
+    MeasurementRecord::encodeBase64(data, record);
     
-    return json;
+    #if USE_WEBHOOK
+    snprintf(out, size, "%s", record);
+    #else
+    snprintf(out, size, "{\"deviceId\":\"%s\",\"record\":\"%s\"}", deviceID, record);
+    #endif
+}
+
+/*
+ * Create JSON payload for a user timeout notification.
+ * In webhook mode, also includes apiKey (webhook extracts for header).
+ */
+void NetworkManager::createTimeoutJSON(uint32_t timestamp, char *out, int size) {
+    char timestampISO[TIMESTAMP_ISO_SIZE];
+    formatTimestamp(timestamp, timestampISO, sizeof(timestampISO));
+    
+    int written = snprintf(out, size,
+                           "{\"deviceId\":\"%s\",\"type\":\"user_timeout\","
+                           "\"message\":\"User did not place finger on sensor within timeout period\","
+                           "\"timestamp\":\"%s\"",
+                           deviceID, timestampISO);
+    #if USE_WEBHOOK
+    // Include API key in payload for webhook mode (webhook extracts for header)
+    written += snprintf(out + written, size - written, ",\"apiKey\":\"%s\"", API_KEY);
+    #endif
+    snprintf(out + written, size - written, "}");
 }
 
 // ============================================================================
-// Offline Storage (EEPROM)
+// Offline Storage (Record Log)
 // ============================================================================
 
 /*
- * Store measurement in EEPROM for later transmission.
- * Uses circular buffer - oldest measurements are overwritten when full.
+ * Restore the open block from the staging slot, and move measurements
+ * stored one per record by earlier firmware into blocks.
  */
-void NetworkManager::storeMeasurement(MeasurementData data) {
-    if (storedCount >= MAX_STORED_MEASUREMENTS) {
-        if (DEBUG_MODE) Serial.println("Storage full - overwriting oldest");
-        storageIndex = 0;
+void NetworkManager::loadStoredMeasurements() {
+    uint8_t block[MEASUREMENT_BLOCK_MAX_BYTES];
+    int length = offlineLog.readStaged(LOG_RECORD_MEASUREMENTS, block, sizeof(block));
+    if (length > 0 && openBlock.load(block, length)) {
+        // A reset just after a full block was appended leaves its start
+        // staged as well; the newest stored block then begins the same way
+        int newest = -1;
+        for (int handle = offlineLog.first(LOG_RECORD_MEASUREMENTS); handle >= 0;
+             handle = offlineLog.next(handle, LOG_RECORD_MEASUREMENTS)) {
+            newest = handle;
+        }
+        if (newest >= 0 && offlineLog.read(newest, block, MEASUREMENT_BLOCK_HEADER) >= MEASUREMENT_BLOCK_HEADER &&
+            memcmp(block + 1, openBlock.getBytes() + 1, 4) == 0) {
+            openBlock.clear();
+            offlineLog.stage(LOG_RECORD_MEASUREMENTS, nullptr, 0);
+        }
     }
     
-    storage[storageIndex].heartRate = data.heartRate;
-    storage[storageIndex].spO2 = data.spO2;
-    storage[storageIndex].timestamp = data.timestamp;
-    storage[storageIndex].transmitted = false;
-    
-    storageIndex = (storageIndex + 1) % MAX_STORED_MEASUREMENTS;
-    if (storedCount < MAX_STORED_MEASUREMENTS) storedCount++;
-    
-    saveToEEPROM();
-    
-    if (DEBUG_MODE) {
-        Serial.printlnf("Stored locally (%d/%d)", storedCount, MAX_STORED_MEASUREMENTS);
+    for (int handle = offlineLog.first(LOG_RECORD_MEASUREMENT); handle >= 0;
+         handle = offlineLog.first(LOG_RECORD_MEASUREMENT)) {
+        MeasurementData data;
+        if (readLegacyMeasurement(handle, data)) storeMeasurement(data);
+        offlineLog.markDone(handle);
     }
 }
 
 /*
- * Sync one stored measurement to server.
- * Called periodically when connected and stored measurements exist.
+ * Store measurement in the offline log for later transmission.
+ * It is added to the open block, which is staged so it survives a reset,
+ * and appended to the log as one record once full. Timestamps are coded
+ * against the measurement interval when it was handed over.
  */
-void NetworkManager::syncStoredMeasurements() {
-    if (storedCount == 0) return;
-    
-    int index = findNextStoredMeasurement();
-    if (index < 0) return;
+void NetworkManager::storeMeasurement(MeasurementData data) {
+    if (!openBlock.add(data, measurementInterval)) {
+        sealOpenBlock();
+        openBlock.add(data, measurementInterval);
+    }
     
-    if (DEBUG_MODE) {
-        Serial.println("Syncing stored measurement to server...");
+    if (openBlock.getCount() >= STORED_BLOCK_SIZE) {
+        sealOpenBlock();
+    } else {
+        offlineLog.stage(LOG_RECORD_MEASUREMENTS, openBlock.getBytes(), openBlock.getLength());
     }
     
-    MeasurementData data;
-    data.heartRate = storage[index].heartRate;
-    data.spO2 = storage[index].spO2;
-    data.timestamp = storage[index].timestamp;
-    data.valid = true;
-    data.confidence = 0.95;
-    
-    String payload = createJSON(data);
-    
-    if (postMeasurement(payload)) {
-        storage[index].transmitted = true;
-        storedCount--;
-        saveToEEPROM();
-        
-        if (DEBUG_MODE) {
-            Serial.printlnf("Stored measurement synced successfully (%d remaining)", storedCount);
-        }
-        ledController.flashSuccess();  // Green flash = sync success
+    if (DEBUG_MODE) {
+        Serial.printlnf("Stored locally (%d pending)", countStoredMeasurements());
     }
 }
 
 /*
- * Store timeout notification in EEPROM for later transmission.
- * Uses circular buffer - oldest events are overwritten when full.
+ * Append the open block to the offline log and empty the staging slot.
  */
-void NetworkManager::storeTimeoutNotification(uint32_t timestamp) {
-    if (storedTimeoutCount >= MAX_STORED_TIMEOUTS) {
-        if (DEBUG_MODE) Serial.println("Timeout storage full - overwriting oldest");
-        timeoutStorageIndex = 0;
-    }
+void NetworkManager::sealOpenBlock() {
+    if (openBlock.getCount() == 0) return;
     
-    timeoutStorage[timeoutStorageIndex].timestamp = timestamp;
-    timeoutStorage[timeoutStorageIndex].transmitted = false;
-    
-    timeoutStorageIndex = (timeoutStorageIndex + 1) % MAX_STORED_TIMEOUTS;
-    if (storedTimeoutCount < MAX_STORED_TIMEOUTS) storedTimeoutCount++;
-    
-    saveToEEPROM();
+    offlineLog.append(LOG_RECORD_MEASUREMENTS, openBlock.getBytes(), openBlock.getLength());
+    offlineLog.stage(LOG_RECORD_MEASUREMENTS, nullptr, 0);
+    openBlock.clear();
 }
 
 /*
- * Sync one stored timeout notification to server.
- * Called periodically when connected and stored timeouts exist.
+ * Measurements waiting to be synced: the entry counts of the stored
+ * blocks plus the open block.
  */
-void NetworkManager::syncStoredTimeouts() {
-    if (storedTimeoutCount == 0) return;
-    
-    int index = findNextStoredTimeout();
-    if (index < 0) return;
-    
-    if (DEBUG_MODE) {
-        Serial.println("Syncing stored timeout notification to server...");
-    }
-    
-    String deviceID = System.deviceID();
-    String timestampISO = Time.format(timeoutStorage[index].timestamp, TIME_FORMAT_ISO8601_FULL);
-    
-    // Create JSON payload for timeout notification
-    String jsonPayload = "{";
-    jsonPayload += "\"deviceId\":\"" + deviceID + "\",";
-    jsonPayload += "\"type\":\"user_timeout\",";
-    jsonPayload += "\"message\":\"User did not place finger on sensor within timeout period\",";
-    jsonPayload += "\"timestamp\":\"" + timestampISO + "\"";
-    #if USE_WEBHOOK
-    jsonPayload += ",\"apiKey\":\"" + String(API_KEY) + "\"";
-    #endif
-    jsonPayload += "}";
-    
-    if (postTimeoutNotification(jsonPayload)) {
-        timeoutStorage[index].transmitted = true;
-        storedTimeoutCount--;
-        saveToEEPROM();
-        
-        if (DEBUG_MODE) {
-            Serial.printlnf("Stored timeout synced successfully (%d remaining)", storedTimeoutCount);
-        }
-        ledController.flashSuccess();  // Green flash = sync success
-    }
+int NetworkManager::countStoredMeasurements() {
+    int count = openBlock.getCount();
+    for (int handle = offlineLog.first(LOG_RECORD_MEASUREMENTS); handle >= 0;
+         handle = offlineLog.next(handle, LOG_RECORD_MEASUREMENTS)) {
+        uint8_t entries = 0;
+        offlineLog.read(handle, &entries, 1);
+        count += entries;
+    }
+    return count;
 }
 
 /*
- * Find next timeout that hasn't been transmitted.
+ * Read a measurement stored by earlier firmware. Records without the
+ * quality bytes (8-byte payload) are read as valid with 95% confidence.
  */
-int NetworkManager::findNextStoredTimeout() {
-    for (int i = 0; i < MAX_STORED_TIMEOUTS; i++) {
-        if (!timeoutStorage[i].transmitted && timeoutStorage[i].timestamp > 0) {
-            return i;
-        }
-    }
-    return -1;
+bool NetworkManager::readLegacyMeasurement(int handle, MeasurementData &data) {
+    uint8_t payload[LEGACY_MEASUREMENT_BYTES];
+    int length = offlineLog.read(handle, payload, sizeof(payload));
+    if (length < 8) return false;
+    
+    data.timestamp = payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((uint32_t)payload[3] << 24);
+    data.heartRate = (payload[4] | (payload[5] << 8)) / 10.0f;
+    data.spO2 = (payload[6] | (payload[7] << 8)) / 10.0f;
+    data.valid = length < LEGACY_MEASUREMENT_BYTES || (payload[8] & MEASUREMENT_FLAG_VALID);
+    data.confidence = length < LEGACY_MEASUREMENT_BYTES ? 0.95f : payload[9] / 100.0f;
+    return true;
 }
 
-void NetworkManager::saveToEEPROM() {
-    int addr = EEPROM_MEASUREMENTS_ADDR;
-    
-    // Save measurements
-    EEPROM.put(addr, storageIndex);
-    addr += sizeof(int);
-    EEPROM.put(addr, storedCount);
-    addr += sizeof(int);
-    
-    for (int i = 0; i < MAX_STORED_MEASUREMENTS; i++) {
-        EEPROM.put(addr, storage[i]);
-        addr += sizeof(StoredMeasurement);
-    }
-    
-    // Save timeout notifications (after measurements)
-    EEPROM.put(addr, timeoutStorageIndex);
-    addr += sizeof(int);
-    EEPROM.put(addr, storedTimeoutCount);
-    addr += sizeof(int);
-    
-    for (int i = 0; i < MAX_STORED_TIMEOUTS; i++) {
-        EEPROM.put(addr, timeoutStorage[i]);
-        addr += sizeof(StoredTimeout);
-    }
-}
-
-void NetworkManager::loadFromEEPROM() {
-    int addr = EEPROM_MEASUREMENTS_ADDR;
-    
-    // Load measurements
-    EEPROM.get(addr, storageIndex);
-    addr += sizeof(int);
-    EEPROM.get(addr, storedCount);
-    addr += sizeof(int);
-    
-    // Validate loaded measurement values
-    if (storageIndex < 0 || storageIndex >= MAX_STORED_MEASUREMENTS) {
-        storageIndex = 0;
-    }
-    if (storedCount < 0 || storedCount > MAX_STORED_MEASUREMENTS) {
-        storedCount = 0;
-    }
-    
-    for (int i = 0; i < MAX_STORED_MEASUREMENTS; i++) {
-        EEPROM.get(addr, storage[i]);
-        addr += sizeof(StoredMeasurement);
-    }
+/*
+ * Sync stored measurements to server.
+ * Called periodically when connected and stored measurements exist.
+ * Queues one upload at a time: compact mode sends whole blocks in one
+ * batch (the open block is appended when the batch is built); otherwise
+ * the oldest block's measurements are sent one per request.
+ */
+void NetworkManager::syncStoredMeasurements() {
+    if (offlineLog.getPendingCount(LOG_RECORD_MEASUREMENTS) == 0 && openBlock.getCount() == 0) return;
     
-    // Load timeout notifications
-    EEPROM.get(addr, timeoutStorageIndex);
-    addr += sizeof(int);
-    EEPROM.get(addr, storedTimeoutCount);
-    addr += sizeof(int);
+    #if COMPACT_MEASUREMENTS
+    enqueue(REQUEST_BATCH);   // Coalesced with a batch already waiting
+    #else
+    if (isQueued(REQUEST_STORED_MEASUREMENT)) return;
+    sealOpenBlock();
     
-    // Validate loaded timeout values
-    if (timeoutStorageIndex < 0 || timeoutStorageIndex >= MAX_STORED_TIMEOUTS) {
-        timeoutStorageIndex = 0;
-    }
-    if (storedTimeoutCount < 0 || storedTimeoutCount > MAX_STORED_TIMEOUTS) {
-        storedTimeoutCount = 0;
+    int handle = offlineLog.first(LOG_RECORD_MEASUREMENTS);
+    if (handle < 0) return;
+    if (handle != storedBlock) {
+        storedBlock = handle;
+        storedEntry = 0;
     }
     
-    for (int i = 0; i < MAX_STORED_TIMEOUTS; i++) {
-        EEPROM.get(addr, timeoutStorage[i]);
-        addr += sizeof(StoredTimeout);
+    // Blocks written with COMPACT_MEASUREMENTS hold several measurements
+    uint8_t bytes[MEASUREMENT_BLOCK_MAX_BYTES];
+    MeasurementBlock block(255);
+    MeasurementData data;
+    int length = offlineLog.read(handle, bytes, sizeof(bytes));
+    bool found = length > 0 && block.load(bytes, length);
+    for (int i = 0; found && i <= storedEntry; i++) found = block.next(data);
+    if (!found) {
+        offlineLog.markDone(handle);   // Undecodable: drop it rather than retry forever
+        return;
     }
     
-    if (DEBUG_MODE) {
-        if (storedCount > 0) {
-            Serial.printlnf("Loaded %d measurements from EEPROM (pending sync)", storedCount);
-        }
-        if (storedTimeoutCount > 0) {
-            Serial.printlnf("Loaded %d timeout notifications from EEPROM (pending sync)", storedTimeoutCount);
-        }
+    NetworkRequest *request = enqueue(REQUEST_STORED_MEASUREMENT);
+    if (request != nullptr) {
+        request->index = handle;
+        request->data = data;
     }
+    #endif
 }
 
-int NetworkManager::findNextStoredMeasurement() {
-    for (int i = 0; i < MAX_STORED_MEASUREMENTS; i++) {
-        if (!storage[i].transmitted && storage[i].timestamp > 0) {
-            return i;
+#if COMPACT_MEASUREMENTS
+/*
+ * Encode stored blocks, oldest first, into a batch payload (format version
+ * MEASUREMENT_BATCH_VERSION followed by the blocks as stored), up to
+ * SYNC_BATCH_SIZE measurements and SYNC_BATCH_MAX_BYTES. Their log handles
+ * are kept in batchIndex until the upload completes.
+ */
+int NetworkManager::buildBatchPayload(char *out, int size) {
+    static uint8_t batch[SYNC_BATCH_MAX_BYTES];
+    static MeasurementBlock block(255);
+    sealOpenBlock();
+    
+    batch[0] = MEASUREMENT_BATCH_VERSION;
+    int length = 1;
+    int measurements = 0;
+    batchCount = 0;
+    
+    for (int handle = offlineLog.first(LOG_RECORD_MEASUREMENTS);
+         handle >= 0 && batchCount < SYNC_BATCH_SIZE;
+         handle = offlineLog.next(handle, LOG_RECORD_MEASUREMENTS)) {
+        int blockLength = offlineLog.read(handle, batch + length, SYNC_BATCH_MAX_BYTES - length);
+        if (length + blockLength > SYNC_BATCH_MAX_BYTES) break;
+        if (!block.load(batch + length, blockLength)) {
+            offlineLog.markDone(handle);   // Undecodable: drop it rather than retry forever
+            continue;
         }
+        if (batchCount > 0 && measurements + block.getCount() > SYNC_BATCH_SIZE) break;
+        
+        length += blockLength;
+        measurements += block.getCount();
+        batchIndex[batchCount++] = handle;
     }
-    return -1;
+    if (batchCount == 0) return 0;
+    
+    #if USE_WEBHOOK
+    // Webhook adds the device ID and API key, as for single records
+    WaveformEncoder::base64Encode(batch, length, out);
+    #else
+    int written = snprintf(out, size, "{\"deviceId\":\"%s\",\"records\":\"", deviceID);
+    written += WaveformEncoder::base64Encode(batch, length, out + written);
+    snprintf(out + written, size - written, "\"}");
+    #endif
+    
+    return measurements;
 }
-
-// ============================================================================
-// JSON Parsing Helpers
-// ============================================================================
+#endif
 
 /*
- * Extract string value from JSON for a given key.
- * Example: extractJsonValue('{"key":"value"}', "key") returns "value"
+ * Store timeout notification in the offline log for later transmission.
  */
-String NetworkManager::extractJsonValue(String json, String key) {
-    String searchKey = "\"" + key + "\":\"";
-    int startIndex = json.indexOf(searchKey);
-    
-    if (startIndex < 0) return "";
-    
-    startIndex += searchKey.length();
-    int endIndex = json.indexOf("\"", startIndex);
-    
-    if (endIndex < 0) return "";
+void NetworkManager::storeTimeoutNotification(uint32_t timestamp) {
+    uint8_t payload[STORED_TIMEOUT_BYTES];
+    for (int i = 0; i < 4; i++) payload[i] = (timestamp >> (8 * i)) & 0xFF;
     
-    return json.substring(startIndex, endIndex);
+    offlineLog.append(LOG_RECORD_TIMEOUT, payload, STORED_TIMEOUT_BYTES);
 }
 
 /*
- * Extract integer value from JSON for a given key.
- * Example: extractJsonInt('{"key":123}', "key") returns 123
+ * Sync stored timeout notifications to server, oldest first.
+ * Called periodically when connected and stored timeouts exist.
+ * Webhook mode queues one per call; HTTP mode queues up to
+ * HTTP_MAX_PIPELINE, which go out pipelined on the persistent connection.
  */
-int NetworkManager::extractJsonInt(String json, String key) {
-    String searchKey = "\"" + key + "\":";
-    int startIndex = json.indexOf(searchKey);
-    
-    if (startIndex < 0) return 0;
+void NetworkManager::syncStoredTimeouts() {
+    if (offlineLog.getPendingCount(LOG_RECORD_TIMEOUT) == 0 || isQueued(REQUEST_TIMEOUT, true)) return;
     
-    startIndex += searchKey.length();
+    #if USE_WEBHOOK
+    const int maxQueued = 1;
+    #else
+    const int maxQueued = HTTP_MAX_PIPELINE;
+    #endif
     
-    int endIndex = startIndex;
-    while (endIndex < (int)json.length()) {
-        char c = json.charAt(endIndex);
-        if (c == ',' || c == '}' || c == ' ' || c == '\n') break;
-        endIndex++;
+    int queued = 0;
+    for (int handle = offlineLog.first(LOG_RECORD_TIMEOUT);
+         handle >= 0 && queued < maxQueued;
+         handle = offlineLog.next(handle, LOG_RECORD_TIMEOUT)) {
+        uint8_t payload[STORED_TIMEOUT_BYTES];
+        if (offlineLog.read(handle, payload, sizeof(payload)) != STORED_TIMEOUT_BYTES) continue;
+        
+        NetworkRequest *request = enqueue(REQUEST_TIMEOUT);
+        if (request == nullptr) break;
+        request->index = handle;
+        request->timestamp = payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((uint32_t)payload[3] << 24);
+        queued++;
     }
     
-    String valueStr = json.substring(startIndex, endIndex);
-    return valueStr.toInt();
+    if (DEBUG_MODE && queued > 0) {
+        Serial.printlnf("Syncing %d stored timeout notification(s) to server...", queued);
+    }
 }
+
@@ -6,6 +6,7 @@
  * 
  * DIRECT HTTP MODE (USE_WEBHOOK false):
  *   - Connects directly to API server via TCP/HTTP
+ *   - One keep-alive connection (HttpConnection) carries all requests
  *   - Used for local development with api-server on localhost
  *   - Device makes HTTP requests to API_SERVER_HOST:API_SERVER_PORT
  *   - API key sent in X-API-Key header
@@ -14,15 +15,41 @@
  *   - Publishes events to Particle Cloud
  *   - Particle webhooks forward requests to Vercel HTTPS API
  *   - API key included in JSON payload (webhook extracts for header)
+ *   - With COMPACT_MEASUREMENTS, measurements are published as a base64
+ *     binary record to 'heartrate-record'; the webhook supplies the
+ *     device ID and API key
  *   - Requires webhook configuration in Particle Console
  * 
+ * NON-BLOCKING OPERATION:
+ *   Requests are queued (NETWORK_QUEUE_SIZE) and driven from update(); no
+ *   call waits for the network, so sensor sampling and LED patterns keep
+ *   running while a publish or HTTP request is in flight. Each request
+ *   moves through explicit states (NetworkRequestState) and its result is
+ *   handled when it completes (e.g. the state machine returns to IDLE once
+ *   a measurement upload succeeds or is stored for later).
+ *   Live measurements and timeouts go before backlog sync, and config polls
+ *   go last. Backlog batches, config fetches and waveforms that are still
+ *   waiting absorb newer requests of the same kind. Webhook publishes are
+ *   paced by PublishScheduler (token bucket).
+ * 
+ * THREADS (THREADED_MODE):
+ *   update() runs on its own network thread. The main thread hands over
+ *   measurements and timeouts as NetworkCommands (commandQueue), and the
+ *   results the state machine and LED act on come back as NetworkEvents
+ *   (eventQueue, applied by processEvents()). Both queues are lock-free
+ *   SPSC queues. Without THREADED_MODE, commands and events are handled
+ *   as soon as they are issued, on the one thread.
+ * 
  * Features:
  *   - Measurement transmission to POST /api/measurements
+ *   - Batched offline backlog sync to POST /api/measurements/batch (COMPACT_MEASUREMENTS)
  *   - User timeout notifications to POST /api/notifications  
  *   - Device config fetching from GET /api/devices/{id}/config
- *   - Offline storage in EEPROM with auto-sync on reconnect:
- *     * Measurements: Up to 48 stored offline
- *     * Timeout notifications: Up to 24 stored offline
+ *   - Raw waveform upload to POST /api/measurements/waveform (STREAM_RAW_WAVEFORM)
+ *   - Offline storage in a record log (RecordLog, flash files or EEPROM)
+ *     with auto-sync on reconnect:
+ *     * Measurements and timeout notifications share the log
+ *     * Storing or syncing a record writes only that record
  *     * Data persists across device reboots
  */
 
@@ -32,33 +59,153 @@
 #include "Particle.h"
 #include "config.h"
 #include "sensor_manager.h"
+#include "measurement_record.h"
+#include "measurement_block.h"
+#include "config_parser.h"
+#include "http_connection.h"
+#include "publish_scheduler.h"
+#include "record_log.h"
+#include "spsc_queue.h"
+
+/*
+ * Offline record payloads (little endian), stored in the RecordLog when
+ * WiFi is unavailable and synced when connectivity is restored:
+ *   LOG_RECORD_MEASUREMENTS  a measurement block (measurement_block.h); the
+ *                            block being filled is kept in the staging slot
+ *   LOG_RECORD_TIMEOUT       timestamp (4)
+ *   LOG_RECORD_MEASUREMENT   earlier firmware, moved into blocks at boot:
+ *                            timestamp (4), heart rate x10 (2), SpO2 x10 (2),
+ *                            flags (1, MEASUREMENT_FLAG_*), confidence % (1)
+ */
+#define LEGACY_MEASUREMENT_BYTES 10
+#define STORED_TIMEOUT_BYTES 4
+
+// Measurements per stored block. Blocks are acknowledged whole, so without
+// COMPACT_MEASUREMENTS (one measurement per request) each holds one.
+#if COMPACT_MEASUREMENTS
+#define STORED_BLOCK_SIZE MEASUREMENT_BLOCK_SIZE
+#else
+#define STORED_BLOCK_SIZE 1
+#endif
+
+// Largest batch: whole blocks, up to SYNC_BATCH_SIZE measurements in this
+// many bytes (960 chars as base64, under the 1024-byte publish limit)
+#define SYNC_BATCH_MAX_BYTES 720
+
+#if MEASUREMENT_BLOCK_MAX_BYTES > RECORD_LOG_MAX_PAYLOAD || 1 + MEASUREMENT_BLOCK_MAX_BYTES > SYNC_BATCH_MAX_BYTES
+#error "Measurement blocks do not fit the offline log or a batch"
+#endif
+
+// Largest compact measurement payload (HTTP mode wraps the record with the device ID)
+#define MEASUREMENT_PAYLOAD_SIZE 64
+
+// Largest batch payload: SYNC_BATCH_MAX_BYTES as base64 plus the HTTP mode wrapper
+#define BATCH_PAYLOAD_SIZE ((SYNC_BATCH_MAX_BYTES + 2) / 3 * 4 + MEASUREMENT_PAYLOAD_SIZE)
+
+#if STREAM_RAW_WAVEFORM
+// Encoded trace bytes per waveform part
+#if USE_WEBHOOK
+#define WAVEFORM_PART_BYTES WAVEFORM_CHUNK_BYTES   // Keeps each publish under 1024 bytes
+#else
+#define WAVEFORM_PART_BYTES (WAVEFORM_MAX_BLOCKS * WAVEFORM_BLOCK_MAX_BYTES)  // Whole trace in one POST body
+#endif
+
+// Largest waveform part payload: base64 data plus the JSON fields
+#define WAVEFORM_PAYLOAD_SIZE ((WAVEFORM_PART_BYTES + 2) / 3 * 4 + 256)
+#else
+#define WAVEFORM_PAYLOAD_SIZE 0
+#endif
+
+// Largest request body: a batch or waveform part, and at least 384 bytes
+// for JSON measurements and timeout notifications
+#define REQUEST_BODY_MIN_SIZE (BATCH_PAYLOAD_SIZE > 384 ? BATCH_PAYLOAD_SIZE : 384)
+#define REQUEST_BODY_SIZE (WAVEFORM_PAYLOAD_SIZE > REQUEST_BODY_MIN_SIZE ? WAVEFORM_PAYLOAD_SIZE : REQUEST_BODY_MIN_SIZE)
+
+// Stack buffer for payload timestamps
+#define TIMESTAMP_ISO_SIZE 24       // "2025-10-20T05:00:00Z"
 
 /*
- * StoredMeasurement - Structure for offline measurement storage
+ * NetworkRequestType - What a queued request sends
+ */
+enum NetworkRequestType {
+    REQUEST_MEASUREMENT,         // New measurement (data)
+    REQUEST_STORED_MEASUREMENT,  // One stored measurement (index), without COMPACT_MEASUREMENTS
+    REQUEST_BATCH,               // Stored measurements (COMPACT_MEASUREMENTS)
+    REQUEST_TIMEOUT,             // Timeout notification (timestamp; index if stored)
+    REQUEST_WAVEFORM,            // Trace of the last measurement (index = part)
+    REQUEST_CONFIG               // Device config fetch
+};
+
+/*
+ * NetworkRequestState - Progress of a queued request
  * 
- * When WiFi is unavailable, measurements are stored in EEPROM
- * and automatically synced when connectivity is restored.
+ * HTTP mode:    QUEUED -> [CONNECTING] -> SENDING -> AWAIT_HEADERS -> READ_BODY
+ * Webhook mode: QUEUED -> PUBLISHING
+ * A completed request frees its slot, or goes back to QUEUED to retry or
+ * to send its next part.
  */
-struct StoredMeasurement {
-    float heartRate;      // Heart rate in BPM
-    float spO2;           // Blood oxygen percentage
-    uint32_t timestamp;   // Unix timestamp of measurement
-    bool transmitted;     // True if already sent to server
+enum NetworkRequestState {
+    REQUEST_FREE,                // Slot unused
+    REQUEST_QUEUED,              // Waiting its turn (and for notBefore)
+    REQUEST_CONNECTING,          // Opening the HTTP connection
+    REQUEST_SENDING,             // Writing the HTTP request
+    REQUEST_AWAIT_HEADERS,       // Waiting for the status line and headers
+    REQUEST_READ_BODY,           // Reading the response body
+    REQUEST_PUBLISHING           // Waiting for the cloud to acknowledge a publish
 };
 
 /*
- * StoredTimeout - Structure for offline timeout event storage
+ * NetworkRequest - One queued request
  * 
- * When WiFi is unavailable, timeout notifications are stored in EEPROM
- * and automatically synced when connectivity is restored.
+ * Only what is needed to build the request is kept; the payload is built
+ * when the request is sent.
  */
-struct StoredTimeout {
-    uint32_t timestamp;   // Unix timestamp of timeout event
-    bool transmitted;     // True if already sent to server
+struct NetworkRequest {
+    NetworkRequestType type;
+    NetworkRequestState state;
+    uint32_t sequence;           // Queue order (oldest first within a priority)
+    unsigned long notBefore;     // millis() before which a queued retry waits
+    int attempts;                // Failed attempts so far
+    int index;                   // Offline log handle, waveform part, or -1
+    uint32_t timestamp;          // Timeout notification time
+    MeasurementData data;        // New measurement
 };
 
-// Maximum number of timeout events to store offline
-#define MAX_STORED_TIMEOUTS 24
+/*
+ * NetworkCommand - Work handed to NetworkManager by the main thread
+ */
+enum NetworkCommandType {
+    COMMAND_MEASUREMENT,         // Upload data, or store it if offline
+    COMMAND_TIMEOUT,             // Send a timeout notification (timestamp), or store it
+    COMMAND_CONFIG_RECEIVED      // A webhook config response was read (applied)
+};
+
+struct NetworkCommand {
+    NetworkCommandType type;
+    MeasurementData data;
+    uint16_t interval;           // Measurement interval (s), to store data offline
+    uint32_t timestamp;
+    bool applied;
+};
+
+/*
+ * NetworkEvent - Result handed back to the main thread, which owns the
+ * state machine and LED
+ */
+enum NetworkEventType {
+    EVENT_MEASUREMENT_DONE,      // Measurement sent or stored: back to IDLE
+    EVENT_FLASH_SUCCESS,         // Green flash
+    EVENT_FLASH_ERROR,           // Red flash
+    EVENT_FLASH_WARNING,         // Yellow flash (stored offline)
+    EVENT_CONFIG                 // Apply frequency, startTime and endTime
+};
+
+struct NetworkEvent {
+    NetworkEventType type;
+    int frequency;
+    char startTime[CONFIG_TIME_SIZE];
+    char endTime[CONFIG_TIME_SIZE];
+};
 
 // Forward declaration for static webhook callback
 class NetworkManager;
@@ -73,8 +220,11 @@ extern NetworkManager* networkManagerInstance;
  *   1. Transmit measurements to API server (or store if offline)
  *   2. Fetch device configuration from server
  *   3. Send timeout notifications (or store if offline)
- *   4. Store measurements offline when disconnected (up to 48)
- *   5. Store timeout notifications offline when disconnected (up to 24)
+ *   4. Store measurements offline when disconnected, in delta-coded blocks
+ *      of a record log (RecordLog: files on flash or EEPROM, see
+ *      OFFLINE_LOG_ON_FLASH); over 60,000 fit in flash, about 750 in EEPROM
+ *   5. Store timeout notifications offline in the same log; when it is
+ *      full, the oldest segment is erased first
  *   6. Auto-sync all stored data when WiFi reconnects
  */
 class NetworkManager {
@@ -93,6 +243,13 @@ public:
      */
     void update();
     
+    /*
+     * millis() at which update() next has work: every SCHEDULER_POLL_INTERVAL
+     * while a request is in flight, otherwise the next connection check,
+     * queued request (retry delay, publish token) or config fetch.
+     */
+    unsigned long getNextUpdate();
+    
     /*
      * Check if device is connected to appropriate network.
      * - Webhook mode: Returns true if connected to Particle Cloud
@@ -101,33 +258,59 @@ public:
     bool isConnected();
     
     /*
-     * Transmit a measurement to the API server.
-     * Routes to either webhook publish or direct HTTP POST based on USE_WEBHOOK.
+     * Transmit a measurement to the API server (main thread).
+     * Queues a webhook publish or direct HTTP POST based on USE_WEBHOOK and
+     * returns without waiting. When it completes (or is stored after
+     * MAX_NETWORK_RETRY retries) the state machine returns to IDLE.
      * Stores measurement locally if offline.
+     * Returns false if the network thread's command queue is full
+     * (THREADED_MODE); the measurement can be handed over again later.
      */
     bool transmitMeasurement(MeasurementData data);
     
     /*
-     * Store measurement in EEPROM for later transmission.
-     * Called when device is offline or transmission fails.
+     * Check if a measurement was handed over and the state machine has not
+     * yet been told the result (main thread).
+     */
+    bool isTransmitting();
+    
+    #if THREADED_MODE
+    /*
+     * Apply the events posted by the network thread (main thread).
+     */
+    void processEvents();
+    
+    /*
+     * millis() at which processEvents() next has work.
+     */
+    unsigned long getNextEvent();
+    #endif
+    
+    /*
+     * Store measurement in the offline log for later transmission.
+     * Called when device is offline or transmission fails. It is added to
+     * the open block, which is appended to the log once full.
      */
     void storeMeasurement(MeasurementData data);
     
     /*
      * Sync stored measurements to server.
      * Called automatically when WiFi reconnects.
+     * Queues one upload unless one is already queued; with
+     * COMPACT_MEASUREMENTS it carries whole blocks, up to SYNC_BATCH_SIZE
+     * measurements.
      */
     void syncStoredMeasurements();
     
     /*
-     * Send notification when user fails to respond to measurement prompt.
-     * Posts to /api/notifications endpoint.
-     * If offline, stores timeout for later transmission.
+     * Send notification when user fails to respond to measurement prompt
+     * (main thread). Queues a POST to /api/notifications endpoint.
+     * If offline or the request fails, stores timeout for later transmission.
      */
     bool sendTimeoutNotification();
     
     /*
-     * Store timeout notification in EEPROM for later transmission.
+     * Store timeout notification in the offline log for later transmission.
      * Called when device is offline.
      */
     void storeTimeoutNotification(uint32_t timestamp);
@@ -135,12 +318,14 @@ public:
     /*
      * Sync stored timeout notifications to server.
      * Called automatically when WiFi reconnects.
+     * Queues up to HTTP_MAX_PIPELINE (HTTP mode, pipelined) or one (webhook mode).
      */
     void syncStoredTimeouts();
     
     /*
      * Fetch device configuration from server.
-     * Gets measurement frequency, active hours, etc. from /api/devices/{id}/config
+     * Queues a request for measurement frequency, active hours, etc. from
+     * /api/devices/{id}/config
      */
     void fetchDeviceConfig();
     
@@ -155,7 +340,7 @@ public:
     bool isConfigFetched();
     
     /*
-     * Handle webhook response for config fetch.
+     * Handle webhook response for config fetch (main thread).
      * Called by static wrapper when Particle receives hook-response event.
      */
     void handleConfigResponse(const char *event, const char *data);
@@ -163,35 +348,131 @@ public:
 private:
     bool wifiConnected;              // Current WiFi connection state
     bool wasWifiConnected;           // Previous state for reconnection detection
-    int retryCount;                  // Transmission retry counter
     unsigned long lastConnectionCheck;
+    unsigned long lastUpdate;        // Polling interval while requests are in flight
     unsigned long lastConfigFetch;
     bool configFetchPending;         // True while waiting for webhook response
     bool configFetchedSuccessfully;  // True after successful config fetch
     int configFetchAttempts;         // Attempts since boot/reconnect
+    char deviceID[25];               // Particle device ID, cached at begin()
     static const int MAX_CONFIG_FETCH_ATTEMPTS = 3;
     unsigned long configRequestTime; // For webhook response timeout
+    ConfigParser configParser;       // Config response being read (HTTP body or webhook parts)
+    uint16_t measurementInterval;    // Seconds, from the last measurement handed over
+    int measurementsInFlight;        // Handed over, result not yet applied (main thread)
+    
+    #if THREADED_MODE
+    SpscQueue<NetworkCommand, NETWORK_COMMAND_QUEUE_SIZE> commandQueue;  // Main -> network thread
+    SpscQueue<NetworkEvent, NETWORK_EVENT_QUEUE_SIZE> eventQueue;        // Network -> main thread
+    Thread *networkThread;
+    
+    /*
+     * Network thread body: update(), then sleep until getNextUpdate(), at
+     * most NETWORK_THREAD_MAX_SLEEP so new commands are picked up.
+     */
+    static void runNetwork(void *manager);
+    #endif
+    
+    // Offline storage - measurements and timeout notifications
+    RecordLog offlineLog;
+    MeasurementBlock openBlock;      // Measurements not yet appended (staged)
+    #if !COMPACT_MEASUREMENTS
+    int storedBlock;                 // Block being synced one measurement at a time
+    int storedEntry;                 // Its measurements already sent
+    #endif
+    
+    // Request queue
+    NetworkRequest queue[NETWORK_QUEUE_SIZE];
+    uint32_t nextSequence;
+    char requestBody[REQUEST_BODY_SIZE];  // Payload of the request being sent
+    #if USE_WEBHOOK
+    int publishingSlot;              // Request waiting for publishResult, or -1
+    particle::Future<bool> publishResult;
+    PublishScheduler publishScheduler;  // Rate limit (token bucket)
+    #else
+    int inFlight[HTTP_MAX_PIPELINE]; // Slots sent on the connection, oldest first
+    int inFlightCount;
+    #endif
+    
+    #if COMPACT_MEASUREMENTS
+    int batchIndex[SYNC_BATCH_SIZE]; // Log handles of the records in the batch being sent
+    int batchCount;
+    #endif
+    
+    #if STREAM_RAW_WAVEFORM
+    uint8_t waveformData[WAVEFORM_MAX_BLOCKS * WAVEFORM_BLOCK_MAX_BYTES];  // Trace being uploaded
+    int waveformLength;
+    int waveformParts;
+    uint32_t waveformTimestamp;
+    #endif
+    
+    /*
+     * Add a request to the queue. Returns nullptr if the queue is full.
+     * Batches, config fetches and waveforms are coalesced: while one has
+     * not started sending, it is returned instead of a new slot; while one
+     * is being sent, nullptr is returned.
+     */
+    NetworkRequest* enqueue(NetworkRequestType type);
+    
+    /*
+     * Check if a request of this type is queued or in flight.
+     * Timeouts count only when stored (index >= 0) if storedOnly is set.
+     */
+    bool isQueued(NetworkRequestType type, bool storedOnly = false);
+    
+    /*
+     * Queued request to send next (highest priority, then oldest), or nullptr.
+     */
+    NetworkRequest* nextReadyRequest();
+    
+    /*
+     * Advance queued and in-flight requests. Called from update().
+     */
+    void processQueue();
+    
+    /*
+     * Build a request's payload into the shared request body.
+     * target receives the HTTP path (HTTP mode) or event name (webhook mode).
+     * Returns false if there is nothing left to send.
+     */
+    bool buildRequest(NetworkRequest &request, char *target, int targetSize);
     
-    // Offline storage - measurements
-    StoredMeasurement storage[MAX_STORED_MEASUREMENTS];
-    int storageIndex;
-    int storedCount;
+    /*
+     * Handle a finished request: apply the result, then free its slot or
+     * queue it again (retry or next part).
+     */
+    void completeRequest(NetworkRequest &request, bool success);
     
-    // Offline storage - timeout notifications
-    StoredTimeout timeoutStorage[MAX_STORED_TIMEOUTS];
-    int timeoutStorageIndex;
-    int storedTimeoutCount;
+    /*
+     * Hand a command to the network side: run it now, or queue it for the
+     * network thread (THREADED_MODE). Returns false if the queue is full.
+     */
+    bool submit(const NetworkCommand &command);
+    
+    /*
+     * Carry out a command (network side). Returns true if a request was
+     * queued, false if it was stored offline.
+     */
+    bool runCommand(const NetworkCommand &command);
+    
+    /*
+     * Hand a result to the main thread: apply it now, or queue it
+     * (THREADED_MODE, waiting while the queue is full).
+     */
+    void postEvent(const NetworkEvent &event);
+    void postEvent(NetworkEventType type);
+    
+    /*
+     * Apply a result to the state machine or LED (main thread).
+     */
+    void handleEvent(const NetworkEvent &event);
     
     /*
-     * POST measurement JSON to API server.
-     * Uses webhook publish or direct HTTP based on USE_WEBHOOK.
+     * Take the settings found by the config parser as an EVENT_CONFIG.
+     * Returns false if there are none.
      */
-    bool postMeasurement(String jsonPayload);
+    bool readParsedConfig(NetworkEvent &event);
     
-    // Legacy methods (kept for compatibility, route to postMeasurement)
-    bool sendDirectHTTP(String jsonPayload, const char* host, int port, bool useHttps);
-    bool sendToProxy(String jsonPayload);
-    bool sendToServer(String jsonPayload);
     void webhookResponseHandler(const char *event, const char *data);
     void configResponseHandler(const char *event, const char *data);
     void fetchConfigDirectHTTP(const char* host, int port, bool useHttps);
@@ -200,19 +481,66 @@ private:
      * Create JSON payload for measurement submission.
      * Includes deviceId, heartRate, spO2, timestamp, quality, confidence.
      * Webhook mode also includes apiKey in payload.
+     * Written to out without heap allocation.
      */
-    String createJSON(MeasurementData data);
+    void createJSON(const MeasurementData &data, char *out, int size);
     
-    // EEPROM persistence
-    void saveToEEPROM();
-    void loadFromEEPROM();
-    int findNextStoredMeasurement();
-    int findNextStoredTimeout();
-    bool postTimeoutNotification(String jsonPayload);
+    /*
+     * Create compact payload for measurement submission (COMPACT_MEASUREMENTS).
+     * Webhook mode: the base64 record only.
+     * HTTP mode: {"deviceId":"...","record":"..."}.
+     * Written to out without heap allocation.
+     */
+    void createRecordPayload(const MeasurementData &data, char *out, int size);
     
-    // JSON parsing helpers for config response
-    String extractJsonValue(String json, String key);
-    int extractJsonInt(String json, String key);
+    /*
+     * Create JSON payload for a user timeout notification.
+     * Written to out without heap allocation.
+     */
+    void createTimeoutJSON(uint32_t timestamp, char *out, int size);
+    
+    /*
+     * Restore the open block from the staging slot, and move measurements
+     * stored by earlier firmware into blocks.
+     */
+    void loadStoredMeasurements();
+    
+    /*
+     * Read a measurement stored by earlier firmware (LOG_RECORD_MEASUREMENT).
+     * Returns false if it is no longer pending.
+     */
+    bool readLegacyMeasurement(int handle, MeasurementData &data);
+    
+    /*
+     * Append the open block to the offline log and empty the staging slot.
+     */
+    void sealOpenBlock();
+    
+    /*
+     * Measurements waiting to be synced (stored blocks and the open block).
+     */
+    int countStoredMeasurements();
+    
+    #if COMPACT_MEASUREMENTS
+    /*
+     * Encode stored blocks, oldest first, as a batch payload (base64;
+     * HTTP mode adds the device ID). Returns the measurement count.
+     */
+    int buildBatchPayload(char *out, int size);
+    #endif
+    
+    #if STREAM_RAW_WAVEFORM
+    /*
+     * Queue upload of the raw trace of the measurement just transmitted.
+     * Webhook mode splits it into publish-sized parts; HTTP mode sends one part.
+     */
+    void transmitWaveform(uint32_t timestamp);
+    
+    /*
+     * Build the JSON payload for one waveform part.
+     */
+    void buildWaveformPayload(int part, char *out, int size);
+    #endif
 };
 
 #endif // NETWORK_MANAGER_H
@@ -0,0 +1,61 @@
+/*
+ * publish_scheduler.cpp - Token Bucket for Particle Cloud Publishes
+ * 
+ * See publish_scheduler.h for the pacing rules.
+ */
+
+#include "publish_scheduler.h"
+
+PublishScheduler::PublishScheduler() {
+    tokens = PUBLISH_BURST;
+    lastRefill = 0;
+    publishCount = 0;
+}
+
+/*
+ * Add the tokens earned since lastRefill. Partial intervals carry over,
+ * except when the bucket is full.
+ */
+void PublishScheduler::refill() {
+    unsigned long now = millis();
+    
+    if (tokens >= PUBLISH_BURST) {
+        lastRefill = now;
+        return;
+    }
+    
+    unsigned long earned = (now - lastRefill) / PUBLISH_INTERVAL_MS;
+    if (earned == 0) return;
+    
+    if (earned >= (unsigned long)(PUBLISH_BURST - tokens)) {
+        tokens = PUBLISH_BURST;
+        lastRefill = now;
+    } else {
+        tokens += earned;
+        lastRefill += earned * PUBLISH_INTERVAL_MS;
+    }
+}
+
+bool PublishScheduler::tryAcquire() {
+    refill();
+    if (tokens == 0) return false;
+    
+    tokens--;
+    publishCount++;
+    return true;
+}
+
+unsigned long PublishScheduler::getWaitTime() {
+    refill();
+    if (tokens > 0) return 0;
+    return PUBLISH_INTERVAL_MS - (millis() - lastRefill);
+}
+
+int PublishScheduler::getTokens() {
+    refill();
+    return tokens;
+}
+
+uint32_t PublishScheduler::getPublishCount() {
+    return publishCount;
+}
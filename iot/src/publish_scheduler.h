@@ -0,0 +1,51 @@
+/*
+ * publish_scheduler.h - Token Bucket for Particle Cloud Publishes
+ * 
+ * Particle Cloud accepts about one publish per second per device, with
+ * short bursts allowed. PublishScheduler paces webhook publishes with a
+ * token bucket: it holds up to PUBLISH_BURST tokens and refills one every
+ * PUBLISH_INTERVAL_MS. A publish takes a token; without one it is deferred
+ * to a later update() instead of waiting, so nothing idles the CPU.
+ * 
+ * After a quiet period the first PUBLISH_BURST publishes go out back to
+ * back (e.g. a measurement and its waveform); a longer backlog then leaves
+ * at the sustained limit. Which request goes next is decided by
+ * NetworkManager (priority, then age).
+ */
+
+#ifndef PUBLISH_SCHEDULER_H
+#define PUBLISH_SCHEDULER_H
+
+#include "Particle.h"
+#include "config.h"
+
+/*
+ * PublishScheduler - Token bucket rate limiter
+ */
+class PublishScheduler {
+public:
+    PublishScheduler();
+    
+    /*
+     * Take a token if one is available.
+     * Returns false if the bucket is empty.
+     */
+    bool tryAcquire();
+    
+    /*
+     * Milliseconds until a token is available (0 if one is now).
+     */
+    unsigned long getWaitTime();
+    
+    int getTokens();
+    uint32_t getPublishCount();     // Tokens taken since boot
+
+private:
+    int tokens;
+    unsigned long lastRefill;       // millis() the last whole token was added
+    uint32_t publishCount;
+    
+    void refill();
+};
+
+#endif // PUBLISH_SCHEDULER_H
@@ -0,0 +1,733 @@
+/*
+ * record_log.cpp - Append-only Offline Record Log Implementation
+ *
+ * See record_log.h for the segment and record formats. The log logic only
+ * reads and writes through readByte(), writeBytes(), commit() and
+ * eraseSegment(); those are implemented for flash files and for EEPROM.
+ * getBytesWritten() counts the bytes actually written (in EEPROM, bytes
+ * that already hold the value are skipped).
+ */
+
+#include "record_log.h"
+
+#if OFFLINE_LOG_ON_FLASH
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if OFFLINE_LOG_SEGMENT_SIZE > 65536 || OFFLINE_LOG_SEGMENTS > 256
+#error "Offline log geometry does not fit record handles"
+#endif
+
+#if RECORD_LOG_HEADER_SIZE + RECORD_LOG_OVERHEAD + RECORD_LOG_MAX_PAYLOAD > OFFLINE_LOG_SEGMENT_SIZE
+#error "Offline log segments are too small for the largest record"
+#endif
+
+#if !OFFLINE_LOG_ON_FLASH && (EEPROM_LOG_ADDR + EEPROM_LOG_SEGMENTS * EEPROM_LOG_SEGMENT_SIZE > EEPROM_LOG_CURSOR_ADDR || \
+                              EEPROM_LOG_CURSOR_ADDR + RECORD_CURSOR_SIZE > EEPROM_LOG_STAGE_ADDR)
+#error "Offline log, cursor and staging slots overlap in EEPROM"
+#endif
+
+/*
+ * CRC-8 (polynomial 0x07) over a record's type, length and payload.
+ */
+static uint8_t crc8(uint8_t crc, uint8_t value) {
+    crc ^= value;
+    for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+/*
+ * A staging slot is valid if its length fits and its CRC matches.
+ */
+static bool stageValid(const uint8_t *slot) {
+    if (slot[2] > RECORD_LOG_MAX_PAYLOAD) return false;
+    uint8_t crc = 0;
+    for (int i = 0; i < 3 + slot[2]; i++) crc = crc8(crc, slot[i]);
+    return crc == slot[3 + slot[2]];
+}
+
+#if OFFLINE_LOG_ON_FLASH
+RecordLog::RecordLog(const char *directory) {
+    this->directory = directory;
+    file = -1;
+    fileSegment = -1;
+    cacheSegment = -1;
+    cacheOffset = 0;
+#else
+RecordLog::RecordLog() {
+    stageSlot = 0;
+#endif
+    for (int i = 0; i < OFFLINE_LOG_SEGMENTS; i++) {
+        sequence[i] = 0;
+        pendingInSegment[i] = 0;
+        firstPending[i] = RECORD_LOG_HEADER_SIZE;
+    }
+    for (int i = 0; i < LOG_RECORD_TYPES; i++) {
+        pendingCount[i] = 0;
+        oldestPending[i] = -1;
+    }
+    tailSegment = -1;
+    tailOffset = 0;
+    headSegment = 0;
+    droppedCount = 0;
+    eraseCount = 0;
+    bytesWritten = 0;
+    savedHeadSequence = 0;
+    savedTailSequence = 0;
+    stageSequence = 0;
+}
+
+void RecordLog::begin() {
+    #if OFFLINE_LOG_ON_FLASH
+    mkdir(directory, 0777);  // Fails harmlessly if it exists
+    #endif
+    
+    if (!resumeFromCursor()) scanLog();
+    
+    uint8_t slot[RECORD_STAGE_SIZE];
+    if (readStage(slot)) stageSequence = slot[0];
+    
+    for (int type = 1; type < LOG_RECORD_TYPES; type++) {
+        oldestPending[type] = (pendingCount[type] > 0)
+                            ? findPending(headSegment, firstPending[headSegment], type) : -1;
+    }
+    saveCursor();
+}
+
+int RecordLog::append(LogRecordType type, const uint8_t *payload, int length) {
+    if (length < 0 || length > RECORD_LOG_MAX_PAYLOAD) return -1;
+    
+    int size = RECORD_LOG_OVERHEAD + length;
+    if (tailOffset + size > OFFLINE_LOG_SEGMENT_SIZE) {
+        startSegment((tailSegment + 1) % OFFLINE_LOG_SEGMENTS);
+    }
+    
+    uint8_t record[RECORD_LOG_OVERHEAD + RECORD_LOG_MAX_PAYLOAD];
+    uint8_t crc = crc8(crc8(0, type), length);
+    record[0] = RECORD_PENDING;
+    record[1] = type;
+    record[2] = length;
+    for (int i = 0; i < length; i++) {
+        record[3 + i] = payload[i];
+        crc = crc8(crc, payload[i]);
+    }
+    record[3 + length] = crc;
+    
+    writeBytes(tailSegment, tailOffset + 1, record + 1, size - 1);
+    writeBytes(tailSegment, tailOffset, record, 1);  // Status last
+    commit();
+    
+    int handle = makeHandle(tailSegment, tailOffset);
+    if (pendingInSegment[tailSegment] == 0) firstPending[tailSegment] = tailOffset;
+    if (pendingCount[type] == 0) oldestPending[type] = handle;
+    tailOffset += size;
+    pendingCount[type]++;
+    pendingInSegment[tailSegment]++;
+    if (pendingInSegment[headSegment] == 0) advanceHead();
+    return handle;
+}
+
+int RecordLog::read(int handle, uint8_t *payload, int size) {
+    int segment, offset;
+    if (!resolve(handle, segment, offset)) return -1;
+    if (readByte(segment, offset) != RECORD_PENDING) return -1;
+    
+    int length = readByte(segment, offset + 2);
+    for (int i = 0; i < length && i < size; i++) {
+        payload[i] = readByte(segment, offset + 3 + i);
+    }
+    return length;
+}
+
+bool RecordLog::isPending(int handle) {
+    int segment, offset;
+    return resolve(handle, segment, offset) && readByte(segment, offset) == RECORD_PENDING;
+}
+
+bool RecordLog::markDone(int handle) {
+    int segment, offset;
+    if (!resolve(handle, segment, offset)) return false;
+    if (readByte(segment, offset) != RECORD_PENDING) return false;
+    
+    int type = readByte(segment, offset + 1);
+    uint8_t done = RECORD_DONE;
+    writeBytes(segment, offset, &done, 1);
+    commit();
+    
+    pendingCount[type]--;
+    pendingInSegment[segment]--;
+    
+    // The next record of this type becomes the oldest
+    if (handle == oldestPending[type]) {
+        oldestPending[type] = (pendingCount[type] > 0)
+                            ? findPending(segment, nextRecord(segment, offset), type) : -1;
+    }
+    
+    // Keep the index pointing at the segment's first pending record
+    if (pendingInSegment[segment] > 0 && offset == firstPending[segment]) {
+        int next = nextRecord(segment, offset);
+        while (readByte(segment, next) == RECORD_DONE) next = nextRecord(segment, next);
+        firstPending[segment] = next;
+    }
+    if (segment == headSegment && pendingInSegment[segment] == 0) advanceHead();
+    return true;
+}
+
+int RecordLog::first(LogRecordType type) {
+    return oldestPending[type];
+}
+
+int RecordLog::next(int handle, LogRecordType type) {
+    int segment, offset;
+    if (!resolve(handle, segment, offset)) return first(type);
+    return findPending(segment, nextRecord(segment, offset), type);
+}
+
+void RecordLog::stage(LogRecordType type, const uint8_t *payload, int length) {
+    if (length < 0 || length > RECORD_LOG_MAX_PAYLOAD) return;
+    
+    uint8_t slot[RECORD_STAGE_SIZE];
+    slot[0] = ++stageSequence;
+    slot[1] = (length > 0) ? type : 0;
+    slot[2] = length;
+    uint8_t crc = crc8(crc8(crc8(0, slot[0]), slot[1]), slot[2]);
+    for (int i = 0; i < length; i++) {
+        slot[3 + i] = payload[i];
+        crc = crc8(crc, payload[i]);
+    }
+    slot[3 + length] = crc;
+    writeStage(slot);
+}
+
+int RecordLog::readStaged(LogRecordType type, uint8_t *payload, int size) {
+    uint8_t slot[RECORD_STAGE_SIZE];
+    if (!readStage(slot) || slot[1] != type) return 0;
+    
+    int length = slot[2];
+    for (int i = 0; i < length && i < size; i++) payload[i] = slot[3 + i];
+    return length;
+}
+
+int RecordLog::getPendingCount(LogRecordType type) {
+    return pendingCount[type];
+}
+
+uint32_t RecordLog::getDroppedCount() {
+    return droppedCount;
+}
+
+uint32_t RecordLog::getEraseCount() {
+    return eraseCount;
+}
+
+uint16_t RecordLog::getSegmentEraseCount(int segment) {
+    return readWord(segment, 0) == RECORD_LOG_MAGIC ? readWord(segment, 2) : 0;
+}
+
+uint32_t RecordLog::getBytesWritten() {
+    return bytesWritten;
+}
+
+// ============================================================================
+// Storage Access - Flash Files
+// ============================================================================
+
+#if OFFLINE_LOG_ON_FLASH
+/*
+ * Open a segment's file, keeping one file open at a time.
+ * Returns the descriptor, or -1.
+ */
+int RecordLog::openSegment(int segment) {
+    if (file >= 0 && fileSegment == segment) return file;
+    if (file >= 0) close(file);
+    
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%02d.log", directory, segment);
+    file = open(path, O_RDWR | O_CREAT, 0644);
+    fileSegment = (file >= 0) ? segment : -1;
+    return file;
+}
+
+/*
+ * Reads go through a small cache; bytes past the end of a file read as
+ * 0xFF (free), like erased EEPROM.
+ */
+uint8_t RecordLog::readByte(int segment, int offset) {
+    if (segment == cacheSegment && offset >= cacheOffset && offset < cacheOffset + RECORD_LOG_CACHE_SIZE) {
+        return cache[offset - cacheOffset];
+    }
+    
+    memset(cache, 0xFF, sizeof(cache));
+    int fd = openSegment(segment);
+    if (fd >= 0 && lseek(fd, offset, SEEK_SET) == offset) {
+        ::read(fd, cache, sizeof(cache));
+    }
+    cacheSegment = segment;
+    cacheOffset = offset;
+    return cache[0];
+}
+
+void RecordLog::writeBytes(int segment, int offset, const uint8_t *data, int length) {
+    int fd = openSegment(segment);
+    if (fd < 0 || lseek(fd, offset, SEEK_SET) != offset) return;
+    
+    int written = write(fd, data, length);
+    if (written > 0) bytesWritten += written;
+    
+    // Keep the cache in step
+    if (segment == cacheSegment) {
+        for (int i = 0; i < length; i++) {
+            int index = offset + i - cacheOffset;
+            if (index >= 0 && index < RECORD_LOG_CACHE_SIZE) cache[index] = data[i];
+        }
+    }
+}
+
+void RecordLog::commit() {
+    if (file >= 0) fsync(file);
+}
+
+void RecordLog::eraseSegment(int segment) {
+    if (file >= 0 && fileSegment == segment) {
+        close(file);
+        file = -1;
+        fileSegment = -1;
+    }
+    if (cacheSegment == segment) cacheSegment = -1;
+    
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%02d.log", directory, segment);
+    unlink(path);
+}
+
+/*
+ * The cursor has a file of its own, written and committed in one go.
+ */
+void RecordLog::readCursor(uint8_t *cursor) {
+    memset(cursor, 0xFF, RECORD_CURSOR_SIZE);
+    
+    char path[64];
+    snprintf(path, sizeof(path), "%s/cursor", directory);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    ::read(fd, cursor, RECORD_CURSOR_SIZE);
+    close(fd);
+}
+
+void RecordLog::writeCursor(const uint8_t *cursor) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/cursor", directory);
+    int fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) return;
+    
+    int written = write(fd, cursor, RECORD_CURSOR_SIZE);
+    if (written > 0) bytesWritten += written;
+    fsync(fd);
+    close(fd);
+}
+
+/*
+ * The staging slot is a file of its own too; an empty slot is removed.
+ */
+bool RecordLog::readStage(uint8_t *slot) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/staged", directory);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    
+    int length = ::read(fd, slot, RECORD_STAGE_SIZE);
+    close(fd);
+    return length >= 4 && length >= 4 + slot[2] && stageValid(slot);
+}
+
+void RecordLog::writeStage(const uint8_t *slot) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/staged", directory);
+    if (slot[2] == 0) {
+        unlink(path);
+        return;
+    }
+    
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    int written = write(fd, slot, 4 + slot[2]);
+    if (written > 0) bytesWritten += written;
+    fsync(fd);
+    close(fd);
+}
+
+#else
+// ============================================================================
+// Storage Access - EEPROM
+// ============================================================================
+
+uint8_t RecordLog::readByte(int segment, int offset) {
+    return EEPROM.read(EEPROM_LOG_ADDR + segment * OFFLINE_LOG_SEGMENT_SIZE + offset);
+}
+
+void RecordLog::writeBytes(int segment, int offset, const uint8_t *data, int length) {
+    int address = EEPROM_LOG_ADDR + segment * OFFLINE_LOG_SEGMENT_SIZE + offset;
+    for (int i = 0; i < length; i++) {
+        if (EEPROM.read(address + i) == data[i]) continue;
+        EEPROM.write(address + i, data[i]);
+        bytesWritten++;
+    }
+}
+
+void RecordLog::commit() {
+}
+
+void RecordLog::eraseSegment(int segment) {
+    uint8_t erased = 0xFF;
+    for (int offset = 0; offset < OFFLINE_LOG_SEGMENT_SIZE; offset++) {
+        writeBytes(segment, offset, &erased, 1);
+    }
+}
+
+void RecordLog::readCursor(uint8_t *cursor) {
+    for (int i = 0; i < RECORD_CURSOR_SIZE; i++) {
+        cursor[i] = EEPROM.read(EEPROM_LOG_CURSOR_ADDR + i);
+    }
+}
+
+void RecordLog::writeCursor(const uint8_t *cursor) {
+    for (int i = 0; i < RECORD_CURSOR_SIZE; i++) {
+        if (EEPROM.read(EEPROM_LOG_CURSOR_ADDR + i) == cursor[i]) continue;
+        EEPROM.write(EEPROM_LOG_CURSOR_ADDR + i, cursor[i]);
+        bytesWritten++;
+    }
+}
+
+/*
+ * Two staging slots are used in turn; the newer valid one is current.
+ */
+bool RecordLog::readStage(uint8_t *slot) {
+    uint8_t other[RECORD_STAGE_SIZE];
+    for (int i = 0; i < RECORD_STAGE_SIZE; i++) {
+        slot[i] = EEPROM.read(EEPROM_LOG_STAGE_ADDR + i);
+        other[i] = EEPROM.read(EEPROM_LOG_STAGE_ADDR + RECORD_STAGE_SIZE + i);
+    }
+    
+    bool first = stageValid(slot);
+    bool second = stageValid(other);
+    if (second && (!first || (int8_t)(other[0] - slot[0]) > 0)) {
+        memcpy(slot, other, RECORD_STAGE_SIZE);
+        stageSlot = 1;
+        return true;
+    }
+    stageSlot = 0;
+    return first;
+}
+
+void RecordLog::writeStage(const uint8_t *slot) {
+    stageSlot ^= 1;
+    int address = EEPROM_LOG_STAGE_ADDR + stageSlot * RECORD_STAGE_SIZE;
+    for (int i = 0; i < 4 + slot[2]; i++) {
+        if (EEPROM.read(address + i) == slot[i]) continue;
+        EEPROM.write(address + i, slot[i]);
+        bytesWritten++;
+    }
+}
+#endif
+
+uint16_t RecordLog::readWord(int segment, int offset) {
+    return readByte(segment, offset) | (readByte(segment, offset + 1) << 8);
+}
+
+// ============================================================================
+// Log Structure
+// ============================================================================
+
+/*
+ * Sequence number from a segment's header, or 0 if it is not in use.
+ */
+uint32_t RecordLog::readSequence(int segment) {
+    if (readWord(segment, 0) != RECORD_LOG_MAGIC) return 0;
+    return readWord(segment, 4) | ((uint32_t)readWord(segment, 6) << 16);
+}
+
+/*
+ * Rebuild the index from the saved cursor, reading only the segments from
+ * the head to the tail. Returns false (index untouched) if there is no
+ * valid cursor or the segments do not match it.
+ */
+bool RecordLog::resumeFromCursor() {
+    uint8_t cursor[RECORD_CURSOR_SIZE];
+    readCursor(cursor);
+    
+    uint8_t crc = 0;
+    for (int i = 0; i < RECORD_CURSOR_SIZE - 1; i++) crc = crc8(crc, cursor[i]);
+    if ((cursor[0] | (cursor[1] << 8)) != RECORD_CURSOR_MAGIC || crc != cursor[RECORD_CURSOR_SIZE - 1]) {
+        return false;
+    }
+    
+    int head = cursor[2];
+    int tail = cursor[3];
+    uint32_t headSequence = cursor[4] | (cursor[5] << 8) | (cursor[6] << 16) | ((uint32_t)cursor[7] << 24);
+    uint32_t tailSequence = cursor[8] | (cursor[9] << 8) | (cursor[10] << 16) | ((uint32_t)cursor[11] << 24);
+    if (head >= OFFLINE_LOG_SEGMENTS || tail >= OFFLINE_LOG_SEGMENTS || headSequence == 0 ||
+        readSequence(tail) != tailSequence) {
+        return false;
+    }
+    
+    // Segments started after the cursor was saved
+    uint32_t cursorTail = tailSequence;
+    for (int i = 1; i < OFFLINE_LOG_SEGMENTS; i++) {
+        int segment = (tail + 1) % OFFLINE_LOG_SEGMENTS;
+        if (segment == head || readSequence(segment) != tailSequence + 1) break;
+        tail = segment;
+        tailSequence++;
+    }
+    
+    // Segments from the head to the tail carry consecutive sequences
+    int count = (tail - head + OFFLINE_LOG_SEGMENTS) % OFFLINE_LOG_SEGMENTS + 1;
+    if (tailSequence - headSequence + 1 != (uint32_t)count) return false;
+    for (int i = 0; i < count; i++) {
+        int segment = (head + i) % OFFLINE_LOG_SEGMENTS;
+        if (readSequence(segment) != headSequence + i) return false;
+    }
+    
+    savedHeadSequence = headSequence;
+    savedTailSequence = cursorTail;
+    
+    // Earlier segments hold no pending records and stay out of the index
+    for (int segment = 0; segment < OFFLINE_LOG_SEGMENTS; segment++) {
+        sequence[segment] = 0;
+    }
+    for (int i = 0; i < count; i++) {
+        sequence[(head + i) % OFFLINE_LOG_SEGMENTS] = headSequence + i;
+    }
+    tailSegment = tail;
+    headSegment = head;
+    
+    for (int i = 0; i < count; i++) {
+        int segment = (head + i) % OFFLINE_LOG_SEGMENTS;
+        int endOffset;
+        scanSegment(segment, true, endOffset);
+        if (segment == tailSegment) tailOffset = endOffset;
+    }
+    advanceHead();
+    return true;
+}
+
+/*
+ * Rebuild the index by reading every segment.
+ */
+void RecordLog::scanLog() {
+    // Segments in use and the newest one (the tail)
+    for (int segment = 0; segment < OFFLINE_LOG_SEGMENTS; segment++) {
+        sequence[segment] = readSequence(segment);
+        if (sequence[segment] != 0 &&
+            (tailSegment < 0 || sequence[segment] > sequence[tailSegment])) {
+            tailSegment = segment;
+        }
+    }
+    
+    // Nothing stored yet (or an older storage layout): start a fresh log
+    if (tailSegment < 0) {
+        startSegment(0);
+        return;
+    }
+    
+    for (int segment = 0; segment < OFFLINE_LOG_SEGMENTS; segment++) {
+        if (sequence[segment] == 0) continue;
+        int endOffset;
+        scanSegment(segment, true, endOffset);
+        if (segment == tailSegment) tailOffset = endOffset;
+    }
+    advanceHead();
+}
+
+/*
+ * Save the head and tail if either has moved to another segment.
+ */
+void RecordLog::saveCursor() {
+    if (tailSegment < 0) return;
+    uint32_t head = sequence[headSegment];
+    uint32_t tail = sequence[tailSegment];
+    if (head == savedHeadSequence && tail == savedTailSequence) return;
+    
+    uint8_t cursor[RECORD_CURSOR_SIZE] = {
+        RECORD_CURSOR_MAGIC & 0xFF, RECORD_CURSOR_MAGIC >> 8,
+        (uint8_t)headSegment, (uint8_t)tailSegment,
+        (uint8_t)(head & 0xFF), (uint8_t)((head >> 8) & 0xFF),
+        (uint8_t)((head >> 16) & 0xFF), (uint8_t)(head >> 24),
+        (uint8_t)(tail & 0xFF), (uint8_t)((tail >> 8) & 0xFF),
+        (uint8_t)((tail >> 16) & 0xFF), (uint8_t)(tail >> 24),
+        0
+    };
+    for (int i = 0; i < RECORD_CURSOR_SIZE - 1; i++) {
+        cursor[RECORD_CURSOR_SIZE - 1] = crc8(cursor[RECORD_CURSOR_SIZE - 1], cursor[i]);
+    }
+    writeCursor(cursor);
+    
+    savedHeadSequence = head;
+    savedTailSequence = tail;
+}
+
+/*
+ * Offset of the record after the one at offset.
+ */
+int RecordLog::nextRecord(int segment, int offset) {
+    return offset + RECORD_LOG_OVERHEAD + readByte(segment, offset + 2);
+}
+
+/*
+ * Walk a segment's records. With countPending, pending records are added
+ * to the index (damaged ones are acknowledged instead); otherwise they are
+ * removed from the counts and dropped. endOffset is where the next record
+ * would go, or the segment size if it ends in a damaged record.
+ */
+void RecordLog::scanSegment(int segment, bool countPending, int &endOffset) {
+    int offset = RECORD_LOG_HEADER_SIZE;
+    if (countPending) firstPending[segment] = OFFLINE_LOG_SEGMENT_SIZE;
+    
+    while (offset + RECORD_LOG_OVERHEAD <= OFFLINE_LOG_SEGMENT_SIZE) {
+        uint8_t status = readByte(segment, offset);
+        if (status == 0xFF) break;
+    
+        int type = readByte(segment, offset + 1);
+        int length = readByte(segment, offset + 2);
+        if ((status != RECORD_PENDING && status != RECORD_DONE) ||
+            length > RECORD_LOG_MAX_PAYLOAD ||
+            offset + RECORD_LOG_OVERHEAD + length > OFFLINE_LOG_SEGMENT_SIZE) {
+            offset = OFFLINE_LOG_SEGMENT_SIZE;
+            break;
+        }
+    
+        if (status == RECORD_PENDING) {
+            if (!countPending) {
+                pendingCount[type]--;
+                droppedCount++;
+            } else {
+                uint8_t crc = crc8(crc8(0, type), length);
+                for (int i = 0; i < length; i++) crc = crc8(crc, readByte(segment, offset + 3 + i));
+    
+                if (type <= 0 || type >= LOG_RECORD_TYPES || crc != readByte(segment, offset + 3 + length)) {
+                    uint8_t done = RECORD_DONE;
+                    writeBytes(segment, offset, &done, 1);
+                    commit();
+                    droppedCount++;
+                } else {
+                    if (pendingInSegment[segment] == 0) firstPending[segment] = offset;
+                    pendingCount[type]++;
+                    pendingInSegment[segment]++;
+                }
+            }
+        }
+        offset += RECORD_LOG_OVERHEAD + length;
+    }
+    endOffset = offset;
+}
+
+/*
+ * Erase a segment and make it the tail. Pending records still in it are
+ * dropped. The header is written last, magic last of all, so a segment
+ * whose erase was interrupted reads as unused.
+ */
+void RecordLog::startSegment(int segment) {
+    bool dropped = sequence[segment] != 0 && pendingInSegment[segment] > 0;
+    if (dropped) {
+        int endOffset;
+        scanSegment(segment, false, endOffset);
+        if (DEBUG_MODE) {
+            Serial.printlnf("Offline log full - %d unsynced record(s) dropped", pendingInSegment[segment]);
+        }
+    }
+    
+    uint16_t erases = getSegmentEraseCount(segment) + 1;
+    uint32_t next = (tailSegment >= 0 ? sequence[tailSegment] : 0) + 1;
+    
+    eraseSegment(segment);
+    uint8_t header[RECORD_LOG_HEADER_SIZE] = {
+        RECORD_LOG_MAGIC & 0xFF, RECORD_LOG_MAGIC >> 8,
+        (uint8_t)(erases & 0xFF), (uint8_t)(erases >> 8),
+        (uint8_t)(next & 0xFF), (uint8_t)((next >> 8) & 0xFF),
+        (uint8_t)((next >> 16) & 0xFF), (uint8_t)(next >> 24)
+    };
+    writeBytes(segment, 2, header + 2, RECORD_LOG_HEADER_SIZE - 2);
+    writeBytes(segment, 0, header, 2);
+    commit();
+    
+    sequence[segment] = next;
+    pendingInSegment[segment] = 0;
+    firstPending[segment] = RECORD_LOG_HEADER_SIZE;
+    tailSegment = segment;
+    tailOffset = RECORD_LOG_HEADER_SIZE;
+    eraseCount++;
+    if (segment == headSegment) advanceHead();
+    
+    // Records that were the oldest of their type may have been dropped
+    if (dropped) {
+        for (int type = 1; type < LOG_RECORD_TYPES; type++) {
+            oldestPending[type] = (pendingCount[type] > 0)
+                                ? findPending(headSegment, firstPending[headSegment], type) : -1;
+        }
+    }
+    saveCursor();
+}
+
+/*
+ * Move the head to the oldest segment with pending records (the tail if
+ * there are none). Segments are used in order, so the oldest is the first
+ * one after the tail.
+ */
+void RecordLog::advanceHead() {
+    headSegment = tailSegment;
+    for (int i = 1; i < OFFLINE_LOG_SEGMENTS; i++) {
+        int segment = (tailSegment + i) % OFFLINE_LOG_SEGMENTS;
+        if (sequence[segment] != 0 && pendingInSegment[segment] > 0) {
+            headSegment = segment;
+            break;
+        }
+    }
+    saveCursor();
+}
+
+/*
+ * Handle: low 7 bits of the segment sequence, the segment and the record's
+ * offset in it. Always non-negative.
+ */
+int RecordLog::makeHandle(int segment, int offset) {
+    return (int)((sequence[segment] & 0x7F) << 24) | (segment << 16) | offset;
+}
+
+bool RecordLog::resolve(int handle, int &segment, int &offset) {
+    if (handle < 0) return false;
+    
+    segment = (handle >> 16) & 0xFF;
+    offset = handle & 0xFFFF;
+    return segment < OFFLINE_LOG_SEGMENTS && offset >= RECORD_LOG_HEADER_SIZE &&
+           sequence[segment] != 0 && (int)(sequence[segment] & 0x7F) == (handle >> 24);
+}
+
+/*
+ * First pending record of a type at or after offset in segment, following
+ * the segments up to the tail. Done records before a segment's first
+ * pending record are skipped using the index.
+ */
+int RecordLog::findPending(int segment, int offset, int type) {
+    while (true) {
+        if (pendingInSegment[segment] > 0) {
+            int end = (segment == tailSegment) ? tailOffset : OFFLINE_LOG_SEGMENT_SIZE;
+            if (offset < firstPending[segment]) offset = firstPending[segment];
+    
+            while (offset + RECORD_LOG_OVERHEAD <= end) {
+                uint8_t status = readByte(segment, offset);
+                if (status != RECORD_PENDING && status != RECORD_DONE) break;
+                if (status == RECORD_PENDING && readByte(segment, offset + 1) == type) {
+                    return makeHandle(segment, offset);
+                }
+                offset = nextRecord(segment, offset);
+            }
+        }
+    
+        if (segment == tailSegment) return -1;
+        segment = (segment + 1) % OFFLINE_LOG_SEGMENTS;
+        offset = RECORD_LOG_HEADER_SIZE;
+    }
+}
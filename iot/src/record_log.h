@@ -0,0 +1,231 @@
+/*
+ * record_log.h - Append-only Offline Record Log
+ *
+ * Offline measurements and timeout notifications are appended to a log
+ * instead of rewriting fixed arrays, so storing a record writes only that
+ * record and acknowledging one (synced to the server) writes one byte.
+ *
+ * STORAGE (OFFLINE_LOG_ON_FLASH in config.h):
+ *   - Flash: one file per segment in FLASH_LOG_DIR on the LittleFS flash
+ *     file system (FLASH_LOG_SEGMENTS files of FLASH_LOG_SEGMENT_SIZE).
+ *     Each append or acknowledgement is committed with fsync(), which
+ *     LittleFS makes atomic.
+ *   - EEPROM: the region at EEPROM_LOG_ADDR (EEPROM_LOG_SEGMENTS segments
+ *     of EEPROM_LOG_SEGMENT_SIZE). Only bytes that change are written.
+ *   Both use the same segment and record formats.
+ *
+ * SEGMENTS:
+ *   Segments are used in turn. Records are appended at the tail; when the
+ *   tail segment is full the next one is erased (set to 0xFF, or the file
+ *   recreated) and gets a new sequence number, so writes and erases spread
+ *   evenly. If that segment still holds unsynced records they are dropped -
+ *   the oldest data is lost first. The head is the oldest segment that
+ *   still holds unsynced records.
+ *
+ * SEGMENT FORMAT (8 bytes header, little endian):
+ *   byte 0-1  magic (RECORD_LOG_MAGIC)
+ *   byte 2-3  erase count of this segment
+ *   byte 4-7  sequence number (increases with every segment erased)
+ *
+ * RECORD FORMAT (payload + 4 bytes):
+ *   byte 0    status: 0xFF free, RECORD_PENDING, RECORD_DONE
+ *   byte 1    type (LogRecordType)
+ *   byte 2    payload length
+ *   byte 3..  payload
+ *   last      CRC-8 of type, length and payload
+ *   The status byte is written last, so a record cut off by a reset is
+ *   never seen as pending; acknowledging a record only clears its status.
+ *
+ * CURSOR FORMAT (13 bytes, file "cursor" in FLASH_LOG_DIR or EEPROM at
+ * EEPROM_LOG_CURSOR_ADDR):
+ *   byte 0-1   magic (RECORD_CURSOR_MAGIC)
+ *   byte 2     head segment
+ *   byte 3     tail segment
+ *   byte 4-7   head segment sequence
+ *   byte 8-11  tail segment sequence
+ *   byte 12    CRC-8 of bytes 0-11
+ *   Saved whenever the head or tail moves to another segment, so about
+ *   twice per segment filled. Segments before the head hold no pending
+ *   records, so begin() only reads the segments from the head to the tail;
+ *   a tail that moved on after the cursor was saved is found from the
+ *   segment sequences. Without a valid cursor the whole log is read.
+ *
+ * STAGING SLOT (file "staged" in FLASH_LOG_DIR, or two alternating slots
+ * at EEPROM_LOG_STAGE_ADDR):
+ *   byte 0     sequence (EEPROM: the newer valid slot is current)
+ *   byte 1     type (0 = empty)
+ *   byte 2     payload length
+ *   byte 3..   payload
+ *   last       CRC-8 of the bytes before it
+ *   Holds one record that is still being filled (the open measurement
+ *   block), so it survives a reset until it is appended to the log. The
+ *   file is replaced atomically; in EEPROM a slot cut off by a reset fails
+ *   its CRC and the other slot still holds the previous payload.
+ *
+ * INDEX:
+ *   begin() keeps a small index in RAM: per segment its sequence, pending
+ *   count and first pending record, plus per type the pending count and
+ *   the oldest pending record. first() is a lookup and acknowledging the
+ *   oldest record moves on to the next one of its type, so the pending
+ *   records of each type form a FIFO that syncs oldest first. RAM use
+ *   depends only on the number of segments, not on their size. Records are
+ *   addressed by handles that also carry the segment sequence, so a handle
+ *   to a record whose segment was since erased is rejected rather than
+ *   hitting the record that replaced it.
+ */
+
+#ifndef RECORD_LOG_H
+#define RECORD_LOG_H
+
+#include "Particle.h"
+#include "config.h"
+
+#if OFFLINE_LOG_ON_FLASH
+#define OFFLINE_LOG_SEGMENT_SIZE FLASH_LOG_SEGMENT_SIZE
+#define OFFLINE_LOG_SEGMENTS FLASH_LOG_SEGMENTS
+#else
+#define OFFLINE_LOG_SEGMENT_SIZE EEPROM_LOG_SEGMENT_SIZE
+#define OFFLINE_LOG_SEGMENTS EEPROM_LOG_SEGMENTS
+#endif
+
+#define RECORD_LOG_MAGIC 0x4C52         // "RL"
+#define RECORD_CURSOR_MAGIC 0x4352      // "RC"
+#define RECORD_CURSOR_SIZE 13
+#define RECORD_STAGE_SIZE (4 + RECORD_LOG_MAX_PAYLOAD)
+#define RECORD_LOG_HEADER_SIZE 8
+#define RECORD_LOG_OVERHEAD 4           // Status, type, length and CRC bytes
+#define RECORD_LOG_MAX_PAYLOAD 144
+#define RECORD_LOG_CACHE_SIZE 64        // Flash read cache
+
+#define RECORD_PENDING 0x5A             // Written, not yet synced
+#define RECORD_DONE 0x00                // Synced (or given up)
+
+/*
+ * LogRecordType - What a record holds
+ */
+enum LogRecordType {
+    LOG_RECORD_MEASUREMENT = 1,         // Offline measurement (earlier firmware)
+    LOG_RECORD_TIMEOUT = 2,             // Offline timeout notification
+    LOG_RECORD_MEASUREMENTS = 3,        // Block of offline measurements
+    LOG_RECORD_TYPES                    // Number of types + 1
+};
+
+/*
+ * RecordLog - Segmented append-only log in flash files or EEPROM
+ */
+class RecordLog {
+public:
+    #if OFFLINE_LOG_ON_FLASH
+    RecordLog(const char *directory = FLASH_LOG_DIR);
+    #else
+    RecordLog();
+    #endif
+    
+    /*
+     * Find the head and tail (from the saved cursor when it is valid) and
+     * build the index from the segments between them.
+     */
+    void begin();
+    
+    /*
+     * Append a pending record. Returns its handle, or -1 if it could not
+     * be written.
+     */
+    int append(LogRecordType type, const uint8_t *payload, int length);
+    
+    /*
+     * Read a pending record. Returns the payload length, or -1 if the
+     * handle is no longer pending (acknowledged or erased).
+     */
+    int read(int handle, uint8_t *payload, int size);
+    
+    bool isPending(int handle);
+    
+    /*
+     * Acknowledge a record (one byte written). Returns false if it was not
+     * pending.
+     */
+    bool markDone(int handle);
+    
+    /*
+     * Oldest pending record of a type, or -1. Constant time.
+     */
+    int first(LogRecordType type);
+    
+    /*
+     * Next pending record of a type after handle, or -1.
+     */
+    int next(int handle, LogRecordType type);
+    
+    /*
+     * Replace the staging slot's payload (length 0 empties it).
+     */
+    void stage(LogRecordType type, const uint8_t *payload, int length);
+    
+    /*
+     * Read the staging slot. Returns the payload length, or 0 if it is
+     * empty or holds another type.
+     */
+    int readStaged(LogRecordType type, uint8_t *payload, int size);
+    
+    int getPendingCount(LogRecordType type);
+    uint32_t getDroppedCount();         // Pending records lost to segment erases
+    uint32_t getEraseCount();           // Segment erases since boot
+    uint16_t getSegmentEraseCount(int segment);  // Lifetime erases (from its header)
+    uint32_t getBytesWritten();         // Bytes written since boot
+
+private:
+    // Index
+    uint32_t sequence[OFFLINE_LOG_SEGMENTS];        // 0 = segment not in use
+    uint16_t pendingInSegment[OFFLINE_LOG_SEGMENTS];
+    uint16_t firstPending[OFFLINE_LOG_SEGMENTS];    // Offset of the first pending record
+    int pendingCount[LOG_RECORD_TYPES];
+    int oldestPending[LOG_RECORD_TYPES];    // Handle of the oldest pending record, or -1
+    int tailSegment;                    // Segment being appended to
+    int tailOffset;                     // Next free byte in it
+    int headSegment;                    // Oldest segment with pending records
+    uint32_t droppedCount;
+    uint32_t eraseCount;
+    uint32_t bytesWritten;
+    uint32_t savedHeadSequence;         // Cursor last saved
+    uint32_t savedTailSequence;
+    uint8_t stageSequence;
+    
+    #if OFFLINE_LOG_ON_FLASH
+    const char *directory;
+    int file;                           // Open segment file, or -1
+    int fileSegment;
+    uint8_t cache[RECORD_LOG_CACHE_SIZE];
+    int cacheSegment;                   // Segment in the cache, or -1
+    int cacheOffset;
+    
+    int openSegment(int segment);
+    #else
+    int stageSlot;                      // Current EEPROM staging slot
+    #endif
+    
+    // Storage access
+    uint8_t readByte(int segment, int offset);
+    uint16_t readWord(int segment, int offset);
+    void writeBytes(int segment, int offset, const uint8_t *data, int length);
+    void commit();
+    void eraseSegment(int segment);
+    void readCursor(uint8_t *cursor);
+    void writeCursor(const uint8_t *cursor);
+    bool readStage(uint8_t *slot);
+    void writeStage(const uint8_t *slot);
+    
+    uint32_t readSequence(int segment);
+    bool resumeFromCursor();
+    void scanLog();
+    void saveCursor();
+    int nextRecord(int segment, int offset);
+    void scanSegment(int segment, bool countPending, int &endOffset);
+    void startSegment(int segment);
+    void advanceHead();
+    int makeHandle(int segment, int offset);
+    bool resolve(int handle, int &segment, int &offset);
+    int findPending(int segment, int offset, int type);
+};
+
+#endif // RECORD_LOG_H
@@ -0,0 +1,30 @@
+/*
+ * sample_window.cpp - Sliding Sample Window Implementation
+ * 
+ * Each push() (inline, in sample_window.h) is O(1): the sample is written
+ * over the oldest entry and the head index advances. Nothing is shifted or
+ * copied when the window slides.
+ */
+
+#include "sample_window.h"
+
+SampleWindow::SampleWindow(int windowSize, int hopSize) {
+    if (windowSize < 1) windowSize = 1;
+    if (windowSize > SAMPLE_WINDOW_CAPACITY) windowSize = SAMPLE_WINDOW_CAPACITY;
+    if (hopSize < 1) hopSize = 1;
+    if (hopSize > windowSize) hopSize = windowSize;
+    
+    this->windowSize = windowSize;
+    this->hopSize = hopSize;
+    reset();
+}
+
+/*
+ * Discard all samples.
+ * Stored values are left in place - count tracks what is valid.
+ */
+void SampleWindow::reset() {
+    head = 0;
+    count = 0;
+    newSamples = 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * sample_window.h - Sliding Sample Window for SpO2 Processing
+ * 
+ * Ring buffer holding the most recent red/IR samples for the SpO2 algorithm.
+ * New samples overwrite the oldest in place, so sliding the window never
+ * moves data. The algorithm reads the window directly from the ring using
+ * getStart() as the index of the oldest sample.
+ * 
+ * WINDOW / HOP:
+ *   - windowSize: Number of samples analysed per calculation
+ *   - hopSize: New samples required between calculations
+ *   push() returns true once the window is full and hopSize new samples
+ *   have arrived since the last calculation.
+ */
+
+#ifndef SAMPLE_WINDOW_H
+#define SAMPLE_WINDOW_H
+
+#include "Particle.h"
+#include "config.h"
+
+// Storage reserved per channel (largest supported window)
+#define SAMPLE_WINDOW_CAPACITY SPO2_WINDOW_SIZE
+
+/*
+ * SampleWindow - Fixed-capacity red/IR ring buffer
+ */
+class SampleWindow {
+public:
+    /*
+     * Create a window of windowSize samples that is ready every hopSize samples.
+     * Sizes are clamped to 1..SAMPLE_WINDOW_CAPACITY.
+     */
+    SampleWindow(int windowSize = SPO2_WINDOW_SIZE, int hopSize = SPO2_HOP_SIZE);
+    
+    /*
+     * Discard all samples.
+     */
+    void reset();
+    
+    // push() and the accessors are defined inline - they are called for every sample
+    
+    /*
+     * Add one sample, overwriting the oldest once full.
+     * Returns true when a new window is ready for calculation: the first
+     * after windowSize samples, then every hopSize.
+     */
+    bool push(uint32_t redValue, uint32_t irValue) {
+        red[head] = redValue;
+        ir[head] = irValue;
+        
+        head++;
+        if (head == windowSize) head = 0;
+        
+        if (count < windowSize) count++;
+        newSamples++;
+        
+        if (count == windowSize && newSamples >= hopSize) {
+            newSamples = 0;
+            return true;
+        }
+        return false;
+    }
+    
+    /*
+     * Check if the window holds windowSize samples.
+     */
+    bool isFull() { return count == windowSize; }
+    
+    /*
+     * Number of samples currently held.
+     */
+    int getCount() { return count; }
+    
+    /*
+     * Window length in samples.
+     */
+    int getSize() { return windowSize; }
+    
+    /*
+     * Ring index of the oldest sample.
+     * Before the window is full the samples start at index 0.
+     */
+    int getStart() { return isFull() ? head : 0; }
+    
+    /*
+     * Ring index the next sample will be written to.
+     */
+    int getHead() { return head; }
+    
+    /*
+     * Raw ring storage (getSize() entries, oldest at getStart()).
+     */
+    uint32_t* getRed() { return red; }
+    uint32_t* getIR() { return ir; }
+    
+private:
+    uint32_t red[SAMPLE_WINDOW_CAPACITY];
+    uint32_t ir[SAMPLE_WINDOW_CAPACITY];
+    int windowSize;
+    int hopSize;
+    int head;           // Next write position (oldest sample once full)
+    int count;          // Samples held (saturates at windowSize)
+    int newSamples;     // Samples added since the last ready window
+};
+
+#endif // SAMPLE_WINDOW_H
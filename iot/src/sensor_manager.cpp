@@ -5,37 +5,55 @@
  * Collects samples from the sensor and calculates heart rate and SpO2.
  * 
  * ALGORITHM:
- *   Uses maxim_heart_rate_and_oxygen_saturation() from spo2_algorithm.h
+ *   Uses Spo2Estimator (spo2_estimator.h), a streaming form of the Maxim
+ *   algorithm in spo2_algorithm.h that gives the same results.
  *   Requires 100 samples to calculate initial reading
- *   Continuously updates with 25-sample sliding window
+ *   Continuously updates with 25-sample sliding window (SPO2_WINDOW_SIZE /
+ *   SPO2_HOP_SIZE). Running sums are updated as each sample arrives, so a
+ *   hop only runs the smoothing/peak search once over the window.
  * 
  * TIMING:
  *   - Initial buffer fill: ~4 seconds (100 samples at 25 Hz)
  *   - Measurement timeout: 60 seconds max
+ * 
+ * ACQUISITION:
+ *   Samples are never waited for. In interrupt mode the sensor signals
+ *   A_FULL (SENSOR_FIFO_ALMOST_FULL samples queued) on MAX30102_INT and
+ *   drainFIFO() reads the whole hardware FIFO in one check() burst into
+ *   the driver's sample ring.
+ *   In polling mode drainFIFO() simply takes whatever is queued.
+ *   After each burst the next one is scheduled a watermark's worth of
+ *   samples later, so loop() does not poll the sensor in between.
+ *   With THREADED_MODE, the bursts run on the acquisition thread
+ *   (acquire()), which is not held up by a publish or HTTP request on the
+ *   main thread; drainFIFO() takes the samples from the driver's ring,
+ *   which the acquisition thread fills without a lock.
  */
 
 #include "sensor_manager.h"
 #include "config.h"
 #include "state_machine.h"
+#include "task_scheduler.h"
 
 extern StateMachine stateMachine;
 
 SensorManager::SensorManager() {
-    bufferLength = 100;
     spo2 = 0;
     validSPO2 = 0;
     heartRate = 0;
     validHeartRate = 0;
-    bufferIndex = 0;
     bufferFilled = false;
     measuring = false;
+    metricsReady = false;
+    latestIR = 0;
     measurementStartTime = 0;
-    
-    // Initialize buffers to zero
-    for (int i = 0; i < 100; i++) {
-        irBuffer[i] = 0;
-        redBuffer[i] = 0;
-    }
+    nextDrainTime = 0;
+    startOverruns = 0;
+    sampleReady = false;
+    interruptTime = 0;
+    #if THREADED_MODE
+    acquisitionThread = nullptr;
+    #endif
 }
 
 /*
@@ -53,6 +71,9 @@ bool SensorManager::begin() {
     
     if (DEBUG_MODE) Serial.println("MAX30102 found!");
     
+    // Read the FIFO in blocks as large as the Wire buffer (see acquireWireBuffer)
+    particleSensor.setI2CBufferLength(SENSOR_I2C_BUFFER_SIZE);
+    
     // Sensor configuration
     byte ledBrightness = 60;    // LED current (0-255)
     byte sampleAverage = 4;     // Samples to average (1, 2, 4, 8, 16, 32)
@@ -68,6 +89,21 @@ bool SensorManager::begin() {
     particleSensor.setPulseAmplitudeRed(0x0A);  // Low red LED
     particleSensor.setPulseAmplitudeGreen(0);   // Green LED off
     
+    #if USE_SENSOR_INTERRUPT
+    // Interrupt when the FIFO is almost full, then drain it in one burst
+    particleSensor.setFIFOAlmostFull(SENSOR_FIFO_ALMOST_FULL);
+    particleSensor.enableAFULL();
+    pinMode(MAX30102_INT, INPUT_PULLUP);
+    attachInterrupt(MAX30102_INT, &SensorManager::onSensorInterrupt, this, FALLING);
+    particleSensor.getINT1();  // Clear any status raised during setup
+    #endif
+    
+    #if THREADED_MODE
+    // From here on only the acquisition thread talks to the sensor
+    acquisitionThread = new Thread("acquisition", runAcquisition, this,
+                                   ACQUISITION_THREAD_PRIORITY, ACQUISITION_THREAD_STACK);
+    #endif
+    
     if (DEBUG_MODE) Serial.println("MAX30102 initialized successfully");
     return true;
 }
@@ -75,46 +111,41 @@ bool SensorManager::begin() {
 /*
  * Main update loop - handles measurement state machine.
  * Called from main loop() when in MEASURING or STABILIZING state.
+ * Only consumes samples that are already queued - never blocks.
  */
 void SensorManager::update() {
     if (!measuring) return;
     
-    // Check if finger is still present
-    long irValue = particleSensor.getIR();
-    
-    if (irValue < FINGER_THRESHOLD) {
+    // Check if finger is still present (only when new data arrived)
+    if (drainFIFO() > 0 && latestIR < FINGER_THRESHOLD) {
         if (DEBUG_MODE) Serial.println("Finger removed!");
         resetMeasurement();
         stateMachine.measurementFailed();
         return;
     }
     
-    // Phase 1: Fill initial buffer (100 samples)
-    if (!bufferFilled) {
-        collectInitialBuffer();
-        return;
-    }
-    
-    // Phase 2: Continuous measurement with sliding window
-    updateBuffer();
-    calculateMetrics();
-    
-    // Check if we have a valid reading
-    if (validHeartRate && validSPO2) {
-        currentMeasurement.heartRate = heartRate;
-        currentMeasurement.spO2 = spo2;
-        currentMeasurement.timestamp = Time.now();
-        currentMeasurement.valid = validateMeasurement();
-        currentMeasurement.confidence = 0.95;
+    // Check if the latest window gave a valid reading
+    if (metricsReady) {
+        metricsReady = false;
         
-        if (currentMeasurement.valid) {
-            if (DEBUG_MODE) {
-                Serial.printlnf("Valid: HR=%ld bpm, SpO2=%ld%%", 
-                              (long)heartRate, (long)spo2);
+        if (validHeartRate && validSPO2) {
+            currentMeasurement.heartRate = heartRate;
+            currentMeasurement.spO2 = spo2;
+            currentMeasurement.timestamp = Time.now();
+            currentMeasurement.valid = validateMeasurement();
+            currentMeasurement.confidence = 0.95;
+            
+            if (currentMeasurement.valid) {
+                if (DEBUG_MODE) {
+                    Serial.printlnf("Valid: HR=%ld bpm, SpO2=%ld%%", 
+                                  (long)heartRate, (long)spo2);
+                    uint32_t lost = getOverrunCount() - startOverruns;
+                    if (lost > 0) Serial.printlnf("  %lu samples lost to FIFO overrun", (unsigned long)lost);
+                }
+                measuring = false;
+                stateMachine.measurementComplete();
+                return;
             }
-            measuring = false;
-            stateMachine.measurementComplete();
-            return;
         }
     }
     
@@ -127,74 +158,184 @@ void SensorManager::update() {
 }
 
 /*
- * Collect initial 100 samples to fill the buffer.
- * Shows progress every 25 samples.
+ * Next time update() has work. Outside a measurement, samples are only
+ * drained for finger detection (see StateMachine::getNextUpdate()).
  */
-void SensorManager::collectInitialBuffer() {
-    // Progress indicator
-    if (DEBUG_MODE && bufferIndex % 25 == 0) {
-        Serial.printlnf("Collecting: %d/100", bufferIndex);
-    }
+unsigned long SensorManager::getNextUpdate() {
+    if (!measuring) return millis() + SCHEDULER_IDLE_WAKEUP;
+    
+    // Checked with '>' in update()
+    return earliestDeadline(getNextSampleTime(), measurementStartTime + 60000 + 1);
+}
+
+/*
+ * Next time drainFIFO() has samples to take: at once if some are left over
+ * from the last burst, when the interrupt came, or when the FIFO should
+ * reach the watermark.
+ */
+unsigned long SensorManager::getNextSampleTime() {
+    if (particleSensor.available() > 0) return millis();
     
-    // Wait for sample to be available
-    while (particleSensor.available() == false) {
+    // With THREADED_MODE the interrupt is the acquisition thread's
+    #if USE_SENSOR_INTERRUPT && !THREADED_MODE
+    if (sampleReady) return interruptTime;
+    #endif
+    
+    return nextDrainTime;
+}
+
+/*
+ * Sensor interrupt handler (A_FULL).
+ * Runs in interrupt context - only flags that the FIFO needs draining,
+ * and ends the loop's sleep.
+ */
+void SensorManager::onSensorInterrupt() {
+    if (!sampleReady) interruptTime = millis();
+    sampleReady = true;
+    #if !THREADED_MODE
+    TaskScheduler::wake();  // The loop drains the FIFO
+    #endif
+}
+
+/*
+ * Pull all queued samples from the sensor without waiting.
+ * In interrupt mode the I2C burst only happens once the sensor has
+ * signalled A_FULL. The INT line stays low until INT1 is read, so a
+ * missed edge is still picked up from the pin level.
+ * Stops early when a new result is ready so update() can act on it;
+ * the remaining samples are consumed on the next call.
+ */
+int SensorManager::drainFIFO() {
+    #if THREADED_MODE
+    // The acquisition thread does the I2C: take what it has put in the
+    // ring, and look again when its next burst is due (or a sample later
+    // if it was not there yet)
+    int taken = 0;
+    while (!metricsReady && particleSensor.available()) {
+        addSample(particleSensor.getFIFORed(), particleSensor.getFIFOIR());
+        particleSensor.nextSample();
+        taken++;
+    }
+    nextDrainTime = millis() + (taken > 0 ? SENSOR_FIFO_WATERMARK : 1) * SENSOR_SAMPLE_PERIOD;
+    return taken;
+    #else
+    if (particleSensor.available() == 0) {
+        #if USE_SENSOR_INTERRUPT
+        if (!sampleReady && digitalRead(MAX30102_INT) == HIGH) {
+            // Early: look again a sample later, unless the interrupt comes first
+            nextDrainTime = millis() + SENSOR_SAMPLE_PERIOD;
+            return 0;
+        }
+        sampleReady = false;
+        particleSensor.getINT1();  // Reading status clears A_FULL
+        #endif
+        
+        // One burst read of everything in the hardware FIFO
         particleSensor.check();
+        nextDrainTime = millis() + SENSOR_FIFO_WATERMARK * SENSOR_SAMPLE_PERIOD;
     }
     
-    // Store sample
-    redBuffer[bufferIndex] = particleSensor.getRed();
-    irBuffer[bufferIndex] = particleSensor.getIR();
-    particleSensor.nextSample();
+    int collected = 0;
+    while (particleSensor.available() && !metricsReady) {
+        addSample(particleSensor.getFIFORed(), particleSensor.getFIFOIR());
+        particleSensor.nextSample();
+        collected++;
+    }
     
-    bufferIndex++;
+    return collected;
+    #endif
+}
+
+#if THREADED_MODE
+/*
+ * Acquisition thread. Wakes on a fixed period (os_thread_delay_until()
+ * does not drift); in interrupt mode each wake only reads a flag and the
+ * INT pin until A_FULL is raised.
+ */
+void SensorManager::runAcquisition(void *manager) {
+    SensorManager *sensor = static_cast<SensorManager*>(manager);
+    #if USE_SENSOR_INTERRUPT
+    const system_tick_t period = SENSOR_SAMPLE_PERIOD;
+    #else
+    const system_tick_t period = SENSOR_FIFO_WATERMARK * SENSOR_SAMPLE_PERIOD;
+    #endif
     
-    // Buffer full - calculate first reading
-    if (bufferIndex >= 100) {
-        bufferFilled = true;
-        bufferIndex = 0;
-        if (DEBUG_MODE) Serial.println("Buffer filled, calculating...");
-        stateMachine.setState(STATE_STABILIZING);
-        calculateMetrics();
+    system_tick_t wake = millis();
+    while (true) {
+        sensor->acquire();
+        os_thread_delay_until(&wake, period);
     }
 }
 
 /*
- * Update buffer with 25 new samples using sliding window.
- * Shifts old samples and adds new ones.
+ * Drain the hardware FIFO into the driver's ring, as drainFIFO() does
+ * without THREADED_MODE. If the ring fills (the main thread is stalled),
+ * the rest stay in the hardware FIFO until the next pass.
+ */
+void SensorManager::acquire() {
+    // Ring full (the main thread is stalled, or not measuring): leave the
+    // samples, and A_FULL, pending in the sensor until there is room
+    if (particleSensor.available() == MAX30105_STORAGE_SIZE) return;
+    
+    #if USE_SENSOR_INTERRUPT
+    if (!sampleReady && digitalRead(MAX30102_INT) == HIGH) return;
+    sampleReady = false;
+    particleSensor.getINT1();  // Reading status clears A_FULL
+    #endif
+    
+    particleSensor.check();
+    
+    #if USE_SENSOR_INTERRUPT
+    // The ring filled first: A_FULL will not come again for the samples
+    // left in the FIFO, so take them once there is room
+    if (particleSensor.available() == MAX30105_STORAGE_SIZE) sampleReady = true;
+    #endif
+}
+#endif
+
+/*
+ * Add one sample to the window.
+ * Outside a measurement only the latest IR value is kept (finger detection).
+ * The first calculation runs once the window is full (STABILIZING), then
+ * again every SPO2_HOP_SIZE samples.
  */
-void SensorManager::updateBuffer() {
-    // Shift old samples (drop oldest 25, keep newest 75)
-    for (byte i = 25; i < 100; i++) {
-        redBuffer[i - 25] = redBuffer[i];
-        irBuffer[i - 25] = irBuffer[i];
+void SensorManager::addSample(uint32_t red, uint32_t ir) {
+    latestIR = ir;
+    
+    if (!measuring) return;
+    
+    // Progress indicator while filling the first window
+    if (DEBUG_MODE && !bufferFilled && estimator.getSampleCount() % SPO2_HOP_SIZE == 0) {
+        Serial.printlnf("Collecting: %d/%d", estimator.getSampleCount(), estimator.getWindowSize());
     }
     
-    // Collect 25 new samples
-    for (byte i = 75; i < 100; i++) {
-        while (particleSensor.available() == false) {
-            particleSensor.check();
-        }
-        
-        redBuffer[i] = particleSensor.getRed();
-        irBuffer[i] = particleSensor.getIR();
-        particleSensor.nextSample();
+    #if STREAM_RAW_WAVEFORM
+    waveform.addSample(red, ir);
+    #endif
+    
+    if (!estimator.addSample(red, ir)) return;
+    
+    // Buffer full - calculate first reading
+    if (!bufferFilled) {
+        bufferFilled = true;
+        if (DEBUG_MODE) Serial.println("Buffer filled, calculating...");
+        stateMachine.setState(STATE_STABILIZING);
     }
+    
+    calculateMetrics();
 }
 
 /*
- * Calculate heart rate and SpO2 using SparkFun algorithm.
+ * Take heart rate and SpO2 from the estimator.
  * Results are stored in class variables.
  */
 void SensorManager::calculateMetrics() {
-    maxim_heart_rate_and_oxygen_saturation(
-        irBuffer, 
-        bufferLength, 
-        redBuffer, 
-        &spo2, 
-        &validSPO2, 
-        &heartRate, 
-        &validHeartRate
-    );
+    spo2 = estimator.getSpO2();
+    validSPO2 = estimator.isSpO2Valid();
+    heartRate = estimator.getHeartRate();
+    validHeartRate = estimator.isHeartRateValid();
+    
+    metricsReady = true;
     
     if (DEBUG_MODE) {
         Serial.printlnf("HR=%ld (valid=%d), SpO2=%ld%% (valid=%d)", 
@@ -205,11 +346,11 @@ void SensorManager::calculateMetrics() {
 
 /*
  * Check if finger is currently detected on sensor.
- * Uses IR value threshold from config.h.
+ * Uses IR value threshold from config.h against the latest queued sample.
  */
 bool SensorManager::isFingerDetected() {
-    long irValue = particleSensor.getIR();
-    return (irValue >= FINGER_THRESHOLD);
+    if (!measuring) drainFIFO();
+    return (latestIR >= FINGER_THRESHOLD);
 }
 
 /*
@@ -218,8 +359,12 @@ bool SensorManager::isFingerDetected() {
  */
 void SensorManager::startMeasurement() {
     resetMeasurement();
+    #if STREAM_RAW_WAVEFORM
+    waveform.reset();
+    #endif
     measuring = true;
     measurementStartTime = millis();
+    startOverruns = getOverrunCount();
     
     if (DEBUG_MODE) Serial.println("Starting measurement...");
 }
@@ -238,6 +383,24 @@ MeasurementData SensorManager::getMeasurement() {
     return currentMeasurement;
 }
 
+/*
+ * FIFO overruns counted by the driver. Safe to call while the acquisition
+ * thread is reading the sensor.
+ */
+uint32_t SensorManager::getOverrunCount() {
+    return particleSensor.getOverrunCount();
+}
+
+#if STREAM_RAW_WAVEFORM
+/*
+ * Raw trace of the current/last measurement.
+ * Cleared when the next measurement starts.
+ */
+WaveformEncoder& SensorManager::getWaveform() {
+    return waveform;
+}
+#endif
+
 /*
  * Validate reading against physiological limits.
  * Heart rate: 40-200 BPM
@@ -259,7 +422,8 @@ bool SensorManager::validateMeasurement() {
 void SensorManager::resetMeasurement() {
     measuring = false;
     bufferFilled = false;
-    bufferIndex = 0;
+    estimator.reset();
+    metricsReady = false;
     currentMeasurement.valid = false;
     validHeartRate = 0;
     validSPO2 = 0;
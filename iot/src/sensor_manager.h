@@ -6,11 +6,23 @@
  * 
  * MEASUREMENT PROCESS:
  *   1. startMeasurement() - Begin data collection
- *   2. update() - Collect samples until buffer is filled
- *   3. calculateMetrics() - Run SpO2 algorithm
+ *   2. update() - Drain queued samples until buffer is filled
+ *   3. calculateMetrics() - Take each new SpO2 estimate
  *   4. isMeasurementComplete() returns true when valid reading obtained
  *   5. getMeasurement() - Retrieve the measurement data
  * 
+ * ACQUISITION:
+ *   update() never waits for the sensor. With USE_SENSOR_INTERRUPT the
+ *   MAX30102 raises its A_FULL interrupt and the whole hardware FIFO is
+ *   drained in one burst; otherwise the FIFO is polled. Either way the next
+ *   drain is scheduled for when SENSOR_FIFO_WATERMARK samples will have
+ *   queued (getNextSampleTime()), or at once when the interrupt came early.
+ *   Bursts land in the driver's sample ring (MAX30105_STORAGE_SIZE), which
+ *   is deeper than the hardware FIFO; what does not fit stays in the FIFO,
+ *   and samples the FIFO itself drops are counted (getOverrunCount()).
+ *   With THREADED_MODE the I2C moves to an acquisition thread, which
+ *   fills the ring the same way; update() only takes samples from it.
+ * 
  * FINGER DETECTION:
  *   Uses IR value threshold to detect finger presence.
  *   Measurement fails if finger is removed during collection.
@@ -28,18 +40,9 @@
 #include "config.h"
 #include "MAX30105.h"
 #include "heartRate.h"
-#include "spo2_algorithm.h"
-
-/*
- * MeasurementData - Container for sensor readings
- */
-struct MeasurementData {
-    float heartRate;      // Heart rate in BPM
-    float spO2;           // Blood oxygen saturation (%)
-    uint32_t timestamp;   // Unix timestamp of measurement
-    bool valid;           // True if reading passed validation
-    float confidence;     // Confidence level (0.0 - 1.0)
-};
+#include "spo2_estimator.h"
+#include "waveform_encoder.h"
+#include "measurement_data.h"
 
 /*
  * SensorManager - Handles MAX30102/MAX30105 sensor operations
@@ -67,6 +70,17 @@ public:
      */
     void update();
     
+    /*
+     * millis() at which update() next has work: the next drain while
+     * measuring, or the measurement timeout.
+     */
+    unsigned long getNextUpdate();
+    
+    /*
+     * millis() at which the next batch of samples is due to be drained.
+     */
+    unsigned long getNextSampleTime();
+    
     /*
      * Check if finger is currently detected on sensor.
      */
@@ -88,45 +102,85 @@ public:
      */
     MeasurementData getMeasurement();
     
+    /*
+     * Samples the sensor's FIFO dropped before they were read, since
+     * begin() (from its OVF_COUNTER).
+     */
+    uint32_t getOverrunCount();
+    
+    #if STREAM_RAW_WAVEFORM
+    /*
+     * Raw trace of the current/last measurement.
+     */
+    WaveformEncoder& getWaveform();
+    #endif
+    
 private:
     MAX30105 particleSensor;        // Sensor driver instance
     MeasurementData currentMeasurement;
     
-    // SpO2 algorithm buffers
-    // AVR uses 16-bit, other platforms use 32-bit
-    #if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
-    uint16_t irBuffer[100];
-    uint16_t redBuffer[100];
-    #else
-    uint32_t irBuffer[100];
-    uint32_t redBuffer[100];
+    // Streaming SpO2/HR estimator (owns the sample window)
+    Spo2Estimator estimator;
+    
+    #if STREAM_RAW_WAVEFORM
+    WaveformEncoder waveform;       // Raw trace for upload
     #endif
     
     // Algorithm variables
-    int32_t bufferLength;
     int32_t spo2;
     int8_t validSPO2;
     int32_t heartRate;
     int8_t validHeartRate;
     
     // State tracking
-    int bufferIndex;
-    bool bufferFilled;
+    bool bufferFilled;              // First full window has been calculated
     bool measuring;
+    bool metricsReady;              // Set when calculateMetrics() produced a new result
+    uint32_t latestIR;              // Most recent IR sample (finger detection)
     unsigned long measurementStartTime;
+    unsigned long nextDrainTime;    // When the FIFO is next expected at the watermark
+    uint32_t startOverruns;         // getOverrunCount() when the measurement started
+    
+    // Set from the sensor interrupt handler
+    volatile bool sampleReady;
+    volatile unsigned long interruptTime;
+    
+    #if THREADED_MODE
+    Thread *acquisitionThread;
+    
+    /*
+     * Acquisition thread body: acquire() every sample period (interrupt
+     * mode) or every watermark's worth of samples (polled).
+     */
+    static void runAcquisition(void *manager);
+    
+    /*
+     * Drain the hardware FIFO into the driver's ring if samples are due.
+     * Runs on the acquisition thread, the only user of the sensor's I2C
+     * and the ring's only producer.
+     */
+    void acquire();
+    #endif
+    
+    /*
+     * Sensor A_FULL interrupt handler.
+     */
+    void onSensorInterrupt();
     
     /*
-     * Collect initial 100 samples to fill buffer.
+     * Pull all queued samples from the sensor without waiting.
+     * Returns the number of samples consumed.
      */
-    void collectInitialBuffer();
+    int drainFIFO();
     
     /*
-     * Shift buffer and collect 25 new samples.
+     * Add one sample to the window.
+     * Calculates metrics each time a full window / hop is ready.
      */
-    void updateBuffer();
+    void addSample(uint32_t red, uint32_t ir);
     
     /*
-     * Run SpO2 algorithm to calculate metrics.
+     * Take the latest SpO2/HR result from the estimator.
      */
     void calculateMetrics();
     
@@ -0,0 +1,303 @@
+/*
+ * spo2_estimator.cpp - Streaming Heart Rate & SpO2 Estimator Implementation
+ *
+ * Matches maxim_heart_rate_and_oxygen_saturation() exactly:
+ *   - DC mean: integer mean of the IR window (running sum)
+ *   - Moving average: the original averages (mean - ir) over 4 samples,
+ *     (4 * mean - sum4) / 4, truncated toward zero. Where that is positive
+ *     it equals mean - ceil(sum4 / 4): the mean plus a level fixed by the
+ *     4 samples alone. Valleys only count above the threshold (at least
+ *     30), and a valley's neighbours are compared with it, so levels
+ *     decide every valley exactly. The last MA4_SIZE samples are left
+ *     unaveraged, as in the original (level -ir), and so are only settled
+ *     once more samples arrive.
+ *   - Threshold: the mean of the moving average. Each average is
+ *     mean - floor(sum4 / 4), less one where sum4 is not a multiple of 4
+ *     and below 4 * mean. The running sums give the total without those
+ *     corrections, and at most unevenCount apply. The threshold only
+ *     decides which valleys count, so the window is only counted for the
+ *     corrections when a valley's height lies between the two bounds.
+ *   - Peak search: the original scans left to right for a rise, a flat
+ *     run and a fall, and keeps the first 15 above the threshold. Each
+ *     candidate is found once, by position since reset(); those that
+ *     leave the window are dropped from the front.
+ *   - Close valleys: maxim_remove_close_peaks() sorts every valley by
+ *     height; only the runs of valleys within SPO2_MIN_VALLEY_DISTANCE
+ *     of one another need it, so each run is sorted on its own.
+ *   - SpO2: each pulse's ratio (maxim_valley_pair_ratio()) is kept while
+ *     both its valleys stay in the window.
+ */
+
+#include "spo2_estimator.h"
+
+// Peak threshold bounds and valley spacing of the Maxim algorithm
+#define SPO2_MIN_THRESHOLD 30
+#define SPO2_MAX_THRESHOLD 60
+#define SPO2_MIN_VALLEY_DISTANCE 4
+#define SPO2_MAX_RATIOS 5
+
+static int32_t clampThreshold(int32_t threshold) {
+    if (threshold < SPO2_MIN_THRESHOLD) return SPO2_MIN_THRESHOLD;
+    if (threshold > SPO2_MAX_THRESHOLD) return SPO2_MAX_THRESHOLD;
+    return threshold;
+}
+
+/*
+ * maxim_remove_close_peaks() over locs in ascending order: keep the highest
+ * valley, then each next highest (the earlier of equal ones first) that is
+ * more than SPO2_MIN_VALLEY_DISTANCE from every one kept and from -1.
+ * Valleys further apart than that never remove one another, so each run of
+ * close valleys is decided on its own and only those are sorted. Returns
+ * the number kept, still in order.
+ */
+static int32_t removeCloseValleys(int32_t *locs, int32_t count, const int32_t *heights) {
+    int32_t kept = 0;
+    int i = 0;
+    while (i < count && locs[i] + 1 <= SPO2_MIN_VALLEY_DISTANCE) i++;
+    while (i < count) {
+        int end = i + 1;
+        while (end < count && locs[end] - locs[end - 1] <= SPO2_MIN_VALLEY_DISTANCE) end++;
+        if (end - i == 1) {
+            locs[kept++] = locs[i++];
+            continue;
+        }
+    
+        // The run by height, highest first; an equal one stays after
+        int order[SPO2_MAX_VALLEYS];
+        int runCount = end - i;
+        for (int k = 0; k < runCount; k++) {
+            int j = k;
+            for (; j > 0 && heights[locs[i + k]] > heights[locs[i + order[j - 1]]]; j--) order[j] = order[j - 1];
+            order[j] = k;
+        }
+        // Only the neighbours in position order can be close enough to it
+        bool keep[SPO2_MAX_VALLEYS] = {false};
+        for (int k = 0; k < runCount; k++) {
+            int at = order[k];
+            int32_t loc = locs[i + at];
+            bool clear = true;
+            for (int j = at - 1; j >= 0 && loc - locs[i + j] <= SPO2_MIN_VALLEY_DISTANCE && clear; j--) clear = !keep[j];
+            for (int j = at + 1; j < runCount && locs[i + j] - loc <= SPO2_MIN_VALLEY_DISTANCE && clear; j++) clear = !keep[j];
+            keep[at] = clear;
+        }
+        for (int k = 0; k < runCount; k++) {
+            if (keep[k]) locs[kept++] = locs[i + k];
+        }
+        i = end;
+    }
+    return kept;
+}
+
+Spo2Estimator::Spo2Estimator() {
+    reset();
+}
+
+/*
+ * Discard all samples and results.
+ */
+void Spo2Estimator::reset() {
+    window.reset();
+    samples = 0;
+    irSum = 0;
+    irRecentSum = 0;
+    quarterSum = 0;
+    unevenCount = 0;
+    valleyFirst = 0;
+    valleyCount = 0;
+    scanFrom = 1;
+    pulseCount = 0;
+    heartRate = -999;
+    validHeartRate = 0;
+    spo2 = -999;
+    validSPO2 = 0;
+}
+
+int Spo2Estimator::slotOf(uint32_t position) {
+    int slot = window.getHead() - (int)(samples - position);
+    if (slot < 0) slot += window.getSize();
+    return slot;
+}
+
+/*
+ * Sum of the moving average over the window without the corrections, and
+ * how many of its sums could need one. The newest 4-sample sum is not
+ * averaged yet.
+ */
+int32_t Spo2Estimator::averageTotal(int32_t mean, int32_t *uneven) {
+    int32_t newest = irSum4[slotOf(samples - MA4_SIZE)];
+    *uneven = unevenCount - ((newest & 3) != 0);
+    return window.getSize() * mean - (quarterSum - (newest >> 2)) - irRecentSum;
+}
+
+/*
+ * The threshold as the Maxim algorithm sets it: the sum of the moving
+ * average, corrected, divided by the window size and clamped to 30..60.
+ */
+int32_t Spo2Estimator::threshold(int32_t mean) {
+    int32_t uneven;
+    int32_t total = averageTotal(mean, &uneven);
+    uint32_t end = samples - MA4_SIZE;
+    for (uint32_t position = samples - window.getSize(); position != end; position++) {
+        int32_t sum = irSum4[slotOf(position)];
+        if ((sum & 3) != 0 && (sum >> 2) < mean) total--;
+    }
+    return clampThreshold(total / window.getSize());
+}
+
+/*
+ * maxim_peaks_above_min_height() by levels, from scanFrom to the end of
+ * the window: a rise, a flat run, then a fall. A level is the moving
+ * average minus the mean where that is positive: -ceil(sum4 / 4), or -ir
+ * for the last MA4_SIZE samples, which are not averaged. A candidate is
+ * settled once every level it was judged by is averaged; scanning stops
+ * settling at the first position that is not.
+ */
+int Spo2Estimator::scanValleys(Valley *tail) {
+    int size = window.getSize();
+    uint32_t first = samples - size;
+    uint32_t from = (int32_t)(scanFrom - first) > 0 ? scanFrom : first + 1;
+    
+    // Levels from the sample before `from` to the end of the window
+    int32_t levels[SPO2_WINDOW_SIZE];
+    uint32_t* irRing = window.getIR();
+    int last = samples - from;                    // Index of the newest sample
+    int unsettled = last + 1 - MA4_SIZE;          // Levels from here on change
+    int slot = slotOf(from - 1);
+    for (int i = 0; i <= last; i++) {
+        levels[i] = i < unsettled ? -((irSum4[slot] + 3) >> 2) : -(int32_t)irRing[slot];
+        if (++slot == size) slot = 0;
+    }
+    
+    bool settling = true;
+    int tailCount = 0;
+    int i = 1;
+    while (i < last) {
+        int32_t level = levels[i];
+        if (level <= levels[i - 1]) {
+            if (settling && i >= unsettled) {
+                settling = false;
+                scanFrom = from - 1 + i;
+            }
+            i++;
+            continue;
+        }
+    
+        int end = i + 1;
+        while (end <= last && levels[end] == level) end++;
+        bool valley = end <= last && levels[end] < level;
+        if (settling && end >= unsettled) {
+            settling = false;
+            scanFrom = from - 1 + i;
+        }
+        if (valley) {
+            Valley found = {from - 1 + i, level};
+            if (settling) {
+                int index = valleyFirst + valleyCount;
+                if (index >= SPO2_WINDOW_SIZE / 2) index -= SPO2_WINDOW_SIZE / 2;
+                valleys[index] = found;
+                valleyCount++;
+            } else {
+                tail[tailCount++] = found;
+            }
+        }
+        i = valley ? end + 1 : end;
+    }
+    if (settling) scanFrom = from - 1 + i;
+    return tailCount;
+}
+
+/*
+ * Select the valleys above the threshold, then derive heart rate and
+ * SpO2, reusing the ratios of pulses seen in the last window.
+ */
+void Spo2Estimator::calculate() {
+    int size = window.getSize();
+    uint32_t first = samples - size;
+    int32_t mean = irSum / size;
+    
+    // Bounds on the threshold; it is only counted if a valley falls between
+    int32_t uneven;
+    int32_t total = averageTotal(mean, &uneven);
+    int32_t lowest = clampThreshold((total - uneven) / size);
+    int32_t highest = clampThreshold(total / size);
+    
+    // A valley needs a sample before it in the window
+    while (valleyCount > 0 && valleys[valleyFirst].position <= first) {
+        if (++valleyFirst == SPO2_WINDOW_SIZE / 2) valleyFirst = 0;
+        valleyCount--;
+    }
+    Valley tail[SPO2_WINDOW_SIZE / 2];
+    int tailCount = scanValleys(tail);
+    
+    int32_t locs[SPO2_MAX_VALLEYS];
+    int32_t count = 0;
+    bool close = false;                           // Any within SPO2_MIN_VALLEY_DISTANCE of the last
+    for (int i = 0; i < valleyCount + tailCount && count < SPO2_MAX_VALLEYS; i++) {
+        int index = valleyFirst + i;
+        if (index >= SPO2_WINDOW_SIZE / 2) index -= SPO2_WINDOW_SIZE / 2;
+        Valley &valley = i < valleyCount ? valleys[index] : tail[i - valleyCount];
+        int32_t height = mean + valley.level;
+        if (height > lowest && height <= highest) lowest = highest = threshold(mean);
+        if (height <= lowest) continue;
+        int32_t loc = valley.position - first;
+        // As maxim_remove_close_peaks(), which counts a valley at -1 first
+        if (loc - (count > 0 ? locs[count - 1] : -1) <= SPO2_MIN_VALLEY_DISTANCE) close = true;
+        heights[loc] = height;
+        locs[count++] = loc;
+    }
+    // Otherwise it would keep them all, in order
+    if (close) count = removeCloseValleys(locs, count, heights);
+    
+    maxim_heart_rate_from_valleys(locs, count, &heartRate, &validHeartRate);
+    
+    // The first SPO2_MAX_RATIOS pulses with a ratio, as the original
+    int32_t ratios[SPO2_MAX_RATIOS] = {0};
+    int32_t ratioCount = 0;
+    Pulse found[SPO2_MAX_VALLEYS - 1];
+    int foundCount = 0;
+    int cached = 0;
+    for (int k = 0; k + 1 < count && ratioCount < SPO2_MAX_RATIOS; k++) {
+        Pulse pulse = {first + locs[k], first + locs[k + 1], 0, 0};
+        while (cached < pulseCount && pulses[cached].from < pulse.from) cached++;
+        if (cached < pulseCount && pulses[cached].from == pulse.from && pulses[cached].to == pulse.to) {
+            pulse = pulses[cached];
+        } else {
+            pulse.valid = maxim_valley_pair_ratio(window.getIR(), window.getRed(), size, window.getStart(),
+                                                  locs[k], locs[k + 1], &pulse.ratio);
+        }
+        found[foundCount++] = pulse;
+        if (pulse.valid) ratios[ratioCount++] = pulse.ratio;
+    }
+    memcpy(pulses, found, foundCount * sizeof(Pulse));
+    pulseCount = foundCount;
+    
+    maxim_oxygen_saturation_from_ratios(ratios, ratioCount, &spo2, &validSPO2);
+}
+
+bool Spo2Estimator::isWindowFull() {
+    return window.isFull();
+}
+
+int Spo2Estimator::getSampleCount() {
+    return window.getCount();
+}
+
+int Spo2Estimator::getWindowSize() {
+    return window.getSize();
+}
+
+int32_t Spo2Estimator::getHeartRate() {
+    return heartRate;
+}
+
+int8_t Spo2Estimator::isHeartRateValid() {
+    return validHeartRate;
+}
+
+int32_t Spo2Estimator::getSpO2() {
+    return spo2;
+}
+
+int8_t Spo2Estimator::isSpO2Valid() {
+    return validSPO2;
+}
@@ -0,0 +1,185 @@
+/*
+ * spo2_estimator.h - Streaming Heart Rate & SpO2 Estimator
+ *
+ * Produces the same readings as maxim_heart_rate_and_oxygen_saturation()
+ * over a sliding window, but carries its work from one window to the next
+ * instead of recomputing the whole window every hop. A hop costs about
+ * SPO2_HOP_SIZE samples' worth of work plus one check per valley
+ * candidate, not SPO2_WINDOW_SIZE.
+ *
+ * STATE KEPT PER SAMPLE (O(1) per sample):
+ *   - Running sum of the IR window (DC mean)
+ *   - Raw 4-sample IR sums for the 4-point moving average, and their sum
+ *
+ * STATE KEPT PER WINDOW:
+ *   - Valley candidates: the moving average is (window mean + a level that
+ *     depends only on its 4 samples), so whether a position is a valley is
+ *     settled once its neighbours' levels are; only its depth against the
+ *     threshold is checked again each window. Each hop scans only the new
+ *     samples (and any flat run still open at the end).
+ *   - The red/IR ratio of each pulse between two valleys, which depends
+ *     only on the raw samples between them
+ *
+ * The threshold (window mean of the moving average) is bounded from the
+ * running sums; the window is only counted for it in the rare window where
+ * a valley's height lies between the bounds.
+ *
+ * USAGE:
+ *   if (estimator.addSample(red, ir)) {
+ *       estimator.getHeartRate(), estimator.getSpO2(), ...
+ *   }
+ */
+
+#ifndef SPO2_ESTIMATOR_H
+#define SPO2_ESTIMATOR_H
+
+#include "Particle.h"
+#include "config.h"
+#include "sample_window.h"
+#include "spo2_algorithm.h"
+
+// Valleys the Maxim algorithm keeps per window
+#define SPO2_MAX_VALLEYS 15
+
+/*
+ * Spo2Estimator - Incremental SpO2 / heart rate over a SampleWindow
+ */
+class Spo2Estimator {
+public:
+    Spo2Estimator();
+    
+    /*
+     * Discard all samples and results.
+     */
+    void reset();
+    
+    // addSample() is defined inline - it is called for every sample
+    
+    /*
+     * Add one red/IR sample and update the running sums.
+     * Returns true when a new result was calculated (every SPO2_HOP_SIZE
+     * samples once the window is full).
+     * The sample being overwritten leaves the IR sum, with the 4-sample
+     * sum that starts at its slot; the sample leaving the last-4 sum is
+     * still in the ring (window > MA4_SIZE).
+     */
+    bool addSample(uint32_t red, uint32_t ir) {
+        int size = window.getSize();
+        int slot = window.getHead();
+        int count = window.getCount();
+        uint32_t* irRing = window.getIR();
+        
+        if (count == size) {
+            int32_t leaving = irSum4[slot];
+            irSum -= irRing[slot];
+            quarterSum -= leaving >> 2;
+            unevenCount -= (leaving & 3) != 0;
+        }
+        irSum += ir;
+        
+        int32_t recent = irRecentSum + ir;
+        if (count >= MA4_SIZE) {
+            int oldest = slot - MA4_SIZE;
+            if (oldest < 0) oldest += size;
+            recent -= irRing[oldest];
+        }
+        irRecentSum = recent;
+        
+        bool ready = window.push(red, ir);
+        samples++;
+        
+        // The new sample completes the 4-sample sum that starts 3 samples back
+        if (count >= MA4_SIZE - 1) {
+            int first = slot - (MA4_SIZE - 1);
+            if (first < 0) first += size;
+            irSum4[first] = recent;
+            quarterSum += recent >> 2;
+            unevenCount += (recent & 3) != 0;
+        }
+        
+        if (ready) calculate();
+        return ready;
+    }
+    
+    /*
+     * Window fill state.
+     */
+    bool isWindowFull();
+    int getSampleCount();
+    int getWindowSize();
+    
+    /*
+     * Latest results (same conventions as the Maxim algorithm:
+     * -999 and valid = 0 when a value could not be calculated).
+     */
+    int32_t getHeartRate();
+    int8_t isHeartRateValid();
+    int32_t getSpO2();
+    int8_t isSpO2Valid();
+
+private:
+    // A valley of the IR signal (a peak of the inverted moving average)
+    struct Valley {
+        uint32_t position;      // Sample number since reset()
+        int32_t level;          // Moving average minus the window mean
+    };
+    
+    // The ratio of the pulse between two valleys
+    struct Pulse {
+        uint32_t from;          // Valley positions
+        uint32_t to;
+        int32_t ratio;
+        int8_t valid;
+    };
+    
+    SampleWindow window;
+    uint32_t samples;                         // Samples added since reset()
+    
+    uint32_t irSum;                           // Sum of the IR window
+    int32_t irRecentSum;                      // Sum of the last MA4_SIZE IR samples
+    int32_t irSum4[SAMPLE_WINDOW_CAPACITY];   // Raw IR sum of 4 samples starting at each ring index
+    int32_t quarterSum;                       // Sum of irSum4 / 4 (rounded down) over the window
+    int32_t unevenCount;                      // irSum4 entries in the window that are not multiples of 4
+    
+    // Settled valley candidates, oldest first (a ring), at any depth
+    Valley valleys[SPO2_WINDOW_SIZE / 2];
+    int valleyFirst;
+    int valleyCount;
+    uint32_t scanFrom;                        // First position not yet settled
+    
+    Pulse pulses[SPO2_MAX_VALLEYS - 1];       // The last window's pulses, in order
+    int pulseCount;
+    
+    int32_t heights[SPO2_WINDOW_SIZE];        // Moving average at the valleys (for maxim_remove_close_peaks)
+    
+    int32_t heartRate;
+    int8_t validHeartRate;
+    int32_t spo2;
+    int8_t validSPO2;
+    
+    /*
+     * Find the window's valleys and derive heart rate and SpO2.
+     */
+    void calculate();
+    
+    /*
+     * Sum of the window's moving average, before correcting for rounding
+     * (at most *uneven corrections), and the threshold (all counted).
+     */
+    int32_t averageTotal(int32_t mean, int32_t *uneven);
+    int32_t threshold(int32_t mean);
+    
+    /*
+     * Scan from scanFrom for valley candidates: settled ones are kept,
+     * the rest (which depend on the last MA4_SIZE samples) go to tail.
+     * Returns the number in tail.
+     */
+    int scanValleys(Valley *tail);
+    
+    /*
+     * Ring index of a sample in the window.
+     */
+    int slotOf(uint32_t position);
+};
+
+#endif // SPO2_ESTIMATOR_H
@@ -0,0 +1,68 @@
+/*
+ * spsc_queue.h - Lock-Free Single-Producer/Single-Consumer Queue
+ *
+ * Hands items from one thread to another without a lock (THREADED_MODE):
+ * commands and events between the main thread and the network thread.
+ * (Samples from the acquisition thread go through the MAX30105 driver's
+ * own ring, which works the same way.)
+ *
+ * Exactly one thread may push and exactly one may pop. The producer owns
+ * tail and the consumer owns head; each only reads the other's index.
+ * An item is written before tail is published (release) and read before
+ * head is published, so neither side sees a slot the other is using.
+ * Indices run freely and wrap at 2^32, so all N slots are usable.
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stdint.h>
+
+template<class T, int N> class SpscQueue {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+    
+    /*
+     * Add an item (producer thread). Returns false if the queue is full.
+     */
+    bool push(const T &item) {
+        uint32_t position = tail.load(std::memory_order_relaxed);
+        if (position - head.load(std::memory_order_acquire) == N) return false;
+        items[position % N] = item;
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+    
+    /*
+     * Take the oldest item (consumer thread). Returns false if empty.
+     */
+    bool pop(T &item) {
+        uint32_t position = head.load(std::memory_order_relaxed);
+        if (tail.load(std::memory_order_acquire) == position) return false;
+        item = items[position % N];
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+    
+    /*
+     * Items queued. Exact on the consumer side; from the producer it may
+     * count items already taken.
+     */
+    int size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+    
+    bool isEmpty() const { return size() == 0; }
+    
+    static constexpr int capacity() { return N; }
+
+private:
+    T items[N];
+    std::atomic<uint32_t> head;     // Next item to pop (consumer)
+    std::atomic<uint32_t> tail;     // Next slot to fill (producer)
+};
+
+#endif // SPSC_QUEUE_H
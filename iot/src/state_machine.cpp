@@ -17,6 +17,7 @@
 #include "led_controller.h"
 #include "sensor_manager.h"
 #include "network_manager.h"
+#include "task_scheduler.h"
 
 extern LEDController ledController;
 extern SensorManager sensorManager;
@@ -28,6 +29,7 @@ StateMachine::StateMachine() {
     stateStartTime = 0;
     lastMeasurementTime = 0;
     nextScheduledMeasurement = 0;
+    lastCountdownUpdate = 0;
     retryCount = 0;
     
     // Initialize with default configuration from config.h
@@ -86,7 +88,6 @@ void StateMachine::update() {
     // Wait for scheduled measurement time, then check if within active window
     if (currentState == STATE_IDLE) {
         // Periodic countdown display (every 10 seconds)
-        static unsigned long lastCountdownUpdate = 0;
         if (currentTime - lastCountdownUpdate >= 10000) {
             int secondsRemaining = getSecondsUntilNextMeasurement();
             if (DEBUG_MODE) {
@@ -156,6 +157,29 @@ void StateMachine::update() {
     // or measurementFailed() to transition back.
 }
 
+/*
+ * Next time update() has work. MEASURING, STABILIZING and TRANSMITTING are
+ * driven by SensorManager and NetworkManager, so only IDLE and
+ * WAITING_FOR_USER have deadlines here.
+ */
+unsigned long StateMachine::getNextUpdate() {
+    unsigned long now = millis();
+    
+    if (currentState == STATE_IDLE) {
+        unsigned long next = now >= nextScheduledMeasurement ? now : nextScheduledMeasurement;
+        if (DEBUG_MODE) next = earliestDeadline(next, lastCountdownUpdate + 10000);
+        return next;
+    }
+    
+    if (currentState == STATE_WAITING_FOR_USER) {
+        // Finger detection looks at each batch of samples as it arrives
+        return earliestDeadline(stateStartTime + MEASUREMENT_TIMEOUT_MS + 1,
+                                sensorManager.getNextSampleTime());
+    }
+    
+    return now + SCHEDULER_IDLE_WAKEUP;
+}
+
 /*
  * Transition to a new state.
  * Handles cleanup of old state and initialization of new state.
@@ -399,11 +423,11 @@ DeviceConfig StateMachine::getConfig() {
 /*
  * Parse time string "HH:MM" into hour and minute integers.
  */
-void StateMachine::parseTimeString(String timeStr, int &hour, int &minute) {
-    int colonIndex = timeStr.indexOf(':');
-    if (colonIndex > 0) {
-        hour = timeStr.substring(0, colonIndex).toInt();
-        minute = timeStr.substring(colonIndex + 1).toInt();
+void StateMachine::parseTimeString(const char *timeStr, int &hour, int &minute) {
+    const char *colon = strchr(timeStr, ':');
+    if (colon != nullptr && colon > timeStr) {
+        hour = atoi(timeStr);
+        minute = atoi(colon + 1);
         
         // Validate ranges
         if (hour < 0 || hour > 23) hour = 0;
@@ -423,7 +447,7 @@ void StateMachine::parseTimeString(String timeStr, int &hour, int &minute) {
  * @param startTime Active window start "HH:MM" (empty string = no change)
  * @param endTime Active window end "HH:MM" (empty string = no change)
  */
-void StateMachine::applyConfiguration(int frequencySeconds, String startTime, String endTime) {
+void StateMachine::applyConfiguration(int frequencySeconds, const char *startTime, const char *endTime) {
     // Update measurement interval (convert seconds to milliseconds)
     if (frequencySeconds > 0) {
         // Validate: minimum 15 seconds, maximum 4 hours (14400s)
@@ -436,12 +460,12 @@ void StateMachine::applyConfiguration(int frequencySeconds, String startTime, St
     }
     
     // Update active start time
-    if (startTime.length() > 0) {
+    if (startTime[0] != '\0') {
         parseTimeString(startTime, config.activeStartHour, config.activeStartMinute);
     }
     
     // Update active end time
-    if (endTime.length() > 0) {
+    if (endTime[0] != '\0') {
         parseTimeString(endTime, config.activeEndHour, config.activeEndMinute);
     }
     
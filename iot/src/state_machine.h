@@ -79,6 +79,12 @@ public:
      */
     void update();
     
+    /*
+     * millis() at which update() next has work: the scheduled measurement
+     * (IDLE), or the user timeout and the next sensor samples (WAITING).
+     */
+    unsigned long getNextUpdate();
+    
     /*
      * Get the current state.
      */
@@ -145,10 +151,10 @@ public:
      * Called by NetworkManager when config is fetched.
      * 
      * @param frequencySeconds Measurement interval in seconds (15-14400)
-     * @param startTime Active window start time "HH:MM"
-     * @param endTime Active window end time "HH:MM"
+     * @param startTime Active window start time "HH:MM" (empty = no change)
+     * @param endTime Active window end time "HH:MM" (empty = no change)
      */
-    void applyConfiguration(int frequencySeconds, String startTime, String endTime);
+    void applyConfiguration(int frequencySeconds, const char *startTime, const char *endTime);
     
     /*
      * Reset to default configuration from config.h.
@@ -166,6 +172,7 @@ private:
     unsigned long stateStartTime;
     unsigned long lastMeasurementTime;
     unsigned long nextScheduledMeasurement;
+    unsigned long lastCountdownUpdate;    // Countdown last printed (DEBUG_MODE)
     int retryCount;
     
     // Device configuration (server-controlled)
@@ -183,7 +190,7 @@ private:
     /*
      * Parse time string "HH:MM" into hour and minute.
      */
-    void parseTimeString(String timeStr, int &hour, int &minute);
+    void parseTimeString(const char *timeStr, int &hour, int &minute);
     
     /*
      * Get human-readable state name for debugging.
@@ -0,0 +1,143 @@
+/*
+ * task_scheduler.cpp - Cooperative Deadline Scheduler for loop()
+ *
+ * See task_scheduler.h for the pass structure and the statistics kept.
+ */
+
+#include "task_scheduler.h"
+
+std::atomic<os_semaphore_t> TaskScheduler::wakeSignal(nullptr);
+
+TaskScheduler::TaskScheduler() {
+    taskCount = 0;
+    passCount = 0;
+    sleepTime = 0;
+    statsStart = 0;
+    lastPassEnd = 0;
+}
+
+bool TaskScheduler::addTask(const char *name, void *context, RunFunction run, WakeupFunction wakeup) {
+    if (taskCount >= SCHEDULER_MAX_TASKS) return false;
+    
+    // Created here, from setup(), rather than in a global constructor
+    if (wakeSignal == nullptr) {
+        os_semaphore_t signal;
+        if (os_semaphore_create(&signal, 1, 0) != 0) return false;
+        wakeSignal = signal;
+    }
+    
+    Task &task = tasks[taskCount++];
+    task.context = context;
+    task.run = run;
+    task.wakeup = wakeup;
+    task.deadline = millis();
+    lastPassEnd = millis();
+    memset(&task.stats, 0, sizeof(task.stats));
+    task.stats.name = name;
+    return true;
+}
+
+/*
+ * Run the due tasks, then sleep until the earliest deadline or a wake(),
+ * for at most SCHEDULER_MAX_SLEEP.
+ * A task's latency counts from the deadline it reported before the sleep if
+ * that has passed (the sleep overran it), or else from the one it reports
+ * now (work created during the sleep or by an earlier task in this pass),
+ * but never from before the last pass ended: a deadline already past then
+ * could not have been met sooner.
+ */
+void TaskScheduler::run() {
+    passCount++;
+    
+    for (int i = 0; i < taskCount; i++) {
+        Task &task = tasks[i];
+        unsigned long now = millis();
+        unsigned long deadline = task.wakeup(task.context);
+        if ((long)(now - deadline) < 0 && (long)(now - task.deadline) < 0) continue;
+    
+        if ((long)(now - task.deadline) >= 0) {
+            deadline = earliestDeadline(deadline, task.deadline);
+        }
+        if ((long)(deadline - lastPassEnd) < 0) deadline = lastPassEnd;
+        runTask(task, deadline);
+    }
+    
+    // Work made from here on is either in the deadlines or wakes the sleep
+    os_semaphore_t signal = wakeSignal;
+    if (signal != nullptr) os_semaphore_take(signal, 0, false);
+    unsigned long now = millis();
+    unsigned long wake = now + SCHEDULER_MAX_SLEEP;
+    for (int i = 0; i < taskCount; i++) {
+        tasks[i].deadline = tasks[i].wakeup(tasks[i].context);
+        wake = earliestDeadline(wake, tasks[i].deadline);
+    }
+    lastPassEnd = now;
+    
+    long left = (long)(wake - millis());
+    if (signal != nullptr && left > 0) os_semaphore_take(signal, left, false);
+    sleepTime += millis() - now;
+}
+
+void TaskScheduler::wake() {
+    os_semaphore_t signal = wakeSignal;
+    if (signal != nullptr) os_semaphore_give(signal, false);
+}
+
+void TaskScheduler::runTask(Task &task, unsigned long deadline) {
+    unsigned long start = micros();
+    uint32_t latency = millis() - deadline;
+    
+    task.run(task.context);
+    
+    TaskStats &stats = task.stats;
+    uint32_t runTime = micros() - start;
+    stats.runs++;
+    stats.totalLatency += latency;
+    stats.squaredLatency += (uint64_t)latency * latency;
+    if (latency > stats.maxLatency) stats.maxLatency = latency;
+    if (runTime > stats.maxRunTime) stats.maxRunTime = runTime;
+}
+
+int TaskScheduler::getTaskCount() {
+    return taskCount;
+}
+
+const TaskStats& TaskScheduler::getStats(int task) {
+    return tasks[task].stats;
+}
+
+float TaskScheduler::getMeanLatency(int task) {
+    const TaskStats &stats = tasks[task].stats;
+    return stats.runs > 0 ? (float)stats.totalLatency / stats.runs : 0;
+}
+
+float TaskScheduler::getJitter(int task) {
+    const TaskStats &stats = tasks[task].stats;
+    if (stats.runs == 0) return 0;
+    float mean = getMeanLatency(task);
+    float variance = (float)stats.squaredLatency / stats.runs - mean * mean;
+    return variance > 0 ? sqrtf(variance) : 0;
+}
+
+uint32_t TaskScheduler::getPassCount() {
+    return passCount;
+}
+
+uint32_t TaskScheduler::getSleepTime() {
+    return sleepTime;
+}
+
+uint32_t TaskScheduler::getElapsedTime() {
+    return millis() - statsStart;
+}
+
+void TaskScheduler::resetStats() {
+    for (int i = 0; i < taskCount; i++) {
+        const char *name = tasks[i].stats.name;
+        memset(&tasks[i].stats, 0, sizeof(tasks[i].stats));
+        tasks[i].stats.name = name;
+    }
+    passCount = 0;
+    sleepTime = 0;
+    statsStart = millis();
+}
@@ -0,0 +1,131 @@
+/*
+ * task_scheduler.h - Cooperative Deadline Scheduler for loop()
+ *
+ * Runs the firmware's modules as cooperative tasks. A task is a module's
+ * update() paired with getNextUpdate(), the millis() at which update() next
+ * has work (now, if it has work already). Each run() is one pass:
+ *   1. Every task whose deadline has passed runs, in the order added.
+ *      Deadlines are asked for just before each task, so work created by
+ *      an earlier task in the pass (a state change, a new LED pattern) is
+ *      seen by the later ones.
+ *   2. The loop sleeps until the earliest deadline, or until wake() is
+ *      called: by an interrupt or another thread that has made work. The
+ *      sleep blocks on a semaphore that wake() gives, so the CPU is free
+ *      and a wake() ends it at once. Deadlines are asked for after a
+ *      pending wake() is taken, so one is never lost between the two.
+ *   3. run() returns after at most SCHEDULER_MAX_SLEEP, even with no
+ *      deadline due, so loop() still runs its reports and
+ *      Particle.process() (cloud events are handled there, not during the
+ *      sleep).
+ *
+ * Deadlines are absolute: derived from the module's own timers (last
+ * poll + interval, not millis() + interval), since a task is asked again
+ * before it runs. Tasks must not block; a module with nothing scheduled
+ * reports a deadline SCHEDULER_IDLE_WAKEUP ahead.
+ *
+ * STATISTICS:
+ *   Per task: runs, latency (how long after its deadline it ran, in ms),
+ *   jitter (standard deviation of the latency) and the longest run (µs).
+ *   Latency grows with the tasks ahead in the same pass and with work
+ *   made during the sleep without a wake().
+ */
+
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include "Particle.h"
+#include "config.h"
+
+#include <atomic>
+
+#define SCHEDULER_MAX_TASKS 8
+
+/*
+ * The earlier of two millis() deadlines (wrap-safe).
+ */
+inline unsigned long earliestDeadline(unsigned long a, unsigned long b) {
+    return (long)(a - b) < 0 ? a : b;
+}
+
+/*
+ * TaskStats - Timing of one task since the last resetStats()
+ */
+struct TaskStats {
+    const char *name;
+    uint32_t runs;
+    uint32_t totalLatency;          // ms
+    uint32_t maxLatency;            // ms
+    uint64_t squaredLatency;        // Sum of squared latencies, for the jitter
+    uint32_t maxRunTime;            // µs
+};
+
+/*
+ * TaskScheduler - Runs due tasks, then sleeps until the next deadline
+ */
+class TaskScheduler {
+public:
+    typedef void (*RunFunction)(void *context);
+    typedef unsigned long (*WakeupFunction)(void *context);
+    
+    TaskScheduler();
+    
+    /*
+     * Add a task. Returns false if SCHEDULER_MAX_TASKS are already added.
+     */
+    bool addTask(const char *name, void *context, RunFunction run, WakeupFunction wakeup);
+    
+    /*
+     * Add a module with update() and getNextUpdate() as a task.
+     */
+    template<class T> bool addTask(const char *name, T *module) {
+        return addTask(name, module,
+                       [](void *context) { static_cast<T*>(context)->update(); },
+                       [](void *context) { return static_cast<T*>(context)->getNextUpdate(); });
+    }
+    
+    /*
+     * One pass: run the due tasks, then sleep until the earliest deadline
+     * (at most SCHEDULER_MAX_SLEEP).
+     */
+    void run();
+    
+    /*
+     * End the current (or next) sleep early: a deadline may have moved
+     * closer. Safe from interrupts and other threads.
+     */
+    static void wake();
+    
+    int getTaskCount();
+    const TaskStats& getStats(int task);
+    float getMeanLatency(int task);  // ms
+    float getJitter(int task);       // ms
+    uint32_t getPassCount();
+    uint32_t getSleepTime();         // ms asleep
+    uint32_t getElapsedTime();       // ms since the last resetStats()
+    void resetStats();
+
+private:
+    struct Task {
+        void *context;
+        RunFunction run;
+        WakeupFunction wakeup;
+        unsigned long deadline;     // As reported when the last sleep began
+        TaskStats stats;
+    };
+    
+    Task tasks[SCHEDULER_MAX_TASKS];
+    int taskCount;
+    uint32_t passCount;
+    uint32_t sleepTime;
+    unsigned long statsStart;
+    unsigned long lastPassEnd;      // When the last pass asked for deadlines
+    
+    static std::atomic<os_semaphore_t> wakeSignal;  // Given by wake(), from interrupts and threads
+    
+    /*
+     * Run a due task and record its latency from deadline.
+     */
+    void runTask(Task &task, unsigned long deadline);
+};
+
+#endif // TASK_SCHEDULER_H
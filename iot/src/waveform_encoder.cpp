@@ -0,0 +1,178 @@
+/*
+ * waveform_encoder.cpp - Raw PPG Waveform Encoder Implementation
+ *
+ * Blocks are encoded once, as their last sample arrives, so uploading
+ * only copies finished bytes. See waveform_encoder.h for the format.
+ */
+
+#include "waveform_encoder.h"
+
+/*
+ * Appends values of a given bit width to a byte buffer, LSB first.
+ */
+struct BitWriter {
+    uint8_t *out;
+    int length;
+    uint32_t bits;
+    int bitCount;
+    
+    BitWriter(uint8_t *buffer) : out(buffer), length(0), bits(0), bitCount(0) {}
+    
+    void write(uint32_t value, int width) {
+        if (width == 0) return;
+        bits |= value << bitCount;
+        bitCount += width;
+        while (bitCount >= 8) {
+            out[length++] = bits & 0xFF;
+            bits >>= 8;
+            bitCount -= 8;
+        }
+    }
+    
+    void finish() {
+        if (bitCount > 0) out[length++] = bits & 0xFF;
+        bits = 0;
+        bitCount = 0;
+    }
+};
+
+/*
+ * Difference to the previous sample modulo 2^18, zigzag-coded.
+ */
+static uint32_t zigzagDelta(uint32_t current, uint32_t previous) {
+    int32_t delta = (current - previous) & WAVEFORM_SAMPLE_MASK;
+    if (delta >= (1 << (WAVEFORM_SAMPLE_BITS - 1))) delta -= (1 << WAVEFORM_SAMPLE_BITS);
+    return ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+}
+
+/*
+ * Bits needed to hold value (0 for 0).
+ */
+static int bitWidth(uint32_t value) {
+    int width = 0;
+    while (value) {
+        width++;
+        value >>= 1;
+    }
+    return width;
+}
+
+WaveformEncoder::WaveformEncoder() {
+    reset();
+}
+
+/*
+ * Discard all samples and blocks (start of a measurement).
+ */
+void WaveformEncoder::reset() {
+    pendingCount = 0;
+    blockStart = 0;
+    blockCount = 0;
+    sequence = 0;
+}
+
+/*
+ * Add one sample. A block is encoded every WAVEFORM_BLOCK_SAMPLES.
+ */
+void WaveformEncoder::addSample(uint32_t red, uint32_t ir) {
+    pendingRed[pendingCount] = red & WAVEFORM_SAMPLE_MASK;
+    pendingIR[pendingCount] = ir & WAVEFORM_SAMPLE_MASK;
+    pendingCount++;
+    
+    if (pendingCount == WAVEFORM_BLOCK_SAMPLES) {
+        encodeBlock();
+    }
+}
+
+/*
+ * Encode any samples left over from the last full block.
+ */
+void WaveformEncoder::flush() {
+    if (pendingCount > 0) {
+        encodeBlock();
+    }
+}
+
+/*
+ * Encode the pending samples as one block.
+ * Widths are found first so each channel's deltas pack at a single width.
+ */
+void WaveformEncoder::encodeBlock() {
+    uint32_t maxRed = 0;
+    uint32_t maxIR = 0;
+    for (int i = 1; i < pendingCount; i++) {
+        uint32_t red = zigzagDelta(pendingRed[i], pendingRed[i - 1]);
+        uint32_t ir = zigzagDelta(pendingIR[i], pendingIR[i - 1]);
+        if (red > maxRed) maxRed = red;
+        if (ir > maxIR) maxIR = ir;
+    }
+    int redWidth = bitWidth(maxRed);
+    int irWidth = bitWidth(maxIR);
+    
+    // Drop the oldest block when full
+    int slot;
+    if (blockCount == WAVEFORM_MAX_BLOCKS) {
+        slot = blockStart;
+        blockStart = (blockStart + 1) % WAVEFORM_MAX_BLOCKS;
+    } else {
+        slot = (blockStart + blockCount) % WAVEFORM_MAX_BLOCKS;
+        blockCount++;
+    }
+    
+    uint8_t *block = blocks[slot];
+    block[0] = sequence & 0xFF;
+    block[1] = sequence >> 8;
+    block[2] = pendingCount;
+    block[3] = redWidth;
+    block[4] = irWidth;
+    
+    BitWriter writer(block + WAVEFORM_BLOCK_HEADER);
+    writer.write(pendingRed[0], WAVEFORM_SAMPLE_BITS);
+    writer.write(pendingIR[0], WAVEFORM_SAMPLE_BITS);
+    for (int i = 1; i < pendingCount; i++) {
+        writer.write(zigzagDelta(pendingRed[i], pendingRed[i - 1]), redWidth);
+    }
+    for (int i = 1; i < pendingCount; i++) {
+        writer.write(zigzagDelta(pendingIR[i], pendingIR[i - 1]), irWidth);
+    }
+    writer.finish();
+    
+    blockLength[slot] = WAVEFORM_BLOCK_HEADER + writer.length;
+    sequence++;
+    pendingCount = 0;
+}
+
+int WaveformEncoder::getBlockCount() {
+    return blockCount;
+}
+
+/*
+ * Encoded block by age (0 = oldest).
+ */
+const uint8_t* WaveformEncoder::getBlock(int index, int &length) {
+    int slot = (blockStart + index) % WAVEFORM_MAX_BLOCKS;
+    length = blockLength[slot];
+    return blocks[slot];
+}
+
+/*
+ * Base64-encode data (standard alphabet, padded).
+ */
+int WaveformEncoder::base64Encode(const uint8_t *data, int length, char *out) {
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    
+    int written = 0;
+    for (int i = 0; i < length; i += 3) {
+        uint32_t group = (uint32_t)data[i] << 16;
+        if (i + 1 < length) group |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < length) group |= data[i + 2];
+    
+        out[written++] = alphabet[(group >> 18) & 0x3F];
+        out[written++] = alphabet[(group >> 12) & 0x3F];
+        out[written++] = (i + 1 < length) ? alphabet[(group >> 6) & 0x3F] : '=';
+        out[written++] = (i + 2 < length) ? alphabet[group & 0x3F] : '=';
+    }
+    out[written] = '\0';
+    return written;
+}
@@ -0,0 +1,96 @@
+/*
+ * waveform_encoder.h - Raw PPG Waveform Encoder
+ *
+ * Compresses the red/IR samples of a measurement into small binary blocks
+ * for upload (STREAM_RAW_WAVEFORM in config.h), so the trace can be
+ * reviewed and re-analysed on the server.
+ *
+ * BLOCK FORMAT (one block per WAVEFORM_BLOCK_SAMPLES samples):
+ *   byte 0-1  sequence number (little endian, first block of a measurement = 0)
+ *   byte 2    sample count n
+ *   byte 3    red delta width wr (0-18 bits)
+ *   byte 4    IR delta width wi (0-18 bits)
+ *   bits      red[0], ir[0] as 18-bit values,
+ *             n-1 red deltas of wr bits, then n-1 IR deltas of wi bits
+ *   Bits are packed LSB first and the block is padded to a whole byte.
+ *
+ * DELTAS:
+ *   Each delta is the difference to the previous sample modulo 2^18,
+ *   zigzag-coded (0, -1, 1, -2, ... -> 0, 1, 2, 3, ...) so small changes
+ *   use few bits. The width is the largest delta in the block, so a block
+ *   never needs more than 18 bits per sample.
+ */
+
+#ifndef WAVEFORM_ENCODER_H
+#define WAVEFORM_ENCODER_H
+
+#include "Particle.h"
+#include "config.h"
+
+// MAX30102 ADC resolution
+#define WAVEFORM_SAMPLE_BITS 18
+#define WAVEFORM_SAMPLE_MASK 0x3FFFF
+
+#define WAVEFORM_BLOCK_HEADER 5
+#define WAVEFORM_BLOCK_MAX_BYTES (WAVEFORM_BLOCK_HEADER + \
+    (2 * WAVEFORM_BLOCK_SAMPLES * WAVEFORM_SAMPLE_BITS + 7) / 8)
+
+/*
+ * WaveformEncoder - Keeps the most recent WAVEFORM_MAX_BLOCKS encoded blocks
+ */
+class WaveformEncoder {
+public:
+    WaveformEncoder();
+    
+    /*
+     * Discard all samples and blocks (start of a measurement).
+     */
+    void reset();
+    
+    /*
+     * Add one sample. A block is encoded every WAVEFORM_BLOCK_SAMPLES.
+     * When WAVEFORM_MAX_BLOCKS are held the oldest block is dropped.
+     */
+    void addSample(uint32_t red, uint32_t ir);
+    
+    /*
+     * Encode any samples left over from the last full block.
+     */
+    void flush();
+    
+    /*
+     * Number of encoded blocks held.
+     */
+    int getBlockCount();
+    
+    /*
+     * Encoded block by age (0 = oldest). Sets length to its size in bytes.
+     */
+    const uint8_t* getBlock(int index, int &length);
+    
+    /*
+     * Base64-encode data into out (4 * ((length + 2) / 3) + 1 chars).
+     * Returns the number of characters written, excluding the terminator.
+     */
+    static int base64Encode(const uint8_t *data, int length, char *out);
+
+private:
+    // Samples of the block being filled
+    uint32_t pendingRed[WAVEFORM_BLOCK_SAMPLES];
+    uint32_t pendingIR[WAVEFORM_BLOCK_SAMPLES];
+    int pendingCount;
+    
+    // Encoded blocks (ring, oldest at blockStart)
+    uint8_t blocks[WAVEFORM_MAX_BLOCKS][WAVEFORM_BLOCK_MAX_BYTES];
+    uint16_t blockLength[WAVEFORM_MAX_BLOCKS];
+    int blockStart;
+    int blockCount;
+    uint16_t sequence;
+    
+    /*
+     * Encode the pending samples as one block.
+     */
+    void encodeBlock();
+};
+
+#endif // WAVEFORM_ENCODER_H
@@ -0,0 +1,281 @@
+/*
+ * block_fuzz.cpp - Round-trip Fuzz Test of the Measurement Block Codec
+ *
+ * Runs the firmware's MeasurementBlock (src/measurement_block.cpp) on a
+ * Linux host:
+ *
+ *   round trip  random measurements (any timestamps, including steps that
+ *               wrap around, readings out of range and NaN) are added to
+ *               blocks of random capacity; every entry must decode to the
+ *               reading rounded as the format stores it, with the exact
+ *               timestamp, both from the block and after load(). A refused
+ *               add() must leave the block unchanged.
+ *   corruption  valid blocks with random bytes changed, cut short or
+ *               extended, and random bytes, are given to load(); it must
+ *               either refuse them or decode exactly the count it reports.
+ *   density     a month of prompts every 30 minutes from 06:00 to 22:00,
+ *               with the user's response delay and 10% timeouts, stored in
+ *               blocks of MEASUREMENT_BLOCK_SIZE. Reports the bytes per
+ *               measurement in the offline log (with the record overhead)
+ *               and in a batch upload, against the earlier formats: once
+ *               as the firmware stores them (all valid, one confidence)
+ *               and once with random validity and confidence.
+ *
+ * BUILD (from iot/tools/block-fuzz; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -fsanitize=address,undefined -I../../host -I../../src \
+ *       block_fuzz.cpp ../../src/measurement_block.cpp -pthread -o block-fuzz
+ *
+ * USAGE:
+ *   ./block-fuzz [-n iterations] [-s seed]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include "config.h"
+#include "measurement_block.h"
+#include "record_log.h"
+
+// Earlier formats, for comparison
+#define LEGACY_STRUCT_BYTES 16      // StoredMeasurement in the fixed EEPROM arrays
+#define RECORD_PER_MEASUREMENT 14   // One 10-byte log record per measurement
+#define V1_BATCH_RECORD_BYTES 9     // MEASUREMENT_RECORD_BYTES
+
+static std::mt19937 random32;
+
+static uint32_t randomBelow(uint32_t limit) {
+    return std::uniform_int_distribution<uint32_t>(0, limit - 1)(random32);
+}
+
+static float randomFloat(float low, float high) {
+    return std::uniform_real_distribution<float>(low, high)(random32);
+}
+
+/*
+ * A reading as the format stores it (rounded, 0..most).
+ */
+static float stored(float value, uint32_t most) {
+    if (!(value > 0)) return 0;
+    if (value >= most) return most;
+    return (uint32_t)(value + 0.5f);
+}
+
+static bool same(const MeasurementData &expected, const MeasurementData &decoded) {
+    return decoded.timestamp == expected.timestamp &&
+           decoded.heartRate == stored(expected.heartRate, 255) &&
+           decoded.spO2 == stored(expected.spO2, 127) &&
+           decoded.valid == expected.valid &&
+           decoded.confidence == stored(expected.confidence * 100, 100) / 100.0f;
+}
+
+static MeasurementData randomMeasurement(uint32_t previous, uint16_t interval) {
+    MeasurementData data;
+    switch (randomBelow(6)) {
+        case 0:  data.timestamp = random32(); break;                                   // Anywhere
+        case 1:  data.timestamp = previous + interval * (1 + randomBelow(20)); break;  // Skipped prompts
+        default: data.timestamp = previous + interval + randomBelow(601) - 300; break; // Response delay
+    }
+    data.heartRate = (randomBelow(50) == 0) ? NAN : randomFloat(-20, 300);
+    data.spO2 = (randomBelow(50) == 0) ? NAN : randomFloat(-10, 150);
+    data.valid = randomBelow(2);
+    data.confidence = (randomBelow(50) == 0) ? NAN : randomFloat(-0.2f, 1.3f);
+    return data;
+}
+
+/*
+ * Fill blocks with random measurements and check that they decode.
+ */
+static bool roundTrip(int iterations, int &entries) {
+    static const uint16_t intervals[] = {15, 60, 300, 1800, 3600, 14400};
+    
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        int capacity = 1 + randomBelow(255);
+        MeasurementBlock block(capacity);
+        std::vector<MeasurementData> added;
+        uint16_t interval = intervals[randomBelow(6)];
+        uint32_t previous = random32();
+    
+        for (int attempt = 0; attempt < 300; attempt++) {
+            // Now and then another interval, which the block must refuse
+            uint16_t used = (randomBelow(40) == 0) ? intervals[randomBelow(6)] : interval;
+            MeasurementData data = randomMeasurement(previous, used);
+    
+            uint8_t before[MEASUREMENT_BLOCK_MAX_BYTES];
+            int beforeLength = block.getLength();
+            memcpy(before, block.getBytes(), beforeLength);
+    
+            if (block.add(data, used)) {
+                if (!added.empty() && used != interval) {
+                    fprintf(stderr, "round trip: accepted a different interval\n");
+                    return false;
+                }
+                interval = used;
+                added.push_back(data);
+                previous = data.timestamp;
+            } else if (block.getLength() != beforeLength || memcmp(before, block.getBytes(), beforeLength) != 0) {
+                fprintf(stderr, "round trip: refused add() changed the block\n");
+                return false;
+            } else if (!added.empty() && used == interval && (int)added.size() < capacity &&
+                       block.getLength() + MEASUREMENT_ENTRY_MAX_BYTES <= MEASUREMENT_BLOCK_MAX_BYTES) {
+                fprintf(stderr, "round trip: refused an entry that fits\n");
+                return false;
+            }
+        }
+    
+        // Decode from the block, then from a copy as read back from storage
+        MeasurementBlock loaded(capacity);
+        if (block.getCount() != (int)added.size() || !loaded.load(block.getBytes(), block.getLength())) {
+            fprintf(stderr, "round trip: block of %d does not load\n", (int)added.size());
+            return false;
+        }
+        MeasurementBlock *blocks[] = {&block, &loaded};
+        for (MeasurementBlock *check : blocks) {
+            check->rewind();
+            MeasurementData decoded;
+            for (size_t i = 0; i < added.size(); i++) {
+                if (!check->next(decoded) || !same(added[i], decoded)) {
+                    fprintf(stderr, "round trip: entry %d of %d differs (timestamp %u, decoded %u)\n",
+                            (int)i, (int)added.size(), added[i].timestamp, decoded.timestamp);
+                    return false;
+                }
+            }
+            if (check->next(decoded)) {
+                fprintf(stderr, "round trip: extra entry\n");
+                return false;
+            }
+        }
+        entries += added.size();
+    }
+    return true;
+}
+
+/*
+ * load() must refuse damaged blocks or decode what it accepts.
+ */
+static bool corruption(int iterations, int &accepted) {
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        MeasurementBlock block(255);
+        uint32_t previous = random32();
+        int count = 1 + randomBelow(40);
+        for (int i = 0; i < count; i++) {
+            MeasurementData data = randomMeasurement(previous, 1800);
+            if (block.add(data, 1800)) previous = data.timestamp;
+        }
+    
+        uint8_t bytes[MEASUREMENT_BLOCK_MAX_BYTES + 16];
+        int length = block.getLength();
+        memcpy(bytes, block.getBytes(), length);
+        switch (randomBelow(4)) {
+            case 0:     // Bytes changed
+                for (int i = 1 + randomBelow(3); i > 0; i--) bytes[randomBelow(length)] = random32();
+                break;
+            case 1:     // Cut short
+                length = randomBelow(length);
+                break;
+            case 2:     // Extended
+                for (int i = 1 + randomBelow(16); i > 0; i--) bytes[length++] = random32();
+                break;
+            default:    // Noise
+                length = randomBelow(sizeof(bytes));
+                for (int i = 0; i < length; i++) bytes[i] = random32();
+                break;
+        }
+    
+        MeasurementBlock loaded(255);
+        if (!loaded.load(bytes, length)) continue;
+        accepted++;
+    
+        MeasurementData decoded;
+        int decodedCount = 0;
+        while (loaded.next(decoded)) decodedCount++;
+        if (decodedCount != loaded.getCount() || loaded.getLength() != length) {
+            fprintf(stderr, "corruption: accepted block decodes %d of %d entries\n", decodedCount, loaded.getCount());
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Bytes per measurement for a realistic offline month. The firmware stores
+ * only valid measurements, all with the same confidence (see
+ * SensorManager); randomQuality gives each its own instead.
+ */
+static void density(bool randomQuality) {
+    MeasurementBlock block(MEASUREMENT_BLOCK_SIZE);
+    long measurements = 0;
+    long logBytes = 0;
+    long batchBytes = 0;
+    int blocks = 0;
+    uint32_t slot = 1760000000;
+    
+    auto seal = [&]() {
+        if (block.getCount() == 0) return;
+        logBytes += RECORD_LOG_OVERHEAD + block.getLength();
+        batchBytes += block.getLength();
+        blocks++;
+        block.clear();
+    };
+    
+    for (int day = 0; day < 30; day++) {
+        for (int tick = 0; tick < 48; tick++, slot += 1800) {
+            if (tick < 12 || tick >= 44 || randomBelow(10) == 0) continue;   // Night, or timed out
+    
+            MeasurementData data;
+            data.timestamp = slot + 20 + randomBelow(120);   // Response delay and measurement time
+            data.heartRate = randomFloat(55, 110);
+            data.spO2 = randomFloat(93, 100);
+            data.valid = randomQuality ? randomBelow(10) != 0 : true;
+            data.confidence = randomQuality ? randomFloat(0.5f, 1.0f) : 0.95f;
+            if (!block.add(data, 1800)) {
+                seal();
+                block.add(data, 1800);
+            }
+            if (block.getCount() == MEASUREMENT_BLOCK_SIZE) seal();
+            measurements++;
+        }
+    }
+    seal();
+    
+    double perLog = (double)logBytes / measurements;
+    double perBatch = (double)(batchBytes + (blocks + 2) / 3) / measurements;   // A version byte per batch of 3 blocks
+    printf("density%s: %ld measurements in %d blocks of up to %d\n", randomQuality ? " (random quality)" : "",
+           measurements, blocks, MEASUREMENT_BLOCK_SIZE);
+    printf("  offline log  %5.2f bytes/measurement (%.1fx smaller than the %d-byte struct, %.1fx than a %d-byte record)\n",
+           perLog, LEGACY_STRUCT_BYTES / perLog, LEGACY_STRUCT_BYTES, RECORD_PER_MEASUREMENT / perLog, RECORD_PER_MEASUREMENT);
+    printf("  batch upload %5.2f bytes/measurement (%.1fx smaller than %d-byte version 1 records)\n",
+           perBatch, V1_BATCH_RECORD_BYTES / perBatch, V1_BATCH_RECORD_BYTES);
+}
+
+int main(int argc, char **argv) {
+    int iterations = 20000;
+    unsigned seed = 1;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [-n iterations] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    random32.seed(seed);
+    
+    int entries = 0;
+    int accepted = 0;
+    bool ok = roundTrip(iterations, entries);
+    if (ok) printf("round trip: %d blocks, %d entries: ok\n", iterations, entries);
+    ok = ok && corruption(iterations, accepted);
+    if (ok) printf("corruption: %d damaged blocks, %d accepted and decoded: ok\n", iterations, accepted);
+    density(false);
+    density(true);
+    
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,619 @@
+/*
+ * config_fuzz.cpp - Differential Fuzz Test of the Streaming Config Parser
+ *
+ * Runs the firmware's ConfigParser (src/config_parser.cpp) on a Linux host
+ * and compares it with a recursive-descent reference parser that reads
+ * the whole document at once:
+ *
+ *   known       the API and webhook response formats, and edge cases
+ *               (escaped keys, long or empty times, nested settings,
+ *               fractions, truncation, trailing bytes, deep nesting)
+ *               with fixed expected results
+ *   generated   random JSON documents built around the config keys and
+ *               decoys, with random whitespace, escapes and numbers
+ *   mutated     generated documents with bytes changed, inserted or
+ *               removed, or cut short, and random bytes
+ *
+ * Every document is fed whole, in random parts (as webhook event parts or
+ * TCP reads arrive) and byte by byte. The parser must agree with the
+ * reference on whether the document is complete, malformed or truncated,
+ * and on the settings found in a complete one.
+ *
+ * It also times one pass over a full API response against the previous
+ * extraction, which searched the body with strstr() once per key and
+ * format (compact keys first, then the full ones).
+ *
+ * BUILD (from iot/tools/config-fuzz; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -fsanitize=address,undefined -I../../host -I../../src \
+ *       config_fuzz.cpp ../../src/config_parser.cpp -pthread -o config-fuzz
+ *
+ * USAGE:
+ *   ./config-fuzz [-n iterations] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+
+#include "config_parser.h"
+
+static std::mt19937 random32;
+
+static uint32_t randomBelow(uint32_t limit) {
+    return std::uniform_int_distribution<uint32_t>(0, limit - 1)(random32);
+}
+
+// ============================================================================
+// Reference parser
+// ============================================================================
+
+enum Outcome { COMPLETE, MALFORMED, TRUNCATED };
+
+static const char *outcomeName(Outcome outcome) {
+    return outcome == COMPLETE ? "complete" : outcome == MALFORMED ? "malformed" : "truncated";
+}
+
+struct Settings {
+    bool frequencyFound = false;
+    int frequency = 0;
+    std::string startTime;
+    std::string endTime;
+};
+
+/*
+ * Whole-document JSON parser with the extraction rules of config_parser.h.
+ * A number that runs to the end of the input is truncated (more digits
+ * could follow), as it is for a stream.
+ */
+class Reference {
+public:
+    Reference(const std::string &text) : text(text) {}
+    
+    Outcome parse() {
+        Outcome outcome = value(FIELD_NONE);
+        if (outcome != COMPLETE) return outcome;
+        skipSpace();
+        return position < text.size() ? MALFORMED : COMPLETE;
+    }
+    
+    Settings settings;
+
+private:
+    enum Field { FIELD_NONE, FIELD_FREQUENCY, FIELD_START, FIELD_END };
+    
+    const std::string &text;
+    size_t position = 0;
+    int depth = 0;
+    
+    bool atEnd() { return position >= text.size(); }
+    char peek() { return text[position]; }
+    
+    void skipSpace() {
+        while (!atEnd() && (peek() == ' ' || peek() == '\t' || peek() == '\n' || peek() == '\r')) position++;
+    }
+    
+    Outcome value(Field field) {
+        skipSpace();
+        if (atEnd()) return TRUNCATED;
+        char c = peek();
+        if (c == '{') return object();
+        if (c == '[') return array();
+        if (c == '"') {
+            std::string string;
+            bool escaped;
+            Outcome outcome = stringToken(string, escaped);
+            if (outcome != COMPLETE) return outcome;
+            std::string *time = field == FIELD_START ? &settings.startTime :
+                                field == FIELD_END ? &settings.endTime : nullptr;
+            if (time && time->empty() && !escaped && string.size() < CONFIG_TIME_SIZE) *time = string;
+            return COMPLETE;
+        }
+        if (c == '-' || (c >= '0' && c <= '9')) return number(field);
+        for (const char *literal : {"true", "false", "null"}) {
+            if (c != literal[0]) continue;
+            for (const char *p = literal; *p; p++, position++) {
+                if (atEnd()) return TRUNCATED;
+                if (peek() != *p) return MALFORMED;
+            }
+            return COMPLETE;
+        }
+        return MALFORMED;
+    }
+    
+    Outcome object() {
+        if (++depth > CONFIG_PARSER_MAX_DEPTH) return MALFORMED;
+        position++;
+        skipSpace();
+        if (atEnd()) return TRUNCATED;
+        if (peek() == '}') {
+            position++;
+            depth--;
+            return COMPLETE;
+        }
+        while (true) {
+            skipSpace();
+            if (atEnd()) return TRUNCATED;
+            if (peek() != '"') return MALFORMED;
+            std::string key;
+            bool escaped;
+            Outcome outcome = stringToken(key, escaped);
+            if (outcome != COMPLETE) return outcome;
+    
+            Field field = FIELD_NONE;
+            if (!escaped && (key == "measurementFrequency" || key == "f")) field = FIELD_FREQUENCY;
+            if (!escaped && (key == "activeStartTime" || key == "s")) field = FIELD_START;
+            if (!escaped && (key == "activeEndTime" || key == "e")) field = FIELD_END;
+    
+            skipSpace();
+            if (atEnd()) return TRUNCATED;
+            if (peek() != ':') return MALFORMED;
+            position++;
+            outcome = value(field);
+            if (outcome != COMPLETE) return outcome;
+    
+            skipSpace();
+            if (atEnd()) return TRUNCATED;
+            char c = text[position++];
+            if (c == '}') break;
+            if (c != ',') return MALFORMED;
+        }
+        depth--;
+        return COMPLETE;
+    }
+    
+    Outcome array() {
+        if (++depth > CONFIG_PARSER_MAX_DEPTH) return MALFORMED;
+        position++;
+        skipSpace();
+        if (atEnd()) return TRUNCATED;
+        if (peek() == ']') {
+            position++;
+            depth--;
+            return COMPLETE;
+        }
+        while (true) {
+            Outcome outcome = value(FIELD_NONE);
+            if (outcome != COMPLETE) return outcome;
+            skipSpace();
+            if (atEnd()) return TRUNCATED;
+            char c = text[position++];
+            if (c == ']') break;
+            if (c != ',') return MALFORMED;
+        }
+        depth--;
+        return COMPLETE;
+    }
+    
+    Outcome stringToken(std::string &out, bool &escaped) {
+        escaped = false;
+        position++;
+        while (true) {
+            if (atEnd()) return TRUNCATED;
+            unsigned char c = text[position++];
+            if (c == '"') return COMPLETE;
+            if (c < 0x20) return MALFORMED;
+            if (c != '\\') {
+                out += (char)c;
+                continue;
+            }
+            escaped = true;
+            if (atEnd()) return TRUNCATED;
+            c = text[position++];
+            if (c == 'u') {
+                for (int i = 0; i < 4; i++) {
+                    if (atEnd()) return TRUNCATED;
+                    if (!isxdigit((unsigned char)text[position++])) return MALFORMED;
+                }
+            } else if (c == 0 || !strchr("\"\\/bfnrt", c)) {
+                return MALFORMED;
+            }
+        }
+    }
+    
+    bool digitAt() { return !atEnd() && peek() >= '0' && peek() <= '9'; }
+    
+    Outcome number(Field field) {
+        bool plain = true;
+        long value = 0;
+        if (peek() == '-') {
+            plain = false;
+            position++;
+            if (atEnd()) return TRUNCATED;
+            if (!digitAt()) return MALFORMED;
+        }
+        if (peek() == '0') {
+            position++;
+        } else {
+            while (digitAt()) {
+                value = std::min(value * 10 + (peek() - '0'), (long)CONFIG_FREQUENCY_MAX);
+                position++;
+            }
+        }
+        if (atEnd()) return TRUNCATED;
+        if (peek() == '.') {
+            plain = false;
+            position++;
+            if (atEnd()) return TRUNCATED;
+            if (!digitAt()) return MALFORMED;
+            while (digitAt()) position++;
+            if (atEnd()) return TRUNCATED;
+        }
+        if (peek() == 'e' || peek() == 'E') {
+            plain = false;
+            position++;
+            if (atEnd()) return TRUNCATED;
+            if (peek() == '+' || peek() == '-') position++;
+            if (atEnd()) return TRUNCATED;
+            if (!digitAt()) return MALFORMED;
+            while (digitAt()) position++;
+            if (atEnd()) return TRUNCATED;
+        }
+        if (field == FIELD_FREQUENCY && plain && !settings.frequencyFound) {
+            settings.frequencyFound = true;
+            settings.frequency = value;
+        }
+        return COMPLETE;
+    }
+};
+
+// ============================================================================
+// Comparison
+// ============================================================================
+
+static Outcome streamOutcome(ConfigParser &parser) {
+    return parser.isComplete() ? COMPLETE : parser.hasError() ? MALFORMED : TRUNCATED;
+}
+
+static void printDocument(const std::string &text) {
+    fprintf(stderr, "  document (%d bytes): ", (int)text.size());
+    for (unsigned char c : text) {
+        if (c >= 0x20 && c < 0x7f) fputc(c, stderr);
+        else fprintf(stderr, "\\x%02x", c);
+    }
+    fputc('\n', stderr);
+}
+
+/*
+ * Parse text whole, in random parts and byte by byte; all must match the
+ * reference. Returns the outcome, or -1 on a mismatch.
+ */
+static int check(const std::string &text) {
+    Reference reference(text);
+    Outcome expected = reference.parse();
+    bool hasNul = text.find('\0') != std::string::npos;
+    
+    for (int mode = 0; mode < 3; mode++) {
+        ConfigParser parser;
+        if (mode == 0 && !hasNul) {
+            parser.feed(text.c_str());
+        } else if (mode == 1 && !hasNul) {
+            // Parts, as NUL-terminated webhook event data
+            size_t start = 0;
+            while (start < text.size()) {
+                size_t length = 1 + randomBelow(64);
+                parser.feed(text.substr(start, length).c_str());
+                start += length;
+            }
+        } else {
+            for (char c : text) parser.feed(c);
+        }
+    
+        Outcome outcome = streamOutcome(parser);
+        bool same = outcome == expected;
+        if (same && expected == COMPLETE) {
+            int frequency = reference.settings.frequency;
+            same = parser.getFrequency() == frequency &&
+                   reference.settings.startTime == parser.getStartTime() &&
+                   reference.settings.endTime == parser.getEndTime() &&
+                   parser.hasValues() == (frequency > 0 || !reference.settings.startTime.empty() ||
+                                          !reference.settings.endTime.empty());
+        }
+        if (!same) {
+            fprintf(stderr, "mismatch (feed mode %d): parser %s f=%d s=\"%s\" e=\"%s\", reference %s f=%d s=\"%s\" e=\"%s\"\n",
+                    mode, outcomeName(outcome), parser.getFrequency(), parser.getStartTime(), parser.getEndTime(),
+                    outcomeName(expected), reference.settings.frequency, reference.settings.startTime.c_str(),
+                    reference.settings.endTime.c_str());
+            printDocument(text);
+            return -1;
+        }
+    }
+    return expected;
+}
+
+// ============================================================================
+// Known answers
+// ============================================================================
+
+struct Known {
+    const char *text;
+    Outcome outcome;
+    int frequency;
+    const char *startTime;
+    const char *endTime;
+};
+
+static const Known KNOWN[] = {
+    {"{\"success\":true,\"data\":{\"config\":{\"measurementFrequency\":1800,"
+     "\"activeStartTime\":\"06:00\",\"activeEndTime\":\"22:00\"}}}", COMPLETE, 1800, "06:00", "22:00"},
+    {"{\"f\":900,\"s\":\"07:30\",\"e\":\"21:00\"}", COMPLETE, 900, "07:30", "21:00"},
+    {" {\n  \"f\" : 60 ,\r\n\t\"e\":\"23:59\" }\n ", COMPLETE, 60, "", "23:59"},
+    {"{\"success\":false,\"error\":\"Invalid API key\"}", COMPLETE, 0, "", ""},
+    {"{\"data\":{\"f\":[1800],\"s\":{\"s\":\"05:00\"}}}", COMPLETE, 0, "05:00", ""},
+    {"{\"\\u0066\":1800,\"f\":120}", COMPLETE, 120, "", ""},
+    {"{\"s\":\"06:00:00:00\",\"s\":\"\",\"s\":\"0\\u0036:00\",\"s\":\"08:00\"}", COMPLETE, 0, "08:00", ""},
+    {"{\"f\":1800.0,\"f\":-5,\"f\":1e3,\"f\":0,\"f\":600}", COMPLETE, 0, "", ""},
+    {"{\"f\":99999999999999999999}", COMPLETE, CONFIG_FREQUENCY_MAX, "", ""},
+    {"{\"measurementFrequency\":1800,\"activeStartTime\":\"06:", TRUNCATED, 0, "", ""},
+    {"{\"f\":1800", TRUNCATED, 0, "", ""},
+    {"{\"f\":1800}}", MALFORMED, 0, "", ""},
+    {"{\"f\":1800,}", MALFORMED, 0, "", ""},
+    {"{\"f\":01}", MALFORMED, 0, "", ""},
+    {"{\"f\":tru}", MALFORMED, 0, "", ""},
+    {"{\"s\":\"06\n00\"}", MALFORMED, 0, "", ""},
+    {"{\"f\":1800}garbage", MALFORMED, 0, "", ""},
+    {"[\"f\",1800]", COMPLETE, 0, "", ""},
+    {"1800", TRUNCATED, 0, "", ""},
+};
+
+static bool knownAnswers() {
+    for (const Known &known : KNOWN) {
+        ConfigParser parser;
+        parser.feed(known.text);
+        Outcome outcome = streamOutcome(parser);
+        if (outcome != known.outcome || parser.getFrequency() != known.frequency ||
+            strcmp(parser.getStartTime(), known.startTime) != 0 || strcmp(parser.getEndTime(), known.endTime) != 0) {
+            fprintf(stderr, "known: parser %s f=%d s=\"%s\" e=\"%s\" for %s\n", outcomeName(outcome),
+                    parser.getFrequency(), parser.getStartTime(), parser.getEndTime(), known.text);
+            return false;
+        }
+        if (check(known.text) < 0) return false;
+    }
+    
+    // Nesting limit
+    std::string deep(CONFIG_PARSER_MAX_DEPTH, '[');
+    deep += std::string(CONFIG_PARSER_MAX_DEPTH, ']');
+    std::string deeper = "[" + deep + "]";
+    return check(deep) == COMPLETE && check(deeper) == MALFORMED;
+}
+
+// ============================================================================
+// Generated and mutated documents
+// ============================================================================
+
+static const char *KEYS[] = {
+    "measurementFrequency", "f", "activeStartTime", "s", "activeEndTime", "e",
+    "success", "data", "config", "error", "frequency", "F", "start", "ee", "measurementFrequencyX",
+    "activeStartTim", "\\u0066", "\\\"s", "aVeryLongKeyThatDoesNotFitTheTokenBuffer",
+};
+
+static void space(std::string &out) {
+    static const char *spaces[] = {" ", "\n", "\t", "\r\n", "  "};
+    while (randomBelow(5) == 0) out += spaces[randomBelow(5)];
+}
+
+static void randomString(std::string &out) {
+    out += '"';
+    switch (randomBelow(6)) {
+        case 0:
+        case 1: {
+            char time[8];
+            snprintf(time, sizeof(time), "%02u:%02u", randomBelow(25), randomBelow(61));
+            out += time;
+            break;
+        }
+        case 2:
+            break;      // Empty
+        case 3: {
+            static const char *escapes[] = {"\\\"", "\\\\", "\\/", "\\n", "\\u00e9", "\\t"};
+            out += "0";
+            out += escapes[randomBelow(6)];
+            out += ":00";
+            break;
+        }
+        default:
+            // Printable, without quotes or backslashes
+            for (int i = randomBelow(30); i > 0; i--) {
+                char c = ' ' + randomBelow(95);
+                out += (c == '"' || c == '\\') ? 'x' : c;
+            }
+            break;
+    }
+    out += '"';
+}
+
+static void randomNumber(std::string &out) {
+    static const char *numbers[] = {"1800", "0", "15", "14400", "-300", "1800.5", "2e3", "1E+2", "0.0",
+                                    "123456789012345", "7", "-0", "3600"};
+    out += numbers[randomBelow(sizeof(numbers) / sizeof(numbers[0]))];
+}
+
+static void randomValue(std::string &out, int depth);
+
+static void randomObject(std::string &out, int depth) {
+    out += '{';
+    int members = randomBelow(depth < 3 ? 6 : 3);
+    for (int i = 0; i < members; i++) {
+        if (i > 0) out += ',';
+        space(out);
+        out += '"';
+        out += KEYS[randomBelow(sizeof(KEYS) / sizeof(KEYS[0]))];
+        out += '"';
+        space(out);
+        out += ':';
+        space(out);
+        randomValue(out, depth + 1);
+        space(out);
+    }
+    out += '}';
+}
+
+static void randomValue(std::string &out, int depth) {
+    switch (randomBelow(depth < 5 ? 8 : 5)) {
+        case 0:
+        case 1: randomString(out); break;
+        case 2:
+        case 3: randomNumber(out); break;
+        case 4: out += (randomBelow(3) == 0) ? "null" : (randomBelow(2) ? "true" : "false"); break;
+        case 5: {
+            out += '[';
+            for (int i = randomBelow(4); i > 0; i--) {
+                space(out);
+                randomValue(out, depth + 1);
+                if (i > 1) out += ',';
+            }
+            out += ']';
+            break;
+        }
+        default: randomObject(out, depth); break;
+    }
+}
+
+static std::string randomDocument() {
+    std::string out;
+    space(out);
+    randomObject(out, 0);
+    space(out);
+    return out;
+}
+
+static std::string mutate(std::string text) {
+    static const char bytes[] = "{}[]\":,\\ 0123456789.e-tfnu\n\x01\x7f\x80\xff";
+    switch (randomBelow(5)) {
+        case 0:     // Bytes changed
+            for (int i = 1 + randomBelow(3); i > 0 && !text.empty(); i--) {
+                text[randomBelow(text.size())] = bytes[randomBelow(sizeof(bytes) - 1)];
+            }
+            break;
+        case 1:     // Bytes inserted
+            for (int i = 1 + randomBelow(3); i > 0; i--) {
+                text.insert(text.begin() + randomBelow(text.size() + 1), bytes[randomBelow(sizeof(bytes) - 1)]);
+            }
+            break;
+        case 2:     // Bytes removed
+            for (int i = 1 + randomBelow(3); i > 0 && !text.empty(); i--) text.erase(randomBelow(text.size()), 1);
+            break;
+        case 3:     // Cut short
+            text.resize(randomBelow(text.size() + 1));
+            break;
+        default:    // Noise
+            text.clear();
+            for (int i = randomBelow(64); i > 0; i--) text += (char)random32();
+            break;
+    }
+    return text;
+}
+
+static bool fuzz(int iterations, bool mutated, int counts[3], int &withValues) {
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        std::string text = randomDocument();
+        if (mutated) text = mutate(text);
+        int outcome = check(text);
+        if (outcome < 0) return false;
+        counts[outcome]++;
+    
+        if (outcome == COMPLETE) {
+            ConfigParser parser;
+            parser.feed(text.c_str());
+            if (parser.hasValues()) withValues++;
+        }
+    }
+    return true;
+}
+
+// ============================================================================
+// Timing
+// ============================================================================
+
+// The previous extraction: one strstr() per key
+static int previousInt(const char *json, const char *key) {
+    char searchKey[32];
+    snprintf(searchKey, sizeof(searchKey), "\"%s\":", key);
+    const char *start = strstr(json, searchKey);
+    return start ? atoi(start + strlen(searchKey)) : 0;
+}
+
+static void previousValue(const char *json, const char *key, char *out, int size) {
+    out[0] = '\0';
+    char searchKey[32];
+    snprintf(searchKey, sizeof(searchKey), "\"%s\":\"", key);
+    const char *start = strstr(json, searchKey);
+    if (start == nullptr) return;
+    start += strlen(searchKey);
+    const char *end = strchr(start, '"');
+    if (end == nullptr) return;
+    int length = std::min((int)(end - start), size - 1);
+    memcpy(out, start, length);
+    out[length] = '\0';
+}
+
+static void timing() {
+    const char *response = KNOWN[0].text;
+    const int rounds = 200000;
+    volatile int sink = 0;
+    
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        ConfigParser parser;
+        parser.feed(response);
+        sink += parser.getFrequency();
+    }
+    double streaming = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        char startTime[8], endTime[8];
+        int frequency = previousInt(response, "f");
+        previousValue(response, "s", startTime, sizeof(startTime));
+        previousValue(response, "e", endTime, sizeof(endTime));
+        if (frequency == 0 && startTime[0] == '\0') {
+            frequency = previousInt(response, "measurementFrequency");
+            previousValue(response, "activeStartTime", startTime, sizeof(startTime));
+            previousValue(response, "activeEndTime", endTime, sizeof(endTime));
+        }
+        sink += frequency;
+    }
+    double previous = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    int length = strlen(response);
+    printf("timing: %d-byte API response, one pass %.0f ns (%.1f ns/byte), six strstr() searches %.0f ns\n",
+           length, streaming * 1e9 / rounds, streaming * 1e9 / rounds / length, previous * 1e9 / rounds);
+}
+
+int main(int argc, char **argv) {
+    int iterations = 20000;
+    unsigned seed = 1;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [-n iterations] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    random32.seed(seed);
+    
+    bool ok = knownAnswers();
+    if (ok) printf("known: %d documents: ok\n", (int)(sizeof(KNOWN) / sizeof(KNOWN[0])) + 2);
+    
+    int generated[3] = {0, 0, 0};
+    int mutated[3] = {0, 0, 0};
+    int withValues = 0;
+    ok = ok && fuzz(iterations, false, generated, withValues);
+    if (ok) printf("generated: %d documents (%d with settings): ok\n", iterations, withValues);
+    withValues = 0;
+    ok = ok && fuzz(iterations, true, mutated, withValues);
+    if (ok) {
+        printf("mutated: %d documents (%d complete, %d malformed, %d truncated): ok\n",
+               iterations, mutated[COMPLETE], mutated[MALFORMED], mutated[TRUNCATED]);
+    }
+    timing();
+    
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+/*
+ * drain_bench.cpp - Host Test and Timing of SensorManager's FIFO Drain
+ *
+ * Builds the firmware (all of src/ but the .ino) on a Linux host and runs
+ * SensorManager's acquisition path (update() -> drainFIFO() -> the
+ * MAX30105 driver) against the host HAL's MAX30102 (iot/host): a fake
+ * I2C bus at 400 kHz and the A_FULL interrupt on MAX30102_INT, on the
+ * simulated clock. With a finger on the sensor (a 72 bpm pulse),
+ * measurements run back to back, each until it completes. The harness
+ * calls update() whenever getNextUpdate() says it has work, looking again
+ * every millisecond, so a drain is only as late as the firmware itself
+ * schedules it.
+ *
+ * Reported per burst (an update() call that read the FIFO): the samples
+ * read, the I2C transactions and bytes, the time the call held up its
+ * caller (bus time on the simulated clock), the host CPU time of the call
+ * and, with the interrupt, how long after A_FULL the burst started (but
+ * for a measurement's first burst). Also the update() calls that found
+ * nothing to read.
+ *
+ * It exits non-zero unless:
+ *   - every burst reads all the samples waiting when it starts
+ *   - no burst but a measurement's first (which reads what gathered before
+ *     the measurement) finds more than SENSOR_FIFO_WATERMARK + 1 samples
+ *     waiting
+ *   - no update() call holds up its caller for a sample period
+ *   - no sample is lost to a FIFO overrun
+ *   - every measurement completes within its 60 s with a heart rate of
+ *     72 +/- 5 bpm
+ * The acquisition mode is USE_SENSOR_INTERRUPT from config.h, which the
+ * ctest build overrides to run both (drain-bench, drain-bench-polled).
+ *
+ * The flash log's files are never opened here: NetworkManager is not
+ * started.
+ *
+ * BUILD (from iot/tools/drain-bench; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -DARDUINO=100 -I../../host -I../../src -I../../lib/SparkFun-MAX3010x/src \
+ *       drain_bench.cpp ../../src/[a-z]*.cpp ../../lib/SparkFun-MAX3010x/src/[a-zA-Z]*.cpp -pthread -o drain-bench
+ *   (add -DUSE_SENSOR_INTERRUPT=false for the polled mode)
+ *
+ * USAGE:
+ *   ./drain-bench [-n measurements] [-v]
+ *   -n  measurements to run (default 20)
+ *   -v  print the firmware's serial output
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "config.h"
+#include "led_controller.h"
+#include "network_manager.h"
+#include "sensor_manager.h"
+#include "state_machine.h"
+
+// The firmware's globals, as in heart-track-iot.ino
+StateMachine stateMachine;
+SensorManager sensorManager;
+LEDController ledController;
+NetworkManager networkManager;
+
+// Minimum, mean and maximum of a series
+struct Series {
+    long count = 0;
+    double total = 0;
+    double least = 0;
+    double most = 0;
+    
+    void add(double value) {
+        if (count == 0 || value < least) least = value;
+        if (count == 0 || value > most) most = value;
+        total += value;
+        count++;
+    }
+    
+    void print(const char *name, const char *unit) {
+        printf("  %-28s %10.1f %10.1f %10.1f  %s\n", name, least, count > 0 ? total / count : 0, most, unit);
+    }
+};
+
+int main(int argc, char **argv) {
+    int measurements = 20;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            hostVerbose = true;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            measurements = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-n measurements] [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+    hostWireBuffer = SENSOR_I2C_BUFFER_SIZE;    // As acquireWireBuffer() in the .ino
+    
+    printf("mode: sensor %s, FIFO watermark %d samples, %d B I2C buffer\n",
+           USE_SENSOR_INTERRUPT ? "A_FULL interrupt" : "polled", SENSOR_FIFO_WATERMARK, SENSOR_I2C_BUFFER_SIZE);
+    
+    ledController.begin();
+    if (!sensorManager.begin()) {
+        fprintf(stderr, "sensor model not found by the driver\n");
+        return 1;
+    }
+    hostSensor.fingerOn = true;
+    delay(2000);                                // The FIFO fills, and overruns, before the first measurement
+    hostSensor.countOverruns = true;
+    
+    Series samples, transactions, bytes, busTime, cpuTime, latency, duration;
+    long idleCalls = 0;
+    long missed = 0;            // Samples left behind by a burst
+    long crowded = 0;           // Bursts after the first that found more than a watermark (+1) waiting
+    long blocking = 0;          // Calls that held up the caller for a sample period
+    int failed = 0;             // Measurements that did not complete with 72 +/- 5 bpm
+    
+    for (int m = 0; m < measurements; m++) {
+        stateMachine.setState(STATE_MEASURING); // Starts a measurement
+        unsigned long start = millis();
+        bool first = true;
+    
+        while (stateMachine.getCurrentState() == STATE_MEASURING && millis() - start < 70000) {
+            if ((long)(millis() - sensorManager.getNextUpdate()) < 0) {
+                delay(1);
+                continue;
+            }
+    
+            int waiting = hostSensor.unread();
+            long startRead = hostSensor.samplesRead;
+            long startTransactions = hostI2CTransactions;
+            long startBytes = hostI2CBytes;
+            uint64_t startMicros = hostMicros();
+            uint64_t interruptAt = hostSensor.interruptAt;
+            auto cpuStart = std::chrono::steady_clock::now();
+    
+            sensorManager.update();
+    
+            double cpu = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - cpuStart).count();
+            uint64_t held = hostMicros() - startMicros;
+            long read = hostSensor.samplesRead - startRead;
+            if (held >= SENSOR_SAMPLE_PERIOD * 1000) blocking++;
+            if (read == 0) {
+                idleCalls++;
+                continue;
+            }
+    
+            samples.add(read);
+            transactions.add(hostI2CTransactions - startTransactions);
+            bytes.add(hostI2CBytes - startBytes);
+            busTime.add(held / 1000.0);
+            cpuTime.add(cpu);
+            if (read < waiting) missed += waiting - read;
+            // The first burst of a measurement reads what gathered before it
+            if (!first) {
+                if (USE_SENSOR_INTERRUPT) latency.add((startMicros - interruptAt) / 1000.0);
+                if (waiting > SENSOR_FIFO_WATERMARK + 1) crowded++;
+            }
+            first = false;
+        }
+    
+        MeasurementData result = sensorManager.getMeasurement();
+        bool complete = stateMachine.getCurrentState() == STATE_TRANSMITTING;
+        duration.add((millis() - start) / 1000.0);
+        if (!complete || result.heartRate < 67 || result.heartRate > 77) {
+            printf("measurement %d: %s, HR %.0f bpm, SpO2 %.0f%%\n", m + 1, complete ? "complete" : "NOT complete",
+                   result.heartRate, result.spO2);
+            failed++;
+        }
+    }
+    
+    printf("%d measurements, %ld bursts, %ld update() calls that found nothing\n", measurements, samples.count,
+           idleCalls);
+    printf("  %-28s %10s %10s %10s\n", "", "min", "mean", "max");
+    duration.print("measurement", "s");
+    samples.print("samples read per burst", "");
+    transactions.print("I2C transactions per burst", "");
+    bytes.print("I2C bytes per burst", "");
+    busTime.print("caller held up (bus time)", "ms");
+    cpuTime.print("host CPU time per burst", "us");
+    if (USE_SENSOR_INTERRUPT) latency.print("A_FULL to burst", "ms");
+    printf("samples left behind by a burst: %ld, bursts with over %d waiting: %ld, calls held up %d ms or more: %ld\n",
+           missed, SENSOR_FIFO_WATERMARK + 1, crowded, SENSOR_SAMPLE_PERIOD, blocking);
+    printf("FIFO overruns while measuring: %ld, measurements off 72 +/- 5 bpm or incomplete: %d\n",
+           hostSensor.overruns.load(), failed);
+    
+    bool ok = missed == 0 && crowded == 0 && blocking == 0 && hostSensor.overruns == 0 && failed == 0;
+    printf("drain checks: %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
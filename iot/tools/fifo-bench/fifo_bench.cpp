@@ -0,0 +1,291 @@
+/*
+ * fifo_bench.cpp - Host Benchmark for MAX30105 FIFO Reads
+ *
+ * Runs the SparkFun driver (lib/SparkFun-MAX3010x/src/MAX30105.cpp) on a
+ * Linux host against the host HAL's simulated MAX30102 (iot/host, with
+ * counter samples) on a 400 kHz I2C bus, reading the same samples each
+ * way the driver offers:
+ *   getRed/getIR - one safeCheck() per value, as the basic examples do
+ *   check        - check() once the batch is waiting, then the ring
+ *                  through getFIFORed()/getFIFOIR()/nextSample()
+ *   readFIFO     - the bulk read into the caller's red/IR arrays
+ * with Device OS's default 32-byte Wire buffer and with the enlarged one
+ * (SENSOR_I2C_BUFFER_SIZE, see acquireWireBuffer() in the .ino). The batch
+ * is the number of samples waiting when the FIFO is read: the A_FULL
+ * watermark (SENSOR_FIFO_WATERMARK) or the whole FIFO (32).
+ *
+ * For each it reports, per 100 samples taken from the FIFO, the I2C
+ * transactions, bytes and bus time, and the rate at which sample data
+ * reaches the caller while the bus is busy. It also checks that every
+ * red/IR pair comes from one sample and that none is skipped or repeated.
+ *
+ * Then the edge cases of the FIFO count: a FIFO of exactly 32 samples
+ * (equal pointers, OVF_COUNTER 0) must read as full, through readFIFO()
+ * and check(), also when check() first finds the ring full; once read, it
+ * must read as empty, after A_FULL and after getINT1().
+ *
+ * Last, the two access styles on one sensor: getRed()/getIR() must not
+ * take entries from a ring that check() filled for a nextSample() caller,
+ * and without one they must keep returning new samples after the ring
+ * fills, without moving its tail.
+ *
+ * BUILD (from iot/tools/fifo-bench; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -DARDUINO=100 -I../../host -I../../src -I../../lib/SparkFun-MAX3010x/src \
+ *       fifo_bench.cpp ../../lib/SparkFun-MAX3010x/src/MAX30105.cpp -pthread -o fifo-bench
+ *
+ * USAGE:
+ *   ./fifo-bench [-n samples]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "MAX30105.h"
+
+enum Method { GET_RED_IR, CHECK, READ_FIFO };
+
+static const char *METHOD_NAMES[] = {"getRed/getIR", "check", "readFIFO"};
+
+struct Result {
+    long samples;           // Taken from the FIFO
+    long delivered;         // Red/IR pairs handed to the caller
+    long transactions;
+    long bytes;
+    long splitPairs;        // Red and IR from different samples
+    long outOfOrder;        // Pairs that skip or repeat a sample
+};
+
+/*
+ * Tracks the pairs handed to the caller: sample n is red = n,
+ * IR = n + 0x10000 (HostSensor::counterSamples).
+ */
+struct PairCheck {
+    uint32_t expected = 0;
+    bool first = true;
+
+    void add(Result &result, uint32_t red, uint32_t ir) {
+        if (ir != ((red + HostSensor::IR_OFFSET) & 0x3FFFF)) result.splitPairs++;
+        if (!first && red != expected) result.outOfOrder++;
+        expected = (red + 1) & 0x3FFFF;
+        first = false;
+        result.delivered++;
+    }
+};
+
+// Let the clock run until the sensor's FIFO holds count samples
+static void waitForSamples(int count) {
+    while (hostSensor.unread() < count) hostAdvance(1000);
+}
+
+// As SensorManager::begin() with USE_SENSOR_INTERRUPT
+static void setupSensor(MAX30105 &sensor, int wireBuffer) {
+    sensor.begin(Wire, I2C_SPEED_FAST);
+    sensor.setup(60, 4, 2, 100, 411, 4096);
+    sensor.setI2CBufferLength(wireBuffer);
+    sensor.setFIFOAlmostFull(SENSOR_FIFO_ALMOST_FULL);
+    sensor.enableAFULL();
+    sensor.getINT1();
+}
+
+static Result run(Method method, int wireBuffer, int batch, long count) {
+    hostWireBuffer = wireBuffer;
+
+    MAX30105 sensor;
+    setupSensor(sensor, wireBuffer);
+
+    Result result = {0, 0, 0, 0, 0, 0};
+    PairCheck pairs;
+    long startRead = hostSensor.samplesRead;
+    long startTransactions = hostI2CTransactions;
+    long startBytes = hostI2CBytes;
+
+    while (hostSensor.samplesRead - startRead < count) {
+        if (method == GET_RED_IR) {
+            uint32_t red = sensor.getRed();
+            uint32_t ir = sensor.getIR();
+            pairs.add(result, red, ir);
+        } else if (method == CHECK) {
+            waitForSamples(batch);
+            sensor.check();
+            while (sensor.available()) {
+                pairs.add(result, sensor.getFIFORed(), sensor.getFIFOIR());
+                sensor.nextSample();
+            }
+        } else {
+            uint32_t red[32], ir[32];
+            waitForSamples(batch);
+            uint8_t read = sensor.readFIFO(red, ir, 32);
+            for (int i = 0; i < read; i++) pairs.add(result, red[i], ir[i]);
+        }
+    }
+
+    result.samples = hostSensor.samplesRead - startRead;
+    result.transactions = hostI2CTransactions - startTransactions;
+    result.bytes = hostI2CBytes - startBytes;
+    return result;
+}
+
+static bool printResult(Method method, int wireBuffer, int batch, const Result &result) {
+    double per100 = 100.0 / result.samples;
+    double busSeconds = result.bytes * 22.5e-6;
+    double payloadRate = result.delivered * 6 / busSeconds;   // Red + IR, 3 bytes each
+    char batchText[8];
+    snprintf(batchText, sizeof(batchText), batch > 0 ? "%d" : "-", batch);
+
+    const char *verdict = "ok";
+    if (result.outOfOrder > 0 && result.splitPairs > 0) {
+        verdict = "red and IR from different samples, samples skipped";
+    } else if (result.outOfOrder > 0) {
+        verdict = "samples skipped or repeated";
+    } else if (result.splitPairs > 0) {
+        verdict = "red and IR from different samples";
+    }
+
+    printf("%-13s %6d B %5s  %8.1f  %8.0f  %7.1f ms  %8.0f B/s  %s\n",
+           METHOD_NAMES[method], wireBuffer, batchText, result.transactions * per100,
+           result.bytes * per100, busSeconds * per100 * 1000.0, payloadRate, verdict);
+
+    // getRed()/getIR() split pairs by design: each call waits for a new sample
+    return method == GET_RED_IR || (result.outOfOrder == 0 && result.splitPairs == 0);
+}
+
+// got must be expected, or within expected..most
+static bool expect(const char *name, int got, int expected, int most = -1) {
+    bool ok = most < 0 ? got == expected : got >= expected && got <= most;
+    printf("  %-52s %3d samples  %s\n", name, got, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+/*
+ * Full and empty FIFOs have equal pointers: check that each is read as
+ * what it is.
+ */
+static bool edgeCases() {
+    uint32_t red[32], ir[32];
+    MAX30105 sensor;
+    hostWireBuffer = SENSOR_I2C_BUFFER_SIZE;
+    setupSensor(sensor, SENSOR_I2C_BUFFER_SIZE);
+    long startOverruns = hostSensor.overruns;
+    bool passed = true;
+
+    printf("FIFO count edge cases\n");
+    waitForSamples(32);
+    int read = sensor.readFIFO(red, ir, 32);
+    bool consecutive = true;
+    for (int i = 1; i < read; i++) consecutive = consecutive && red[i] == ((red[i - 1] + 1) & 0x3FFFF);
+    passed = expect("readFIFO, 32 waiting (pointers equal, OVF 0)", read, 32) && consecutive && passed;
+    passed = expect("readFIFO again, none waiting", sensor.readFIFO(red, ir, 32), 0) && passed;
+
+    waitForSamples(SENSOR_FIFO_WATERMARK);
+    passed = expect("readFIFO at A_FULL", sensor.readFIFO(red, ir, 32), SENSOR_FIFO_WATERMARK) && passed;
+    sensor.getINT1();
+    passed = expect("readFIFO after getINT1(), none waiting", sensor.readFIFO(red, ir, 32), 0) && passed;
+
+    waitForSamples(32);
+    sensor.getINT1();           // As SensorManager::drainFIFO() before check()
+    passed = expect("check, 32 waiting, after getINT1()", sensor.check(), 32) && passed;
+
+    // The ring fills: the FIFO's 32 wait for room
+    waitForSamples(32);
+    sensor.check();
+    waitForSamples(32);
+    passed = expect("check, 32 waiting, ring full", sensor.check(), 0) && passed;
+    while (sensor.available()) sensor.nextSample();
+    passed = expect("check, 32 waiting, ring emptied", sensor.check(), 32) && passed;
+    passed = expect("check again, none waiting", sensor.check(), 0) && passed;
+
+    return passed && hostSensor.overruns == startOverruns;
+}
+
+/*
+ * getRed()/getIR() next to check() and nextSample().
+ */
+static bool mixedStyles() {
+    MAX30105 sensor;
+    hostWireBuffer = SENSOR_I2C_BUFFER_SIZE;
+    setupSensor(sensor, SENSOR_I2C_BUFFER_SIZE);
+    bool passed = true;
+
+    printf("latest-value getters\n");
+
+    // Only getRed(): the ring fills after MAX30105_STORAGE_SIZE samples,
+    // and the samples after it are read past the ring, which stays as it was
+    uint32_t previous = sensor.getRed();
+    uint32_t first = previous;
+    int fresh = 0;
+    for (int i = 0; i < 2 * MAX30105_STORAGE_SIZE; i++) {
+        uint32_t red = sensor.getRed();
+        if (red == ((previous + 1) & 0x3FFFF)) fresh++;
+        previous = red;
+    }
+    passed = expect("getRed() alone, new samples in 2 rings' worth", fresh, 2 * MAX30105_STORAGE_SIZE) && passed;
+    bool untouched = sensor.available() == MAX30105_STORAGE_SIZE && sensor.getFIFORed() == first;
+    passed = expect("getRed() alone, ring's tail left alone", untouched ? sensor.available() : 0,
+                    MAX30105_STORAGE_SIZE) && passed;
+
+    // A consumer of the ring lets it fill, then reads the latest value
+    while (sensor.available()) sensor.nextSample();
+    while (sensor.available() < MAX30105_STORAGE_SIZE) {
+        waitForSamples(SENSOR_FIFO_WATERMARK);
+        sensor.check();
+    }
+    uint32_t oldest = sensor.getFIFORed();
+    uint32_t newest = sensor.getRed();
+    bool kept = sensor.available() == MAX30105_STORAGE_SIZE && sensor.getFIFORed() == oldest &&
+                newest == ((oldest + MAX30105_STORAGE_SIZE - 1) & 0x3FFFF);
+    passed = expect("getRed() with a full ring, entries kept", kept ? sensor.available() : 0,
+                    MAX30105_STORAGE_SIZE) && passed;
+
+    // Entries taken in order, then the getters wait for new samples again
+    PairCheck pairs;
+    Result result = {0, 0, 0, 0, 0, 0};
+    while (sensor.available()) {
+        pairs.add(result, sensor.getFIFORed(), sensor.getFIFOIR());
+        sensor.nextSample();
+    }
+    passed = expect("ring consumed in order after getRed()", result.delivered - result.outOfOrder,
+                    MAX30105_STORAGE_SIZE) && passed;
+    int ahead = (sensor.getRed() - newest) & 0x3FFFF;
+    passed = expect("getRed() after, past the ring's newest by", ahead, 1, 32) && passed;
+
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    long count = 3200;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = atol(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-n samples]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    hostSensor.counterSamples = true;
+    hostSensor.countOverruns = true;
+    
+    printf("%ld samples per run, 400 kHz I2C, Red+IR (6 bytes per sample)\n", count);
+    printf("%-13s %8s %5s  %8s  %8s  %10s  %10s\n",
+           "method", "buffer", "batch", "trans/100", "bytes/100", "bus/100", "payload");
+
+    const int batches[] = {SENSOR_FIFO_WATERMARK, 32};
+    const int buffers[] = {32, SENSOR_I2C_BUFFER_SIZE};
+    bool passed = printResult(GET_RED_IR, 32, 0, run(GET_RED_IR, 32, 0, count));
+    for (Method method : {CHECK, READ_FIFO}) {
+        for (int buffer : buffers) {
+            for (int batch : batches) {
+                passed = printResult(method, buffer, batch, run(method, buffer, batch, count)) && passed;
+            }
+        }
+    }
+
+    printf("overruns: %ld\n", hostSensor.overruns.load());
+    passed = edgeCases() && passed;
+    passed = mixedStyles() && passed;
+    printf("sample checks: %s\n", passed && hostSensor.overruns == 0 ? "passed" : "FAILED");
+    return passed && hostSensor.overruns == 0 ? 0 : 1;
+}
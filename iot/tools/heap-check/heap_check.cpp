@@ -0,0 +1,261 @@
+/*
+ * heap_check.cpp - Heap Allocation Check of the Firmware's Network Cycles
+ *
+ * Builds the firmware (all of src/ but the .ino) on a Linux host and runs
+ * NetworkManager, StateMachine and the offline log against the host HAL's
+ * simulated cloud (iot/host), counting every malloc, calloc, realloc and
+ * operator new the firmware makes. The connection mode and payload format
+ * are those set in config.h.
+ *
+ * Each cycle is run CYCLES times:
+ *   measurement  a measurement uploaded while online
+ *   offline      a measurement stored while offline
+ *   timeout      a timeout notification sent while online
+ *   timeout-off  a timeout notification stored while offline
+ *   sync         reconnecting and uploading the stored backlog
+ *   config       a config response applied (webhook: both formats; HTTP:
+ *                a fetch from the stand-in server)
+ * Boot (NetworkManager::begin) is reported too: System.deviceID() returns
+ * a String once there.
+ *
+ * Reported per cycle: allocations in the first run and in the later runs,
+ * and bytes allocated. The run ends with the heap high-water mark: the most
+ * bytes the firmware had allocated at once.
+ *
+ * The flash log's FLASH_LOG_DIR is redirected to a temporary directory
+ * (host_log_dir.h).
+ * Allocations are counted by replacing malloc and friends, so do not build
+ * with a sanitizer.
+ *
+ * BUILD (from iot/tools/heap-check; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -DARDUINO=100 -I../../host -I../../src -I../../lib/SparkFun-MAX3010x/src \
+ *       heap_check.cpp ../../src/[a-z]*.cpp ../../lib/SparkFun-MAX3010x/src/[a-zA-Z]*.cpp -pthread -o heap-check
+ *
+ * USAGE:
+ *   ./heap-check [-v]     (-v prints the firmware's serial output)
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "host_log_dir.h"
+#include "led_controller.h"
+#include "network_manager.h"
+#include "sensor_manager.h"
+#include "state_machine.h"
+
+#define CYCLES 5
+
+// The firmware's globals, as in heart-track-iot.ino
+StateMachine stateMachine;
+SensorManager sensorManager;
+LEDController ledController;
+NetworkManager networkManager;
+
+// ============================================================================
+// Allocation counting
+// ============================================================================
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+extern "C" void __libc_free(void *pointer);
+
+static bool counting = false;
+static long allocations = 0;        // While counting
+static long allocatedBytes = 0;     // While counting
+static long bytesInUse = 0;         // Allocated while counting, not yet freed
+static long peakBytesInUse = 0;
+
+static void noteAllocation(void *pointer, size_t oldSize) {
+    if (!counting || pointer == nullptr) return;
+    long size = malloc_usable_size(pointer);
+    allocations++;
+    allocatedBytes += size;
+    bytesInUse += size - (long)oldSize;
+    peakBytesInUse = max(peakBytesInUse, bytesInUse);
+}
+
+extern "C" void *malloc(size_t size) {
+    void *pointer = __libc_malloc(size);
+    noteAllocation(pointer, 0);
+    return pointer;
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+    void *pointer = __libc_calloc(count, size);
+    noteAllocation(pointer, 0);
+    return pointer;
+}
+
+extern "C" void *realloc(void *pointer, size_t size) {
+    size_t oldSize = counting && pointer ? malloc_usable_size(pointer) : 0;
+    void *resized = __libc_realloc(pointer, size);
+    noteAllocation(resized, oldSize);
+    return resized;
+}
+
+extern "C" void free(void *pointer) {
+    if (counting && pointer != nullptr) bytesInUse -= malloc_usable_size(pointer);
+    __libc_free(pointer);
+}
+
+static void removeLog() {
+    char path[64];
+    for (int segment = 0; segment < FLASH_LOG_SEGMENTS; segment++) {
+        snprintf(path, sizeof(path), "%s/%02d.log", hostLogDirectory, segment);
+        ::unlink(path);
+    }
+    const char *files[] = {"cursor", "staged"};
+    for (const char *file : files) {
+        snprintf(path, sizeof(path), "%s/%s", hostLogDirectory, file);
+        ::unlink(path);
+    }
+    rmdir(hostLogDirectory);
+}
+
+// ============================================================================
+// Cycles
+// ============================================================================
+
+// Run the main loop for ms of simulated time
+static void run(unsigned long ms) {
+    for (unsigned long elapsed = 0; elapsed < ms; elapsed += 10) {
+        stateMachine.update();
+        ledController.update();
+        networkManager.update();
+        delay(10);
+    }
+}
+
+static void measure() {
+    MeasurementData data;
+    data.heartRate = 60 + rand() % 40;
+    data.spO2 = 94 + rand() % 6;
+    data.timestamp = Time.now();
+    data.valid = true;
+    data.confidence = 0.9f;
+    
+    stateMachine.setState(STATE_TRANSMITTING);
+    networkManager.transmitMeasurement(data);
+    run(3000);
+}
+
+static void measureOnline() {
+    hostOnline = true;
+    measure();
+}
+
+static void measureOffline() {
+    hostOnline = false;
+    measure();
+}
+
+static void timeoutOnline() {
+    hostOnline = true;
+    networkManager.sendTimeoutNotification();
+    run(3000);
+}
+
+static void timeoutOffline() {
+    hostOnline = false;
+    networkManager.sendTimeoutNotification();
+    run(1000);
+}
+
+// Store a backlog offline, then count only the reconnection
+static void prepareSync() {
+    hostOnline = false;
+    for (int i = 0; i < 40; i++) {
+        measure();
+        delay(60000);
+    }
+    timeoutOffline();
+    timeoutOffline();
+}
+
+static void syncBacklog() {
+    hostOnline = true;
+    run(30000);
+}
+
+static void config() {
+    hostOnline = true;
+    #if USE_WEBHOOK
+    Particle.deliver("hook-response/heartrate-getconfig/0", "{\"f\":900,\"s\":\"07:00\",\"e\":\"21:30\"}");
+    Particle.deliver("hook-response/heartrate-getconfig/0", hostConfigResponse);
+    #else
+    networkManager.fetchDeviceConfig();
+    run(3000);
+    #endif
+}
+
+struct Cycle {
+    const char *name;
+    void (*prepare)();
+    void (*cycle)();
+};
+
+int main(int argc, char **argv) {
+    hostVerbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    hostEpoch = 1760936400;
+    if (!hostMakeLogDirectory("heap-check")) return 1;
+    
+    printf("mode: %s, %s, offline log on %s\n", USE_WEBHOOK ? "webhook" : "direct HTTP",
+           COMPACT_MEASUREMENTS ? "compact records" : "JSON measurements",
+           OFFLINE_LOG_ON_FLASH ? "flash" : "EEPROM");
+    printf("%-12s %12s %12s %12s\n", "cycle", "first run", "later runs", "bytes");
+    
+    // glibc loads the time zone on the first strftime(); the device's C
+    // library does not, so load it before counting
+    tzset();
+    
+    counting = true;
+    stateMachine.begin();
+    networkManager.begin();
+    counting = false;
+    printf("%-12s %12ld %12s %12ld\n", "boot", allocations, "-", allocatedBytes);
+    run(10000);   // Initial config fetch
+    
+    const Cycle cycles[] = {
+        {"measurement", nullptr, measureOnline},
+        {"offline", nullptr, measureOffline},
+        {"timeout", nullptr, timeoutOnline},
+        {"timeout-off", nullptr, timeoutOffline},
+        {"sync", prepareSync, syncBacklog},
+        {"config", nullptr, config},
+    };
+    
+    bool ok = true;
+    for (const Cycle &cycle : cycles) {
+        long first = 0, later = 0, bytes = 0;
+        for (int i = 0; i < CYCLES; i++) {
+            stateMachine.scheduleNextMeasurement();
+            if (cycle.prepare) cycle.prepare();
+    
+            allocations = 0;
+            allocatedBytes = 0;
+            counting = true;
+            cycle.cycle();
+            counting = false;
+    
+            if (i == 0) first = allocations;
+            else later = max(later, allocations);
+            bytes += allocatedBytes;
+        }
+        printf("%-12s %12ld %12ld %12ld\n", cycle.name, first, later, bytes);
+        if (first > 0 || later > 0) ok = false;
+    }
+    
+    printf("cloud traffic: %d publishes, %d HTTP requests\n", hostPublishCount.load(), hostRequestCount.load());
+    printf("heap high-water mark: %ld bytes allocated at once\n", peakBytesInUse);
+    printf("allocations per cycle: %s\n", ok ? "none" : "FOUND");
+    
+    removeLog();
+    return ok ? 0 : 1;
+}
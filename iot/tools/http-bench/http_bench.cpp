@@ -0,0 +1,215 @@
+/*
+ * http_bench.cpp - Host Benchmark for the Persistent HTTP Connection
+ *
+ * Runs the firmware's non-blocking HttpConnection (src/http_connection.cpp)
+ * on a Linux host against a local stand-in server, driving it with
+ * connect / send / poll the way NetworkManager does, and comparing:
+ *   close      - a new TCP connection per request (the old behaviour)
+ *   keep-alive - one persistent connection, one request at a time
+ *   pipelined  - HTTP_MAX_PIPELINE requests sent before reading responses
+ * and checking that a chunked config response is read correctly and that
+ * an idle or server-closed connection is reopened. The longest single
+ * poll() call shows how long loop() would be held up on the device.
+ *
+ * The host HAL's socket TCPClient (iot/host/host_tcp.h) can add an
+ * emulated round-trip (-r ms) to each connect and each request/response
+ * exchange, which is where the device spends its time on WiFi.
+ *
+ * BUILD (from iot/tools/http-bench; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -DHOST_REAL_CLOCK=1 -DHOST_SOCKETS=1 -I../../host -I../../src \
+ *       http_bench.cpp ../../src/http_connection.cpp ../../src/config_parser.cpp -pthread -o http-bench
+ *
+ * USAGE:
+ *   node stand_in_server.js 4000 &
+ *   ./http-bench [-h host] [-p port] [-n requests] [-r rtt-ms] [-i idle-ms]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "config.h"
+#include "http_connection.h"
+
+static const char *PAYLOAD = "{\"deviceId\":\"e00fce68b0e2a4cd3a9b1234\",\"record\":\"AZNYPGlIYgNf\"}";
+
+struct Result {
+    int ok;
+    uint32_t connects;
+    double seconds;
+    double longestPollMs;   // Longest single poll() call: how long loop() would stall
+};
+
+static double elapsedSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * poll() once, tracking the longest call.
+ */
+static HttpEvent timedPoll(HttpConnection &connection, Result &result) {
+    auto start = std::chrono::steady_clock::now();
+    HttpEvent event = connection.poll();
+    double ms = elapsedSince(start) * 1000.0;
+    if (ms > result.longestPollMs) result.longestPollMs = ms;
+    return event;
+}
+
+/*
+ * One request driven the way NetworkManager drives its queue: connect if
+ * the connection cannot be reused, send, then poll until it completes.
+ * A stale connection error is retried once on a new connection. The
+ * response body goes to parser, if given.
+ * Returns the HTTP status, or 0 on failure.
+ */
+static int request(HttpConnection &connection, Result &result, const char *method, const char *path,
+                   const char *body, ConfigParser *parser = nullptr) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!connection.isReusable() && !connection.connect()) return 0;
+        if (!connection.send(method, path, body, parser)) return 0;
+    
+        HttpEvent event;
+        while ((event = timedPoll(connection, result)) == HTTP_BUSY) {}
+        if (event == HTTP_RESPONSE) return connection.getStatus();
+        if (!connection.isStale()) return 0;
+    }
+    return 0;
+}
+
+static Result runClose(const char *host, int port, int count) {
+    HttpConnection connection(host, port);
+    Result result = {0, 0, 0, 0};
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        if (request(connection, result, "POST", "/api/measurements", PAYLOAD) == 201) result.ok++;
+        connection.close();
+    }
+    result.seconds = elapsedSince(start);
+    result.connects = connection.getConnectCount();
+    return result;
+}
+
+static Result runKeepAlive(const char *host, int port, int count) {
+    HttpConnection connection(host, port);
+    Result result = {0, 0, 0, 0};
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        if (request(connection, result, "POST", "/api/measurements", PAYLOAD) == 201) result.ok++;
+    }
+    result.seconds = elapsedSince(start);
+    result.connects = connection.getConnectCount();
+    return result;
+}
+
+/*
+ * Send whenever the connection can take another request (up to
+ * HTTP_MAX_PIPELINE outstanding; poll() writes each one) and count
+ * responses as they complete.
+ */
+static Result runPipelined(const char *host, int port, int count) {
+    HttpConnection connection(host, port);
+    Result result = {0, 0, 0, 0};
+    auto start = std::chrono::steady_clock::now();
+    int sent = 0;
+    int done = 0;
+    while (done < count) {
+        if (connection.getPendingCount() == 0 && !connection.isReusable() && !connection.connect()) break;
+        if (sent < count && connection.canSend() &&
+            connection.send("POST", "/api/notifications", PAYLOAD)) {
+            sent++;
+        }
+    
+        HttpEvent event = timedPoll(connection, result);
+        if (event == HTTP_RESPONSE) {
+            if (connection.getStatus() == 201) result.ok++;
+            done++;
+        } else if (event == HTTP_ERROR) {
+            // Outstanding requests are lost; resend them on a new connection
+            sent = done;
+        }
+    }
+    result.seconds = elapsedSince(start);
+    result.connects = connection.getConnectCount();
+    return result;
+}
+
+static void printResult(const char *name, int count, const Result &result) {
+    printf("%-11s %5d/%-5d ok  %5u connections  %8.3f s  %8.3f ms/request  longest poll %.3f ms\n",
+           name, result.ok, count, (unsigned)result.connects, result.seconds,
+           result.seconds * 1000.0 / count, result.longestPollMs);
+}
+
+/*
+ * Chunked config response, then reuse after a short idle, then a reconnect
+ * after more than HTTP_KEEPALIVE_IDLE_MS idle. With -i, one more request
+ * after that idle time, for a server whose keep-alive timeout is shorter
+ * than HTTP_KEEPALIVE_IDLE_MS (it closes the connection while we wait).
+ */
+static bool checkReuse(const char *host, int port, unsigned long serverIdleMs) {
+    HttpConnection connection(host, port);
+    Result result = {0, 0, 0, 0};
+    bool passed = true;
+    
+    ConfigParser parser;
+    int status = request(connection, result, "GET", "/api/devices/e00fce68b0e2a4cd3a9b1234/config", nullptr, &parser);
+    bool bodyOk = parser.isComplete() && strcmp(parser.getEndTime(), "22:00") == 0;
+    printf("config (chunked): status %d, body %s\n", status, bodyOk ? "complete" : "INCOMPLETE");
+    passed = passed && status == 200 && bodyOk;
+    
+    delay(500);
+    request(connection, result, "POST", "/api/measurements", PAYLOAD);
+    printf("after 0.5 s idle: %u connection(s) (expect 1)\n", (unsigned)connection.getConnectCount());
+    passed = passed && connection.getConnectCount() == 1;
+    
+    delay(HTTP_KEEPALIVE_IDLE_MS + 200);
+    status = request(connection, result, "POST", "/api/measurements", PAYLOAD);
+    printf("after %.1f s idle: status %d, %u connection(s) (expect 2)\n",
+           (HTTP_KEEPALIVE_IDLE_MS + 200) / 1000.0, status, (unsigned)connection.getConnectCount());
+    passed = passed && status == 201 && connection.getConnectCount() == 2;
+    
+    if (serverIdleMs > 0) {
+        delay(serverIdleMs);
+        status = request(connection, result, "POST", "/api/measurements", PAYLOAD);
+        printf("after %.1f s idle: status %d, %u connection(s)\n",
+               serverIdleMs / 1000.0, status, (unsigned)connection.getConnectCount());
+        passed = passed && status == 201;
+    }
+    
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1";
+    int port = 4000;
+    int count = 200;
+    unsigned long serverIdleMs = 0;
+    hostVerbose = true;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            emulatedRttMs = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            serverIdleMs = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+            host = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-n requests] [-r rtt-ms] [-i idle-ms]\n", argv[0]);
+            return 2;
+        }
+    }
+    
+    printf("%d requests to %s:%d, emulated RTT %lu ms\n", count, host, port, emulatedRttMs);
+    printResult("close", count, runClose(host, port, count));
+    printResult("keep-alive", count, runKeepAlive(host, port, count));
+    printResult("pipelined", count, runPipelined(host, port, count));
+    
+    bool passed = checkReuse(host, port, serverIdleMs);
+    printf("reuse checks: %s\n", passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+/**
+ * Stand-in API server for http-bench
+ *
+ * Answers the device endpoints the way the API server does, without a
+ * database, so the firmware's HTTP client can be measured on the host:
+ *   POST /api/measurements, /api/measurements/batch,
+ *        /api/measurements/waveform, /api/notifications  -> 201, Content-Length
+ *   GET  /api/devices/:deviceId/config                  -> 200, chunked
+ *
+ * Usage: node stand_in_server.js [port] [keepAliveTimeoutMs] [latencyMs]
+ * Prints connection and request counts on exit (Ctrl+C).
+ */
+
+const http = require('node:http');
+
+const port = Number(process.argv[2] ?? 4000);
+const keepAliveTimeout = Number(process.argv[3] ?? 5000); // Node's default
+const latency = Number(process.argv[4] ?? 0);
+
+let connections = 0;
+let requests = 0;
+
+const server = http.createServer((req, res) => {
+  requests++;
+  let body = '';
+  req.on('data', chunk => (body += chunk));
+  req.on('end', () => {
+    setTimeout(() => {
+      if (req.method === 'GET' && /^\/api\/devices\/[^/]+\/config$/.test(req.url)) {
+        // Written in two parts, so Node sends it chunked
+        res.writeHead(200, { 'Content-Type': 'application/json' });
+        res.write('{"success":true,"data":{"config":');
+        res.end('{"measurementFrequency":1800,"activeStartTime":"06:00","activeEndTime":"22:00","timezoneOffset":-7}}}');
+      } else if (req.method === 'POST') {
+        res.writeHead(201, { 'Content-Type': 'application/json' });
+        res.end(JSON.stringify({ success: true, data: { received: body.length } }));
+      } else {
+        res.writeHead(404, { 'Content-Type': 'application/json' });
+        res.end('{"success":false}');
+      }
+    }, latency);
+  });
+});
+
+server.keepAliveTimeout = keepAliveTimeout;
+server.on('connection', () => connections++);
+
+server.listen(port, () => {
+  console.log(`Stand-in API server on port ${port} (keep-alive ${keepAliveTimeout} ms, latency ${latency} ms)`);
+});
+
+for (const signal of ['SIGINT', 'SIGTERM']) {
+  process.on(signal, () => {
+    console.log(`connections: ${connections}, requests: ${requests}`);
+    process.exit(0);
+  });
+}
@@ -0,0 +1,418 @@
+/*
+ * log_sim.cpp - Host Simulation of the Offline Record Log
+ *
+ * Runs the firmware's RecordLog (src/record_log.cpp) on a Linux host over a
+ * simulated month of operation and compares its write traffic with the
+ * previous storage scheme, which rewrote all 48 measurement and 24 timeout
+ * slots plus their indices (976 bytes of EEPROM) on every store and every
+ * sync. The log uses the medium selected in config.h: with
+ * OFFLINE_LOG_ON_FLASH its segment files go to a temporary directory, with
+ * EEPROM the host HAL's EEPROM (iot/host) counts the writes to every byte.
+ *
+ * The device is prompted every 30 minutes from 06:00 to 22:00. A share of
+ * prompts time out (timeout notification instead of a measurement), and
+ * connectivity drops out for a few hours at a time. While offline, events
+ * are stored the way NetworkManager does it: measurements go into an open
+ * block of MEASUREMENT_BLOCK_SIZE (kept in the staging slot) that is
+ * appended to the log when it is full, timeouts are a record each. When back
+ * online the backlog is synced in batches of whole blocks (up to
+ * SYNC_BATCH_SIZE measurements) and one timeout per request. The device
+ * reboots every midnight, and the log is scanned again with begin().
+ *
+ * Reported per scheme:
+ *   bytes passed  bytes handed to EEPROM or file writes
+ *   bytes changed bytes whose value actually changed (EEPROM only)
+ *   max/byte      most writes to any single EEPROM byte (wear hot spot)
+ *   erases        segment erases (record log only)
+ * and checks that every stored measurement and timeout is synced once,
+ * oldest first. With -o 100 (never online) the pending count at the end
+ * shows how many measurements the log holds before dropping the oldest.
+ *
+ * BUILD (from iot/tools/log-sim; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -I../../host -I../../src log_sim.cpp ../../src/record_log.cpp \
+ *       ../../src/measurement_block.cpp -pthread -o log-sim
+ *
+ * USAGE:
+ *   ./log-sim [-d days] [-o offline-percent] [-t timeout-percent] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "config.h"
+#include "measurement_block.h"
+#include "record_log.h"
+
+#define LEGACY_MEASUREMENTS 48
+#define LEGACY_TIMEOUTS 24
+#define MEASUREMENT_INTERVAL 1800
+#define SYNC_BATCH_MAX_BYTES 720    // As in network_manager.h
+
+/*
+ * The previous scheme: fixed arrays saved in full by saveToEEPROM().
+ */
+class LegacyStore {
+public:
+    struct Measurement { float heartRate; float spO2; uint32_t timestamp; bool transmitted; };
+    struct Timeout { uint32_t timestamp; bool transmitted; };
+    
+    HostEEPROM eeprom;
+    uint64_t bytesPassed = 0;
+    
+    void storeMeasurement(uint32_t timestamp) {
+        if (count >= LEGACY_MEASUREMENTS) index = 0;
+        measurements[index] = {72.0f, 98.0f, timestamp, false};
+        index = (index + 1) % LEGACY_MEASUREMENTS;
+        if (count < LEGACY_MEASUREMENTS) count++;
+        save();
+    }
+    
+    void storeTimeout(uint32_t timestamp) {
+        if (timeoutCount >= LEGACY_TIMEOUTS) timeoutIndex = 0;
+        timeouts[timeoutIndex] = {timestamp, false};
+        timeoutIndex = (timeoutIndex + 1) % LEGACY_TIMEOUTS;
+        if (timeoutCount < LEGACY_TIMEOUTS) timeoutCount++;
+        save();
+    }
+    
+    // One save per synced batch of measurements
+    void syncMeasurements(int batch) {
+        while (count > 0) {
+            int synced = 0;
+            for (int i = 0; i < LEGACY_MEASUREMENTS && synced < batch; i++) {
+                if (measurements[i].transmitted || measurements[i].timestamp == 0) continue;
+                measurements[i].transmitted = true;
+                synced++;
+            }
+            count -= synced;
+            save();
+        }
+    }
+    
+    // One save per synced timeout
+    void syncTimeouts() {
+        for (int i = 0; i < LEGACY_TIMEOUTS && timeoutCount > 0; i++) {
+            if (timeouts[i].transmitted || timeouts[i].timestamp == 0) continue;
+            timeouts[i].transmitted = true;
+            timeoutCount--;
+            save();
+        }
+    }
+
+private:
+    Measurement measurements[LEGACY_MEASUREMENTS] = {};
+    Timeout timeouts[LEGACY_TIMEOUTS] = {};
+    int index = 0, count = 0, timeoutIndex = 0, timeoutCount = 0;
+    
+    template<class T> void put(int &address, const T &value) {
+        const uint8_t *bytes = (const uint8_t *)&value;
+        for (size_t i = 0; i < sizeof(T); i++, address++) {
+            if (eeprom.read(address) != bytes[i]) eeprom.write(address, bytes[i]);
+        }
+        bytesPassed += sizeof(T);
+    }
+    
+    void save() {
+        int address = EEPROM_LOG_ADDR;
+        put(address, index);
+        put(address, count);
+        for (int i = 0; i < LEGACY_MEASUREMENTS; i++) put(address, measurements[i]);
+        put(address, timeoutIndex);
+        put(address, timeoutCount);
+        for (int i = 0; i < LEGACY_TIMEOUTS; i++) put(address, timeouts[i]);
+    }
+};
+
+/*
+ * The record log, with the synced order checked against what was stored.
+ */
+struct LogRun {
+    static const int TIMEOUT_BYTES = 4;
+    
+    RecordLog *log = nullptr;
+    MeasurementBlock openBlock{MEASUREMENT_BLOCK_SIZE};
+    std::vector<uint32_t> openExpected;     // Timestamps in the open block
+    std::deque<std::vector<uint32_t>> expected[LOG_RECORD_TYPES];  // Per record stored, not yet synced
+    std::deque<uint32_t> appended[LOG_RECORD_TYPES];     // When each of those was appended
+    uint32_t appends = 0;
+    uint32_t stored[LOG_RECORD_TYPES] = {};
+    uint32_t synced[LOG_RECORD_TYPES] = {};
+    uint32_t dropped = 0;           // Measurements and timeouts lost
+    uint64_t bytesWritten = 0;      // By logs before the last reboot
+    #if OFFLINE_LOG_ON_FLASH
+    char directory[32] = "/tmp/log-sim-XXXXXX";
+    #endif
+    bool orderOk = true;
+    
+    void reboot() {
+        if (log) bytesWritten += log->getBytesWritten();
+        delete log;
+        #if OFFLINE_LOG_ON_FLASH
+        if (!log && !mkdtemp(directory)) {
+            perror("mkdtemp");
+            exit(1);
+        }
+        log = new RecordLog(directory);
+        #else
+        log = new RecordLog();
+        #endif
+        log->begin();
+        for (int type = 1; type < LOG_RECORD_TYPES; type++) {
+            if ((size_t)log->getPendingCount((LogRecordType)type) != expected[type].size()) orderOk = false;
+        }
+    
+        // The open block comes back from the staging slot
+        uint8_t block[MEASUREMENT_BLOCK_MAX_BYTES];
+        int length = log->readStaged(LOG_RECORD_MEASUREMENTS, block, sizeof(block));
+        if (!openBlock.load(block, length) && length > 0) orderOk = false;
+        if ((size_t)openBlock.getCount() != openExpected.size()) orderOk = false;
+    }
+    
+    void append(LogRecordType type, const uint8_t *payload, int length, const std::vector<uint32_t> &timestamps) {
+        uint32_t before = log->getDroppedCount();
+        log->append(type, payload, length);
+        expected[type].push_back(timestamps);
+        appended[type].push_back(appends++);
+    
+        // A full log drops the records appended first
+        for (uint32_t i = before; i < log->getDroppedCount(); i++) {
+            int oldest = appended[LOG_RECORD_MEASUREMENTS].empty() ? LOG_RECORD_TIMEOUT
+                       : appended[LOG_RECORD_TIMEOUT].empty() ? LOG_RECORD_MEASUREMENTS
+                       : appended[LOG_RECORD_MEASUREMENTS].front() < appended[LOG_RECORD_TIMEOUT].front()
+                       ? LOG_RECORD_MEASUREMENTS : LOG_RECORD_TIMEOUT;
+            dropped += expected[oldest].front().size();
+            expected[oldest].pop_front();
+            appended[oldest].pop_front();
+        }
+    }
+    
+    void sealOpenBlock() {
+        if (openBlock.getCount() == 0) return;
+        append(LOG_RECORD_MEASUREMENTS, openBlock.getBytes(), openBlock.getLength(), openExpected);
+        log->stage(LOG_RECORD_MEASUREMENTS, nullptr, 0);
+        openBlock.clear();
+        openExpected.clear();
+    }
+    
+    void storeMeasurement(const MeasurementData &data) {
+        if (!openBlock.add(data, MEASUREMENT_INTERVAL)) {
+            sealOpenBlock();
+            openBlock.add(data, MEASUREMENT_INTERVAL);
+        }
+        openExpected.push_back(data.timestamp);
+        stored[LOG_RECORD_MEASUREMENTS]++;
+    
+        if (openBlock.getCount() >= MEASUREMENT_BLOCK_SIZE) {
+            sealOpenBlock();
+        } else {
+            log->stage(LOG_RECORD_MEASUREMENTS, openBlock.getBytes(), openBlock.getLength());
+        }
+    }
+    
+    void storeTimeout(uint32_t timestamp) {
+        uint8_t payload[TIMEOUT_BYTES];
+        memcpy(payload, &timestamp, 4);
+        append(LOG_RECORD_TIMEOUT, payload, TIMEOUT_BYTES, {timestamp});
+        stored[LOG_RECORD_TIMEOUT]++;
+    }
+    
+    // Check a synced record against the oldest one stored
+    void check(LogRecordType type, const std::vector<uint32_t> &timestamps) {
+        if (expected[type].empty() || expected[type].front() != timestamps) orderOk = false;
+        if (!expected[type].empty()) {
+            expected[type].pop_front();
+            appended[type].pop_front();
+        }
+        synced[type] += timestamps.size();
+    }
+    
+    // Sync one batch of whole blocks; returns the number of measurements
+    int syncMeasurements() {
+        sealOpenBlock();
+    
+        int handles[SYNC_BATCH_SIZE];
+        int count = 0, measurements = 0, bytes = 1;
+        for (int handle = log->first(LOG_RECORD_MEASUREMENTS); handle >= 0;
+             handle = log->next(handle, LOG_RECORD_MEASUREMENTS)) {
+            uint8_t payload[RECORD_LOG_MAX_PAYLOAD];
+            int length = log->read(handle, payload, sizeof(payload));
+            MeasurementBlock block(255);
+            if (!block.load(payload, length)) {
+                orderOk = false;
+                break;
+            }
+            if (count > 0 && (measurements + block.getCount() > SYNC_BATCH_SIZE ||
+                              bytes + length > SYNC_BATCH_MAX_BYTES)) break;
+    
+            std::vector<uint32_t> timestamps;
+            MeasurementData data;
+            while (block.next(data)) timestamps.push_back(data.timestamp);
+            check(LOG_RECORD_MEASUREMENTS, timestamps);
+            handles[count++] = handle;
+            measurements += block.getCount();
+            bytes += length;
+        }
+        for (int i = 0; i < count; i++) {
+            if (!log->markDone(handles[i])) orderOk = false;
+        }
+        return measurements;
+    }
+    
+    // Sync the oldest timeout; returns whether there was one
+    bool syncTimeout() {
+        int handle = log->first(LOG_RECORD_TIMEOUT);
+        if (handle < 0) return false;
+        uint8_t payload[RECORD_LOG_MAX_PAYLOAD];
+        uint32_t timestamp;
+        log->read(handle, payload, sizeof(payload));
+        memcpy(&timestamp, payload, 4);
+        check(LOG_RECORD_TIMEOUT, {timestamp});
+        if (!log->markDone(handle)) orderOk = false;
+        return true;
+    }
+    
+    void syncAll() {
+        while (syncMeasurements() > 0) {}
+        while (syncTimeout()) {}
+    }
+    
+    int pendingMeasurements() {
+        int count = openExpected.size();
+        for (const std::vector<uint32_t> &timestamps : expected[LOG_RECORD_MEASUREMENTS]) count += timestamps.size();
+        return count;
+    }
+    
+    // Remove the segment files
+    void cleanup() {
+        #if OFFLINE_LOG_ON_FLASH
+        delete log;
+        log = nullptr;
+        for (int segment = 0; segment < OFFLINE_LOG_SEGMENTS; segment++) {
+            char path[64];
+            snprintf(path, sizeof(path), "%s/%02d.log", directory, segment);
+            unlink(path);
+        }
+        char path[64];
+        snprintf(path, sizeof(path), "%s/cursor", directory);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/staged", directory);
+        unlink(path);
+        rmdir(directory);
+        #endif
+    }
+};
+
+int main(int argc, char **argv) {
+    int days = 30;
+    int offlinePercent = 25;
+    int timeoutPercent = 10;
+    unsigned seed = 1;
+    hostVerbose = true;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            days = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            offlinePercent = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            timeoutPercent = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "usage: %s [-d days] [-o offline-percent] [-t timeout-percent] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> percent(0, 99);
+    
+    // Outages last 4 hours on average; they start often enough to be
+    // offline offlinePercent of the time (100: never online)
+    double recoverPerTick = offlinePercent >= 100 ? 0.0 : 1.0 / 8;   // Ticks are 30 minutes
+    double dropPerTick = offlinePercent >= 100 ? 1.0
+                       : recoverPerTick * offlinePercent / (100.0 - offlinePercent);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    
+    LegacyStore legacy;
+    LogRun run;
+    run.reboot();
+    
+    bool online = offlinePercent < 100;
+    uint32_t timestamp = 1760000000;
+    int prompts = 0;
+    
+    for (int day = 0; day < days; day++) {
+        for (int tick = 0; tick < 48; tick++, timestamp += 1800) {
+            online = online ? chance(random) >= dropPerTick : chance(random) < recoverPerTick;
+    
+            if (online) {
+                legacy.syncMeasurements(SYNC_BATCH_SIZE);
+                legacy.syncTimeouts();
+                run.syncAll();
+            }
+    
+            bool active = tick >= 12 && tick < 44;   // 06:00 - 22:00
+            if (!active) continue;
+            prompts++;
+    
+            bool timedOut = percent(random) < timeoutPercent;
+            if (online) continue;   // Sent live, nothing stored
+    
+            if (timedOut) {
+                legacy.storeTimeout(timestamp);
+                run.storeTimeout(timestamp);
+            } else {
+                // Taken after the user responds
+                MeasurementData data;
+                data.timestamp = timestamp + 20 + random() % 120;
+                data.heartRate = 72.0f;
+                data.spO2 = 98.0f;
+                data.valid = true;
+                data.confidence = 0.9f;
+                legacy.storeMeasurement(data.timestamp);
+                run.storeMeasurement(data);
+            }
+        }
+        run.reboot();
+    }
+    
+    uint16_t maxErases = 0;
+    uint32_t totalErases = 0;
+    for (int segment = 0; segment < OFFLINE_LOG_SEGMENTS; segment++) {
+        uint16_t erases = run.log->getSegmentEraseCount(segment);
+        totalErases += erases;
+        if (erases > maxErases) maxErases = erases;
+    }
+    
+    printf("%d days, %d prompts, %d%% offline, %d%% timeouts\n", days, prompts, offlinePercent, timeoutPercent);
+    printf("stored %u measurements and %u timeouts; synced %u and %u; dropped %u; %u and %u still pending\n",
+           run.stored[LOG_RECORD_MEASUREMENTS], run.stored[LOG_RECORD_TIMEOUT],
+           run.synced[LOG_RECORD_MEASUREMENTS], run.synced[LOG_RECORD_TIMEOUT], run.dropped,
+           run.pendingMeasurements(), (unsigned)run.expected[LOG_RECORD_TIMEOUT].size());
+    printf("%-22s %14s %14s %10s %8s\n", "", "bytes passed", "bytes changed", "max/byte", "erases");
+    printf("%-22s %14llu %14llu %10u %8s\n", "full rewrite (before)",
+           (unsigned long long)legacy.bytesPassed, (unsigned long long)legacy.eeprom.writes,
+           legacy.eeprom.maxCellWrites(), "-");
+    #if OFFLINE_LOG_ON_FLASH
+    printf("%-22s %14llu %14s %10s %8u\n", "record log (flash)",
+           (unsigned long long)(run.bytesWritten + run.log->getBytesWritten()), "-", "-", totalErases);
+    #else
+    printf("%-22s %14llu %14llu %10u %8u\n", "record log (EEPROM)",
+           (unsigned long long)EEPROM.writes, (unsigned long long)EEPROM.writes,
+           EEPROM.maxCellWrites(), totalErases);
+    #endif
+    printf("segment erases: %u max, %.1f mean over %d segments\n",
+           maxErases, (double)totalErases / OFFLINE_LOG_SEGMENTS, OFFLINE_LOG_SEGMENTS);
+    printf("sync order and counts: %s\n", run.orderOk ? "ok" : "MISMATCH");
+    
+    bool ok = run.orderOk;
+    run.cleanup();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,287 @@
+/*
+ * ppg_batch.cpp - Batch Re-analysis of Recorded PPG Traces
+ *
+ * Re-runs the on-device algorithms over a directory of recordings on a
+ * Linux host, using the firmware's own sources from lib/SparkFun-MAX3010x:
+ *   - maxim_heart_rate_and_oxygen_saturation (per window)
+ *   - checkForBeat (per sample)
+ *
+ * INPUT:
+ *   Every *.csv file in the input directory, one "red,ir" sample per line at
+ *   25 samples/s - the CSV format of tools/replay. Other lines (headers,
+ *   blanks) are skipped.
+ *
+ * OUTPUT:
+ *   <output-dir>/<name>.results.csv with one row per window:
+ *     window,start_sample,heart_rate,hr_valid,spo2,spo2_valid,beats
+ *   Windows are SPO2_WINDOW_SIZE samples every SPO2_HOP_SIZE samples, as on
+ *   the device. beats counts checkForBeat() detections in the samples that
+ *   entered with this window.
+ *
+ * THREADING:
+ *   Recordings are dealt round-robin, in name order, to one queue per
+ *   worker. A worker takes from the back of its own queue and, once that is
+ *   empty, steals from the front of the others, so a few long recordings do
+ *   not leave cores idle.
+ *   Each worker has its own algorithm contexts (maxim_spo2_context_t,
+ *   heartRateContext_t), so no algorithm state is shared.
+ *
+ * BUILD (from iot/tools/ppg-batch; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -pthread -DARDUINO=100 -I../../host -I../../src -I../../lib/SparkFun-MAX3010x/src \
+ *       ppg_batch.cpp ../../lib/SparkFun-MAX3010x/src/spo2_algorithm.cpp \
+ *       ../../lib/SparkFun-MAX3010x/src/heartRate.cpp -o ppg-batch
+ *
+ * USAGE:
+ *   ./ppg-batch <input-dir> <output-dir> [-j threads]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "spo2_algorithm.h"
+#include "heartRate.h"
+
+#if SPO2_WINDOW_SIZE > BUFFER_SIZE
+#error "SPO2_WINDOW_SIZE must be at most the algorithm BUFFER_SIZE"
+#endif
+
+namespace fs = std::filesystem;
+
+/*
+ * Per-worker counters for the throughput report.
+ */
+struct WorkerStats {
+    unsigned long recordings = 0;
+    unsigned long windows = 0;
+    unsigned long stolen = 0;           // Recordings taken from another worker
+    double busySeconds = 0;
+};
+
+/*
+ * WorkQueue - One worker's recordings (indices into the file list)
+ */
+class WorkQueue {
+public:
+    void push(size_t item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        items.push_back(item);
+    }
+    
+    // Owner end
+    bool pop(size_t &item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) return false;
+        item = items.back();
+        items.pop_back();
+        return true;
+    }
+    
+    // Thief end
+    bool steal(size_t &item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (items.empty()) return false;
+        item = items.front();
+        items.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<size_t> items;
+};
+
+/*
+ * Read a "red,ir" recording.
+ * Returns false if the file cannot be opened.
+ */
+static bool loadRecording(const fs::path &path,
+                          std::vector<spo2_sample_t> &red,
+                          std::vector<spo2_sample_t> &ir) {
+    FILE *file = fopen(path.c_str(), "r");
+    if (!file) return false;
+    
+    char line[128];
+    while (fgets(line, sizeof(line), file)) {
+        char *end;
+        unsigned long redValue = strtoul(line, &end, 10);
+        if (end == line || *end != ',') continue;
+    
+        char *irStart = end + 1;
+        unsigned long irValue = strtoul(irStart, &end, 10);
+        if (end == irStart) continue;
+    
+        red.push_back((spo2_sample_t)redValue);
+        ir.push_back((spo2_sample_t)irValue);
+    }
+    
+    fclose(file);
+    return true;
+}
+
+/*
+ * Analyse one recording and write its per-window results.
+ * Returns the number of windows, or -1 on an I/O error.
+ */
+static long processRecording(const fs::path &input, const fs::path &outputDir,
+                             maxim_spo2_context_t *spo2Context) {
+    std::vector<spo2_sample_t> red, ir;
+    if (!loadRecording(input, red, ir)) {
+        fprintf(stderr, "Cannot read %s\n", input.c_str());
+        return -1;
+    }
+    
+    fs::path outputPath = outputDir / (input.stem().string() + ".results.csv");
+    FILE *output = fopen(outputPath.c_str(), "w");
+    if (!output) {
+        fprintf(stderr, "Cannot write %s\n", outputPath.c_str());
+        return -1;
+    }
+    fprintf(output, "window,start_sample,heart_rate,hr_valid,spo2,spo2_valid,beats\n");
+    
+    // Beat detection runs over the continuous stream, like on the device
+    heartRateContext_t beatContext;
+    initHeartRateContext(&beatContext);
+    size_t beatPosition = 0;
+    
+    long windows = 0;
+    for (size_t start = 0; start + SPO2_WINDOW_SIZE <= ir.size(); start += SPO2_HOP_SIZE) {
+        size_t end = start + SPO2_WINDOW_SIZE;
+    
+        unsigned long beats = 0;
+        for (; beatPosition < end; beatPosition++) {
+            if (checkForBeat(&beatContext, ir[beatPosition])) beats++;
+        }
+    
+        int32_t spo2, heartRate;
+        int8_t validSPO2, validHeartRate;
+        maxim_heart_rate_and_oxygen_saturation_ring_ctx(spo2Context, &ir[start], &red[start],
+                                                        SPO2_WINDOW_SIZE, 0,
+                                                        &spo2, &validSPO2,
+                                                        &heartRate, &validHeartRate);
+    
+        fprintf(output, "%ld,%zu,%ld,%d,%ld,%d,%lu\n", windows, start,
+                (long)heartRate, validHeartRate, (long)spo2, validSPO2, beats);
+        windows++;
+    }
+    
+    fclose(output);
+    return windows;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: ppg-batch <input-dir> <output-dir> [-j threads]\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3 && argc != 5) {
+        usage();
+        return 2;
+    }
+    
+    fs::path inputDir = argv[1];
+    fs::path outputDir = argv[2];
+    unsigned threadCount = std::thread::hardware_concurrency();
+    if (argc == 5) {
+        if (strcmp(argv[3], "-j") != 0 || atoi(argv[4]) < 1) {
+            usage();
+            return 2;
+        }
+        threadCount = atoi(argv[4]);
+    }
+    if (threadCount == 0) threadCount = 1;
+    
+    std::error_code error;
+    std::vector<fs::path> recordings;
+    for (const auto &entry : fs::directory_iterator(inputDir, error)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".csv") {
+            recordings.push_back(entry.path());
+        }
+    }
+    if (error) {
+        fprintf(stderr, "Cannot list %s: %s\n", inputDir.c_str(), error.message().c_str());
+        return 1;
+    }
+    std::sort(recordings.begin(), recordings.end());   // The same deal every run
+    fs::create_directories(outputDir, error);
+    if (error) {
+        fprintf(stderr, "Cannot create %s: %s\n", outputDir.c_str(), error.message().c_str());
+        return 1;
+    }
+    
+    // Deal recordings round-robin, then let idle workers steal
+    std::vector<WorkQueue> queues(threadCount);
+    for (size_t i = 0; i < recordings.size(); i++) {
+        queues[i % threadCount].push(i);
+    }
+    
+    std::vector<WorkerStats> stats(threadCount);
+    std::atomic<bool> failed(false);
+    
+    auto worker = [&](unsigned id) {
+        maxim_spo2_context_t spo2Context;
+        WorkerStats &mine = stats[id];
+        size_t item;
+    
+        for (;;) {
+            bool found = queues[id].pop(item);
+            for (unsigned k = 1; !found && k < threadCount; k++) {
+                found = queues[(id + k) % threadCount].steal(item);
+                if (found) mine.stolen++;
+            }
+            // Nothing is queued after start-up, so empty everywhere means done
+            if (!found) return;
+    
+            auto started = std::chrono::steady_clock::now();
+            long windows = processRecording(recordings[item], outputDir, &spo2Context);
+            mine.busySeconds += std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - started).count();
+    
+            if (windows < 0) {
+                failed = true;
+                continue;
+            }
+            mine.recordings++;
+            mine.windows += windows;
+        }
+    };
+    
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned id = 0; id < threadCount; id++) {
+        threads.emplace_back(worker, id);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    double wallSeconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - started).count();
+    
+    // Throughput report
+    unsigned long totalWindows = 0;
+    for (unsigned id = 0; id < threadCount; id++) {
+        const WorkerStats &s = stats[id];
+        totalWindows += s.windows;
+        printf("worker %2u: %lu recordings (%lu stolen), %lu windows, %.0f windows/s\n",
+               id, s.recordings, s.stolen, s.windows,
+               s.busySeconds > 0 ? s.windows / s.busySeconds : 0.0);
+    }
+    
+    double perSecond = wallSeconds > 0 ? totalWindows / wallSeconds : 0.0;
+    printf("%zu recordings, %lu windows in %.3f s on %u threads\n",
+           recordings.size(), totalWindows, wallSeconds, threadCount);
+    printf("%.0f windows/s, %.0f windows/s per core\n", perSecond, perSecond / threadCount);
+    
+    return failed ? 1 : 0;
+}
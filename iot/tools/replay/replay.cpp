@@ -0,0 +1,268 @@
+/*
+ * replay.cpp - Recorded PPG Replay through the Firmware
+ *
+ * Builds the firmware (all of src/ but the .ino) on a Linux host and plays
+ * a recorded red/IR trace through it: the host HAL's MAX30102 (iot/host)
+ * takes its samples from the trace, and the firmware reads them over the
+ * fake I2C bus as it would the sensor's, through SensorManager::update(),
+ * the Spo2Estimator and the full StateMachine, with the tasks of
+ * heart-track-iot.ino on TaskScheduler. Traces from the fleet can so be
+ * replayed before and after an algorithm or buffer change.
+ *
+ * INPUT (host_trace.h):
+ *   A "red,ir" CSV at 25 samples/s (as ppg-batch reads), or at 100 Hz
+ *   with -r 100, or the binary format, which carries its rate. Recordings
+ *   above 25 samples/s are averaged down as the sensor's sample averaging
+ *   does (4 samples at 100 Hz).
+ *
+ * PACING:
+ *   By default the replay runs as fast as the host can: the clock is
+ *   simulated, and only I2C transfers move it. With -p it is paced to the
+ *   recording's own rate (100 Hz sampling, 25 samples/s out of the FIFO)
+ *   in real time.
+ *
+ * The trace plays from the first prompt for a finger (WAITING_FOR_USER).
+ * It pauses, and the sensor reads as if no finger were on, once a
+ * measurement is handed to NetworkManager or given up, and resumes at the
+ * next prompt: the time in between (MEASUREMENT_INTERVAL_MS) passes at
+ * once, in either mode. The replay ends with the trace.
+ *
+ * REPORTED:
+ *   Per measurement: its reading, the time from the measurement's start
+ *   (MEASURING) to the first valid reading, which completes it, and the
+ *   latency from finger placement to measurementComplete(). Finger
+ *   placement is taken from the trace: the first sample at or above
+ *   FINGER_THRESHOLD of the run of such samples the measurement ended in,
+ *   or the prompt if the trace resumed with a finger on. Overall: the
+ *   samples SensorManager::update() read and processed per second of its
+ *   host CPU time (the HAL's I2C stand-in included; the samples a paused
+ *   trace left in the FIFO count too), and the replay's speed against
+ *   real time.
+ * It exits non-zero if the trace cannot be read or no measurement
+ * completes.
+ *
+ * The flash log's FLASH_LOG_DIR is redirected to a temporary directory
+ * (host_log_dir.h).
+ *
+ * BUILD (from iot/tools/replay; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -DARDUINO=100 -I../../host -I../../src -I../../lib/SparkFun-MAX3010x/src \
+ *       replay.cpp ../../src/[a-z]*.cpp ../../lib/SparkFun-MAX3010x/src/[a-zA-Z]*.cpp -pthread -o replay
+ *
+ * USAGE:
+ *   ./replay <trace.csv|trace.ppg> [-r rate] [-p] [-o out.ppg] [-v]
+ *   -r  sample rate of a CSV trace, a multiple of 25 (default 25)
+ *   -p  pace the replay in real time
+ *   -o  also write the trace in the binary format
+ *   -v  print the firmware's serial output
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+#include "config.h"
+#include "host_log_dir.h"
+#include "host_trace.h"
+#include "led_controller.h"
+#include "network_manager.h"
+#include "sensor_manager.h"
+#include "state_machine.h"
+#include "task_scheduler.h"
+
+// The firmware's globals, as in heart-track-iot.ino
+StateMachine stateMachine;
+SensorManager sensorManager;
+LEDController ledController;
+NetworkManager networkManager;
+TaskScheduler scheduler;
+
+typedef std::chrono::steady_clock Clock;
+
+// Host CPU time spent in SensorManager::update()
+static Clock::duration sensorTime{};
+
+// ============================================================================
+// Tasks, as added in heart-track-iot.ino
+// ============================================================================
+
+static bool isMeasurementReady() {
+    return stateMachine.getCurrentState() == STATE_TRANSMITTING &&
+           sensorManager.isMeasurementComplete() && !networkManager.isTransmitting();
+}
+
+static void handOffMeasurement(void *context) {
+    if (isMeasurementReady()) {
+        MeasurementData data = sensorManager.getMeasurement();
+        networkManager.transmitMeasurement(data);
+    }
+}
+
+static unsigned long nextHandoff(void *context) {
+    return millis() + (isMeasurementReady() ? 0 : SCHEDULER_IDLE_WAKEUP);
+}
+
+static void updateSensor(void *context) {
+    Clock::time_point start = Clock::now();
+    sensorManager.update();
+    sensorTime += Clock::now() - start;
+}
+
+static void boot() {
+    ledController.begin();
+    if (!sensorManager.begin()) {
+        fprintf(stderr, "sensor model not found by the driver\n");
+        exit(1);
+    }
+    networkManager.begin();
+    stateMachine.begin();
+    
+    scheduler.addTask("state", nullptr, [](void *) { stateMachine.update(); },
+                      [](void *) { return stateMachine.getNextUpdate(); });
+    scheduler.addTask("sensor", nullptr, updateSensor, [](void *) { return sensorManager.getNextUpdate(); });
+    scheduler.addTask("handoff", nullptr, handOffMeasurement, nextHandoff);
+    scheduler.addTask("network", nullptr, [](void *) { networkManager.update(); },
+                      [](void *) { return networkManager.getNextUpdate(); });
+    scheduler.addTask("led", nullptr, [](void *) { ledController.update(); },
+                      [](void *) { return ledController.getNextUpdate(); });
+}
+
+// ============================================================================
+// Replay
+// ============================================================================
+
+/*
+ * Where the trace is in time: the sensor takes trace sample `index`
+ * (after averaging) at `due` µs, and one SAMPLE_PERIOD apart from there on
+ * while the trace plays.
+ */
+struct TraceClock {
+    size_t index;
+    uint64_t due;
+    
+    uint64_t timeOf(size_t sample) { return due + (uint64_t)(sample - index) * HostSensor::SAMPLE_PERIOD; }
+};
+
+int main(int argc, char **argv) {
+    int csvRate = 25;
+    bool paced = false;
+    const char *output = nullptr;
+    int option;
+    while ((option = getopt(argc, argv, "r:po:v")) != -1) {
+        switch (option) {
+            case 'r': csvRate = atoi(optarg); break;
+            case 'p': paced = true; break;
+            case 'o': output = optarg; break;
+            case 'v': hostVerbose = true; break;
+            default: csvRate = 0; break;
+        }
+    }
+    if (optind != argc - 1 || csvRate <= 0 || csvRate % 25 != 0) {
+        fprintf(stderr, "usage: %s <trace.csv|trace.ppg> [-r rate] [-p] [-o out.ppg] [-v]\n", argv[0]);
+        return 2;
+    }
+    
+    HostTrace trace;
+    if (!hostLoadTrace(argv[optind], trace, csvRate) || trace.rate % 25 != 0) {
+        fprintf(stderr, "%s: not a trace at a multiple of 25 samples/s\n", argv[optind]);
+        return 1;
+    }
+    if (output != nullptr && !hostSaveTrace(output, trace)) {
+        perror(output);
+        return 1;
+    }
+    
+    // The trace as the firmware sees it, 25 samples/s: where a finger is on
+    int average = trace.rate / 25;
+    size_t samples = trace.ir.size() / average;
+    std::vector<bool> finger(samples);
+    for (size_t i = 0; i < samples; i++) {
+        uint64_t sum = 0;
+        for (int k = 0; k < average; k++) sum += trace.ir[i * average + k];
+        finger[i] = sum / average >= FINGER_THRESHOLD;
+    }
+    printf("trace: %zu samples at %d samples/s (%.1f s), %s\n", trace.ir.size(), trace.rate,
+           samples / 25.0, paced ? "paced in real time" : "unlimited speed");
+    
+    if (!hostMakeLogDirectory("replay")) return 1;
+    hostWireBuffer = SENSOR_I2C_BUFFER_SIZE;    // As acquireWireBuffer() in the .ino
+    boot();
+    
+    Clock::time_point wallStart = Clock::now();
+    Clock::time_point paceStart = wallStart;
+    uint64_t paceFrom = 0;
+    TraceClock traceClock = {0, 0};
+    bool started = false;
+    unsigned long measureStart = 0;
+    int measurements = 0, completed = 0;
+    double totalFirstValid = 0, totalLatency = 0;
+    DeviceState last = stateMachine.getCurrentState();
+    
+    while (true) {
+        scheduler.run();
+    
+        if (paced && hostSensor.tracePlaying) {
+            std::this_thread::sleep_until(paceStart + std::chrono::microseconds(hostMicros() - paceFrom));
+        }
+    
+        DeviceState state = stateMachine.getCurrentState();
+        if (state != last) {
+            if (state == STATE_WAITING_FOR_USER && !hostSensor.tracePlaying) {
+                if (!started) hostSensor.play(&trace.red, &trace.ir, average);
+                hostSensor.tracePlaying = true;
+                started = true;
+                traceClock = {hostSensor.tracePoint() / average, hostSensor.nextDue()};
+                paceStart = Clock::now();
+                paceFrom = hostMicros();
+            }
+            if (state == STATE_MEASURING && last == STATE_WAITING_FOR_USER) {
+                measureStart = millis();
+                measurements++;
+            }
+            if (state == STATE_TRANSMITTING) {
+                // The run of finger-on samples the measurement ended in
+                size_t end = hostSensor.tracePoint() / average;
+                size_t placed = end;
+                while (placed > traceClock.index && finger[placed - 1]) placed--;
+                double firstValid = (millis() - measureStart) / 1000.0;
+                double latency = (hostMicros() - traceClock.timeOf(placed)) / 1e6;
+                MeasurementData result = sensorManager.getMeasurement();
+                printf("measurement %d: HR %.0f bpm, SpO2 %.0f%%, first valid reading %.2f s after the start, "
+                       "complete %.2f s after finger placement\n",
+                       measurements, result.heartRate, result.spO2, firstValid, latency);
+                totalFirstValid += firstValid;
+                totalLatency += latency;
+                completed++;
+            }
+            if (state == STATE_IDLE && (last == STATE_MEASURING || last == STATE_STABILIZING)) {
+                printf("measurement %d: failed\n", measurements);
+            }
+            if (state == STATE_TRANSMITTING || state == STATE_IDLE) hostSensor.tracePlaying = false;
+            last = state;
+        }
+    
+        if (started && hostSensor.traceLeft() == 0) break;
+    }
+    if (last == STATE_MEASURING || last == STATE_STABILIZING) {
+        printf("measurement %d: the trace ended first\n", measurements);
+    }
+    
+    double wall = std::chrono::duration<double>(Clock::now() - wallStart).count();
+    double cpu = std::chrono::duration<double>(sensorTime).count();
+    printf("%d of %d measurements complete", completed, measurements);
+    if (completed > 0) {
+        printf(", mean first valid reading %.2f s, mean finger-to-complete latency %.2f s",
+               totalFirstValid / completed, totalLatency / completed);
+    }
+    long samplesRead = hostSensor.samplesRead;
+    printf("\n%ld samples read and processed by SensorManager::update(), %.0f samples/s of host CPU time (%.3f s)\n",
+           samplesRead, cpu > 0 ? samplesRead / cpu : 0, cpu);
+    printf("replay took %.2f s for %.1f s of trace (%.1fx real time)\n", wall, samples / 25.0,
+           wall > 0 ? samples / 25.0 / wall : 0);
+    
+    hostRemoveLogDirectory();
+    return completed > 0 ? 0 : 1;
+}
@@ -0,0 +1,286 @@
+/*
+ * sched_sim.cpp - Task Latency and Jitter Simulation of loop()
+ *
+ * Builds the firmware (all of src/ but the .ino) on a Linux host and runs
+ * it against the host HAL's simulated clock, cloud and MAX30102 (iot/host)
+ * for a number of measurement cycles, in two modes:
+ *   loop       the previous loop(): every module's update() in a fixed
+ *              order, then delay(10)
+ *   scheduler  TaskScheduler with the tasks heart-track-iot.ino adds
+ * Each cycle waits for the state machine's prompt (MEASUREMENT_INTERVAL_MS
+ * apart), places a finger on the sensor FINGER_DELAY_MS later and takes it
+ * off once the measurement is handed to NetworkManager. The connection mode
+ * and sensor acquisition mode are those set in config.h.
+ *
+ * Reported per task: runs, runs with work due, latency (how long after its
+ * deadline the task ran: mean and max) and jitter (standard deviation of
+ * the latency). Deadlines are those the modules report (getNextUpdate());
+ * in loop mode a task's latency is taken at the first pass that finds it
+ * due, by the same rules as TaskScheduler. Also reported: passes, time
+ * asleep, I2C traffic, FIFO overruns while measuring, LED writes and the
+ * measurements uploaded.
+ *
+ * Only I2C transfers take simulated time (Wire.h); the firmware's own
+ * processing takes none. Latency here comes from deadlines falling between
+ * passes, I2C bursts ahead in the same pass and sleeps that overrun a
+ * deadline (in loop mode, the sensor interrupt; the scheduler's sleep ends
+ * at TaskScheduler::wake()).
+ *
+ * The flash log's FLASH_LOG_DIR is redirected to a temporary directory
+ * (host_log_dir.h).
+ *
+ * BUILD (from iot/tools/sched-sim; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -DARDUINO=100 -I../../host -I../../src -I../../lib/SparkFun-MAX3010x/src \
+ *       sched_sim.cpp ../../src/[a-z]*.cpp ../../lib/SparkFun-MAX3010x/src/[a-zA-Z]*.cpp -pthread -o sched-sim
+ *
+ * USAGE:
+ *   ./sched-sim [-c cycles] [-v]     (-v prints the firmware's serial output)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "host_log_dir.h"
+#include "led_controller.h"
+#include "network_manager.h"
+#include "sensor_manager.h"
+#include "state_machine.h"
+#include "task_scheduler.h"
+
+#define FINGER_DELAY_MS 3000
+#define LOOP_DELAY_MS 10
+
+// The firmware's globals, as in heart-track-iot.ino
+StateMachine stateMachine;
+SensorManager sensorManager;
+LEDController ledController;
+NetworkManager networkManager;
+TaskScheduler scheduler;
+
+// ============================================================================
+// Tasks, as added in heart-track-iot.ino
+// ============================================================================
+
+static bool isMeasurementReady() {
+    return stateMachine.getCurrentState() == STATE_TRANSMITTING &&
+           sensorManager.isMeasurementComplete() && !networkManager.isTransmitting();
+}
+
+static void handOffMeasurement(void *context) {
+    if (isMeasurementReady()) {
+        MeasurementData data = sensorManager.getMeasurement();
+        networkManager.transmitMeasurement(data);
+    }
+}
+
+static unsigned long nextHandoff(void *context) {
+    return millis() + (isMeasurementReady() ? 0 : SCHEDULER_IDLE_WAKEUP);
+}
+
+struct SimTask {
+    const char *name;
+    TaskScheduler::RunFunction run;
+    TaskScheduler::WakeupFunction wakeup;
+    
+    // Loop mode statistics
+    unsigned long deadline;
+    uint32_t dueRuns;
+    TaskStats stats;
+};
+
+static SimTask tasks[] = {
+    {"state", [](void *) { stateMachine.update(); }, [](void *) { return stateMachine.getNextUpdate(); }},
+    {"sensor", [](void *) { sensorManager.update(); }, [](void *) { return sensorManager.getNextUpdate(); }},
+    {"handoff", handOffMeasurement, nextHandoff},
+    {"network", [](void *) { networkManager.update(); }, [](void *) { return networkManager.getNextUpdate(); }},
+    {"led", [](void *) { ledController.update(); }, [](void *) { return ledController.getNextUpdate(); }},
+};
+static const int TASK_COUNT = sizeof(tasks) / sizeof(tasks[0]);
+
+// ============================================================================
+// Loop mode: the previous loop()
+// ============================================================================
+
+static uint32_t loopPasses = 0;
+static uint32_t loopSleepTime = 0;
+static unsigned long loopPassEnd = 0;
+
+/*
+ * One pass of the previous loop(). Every task runs; latency is recorded
+ * when one is due, as TaskScheduler::run() does.
+ */
+static void loopPass() {
+    loopPasses++;
+    
+    for (SimTask &task : tasks) {
+        unsigned long now = millis();
+        unsigned long deadline = task.wakeup(nullptr);
+        bool due = (long)(now - deadline) >= 0 || (long)(now - task.deadline) >= 0;
+    
+        if (due) {
+            if ((long)(now - task.deadline) >= 0) deadline = earliestDeadline(deadline, task.deadline);
+            if ((long)(deadline - loopPassEnd) < 0) deadline = loopPassEnd;
+            uint32_t latency = now - deadline;
+            task.dueRuns++;
+            task.stats.totalLatency += latency;
+            task.stats.squaredLatency += (uint64_t)latency * latency;
+            task.stats.maxLatency = max(task.stats.maxLatency, latency);
+        }
+        task.stats.runs++;
+        task.run(nullptr);
+    }
+    
+    for (SimTask &task : tasks) task.deadline = task.wakeup(nullptr);
+    loopPassEnd = millis();
+    
+    delay(LOOP_DELAY_MS);
+    loopSleepTime += LOOP_DELAY_MS;
+}
+
+// ============================================================================
+// Simulation
+// ============================================================================
+
+struct Results {
+    uint32_t cycles;
+    uint32_t measurements;          // Handed to NetworkManager
+    unsigned long elapsed;          // ms
+};
+
+/*
+ * Boot the firmware, as setup() does (without the cloud connection).
+ */
+static void boot(bool scheduled) {
+    ledController.begin();
+    ledController.setPattern(DEVICE_LED_SOLID_CYAN);
+    if (!sensorManager.begin()) {
+        fprintf(stderr, "sensor model not found by the driver\n");
+        exit(1);
+    }
+    networkManager.begin();
+    stateMachine.begin();
+    
+    for (SimTask &task : tasks) {
+        if (scheduled) scheduler.addTask(task.name, nullptr, task.run, task.wakeup);
+        task.deadline = millis();
+    }
+    ledController.setPattern(DEVICE_LED_OFF);
+    
+    scheduler.resetStats();
+    loopPassEnd = millis();
+}
+
+/*
+ * Run cycles measurement cycles: each ends when the state machine returns
+ * to IDLE after a measurement was handed off (or failed).
+ */
+static Results simulate(bool scheduled, int cycles) {
+    Results results = {};
+    unsigned long start = millis();
+    unsigned long fingerAt = 0;
+    DeviceState last = stateMachine.getCurrentState();
+    
+    while ((int)results.cycles < cycles) {
+        if (scheduled) scheduler.run();
+        else loopPass();
+    
+        DeviceState state = stateMachine.getCurrentState();
+        if (state != last) {
+            if (state == STATE_WAITING_FOR_USER) fingerAt = millis() + FINGER_DELAY_MS;
+            if (state == STATE_MEASURING) hostSensor.countOverruns = true;
+            if (state == STATE_TRANSMITTING) results.measurements++;
+            if (state == STATE_TRANSMITTING || state == STATE_IDLE) {
+                hostSensor.fingerOn = false;
+                hostSensor.countOverruns = false;
+                fingerAt = 0;
+            }
+            if (state == STATE_IDLE) results.cycles++;
+            last = state;
+        }
+    
+        if (fingerAt != 0 && (long)(millis() - fingerAt) >= 0) {
+            hostSensor.fingerOn = true;
+            fingerAt = 0;
+        }
+    }
+    
+    results.elapsed = millis() - start;
+    return results;
+}
+
+static void printTask(const char *name, uint32_t runs, uint32_t dueRuns, const TaskStats &stats) {
+    float mean = dueRuns > 0 ? (float)stats.totalLatency / dueRuns : 0;
+    float variance = dueRuns > 0 ? (float)stats.squaredLatency / dueRuns - mean * mean : 0;
+    printf("  %-10s %10lu %10lu %10.2f %8lu %10.2f\n", name, (unsigned long)runs, (unsigned long)dueRuns,
+           mean, (unsigned long)stats.maxLatency, variance > 0 ? sqrtf(variance) : 0);
+}
+
+static void run(bool scheduled, int cycles) {
+    boot(scheduled);
+    Results results = simulate(scheduled, cycles);
+    
+    printf("%s\n", scheduled ? "scheduler (TaskScheduler)" : "loop (fixed order, delay(10))");
+    printf("  %-10s %10s %10s %10s %8s %10s\n", "task", "runs", "due runs", "latency", "max", "jitter");
+    
+    for (int i = 0; i < TASK_COUNT; i++) {
+        if (scheduled) {
+            const TaskStats &stats = scheduler.getStats(i);
+            printTask(stats.name, stats.runs, stats.runs, stats);
+        } else {
+            printTask(tasks[i].name, tasks[i].stats.runs, tasks[i].dueRuns, tasks[i].stats);
+        }
+    }
+    
+    uint32_t passes = scheduled ? scheduler.getPassCount() : loopPasses;
+    uint32_t asleep = scheduled ? scheduler.getSleepTime() : loopSleepTime;
+    printf("  passes: %lu (%.1f per second), asleep %.1f%% of the time\n",
+           (unsigned long)passes, passes * 1000.0 / results.elapsed, asleep * 100.0 / results.elapsed);
+    printf("  I2C: %ld bytes (%.1f ms of bus time), %ld samples read, %ld FIFO overruns while measuring\n",
+           hostI2CBytes.load(), hostI2CBytes * 0.0225, hostSensor.samplesRead.load(), hostSensor.overruns.load());
+    printf("  LED writes: %d, measurements handed off: %lu of %lu cycles, %d publishes, %d HTTP requests\n\n",
+           hostColorWrites.load(), (unsigned long)results.measurements, (unsigned long)results.cycles,
+           hostPublishCount.load(), hostRequestCount.load());
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    int cycles = 5;
+    int option;
+    while ((option = getopt(argc, argv, "c:v")) != -1) {
+        switch (option) {
+            case 'c': cycles = atoi(optarg); break;
+            case 'v': hostVerbose = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-c cycles] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (!hostMakeLogDirectory("sched-sim")) return 1;
+    hostWireBuffer = SENSOR_I2C_BUFFER_SIZE;    // As acquireWireBuffer() in the .ino
+    
+    printf("mode: %s, sensor %s, %d measurement cycles %lu min apart\n\n",
+           USE_WEBHOOK ? "webhook" : "direct HTTP",
+           USE_SENSOR_INTERRUPT ? "A_FULL interrupt" : "polled", cycles,
+           (unsigned long)(MEASUREMENT_INTERVAL_MS / 60000));
+    fflush(stdout);
+    
+    // Each mode starts from a fresh firmware, in its own process
+    bool ok = true;
+    for (bool scheduled : {false, true}) {
+        pid_t child = fork();
+        if (child == 0) {
+            run(scheduled, cycles);
+            exit(0);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = false;
+    }
+    
+    hostRemoveLogDirectory();
+    return ok ? 0 : 1;
+}
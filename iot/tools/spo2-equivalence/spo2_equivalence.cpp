@@ -0,0 +1,532 @@
+/*
+ * spo2_equivalence.cpp - Spo2Estimator against the Original Maxim Algorithm
+ *
+ * Spo2Estimator (src/spo2_estimator.cpp) carries valley candidates, pulse
+ * ratios and sums from window to window instead of recomputing each
+ * window. This feeds it traces sample by sample and checks every window's
+ * heart rate, SpO2 and both valid flags against:
+ *   reference - maxim_heart_rate_and_oxygen_saturation() as the project
+ *               first had it from SparkFun (below, linear buffers, three
+ *               passes), with only the bounds fix in the peak search
+ *   ring      - the library's maxim_heart_rate_and_oxygen_saturation_ring()
+ *               over the estimator's own ring, which ppg-batch uses
+ *
+ * TRACES:
+ *   Generated ones (-t, default 200, from a fixed seed): pulses of 40 to
+ *   200 bpm, with AC amplitudes from a few counts (flat runs, thresholds
+ *   at their bounds) to thousands, noise, baseline drift and steps, a
+ *   finger taken off and put back, and stretches of a constant signal.
+ *   And any trace files given (host_trace.h), averaged to 25 samples/s
+ *   as the sensor does. The estimator is reset at the start of each trace
+ *   and, in the generated traces, now and then in between (a new
+ *   measurement).
+ *
+ * Also checks the bounds fix itself: a flat run that reaches the last
+ * sample is not a peak, whatever lies past the buffer; and that the ring
+ * function rejects window lengths outside MA4_SIZE+1 to BUFFER_SIZE.
+ * Windows are SPO2_WINDOW_SIZE; the reference only runs when that is
+ * BUFFER_SIZE, the one length the original handles.
+ *
+ * For scale it reports the host time per window, in a second pass over
+ * each trace: the estimator's, and that of what SensorManager ran before
+ * it (SampleWindow and the ring function), per-sample work included.
+ * It exits non-zero on any difference. Built with the wide pulse ratio
+ * kernel (spo2-equivalence-wide), windows where the reference's 32-bit
+ * AC x DC products wrap are counted apart: there the wide kernel's result
+ * is the right one.
+ *
+ * BUILD (from iot/tools/spo2-equivalence; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -DARDUINO=100 -I../../host -I../../src -I../../lib/SparkFun-MAX3010x/src \
+ *       spo2_equivalence.cpp ../../src/spo2_estimator.cpp ../../src/sample_window.cpp \
+ *       ../../lib/SparkFun-MAX3010x/src/spo2_algorithm.cpp -pthread -o spo2-equivalence
+ *   (add -DSPO2_KERNEL=SPO2_KERNEL_WIDE for spo2-equivalence-wide: the estimator and the ring
+ *   function through the 64-bit pulse ratio kernel, against the reference's int32 arithmetic)
+ *
+ * USAGE:
+ *   ./spo2-equivalence [-t traces] [-r rate] [trace.csv|trace.ppg ...]
+ *   -t  generated traces (default 200)
+ *   -r  sample rate of CSV traces, a multiple of 25 (default 25)
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <vector>
+
+#include "config.h"
+#include "host_trace.h"
+#include "spo2_algorithm.h"
+#include "sample_window.h"
+#include "spo2_estimator.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// ============================================================================
+// Reference: the original algorithm
+// ============================================================================
+
+/*
+ * maxim_peaks_above_min_height() as first imported, with the one change:
+ * the right edge of a flat run is not read past pn_x[n_size - 1].
+ */
+static void reference_peaks_above_min_height( int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height )
+{
+  int32_t i = 1, n_width;
+  *n_npks = 0;
+
+  while (i < n_size-1){
+    if (pn_x[i] > n_min_height && pn_x[i] > pn_x[i-1]){      // find left edge of potential peaks
+      n_width = 1;
+      while (i+n_width < n_size && pn_x[i] == pn_x[i+n_width])  // find flat peaks
+        n_width++;
+      if (i+n_width < n_size && pn_x[i] > pn_x[i+n_width] && (*n_npks) < 15 ){      // find right edge of peaks
+        pn_locs[(*n_npks)++] = i;
+        // for flat peaks, peak location is left edge
+        i += n_width+1;
+      }
+      else
+        i += n_width;
+    }
+    else
+      i++;
+  }
+}
+
+/*
+ * maxim_heart_rate_and_oxygen_saturation() as first imported, with its
+ * an_x/an_y on the stack. maxim_remove_close_peaks() and
+ * maxim_sort_ascend() are the library's, unchanged since. It also notes in
+ * referenceWrapped whether a pulse's 32-bit AC x DC products wrapped.
+ */
+static bool referenceWrapped;
+
+static void reference_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer, int32_t *pn_spo2, int8_t *pch_spo2_valid,
+                int32_t *pn_heart_rate, int8_t *pch_hr_valid)
+{
+  int32_t an_x[ BUFFER_SIZE]; //ir
+  int32_t an_y[ BUFFER_SIZE]; //red
+  uint32_t un_ir_mean;
+  int32_t k, n_i_ratio_count;
+  int32_t i, n_exact_ir_valley_locs_count, n_middle_idx;
+  int32_t n_th1, n_npks;
+  int32_t an_ir_valley_locs[15] ;
+  int32_t n_peak_interval_sum;
+
+  int32_t n_y_ac, n_x_ac;
+  int32_t n_spo2_calc;
+  int32_t n_y_dc_max, n_x_dc_max;
+  int32_t n_y_dc_max_idx = 0;
+  int32_t n_x_dc_max_idx = 0;
+  int32_t an_ratio[5], n_ratio_average;
+  int32_t n_nume, n_denom ;
+
+  // calculates DC mean and subtract DC from ir
+  un_ir_mean =0;
+  for (k=0 ; k<n_ir_buffer_length ; k++ ) un_ir_mean += pun_ir_buffer[k] ;
+  un_ir_mean =un_ir_mean/n_ir_buffer_length ;
+
+  // remove DC and invert signal so that we can use peak detector as valley detector
+  for (k=0 ; k<n_ir_buffer_length ; k++ )
+    an_x[k] = -1*(pun_ir_buffer[k] - un_ir_mean) ;
+
+  // 4 pt Moving Average
+  for(k=0; k< BUFFER_SIZE-MA4_SIZE; k++){
+    an_x[k]=( an_x[k]+an_x[k+1]+ an_x[k+2]+ an_x[k+3])/(int)4;
+  }
+  // calculate threshold
+  n_th1=0;
+  for ( k=0 ; k<BUFFER_SIZE ;k++){
+    n_th1 +=  an_x[k];
+  }
+  n_th1=  n_th1/ ( BUFFER_SIZE);
+  if( n_th1<30) n_th1=30; // min allowed
+  if( n_th1>60) n_th1=60; // max allowed
+
+  for ( k=0 ; k<15;k++) an_ir_valley_locs[k]=0;
+  // since we flipped signal, we use peak detector as valley detector
+  reference_peaks_above_min_height( an_ir_valley_locs, &n_npks, an_x, BUFFER_SIZE, n_th1 );
+  maxim_remove_close_peaks( an_ir_valley_locs, &n_npks, an_x, 4 );
+  n_npks = min( n_npks, 15 );
+  n_peak_interval_sum =0;
+  if (n_npks>=2){
+    for (k=1; k<n_npks; k++) n_peak_interval_sum += (an_ir_valley_locs[k] -an_ir_valley_locs[k -1] ) ;
+    n_peak_interval_sum =n_peak_interval_sum/(n_npks-1);
+    *pn_heart_rate =(int32_t)( (FreqS*60)/ n_peak_interval_sum );
+    *pch_hr_valid  = 1;
+  }
+  else  {
+    *pn_heart_rate = -999; // unable to calculate because # of peaks are too small
+    *pch_hr_valid  = 0;
+  }
+
+  //  load raw value again for SPO2 calculation : RED(=y) and IR(=X)
+  for (k=0 ; k<n_ir_buffer_length ; k++ )  {
+      an_x[k] =  pun_ir_buffer[k] ;
+      an_y[k] =  pun_red_buffer[k] ;
+  }
+
+  // find precise min near an_ir_valley_locs
+  n_exact_ir_valley_locs_count =n_npks;
+
+  //using exact_ir_valley_locs , find ir-red DC andir-red AC for SPO2 calibration an_ratio
+  //finding AC/DC maximum of raw
+
+  n_ratio_average =0;
+  n_i_ratio_count = 0;
+  for(k=0; k< 5; k++) an_ratio[k]=0;
+  for (k=0; k< n_exact_ir_valley_locs_count; k++){
+    if (an_ir_valley_locs[k] > BUFFER_SIZE ){
+      *pn_spo2 =  -999 ; // do not use SPO2 since valley loc is out of range
+      *pch_spo2_valid  = 0;
+      return;
+    }
+  }
+  // find max between two valley locations
+  // and use an_ratio betwen AC compoent of Ir & Red and DC compoent of Ir & Red for SPO2
+  for (k=0; k< n_exact_ir_valley_locs_count-1; k++){
+    n_y_dc_max= -16777216 ;
+    n_x_dc_max= -16777216;
+    if (an_ir_valley_locs[k+1]-an_ir_valley_locs[k] >3){
+        for (i=an_ir_valley_locs[k]; i< an_ir_valley_locs[k+1]; i++){
+          if (an_x[i]> n_x_dc_max) {n_x_dc_max =an_x[i]; n_x_dc_max_idx=i;}
+          if (an_y[i]> n_y_dc_max) {n_y_dc_max =an_y[i]; n_y_dc_max_idx=i;}
+      }
+      n_y_ac= (an_y[an_ir_valley_locs[k+1]] - an_y[an_ir_valley_locs[k] ] )*(n_y_dc_max_idx -an_ir_valley_locs[k]); //red
+      n_y_ac=  an_y[an_ir_valley_locs[k]] + n_y_ac/ (an_ir_valley_locs[k+1] - an_ir_valley_locs[k])  ;
+      n_y_ac=  an_y[n_y_dc_max_idx] - n_y_ac;    // subracting linear DC compoenents from raw
+      n_x_ac= (an_x[an_ir_valley_locs[k+1]] - an_x[an_ir_valley_locs[k] ] )*(n_x_dc_max_idx -an_ir_valley_locs[k]); // ir
+      n_x_ac=  an_x[an_ir_valley_locs[k]] + n_x_ac/ (an_ir_valley_locs[k+1] - an_ir_valley_locs[k]);
+      n_x_ac=  an_x[n_y_dc_max_idx] - n_x_ac;      // subracting linear DC compoenents from raw
+      int64_t ll_nume= (int64_t)n_y_ac *n_x_dc_max, ll_denom= (int64_t)n_x_ac *n_y_dc_max; // not in the original
+      if (ll_nume != (int32_t)ll_nume || ll_denom != (int32_t)ll_denom || (ll_nume >> 7) * 100 != (int32_t)((ll_nume >> 7) * 100))
+        referenceWrapped = true;
+      n_nume=( n_y_ac *n_x_dc_max)>>7 ; //prepare X100 to preserve floating value
+      n_denom= ( n_x_ac *n_y_dc_max)>>7;
+      if (n_denom>0  && n_i_ratio_count <5 &&  n_nume != 0)
+      {
+        an_ratio[n_i_ratio_count]= (n_nume*100)/n_denom ; //formular is ( n_y_ac *n_x_dc_max) / ( n_x_ac *n_y_dc_max) ;
+        n_i_ratio_count++;
+      }
+    }
+  }
+  // choose median value since PPG signal may varies from beat to beat
+  maxim_sort_ascend(an_ratio, n_i_ratio_count);
+  n_middle_idx= n_i_ratio_count/2;
+
+  if (n_middle_idx >1)
+    n_ratio_average =( an_ratio[n_middle_idx-1] +an_ratio[n_middle_idx])/2; // use median
+  else
+    n_ratio_average = an_ratio[n_middle_idx ];
+
+  if( n_ratio_average>2 && n_ratio_average <184){
+    n_spo2_calc= uch_spo2_table[n_ratio_average] ;
+    *pn_spo2 = n_spo2_calc ;
+    *pch_spo2_valid  = 1;
+  }
+  else{
+    *pn_spo2 =  -999 ; // do not use SPO2 since signal an_ratio is out of range
+    *pch_spo2_valid  = 0;
+  }
+}
+
+// ============================================================================
+// Traces
+// ============================================================================
+
+// xorshift64*, so every run generates the same traces
+static uint64_t rngState = 0x2545F4914F6CDD1DULL;
+
+static double uniform() {
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return (double)((rngState * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+static double between(double low, double high) {
+    return low + (high - low) * uniform();
+}
+
+static uint32_t clampSample(double value) {
+    if (value < 0) return 0;
+    if (value > 0x3FFFF) return 0x3FFFF;
+    return (uint32_t)value;
+}
+
+/*
+ * One generated trace: stretches of a few seconds to a minute, each a
+ * pulse, no finger, or a constant signal, at 25 samples/s.
+ */
+static void generate(HostTrace &trace, int seconds) {
+    trace.red.clear();
+    trace.ir.clear();
+    trace.rate = 25;
+    double phase = 0;
+    while ((int)trace.ir.size() < seconds * 25) {
+        int length = (int)between(3, 60) * 25;
+        double kind = uniform();
+        double bpm = between(40, 200);
+        double dc = between(5000, 230000);
+        double ac = exp(between(log(2.0), log(6000.0)));
+        double noise = uniform() < 0.3 ? 0 : between(0, ac / 4 + 2);
+        double drift = between(-40, 40);            // Counts per sample
+        double redScale = between(0.4, 1.2);
+        for (int i = 0; i < length; i++) {
+            double ir, red;
+            if (kind < 0.7) {                       // A pulse
+                phase += bpm / 60.0 / 25.0;
+                double beat = phase - floor(phase);
+                double pulse = exp(-pow(beat - 0.2, 2) / 0.01) + 0.3 * exp(-pow(beat - 0.5, 2) / 0.005);
+                ir = dc + drift * i - ac * pulse + between(-noise, noise);
+                red = dc * 0.8 + drift * i * 0.8 - ac * redScale * pulse + between(-noise, noise);
+            } else if (kind < 0.85) {               // No finger
+                ir = between(500, 3000);
+                red = between(400, 2500);
+            } else {                                // Constant, or a slow ramp
+                ir = dc + (kind < 0.92 ? 0 : floor(i / 7.0));
+                red = dc * 0.8;
+            }
+            trace.ir.push_back(clampSample(ir));
+            trace.red.push_back(clampSample(red));
+        }
+    }
+}
+
+// ============================================================================
+// Comparison
+// ============================================================================
+
+struct Totals {
+    long windows = 0;
+    long validHeartRates = 0;
+    long mismatches = 0;
+    long wrapped = 0;               // Windows where the reference's 32-bit products wrap
+    long mismatchesWrapped = 0;     // ...and the wide kernel differs there
+    long timedWindows = 0;
+    Clock::duration estimatorTime{};
+    Clock::duration ringTime{};
+};
+
+static bool same(int32_t hr1, int8_t hrValid1, int32_t spo21, int8_t spo2Valid1,
+                 int32_t hr2, int8_t hrValid2, int32_t spo22, int8_t spo2Valid2) {
+    return hr1 == hr2 && hrValid1 == hrValid2 && spo21 == spo22 && spo2Valid1 == spo2Valid2;
+}
+
+/*
+ * Feed one trace (25 samples/s) to the estimator and check every window.
+ * resetChance is the chance per sample of starting a new measurement.
+ */
+static void compare(const char *name, const std::vector<uint32_t> &red, const std::vector<uint32_t> &ir,
+                    double resetChance, Spo2Estimator &estimator, Totals &totals) {
+    estimator.reset();
+    std::vector<uint32_t> redWindow, irWindow;      // Since the last reset
+    
+    for (size_t n = 0; n < ir.size(); n++) {
+        if (resetChance > 0 && uniform() < resetChance) {
+            estimator.reset();
+            redWindow.clear();
+            irWindow.clear();
+        }
+        redWindow.push_back(red[n]);
+        irWindow.push_back(ir[n]);
+    
+        if (!estimator.addSample(red[n], ir[n])) continue;
+    
+        // The window as a linear copy for the reference
+        uint32_t redLinear[SPO2_WINDOW_SIZE], irLinear[SPO2_WINDOW_SIZE];
+        size_t first = irWindow.size() - SPO2_WINDOW_SIZE;
+        for (int k = 0; k < SPO2_WINDOW_SIZE; k++) {
+            redLinear[k] = redWindow[first + k];
+            irLinear[k] = irWindow[first + k];
+        }
+    
+        // The ring function over the same window, laid out as the estimator's ring
+        uint32_t redRing[SPO2_WINDOW_SIZE], irRing[SPO2_WINDOW_SIZE];
+        int start = irWindow.size() % SPO2_WINDOW_SIZE;
+        for (int k = 0; k < SPO2_WINDOW_SIZE; k++) {
+            redRing[(start + k) % SPO2_WINDOW_SIZE] = redLinear[k];
+            irRing[(start + k) % SPO2_WINDOW_SIZE] = irLinear[k];
+        }
+        int32_t ringHR, ringSpO2;
+        int8_t ringHRValid, ringSpO2Valid;
+        maxim_heart_rate_and_oxygen_saturation_ring(irRing, redRing, SPO2_WINDOW_SIZE, start,
+                                                    &ringSpO2, &ringSpO2Valid, &ringHR, &ringHRValid);
+    
+        // The original only takes windows of BUFFER_SIZE; with another
+        // SPO2_WINDOW_SIZE the estimator is checked against the ring alone
+        int32_t hr = ringHR, spo2 = ringSpO2;
+        int8_t hrValid = ringHRValid, spo2Valid = ringSpO2Valid;
+        referenceWrapped = false;
+        #if SPO2_WINDOW_SIZE == BUFFER_SIZE
+        reference_heart_rate_and_oxygen_saturation(irLinear, BUFFER_SIZE, redLinear, &spo2, &spo2Valid, &hr, &hrValid);
+        #endif
+    
+        totals.windows++;
+        if (hrValid) totals.validHeartRates++;
+        if (referenceWrapped) totals.wrapped++;
+        bool estimatorSame = same(estimator.getHeartRate(), estimator.isHeartRateValid(), estimator.getSpO2(),
+                                  estimator.isSpO2Valid(), hr, hrValid, spo2, spo2Valid);
+        bool ringSame = same(ringHR, ringHRValid, ringSpO2, ringSpO2Valid, hr, hrValid, spo2, spo2Valid);
+        if (estimatorSame && ringSame) continue;
+        #if SPO2_KERNEL == SPO2_KERNEL_WIDE
+        // Where the original wraps, the wide kernel's ratio is the right one
+        if (referenceWrapped) {
+            totals.mismatchesWrapped++;
+            continue;
+        }
+        #endif
+        if (totals.mismatches++ < 10) {
+            printf("%s, window ending at sample %zu: reference HR %ld (%d) SpO2 %ld (%d), "
+                   "estimator HR %ld (%d) SpO2 %ld (%d), ring HR %ld (%d) SpO2 %ld (%d)\n",
+                   name, n, (long)hr, hrValid, (long)spo2, spo2Valid,
+                   (long)estimator.getHeartRate(), estimator.isHeartRateValid(), (long)estimator.getSpO2(),
+                   estimator.isSpO2Valid(), (long)ringHR, ringHRValid, (long)ringSpO2, ringSpO2Valid);
+        }
+    }
+}
+
+/*
+ * Host time over a whole trace, without resets: the estimator, and what
+ * SensorManager did before it (SampleWindow and the ring function).
+ */
+static void timeTrace(const std::vector<uint32_t> &red, const std::vector<uint32_t> &ir,
+                      Spo2Estimator &estimator, Totals &totals) {
+    estimator.reset();
+    Clock::time_point start = Clock::now();
+    for (size_t n = 0; n < ir.size(); n++) estimator.addSample(red[n], ir[n]);
+    totals.estimatorTime += Clock::now() - start;
+    
+    static SampleWindow window;
+    window.reset();
+    int32_t hr, spo2;
+    int8_t hrValid, spo2Valid;
+    start = Clock::now();
+    for (size_t n = 0; n < ir.size(); n++) {
+        if (!window.push(red[n], ir[n])) continue;
+        maxim_heart_rate_and_oxygen_saturation_ring(window.getIR(), window.getRed(), window.getSize(),
+                                                    window.getStart(), &spo2, &spo2Valid, &hr, &hrValid);
+        totals.timedWindows++;
+    }
+    totals.ringTime += Clock::now() - start;
+}
+
+/*
+ * A flat run up to the last sample has no right edge: no peak, even with
+ * a lower value just past the buffer (which the unfixed search read).
+ */
+static bool checkBounds() {
+    int32_t x[7] = {0, 10, 40, 50, 50, 50, 0};
+    int32_t locs[15], count, referenceCount;
+    maxim_peaks_above_min_height(locs, &count, x, 6, 30);
+    reference_peaks_above_min_height(locs, &referenceCount, x, 6, 30);
+    
+    // And with a right edge inside the buffer, the peak is found
+    int32_t y[7] = {0, 10, 40, 50, 50, 20, 0};
+    int32_t edgeCount;
+    maxim_peaks_above_min_height(locs, &edgeCount, y, 6, 30);
+    bool ok = count == 0 && referenceCount == 0 && edgeCount == 1 && locs[0] == 3;
+    printf("flat run to the last sample: %s\n", ok ? "no peak" : "FOUND A PEAK (or missed the edge)");
+    return ok;
+}
+
+/*
+ * The ring function takes its window length from n_ring_size, and gives
+ * no result for lengths it has no room for or cannot average.
+ */
+static bool checkRingSizes() {
+    static uint32_t red[BUFFER_SIZE + 1], ir[BUFFER_SIZE + 1];
+    const int32_t sizes[] = {MA4_SIZE, BUFFER_SIZE + 1};
+    bool ok = true;
+    for (int32_t size : sizes) {
+        int32_t hr = 0, spo2 = 0;
+        int8_t hrValid = 1, spo2Valid = 1;
+        maxim_heart_rate_and_oxygen_saturation_ring(ir, red, size, 0, &spo2, &spo2Valid, &hr, &hrValid);
+        ok = ok && hr == -999 && !hrValid && spo2 == -999 && !spo2Valid;
+    }
+    printf("ring of %d or %d samples: %s\n", MA4_SIZE, BUFFER_SIZE + 1, ok ? "rejected" : "NOT REJECTED");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int traces = 200;
+    int csvRate = 25;
+    int option;
+    while ((option = getopt(argc, argv, "t:r:")) != -1) {
+        switch (option) {
+            case 't': traces = atoi(optarg); break;
+            case 'r': csvRate = atoi(optarg); break;
+            default: traces = -1; break;
+        }
+    }
+    if (traces < 0 || csvRate <= 0 || csvRate % 25 != 0) {
+        fprintf(stderr, "usage: %s [-t traces] [-r rate] [trace.csv|trace.ppg ...]\n", argv[0]);
+        return 2;
+    }
+    
+    printf("pulse ratio kernel: %s\n", SPO2_KERNEL == SPO2_KERNEL_WIDE ? "wide" : "scalar");
+    bool ok = checkBounds();
+    ok = checkRingSizes() && ok;
+    static Spo2Estimator estimator;
+    
+    Totals generated;
+    HostTrace trace;
+    for (int t = 0; t < traces; t++) {
+        generate(trace, 300);
+        char name[32];
+        snprintf(name, sizeof(name), "generated trace %d", t + 1);
+        compare(name, trace.red, trace.ir, 1.0 / 2000, estimator, generated);
+        timeTrace(trace.red, trace.ir, estimator, generated);
+    }
+    printf("generated: %d traces, %ld windows (%ld with a heart rate), %ld differ\n", traces, generated.windows,
+           generated.validHeartRates, generated.mismatches);
+    printf("  %ld windows where the reference's 32-bit products wrap, %ld differ there (wide kernel only)\n",
+           generated.wrapped, generated.mismatchesWrapped);
+    
+    Totals files;
+    for (int i = optind; i < argc; i++) {
+        if (!hostLoadTrace(argv[i], trace, csvRate) || trace.rate % 25 != 0) {
+            fprintf(stderr, "%s: not a trace at a multiple of 25 samples/s\n", argv[i]);
+            return 1;
+        }
+        // As the sensor's sample averaging
+        int average = trace.rate / 25;
+        std::vector<uint32_t> red, ir;
+        for (size_t n = 0; n + average <= trace.ir.size(); n += average) {
+            uint64_t redSum = 0, irSum = 0;
+            for (int k = 0; k < average; k++) {
+                redSum += trace.red[n + k];
+                irSum += trace.ir[n + k];
+            }
+            red.push_back(redSum / average);
+            ir.push_back(irSum / average);
+        }
+        long before = files.windows;
+        compare(argv[i], red, ir, 0, estimator, files);
+        timeTrace(red, ir, estimator, files);
+        printf("%s: %ld windows\n", argv[i], files.windows - before);
+    }
+    if (optind < argc) {
+        printf("trace files: %ld windows (%ld with a heart rate), %ld differ\n", files.windows,
+               files.validHeartRates, files.mismatches);
+        printf("  %ld windows where the reference's 32-bit products wrap, %ld differ there (wide kernel only)\n",
+               files.wrapped, files.mismatchesWrapped);
+    }
+    
+    long windows = generated.windows + files.windows;
+    long timed = generated.timedWindows + files.timedWindows;
+    double estimatorTime = std::chrono::duration<double, std::nano>(generated.estimatorTime + files.estimatorTime).count();
+    double ringTime = std::chrono::duration<double, std::nano>(generated.ringTime + files.ringTime).count();
+    if (timed > 0) {
+        printf("host time per window (%d samples in and a result out): estimator %.0f ns, "
+               "SampleWindow and the ring function %.0f ns\n",
+               SPO2_HOP_SIZE, estimatorTime / timed, ringTime / timed);
+    }
+    
+    ok = ok && generated.mismatches == 0 && files.mismatches == 0 && windows > 0;
+    printf("equivalence: %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,246 @@
+/*
+ * spo2_kernel_bench.cpp - Host Benchmark for the SpO2 Pulse Ratio Kernels
+ *
+ * maxim_valley_pair_ratio() works out the red/IR ratio of one pulse, the
+ * only step left that reads every sample between two valleys each time a
+ * pulse is new (Spo2Estimator keeps the result while both valleys stay in
+ * the window). SPO2_KERNEL selects its kernel at compile time:
+ *   scalar - maxim_valley_pair_ratio_scalar(), the original int32
+ *            arithmetic (the default everywhere)
+ *   wide   - maxim_valley_pair_ratio_wide(): maxima over linear runs of
+ *            the ring, a reciprocal instead of two divisions, 64-bit
+ *            products
+ * Both are always built, so this runs them side by side on the same
+ * pulses: every pulse of 4 to 50 samples (30 to 375 bpm) starting at every
+ * position of each window, over the host HAL's MAX30102 with a finger on,
+ * and over the same samples with the AC made 40 times larger (clipped to
+ * 18 bits), where the scalar's AC x DC products leave 32 bits.
+ *
+ * It checks that the two agree on every pulse where the scalar arithmetic
+ * fits in 32 bits (where it does not, the scalar wraps and the wide kernel
+ * does not), and that maxim_valley_pair_ratio() runs the kernel SPO2_KERNEL
+ * names. It exits non-zero otherwise.
+ *
+ * Cycles are the x86 time-stamp counter (on other hosts, nanoseconds), per
+ * pulse at three pulse lengths: the best of 5 runs of 20 passes over the
+ * windows, each run timed as a whole. On the device, time the same calls with the DWT cycle counter.
+ *
+ * BUILD (from iot/tools/spo2-kernel-bench; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -DARDUINO=100 -I../../host -I../../src -I../../lib/SparkFun-MAX3010x/src \
+ *       spo2_kernel_bench.cpp ../../src/sample_window.cpp ../../lib/SparkFun-MAX3010x/src/spo2_algorithm.cpp \
+ *       -pthread -o spo2-kernel-bench
+ *   (add -DSPO2_KERNEL=SPO2_KERNEL_WIDE to run the firmware's path through the wide kernel)
+ *
+ * USAGE:
+ *   ./spo2-kernel-bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycles"
+static inline uint64_t cycles() { return __rdtsc(); }
+#else
+#define CYCLE_UNIT "ns"
+static inline uint64_t cycles() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+#include "config.h"
+#include "sample_window.h"
+#include "spo2_algorithm.h"
+
+static const int RUNS = 5;
+static const int PASSES = 20;           // Over all the windows, per run
+static const int MIN_PULSE = 4;         // maxim_valley_pair_ratio() takes no shorter pulse
+static const int MAX_PULSE = 50;
+static const int AC_GAIN = 40;
+
+typedef int8_t (*Kernel)(spo2_sample_t *, spo2_sample_t *, int32_t, int32_t, int32_t, int32_t, int32_t *);
+
+// Keep the compiler from dropping results nobody reads
+static inline void keep(const void *data) {
+    asm volatile("" : : "r"(data) : "memory");
+}
+
+// One 18-bit value from FIFO_DATA
+static uint32_t readValue() {
+    uint32_t value = 0;
+    for (int i = 0; i < 3; i++) value = (value << 8) | hostSensor.read(0x07);
+    return value & 0x3FFFF;
+}
+
+/*
+ * One window as the algorithm reads it: the rings and where they start.
+ */
+struct Window {
+    uint32_t red[SPO2_WINDOW_SIZE];
+    uint32_t ir[SPO2_WINDOW_SIZE];
+    int start;
+};
+
+// Every window of the samples, as SampleWindow hands them on
+static std::vector<Window> windowsOf(const std::vector<uint32_t> &red, const std::vector<uint32_t> &ir) {
+    std::vector<Window> windows;
+    SampleWindow ring;
+    for (size_t i = 0; i < red.size(); i++) {
+        if (!ring.push(red[i], ir[i])) continue;
+        Window window;
+        memcpy(window.red, ring.getRed(), sizeof(window.red));
+        memcpy(window.ir, ring.getIR(), sizeof(window.ir));
+        window.start = ring.getStart();
+        windows.push_back(window);
+    }
+    return windows;
+}
+
+/*
+ * Whether the scalar kernel's arithmetic leaves 32 bits on this pulse: its
+ * steps again, in 64 bits.
+ */
+static bool scalarWraps(Window &w, int lo, int hi) {
+    int size = SPO2_WINDOW_SIZE;
+    int64_t xMax = -1, yMax = -1;
+    int xAt = lo, yAt = lo;
+    for (int i = lo; i < hi; i++) {
+        int index = (w.start + i) % size;
+        if ((int64_t)w.ir[index] > xMax) { xMax = w.ir[index]; xAt = i; }
+        if ((int64_t)w.red[index] > yMax) { yMax = w.red[index]; yAt = i; }
+    }
+    int64_t redLo = w.red[(w.start + lo) % size], redHi = w.red[(w.start + hi) % size];
+    int64_t irLo = w.ir[(w.start + lo) % size], irHi = w.ir[(w.start + hi) % size];
+    int at = (w.start + yAt) % size;
+    int64_t yAc = w.red[at] - (redLo + (redHi - redLo) * (yAt - lo) / (hi - lo));
+    int64_t xAc = w.ir[at] - (irLo + (irHi - irLo) * (xAt - lo) / (hi - lo));
+    int64_t nume = yAc * xMax, denom = xAc * yMax;
+    return nume != (int32_t)nume || denom != (int32_t)denom || (nume >> 7) * 100 != (int32_t)((nume >> 7) * 100);
+}
+
+struct Agreement {
+    long pulses = 0;
+    long wraps = 0;           // Pulses where the scalar arithmetic wraps
+    long differWrapped = 0;   // ...and the kernels differ there
+    long differ = 0;          // Pulses where it does not, and they differ
+};
+
+// Both kernels on every pulse of every window
+static Agreement compare(std::vector<Window> &windows) {
+    Agreement result;
+    for (Window &w : windows) {
+        for (int length = MIN_PULSE; length <= MAX_PULSE; length++) {
+            for (int lo = 0; lo + length < SPO2_WINDOW_SIZE; lo++) {
+                int32_t scalarRatio = 0, wideRatio = 0;
+                int8_t scalarValid = maxim_valley_pair_ratio_scalar(w.ir, w.red, SPO2_WINDOW_SIZE, w.start,
+                                                                    lo, lo + length, &scalarRatio);
+                int8_t wideValid = maxim_valley_pair_ratio_wide(w.ir, w.red, SPO2_WINDOW_SIZE, w.start,
+                                                                lo, lo + length, &wideRatio);
+                bool same = scalarValid == wideValid && (!scalarValid || scalarRatio == wideRatio);
+                result.pulses++;
+                if (scalarWraps(w, lo, lo + length)) {
+                    result.wraps++;
+                    if (!same) result.differWrapped++;
+                } else if (!same) {
+                    result.differ++;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+// Best mean cycles per pulse over RUNS runs: every pulse of one length
+static double timeKernel(Kernel kernel, std::vector<Window> &windows, int length) {
+    double best = 0;
+    for (int r = 0; r < RUNS; r++) {
+        long calls = 0;
+        uint64_t start = cycles();
+        for (int pass = 0; pass < PASSES; pass++) {
+            for (Window &w : windows) {
+                for (int lo = 0; lo + length < SPO2_WINDOW_SIZE; lo++) {
+                    int32_t ratio;
+                    kernel(w.ir, w.red, SPO2_WINDOW_SIZE, w.start, lo, lo + length, &ratio);
+                    keep(&ratio);
+                    calls++;
+                }
+            }
+        }
+        double perCall = (double)(cycles() - start) / calls;
+        if (r == 0 || perCall < best) best = perCall;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 1) {
+        fprintf(stderr, "usage: %s\n", argv[0]);
+        return 2;
+    }
+    
+    // Two minutes of samples, and the same with a far stronger pulse
+    std::vector<uint32_t> red, ir;
+    hostSensor.fingerOn = true;
+    for (int i = 0; i < 120 * 25; i++) {
+        hostAdvance(HostSensor::SAMPLE_PERIOD);
+        red.push_back(readValue());
+        ir.push_back(readValue());
+    }
+    uint64_t redSum = 0, irSum = 0;
+    for (size_t i = 0; i < red.size(); i++) {
+        redSum += red[i];
+        irSum += ir[i];
+    }
+    int64_t redMean = redSum / red.size(), irMean = irSum / ir.size();
+    std::vector<uint32_t> strongRed, strongIR;
+    for (size_t i = 0; i < red.size(); i++) {
+        int64_t r = redMean + (red[i] - redMean) * AC_GAIN;
+        int64_t x = irMean + (ir[i] - irMean) * AC_GAIN;
+        strongRed.push_back(r < 0 ? 0 : r > 0x3FFFF ? 0x3FFFF : r);
+        strongIR.push_back(x < 0 ? 0 : x > 0x3FFFF ? 0x3FFFF : x);
+    }
+    std::vector<Window> sensor = windowsOf(red, ir);
+    std::vector<Window> strong = windowsOf(strongRed, strongIR);
+    
+    // maxim_valley_pair_ratio() must be the kernel SPO2_KERNEL names
+    Kernel selected = SPO2_KERNEL == SPO2_KERNEL_WIDE ? maxim_valley_pair_ratio_wide : maxim_valley_pair_ratio_scalar;
+    long selectedDiffer = 0;
+    for (Window &w : sensor) {
+        for (int lo = 0; lo + 21 < SPO2_WINDOW_SIZE; lo++) {
+            int32_t expected = 0, ratio = 0;
+            int8_t expectedValid = selected(w.ir, w.red, SPO2_WINDOW_SIZE, w.start, lo, lo + 21, &expected);
+            int8_t valid = maxim_valley_pair_ratio(w.ir, w.red, SPO2_WINDOW_SIZE, w.start, lo, lo + 21, &ratio);
+            if (valid != expectedValid || ratio != expected) selectedDiffer++;
+        }
+    }
+    
+    Agreement sensorAgreement = compare(sensor);
+    Agreement strongAgreement = compare(strong);
+    
+    printf("SPO2_KERNEL here: %s\n", SPO2_KERNEL == SPO2_KERNEL_WIDE ? "wide" : "scalar");
+    printf("  %-34s %10s %10s %12s %10s\n", "pulses of 4 to 50 samples", "pulses", "wrap", "differ there",
+           "differ");
+    printf("  %-34s %10ld %10ld %12ld %10ld\n", "sensor model", sensorAgreement.pulses, sensorAgreement.wraps,
+           sensorAgreement.differWrapped, sensorAgreement.differ);
+    printf("  %-34s %10ld %10ld %12ld %10ld\n", "sensor model, AC x40", strongAgreement.pulses,
+           strongAgreement.wraps, strongAgreement.differWrapped, strongAgreement.differ);
+    
+    static const int lengths[] = {37, 21, 12};   // 40, 71 and 125 bpm
+    printf("  %-34s %10s %10s\n", "per pulse", "scalar", "wide");
+    for (int length : lengths) {
+        char label[48];
+        snprintf(label, sizeof(label), "%d samples (%d bpm), %s", length, FreqS * 60 / length, CYCLE_UNIT);
+        printf("  %-34s %10.0f %10.0f\n", label, timeKernel(maxim_valley_pair_ratio_scalar, sensor, length),
+               timeKernel(maxim_valley_pair_ratio_wide, sensor, length));
+    }
+    
+    long failures = sensorAgreement.differ + strongAgreement.differ + selectedDiffer;
+    printf("kernels: %s\n", failures == 0 ? "agree" : "DIFFER");
+    return failures == 0 ? 0 : 1;
+}
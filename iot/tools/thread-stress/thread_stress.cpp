@@ -0,0 +1,342 @@
+/*
+ * thread_stress.cpp - Stress Test of the Threaded Mode (THREADED_MODE)
+ *
+ * Builds the firmware (all of src/ but the .ino) on a Linux host, with its
+ * threads on std::thread (iot/host, on its real clock), and runs two
+ * tests meant to be built with ThreadSanitizer:
+ *   queues    one producer and one consumer thread per SpscQueue (the
+ *             command and event queue types) pass sequence-numbered items
+ *             in random bursts; every item must arrive once and in order
+ *   firmware  the firmware's own threads (acquisition, filling the
+ *             MAX30105 driver's sample ring; network; and the main
+ *             thread's TaskScheduler) run measurement cycles against a
+ *             simulated MAX30102 and cloud on a sped-up real clock, as in
+ *             tools/sched-sim, with each publish blocking its caller for
+ *             -b ms and the main thread stalled for -m ms once in each
+ *             measurement (as Particle.process() can be while the cloud
+ *             connection is re-established); no FIFO overrun may occur
+ *             while measuring
+ *
+ * Reported: queue throughput, the scheduler's per-task latency, FIFO
+ * overruns and the most samples left waiting in the FIFO while measuring,
+ * I2C traffic and the measurements uploaded. The connection mode and
+ * sensor acquisition mode are those set in config.h. Built without
+ * -DTHREADED_MODE=true the firmware test runs the single-threaded loop
+ * for comparison: there the stall holds up the FIFO reads too, and the
+ * FIFO overruns once it outlasts 32 samples (1.28 s).
+ *
+ * The flash log's FLASH_LOG_DIR is redirected to a temporary directory
+ * (host_log_dir.h).
+ *
+ * BUILD (from iot/tools/thread-stress; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O1 -g -fsanitize=thread -DARDUINO=100 -DTHREADED_MODE=true -DHOST_REAL_CLOCK=1 \
+ *       -I../../host -I../../src -I../../lib/SparkFun-MAX3010x/src \
+ *       thread_stress.cpp ../../src/[a-z]*.cpp ../../lib/SparkFun-MAX3010x/src/[a-zA-Z]*.cpp \
+ *       -pthread -o thread-stress
+ *
+ * USAGE:
+ *   ./thread-stress [-n items] [-c cycles] [-b block_ms] [-m stall_ms] [-s speed] [-v]
+ *     -n  items per queue test (default 1000000)
+ *     -c  measurement cycles (default 3)
+ *     -b  ms each publish holds up its caller (default 2000)
+ *     -m  ms the main thread stalls in each measurement (default 2000)
+ *     -s  simulated ms per real ms (default 20)
+ *     -v  prints the firmware's serial output
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "host_log_dir.h"
+#include "led_controller.h"
+#include "network_manager.h"
+#include "sensor_manager.h"
+#include "spsc_queue.h"
+#include "state_machine.h"
+#include "task_scheduler.h"
+
+#define FINGER_DELAY_MS 3000
+#define STALL_DELAY_MS 1000     // Into the measurement
+
+static unsigned long mainStall = 2000;
+
+// The firmware's globals, as in heart-track-iot.ino
+StateMachine stateMachine;
+SensorManager sensorManager;
+LEDController ledController;
+NetworkManager networkManager;
+TaskScheduler scheduler;
+
+// ============================================================================
+// Queue test
+// ============================================================================
+
+/*
+ * Item of a queue test: a sequence number, padded to the size of the
+ * firmware's item type so copies take as long as they do there.
+ */
+template<class Item> struct Numbered {
+    uint32_t sequence;
+    uint8_t padding[sizeof(Item) > sizeof(uint32_t) ? sizeof(Item) - sizeof(uint32_t) : 1];
+};
+
+/*
+ * Pass items sequence numbers through an SpscQueue of the given depth,
+ * from a producer thread to a consumer thread, each working in random
+ * bursts and yielding in between so the queue runs both full and empty.
+ * Returns false if an item was lost, repeated or out of order.
+ */
+template<class Item, int N> static bool testQueue(const char *name, uint32_t items) {
+    typedef Numbered<Item> Entry;
+    static SpscQueue<Entry, N> queue;
+    std::atomic<uint32_t> fullCount(0), emptyCount(0);
+    
+    auto started = std::chrono::steady_clock::now();
+    
+    std::thread producer([&] {
+        unsigned seed = 1;
+        uint32_t next = 0;
+        while (next < items) {
+            int burst = 1 + rand_r(&seed) % (2 * N);
+            for (int i = 0; i < burst && next < items; i++) {
+                Entry entry;
+                entry.sequence = next;
+                memset(entry.padding, next & 0xFF, sizeof(entry.padding));
+                if (!queue.push(entry)) {
+                    fullCount++;
+                    break;
+                }
+                next++;
+            }
+            std::this_thread::yield();
+        }
+    });
+    
+    uint32_t expected = 0;
+    bool ok = true;
+    unsigned seed = 2;
+    while (expected < items && ok) {
+        int burst = 1 + rand_r(&seed) % (2 * N);
+        for (int i = 0; i < burst && expected < items; i++) {
+            Entry entry;
+            if (!queue.pop(entry)) {
+                emptyCount++;
+                break;
+            }
+            if (entry.sequence != expected || entry.padding[0] != (expected & 0xFF)) {
+                fprintf(stderr, "%s: got item %lu, expected %lu\n", name,
+                        (unsigned long)entry.sequence, (unsigned long)expected);
+                ok = false;
+                break;
+            }
+            expected++;
+        }
+        std::this_thread::yield();
+    }
+    producer.join();
+    
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    printf("  %-10s %6d x %3zu B %10lu %12.0f %10lu %10lu  %s\n", name, N, sizeof(Entry),
+           (unsigned long)expected, expected / seconds, (unsigned long)fullCount.load(),
+           (unsigned long)emptyCount.load(), ok && queue.isEmpty() ? "ok" : "FAILED");
+    return ok && queue.isEmpty();
+}
+
+static bool testQueues(uint32_t items) {
+    printf("queues (one producer, one consumer thread)\n");
+    printf("  %-10s %16s %10s %12s %10s %10s\n", "queue", "depth x item", "items", "items/s", "full", "empty");
+    bool ok = testQueue<uint32_t, 64>("uint32", items);
+    #if THREADED_MODE
+    ok = testQueue<NetworkCommand, NETWORK_COMMAND_QUEUE_SIZE>("command", items) && ok;
+    ok = testQueue<NetworkEvent, NETWORK_EVENT_QUEUE_SIZE>("event", items) && ok;
+    #endif
+    printf("\n");
+    fflush(stdout);
+    return ok;
+}
+
+// ============================================================================
+// Firmware test
+// ============================================================================
+
+// Tasks, as added in heart-track-iot.ino
+static bool isMeasurementReady() {
+    return stateMachine.getCurrentState() == STATE_TRANSMITTING &&
+           sensorManager.isMeasurementComplete() && !networkManager.isTransmitting();
+}
+
+static void handOffMeasurement(void *context) {
+    if (isMeasurementReady()) {
+        MeasurementData data = sensorManager.getMeasurement();
+        networkManager.transmitMeasurement(data);
+    }
+}
+
+static unsigned long nextHandoff(void *context) {
+    return millis() + (isMeasurementReady() ? 0 : SCHEDULER_IDLE_WAKEUP);
+}
+
+#if THREADED_MODE
+static void applyNetworkEvents(void *context) {
+    networkManager.processEvents();
+}
+
+static unsigned long nextNetworkEvent(void *context) {
+    return networkManager.getNextEvent();
+}
+#endif
+
+/*
+ * Boot the firmware as setup() does (without the cloud connection; the
+ * cloud is always connected here) and add its tasks.
+ */
+static void boot() {
+    ledController.begin();
+    ledController.setPattern(DEVICE_LED_SOLID_CYAN);
+    if (!sensorManager.begin()) {
+        fprintf(stderr, "sensor model not found by the driver\n");
+        exit(1);
+    }
+    networkManager.begin();
+    stateMachine.begin();
+    
+    scheduler.addTask("state", &stateMachine);
+    scheduler.addTask("sensor", &sensorManager);
+    scheduler.addTask("handoff", nullptr, handOffMeasurement, nextHandoff);
+    #if THREADED_MODE
+    scheduler.addTask("network", nullptr, applyNetworkEvents, nextNetworkEvent);
+    #else
+    scheduler.addTask("network", &networkManager);
+    #endif
+    scheduler.addTask("led", &ledController);
+    
+    ledController.setPattern(DEVICE_LED_OFF);
+    scheduler.resetStats();
+}
+
+/*
+ * Run the main thread's loop() for cycles measurement cycles: each ends
+ * when the state machine returns to IDLE after a measurement was handed
+ * off (or failed). Returns the measurements handed off.
+ */
+static uint32_t runCycles(int cycles) {
+    uint32_t measurements = 0;
+    int completed = 0;
+    unsigned long fingerAt = 0;
+    unsigned long stallAt = 0;
+    DeviceState last = stateMachine.getCurrentState();
+    
+    while (completed < cycles) {
+        scheduler.run();
+        Particle.process();
+    
+        DeviceState state = stateMachine.getCurrentState();
+        if (state != last) {
+            if (state == STATE_WAITING_FOR_USER) fingerAt = millis() + FINGER_DELAY_MS;
+            if (state == STATE_MEASURING) {
+                hostSensor.countOverruns = true;
+                stallAt = millis() + STALL_DELAY_MS;
+            }
+            if (state == STATE_TRANSMITTING) measurements++;
+            if (state == STATE_TRANSMITTING || state == STATE_IDLE) {
+                hostSensor.fingerOn = false;
+                hostSensor.countOverruns = false;
+                fingerAt = 0;
+                stallAt = 0;
+            }
+            if (state == STATE_IDLE) completed++;
+            last = state;
+        }
+    
+        if (fingerAt != 0 && (long)(millis() - fingerAt) >= 0) {
+            hostSensor.fingerOn = true;
+            fingerAt = 0;
+        }
+        if (stallAt != 0 && (long)(millis() - stallAt) >= 0) {
+            delay(mainStall);
+            stallAt = 0;
+        }
+    }
+    return measurements;
+}
+
+static bool testFirmware(int cycles) {
+    printf("firmware (%s), %d measurement cycles, publishes block %lu ms, main thread stalls %lu ms\n",
+           THREADED_MODE ? "acquisition and network threads" : "single-threaded loop",
+           cycles, hostPublishBlock, mainStall);
+    
+    boot();
+    unsigned long start = millis();
+    uint32_t measurements = runCycles(cycles);
+    
+    // Let the network thread finish the last upload
+    unsigned long settle = millis() + 2 * (hostPublishBlock + hostPublishLatency) + 1000;
+    while (networkManager.isTransmitting() && (long)(millis() - settle) < 0) {
+        scheduler.run();
+        Particle.process();
+    }
+    unsigned long elapsed = millis() - start;
+    
+    printf("  %-10s %10s %10s %8s\n", "task", "runs", "latency", "max");
+    for (int i = 0; i < scheduler.getTaskCount(); i++) {
+        const TaskStats &stats = scheduler.getStats(i);
+        printf("  %-10s %10lu %10.2f %8lu\n", stats.name, (unsigned long)stats.runs,
+               stats.runs > 0 ? (float)stats.totalLatency / stats.runs : 0, (unsigned long)stats.maxLatency);
+    }
+    printf("  elapsed: %.1f s simulated\n", elapsed / 1000.0);
+    printf("  sensor: %ld samples read, %ld lost to FIFO overruns while measuring (%lu counted by the driver"
+           " since boot), at most %d of 32 samples waiting\n",
+           hostSensor.samplesRead.load(), hostSensor.overruns.load(),
+           (unsigned long)sensorManager.getOverrunCount(), hostSensor.peakUnread.load());
+    printf("  I2C: %ld bytes; measurements handed off: %lu of %d cycles, %d publishes, %d HTTP requests\n\n",
+           hostI2CBytes.load(), (unsigned long)measurements, cycles,
+           hostPublishCount.load(), hostRequestCount.load());
+    fflush(stdout);
+    
+    return hostSensor.overruns == 0 && measurements == (uint32_t)cycles && !networkManager.isTransmitting();
+}
+
+int main(int argc, char **argv) {
+    uint32_t items = 1000000;
+    int cycles = 3;
+    hostSpeed = 20;
+    hostPublishBlock = 2000;
+    hostPublishLatency = 300;
+    // A measurement every 15 s
+    hostConfigResponse = "{\"success\":true,\"data\":{\"config\":"
+                         "{\"measurementFrequency\":15,"
+                         "\"activeStartTime\":\"06:00\",\"activeEndTime\":\"22:00\"}}}";
+    int option;
+    while ((option = getopt(argc, argv, "n:c:b:m:s:v")) != -1) {
+        switch (option) {
+            case 'n': items = strtoul(optarg, nullptr, 10); break;
+            case 'c': cycles = atoi(optarg); break;
+            case 'b': hostPublishBlock = strtoul(optarg, nullptr, 10); break;
+            case 'm': mainStall = strtoul(optarg, nullptr, 10); break;
+            case 's': hostSpeed = max(1, atoi(optarg)); break;
+            case 'v': hostVerbose = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-n items] [-c cycles] [-b block_ms] [-m stall_ms] [-s speed] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (!hostMakeLogDirectory("thread-stress")) return 1;
+    hostWireBuffer = SENSOR_I2C_BUFFER_SIZE;    // As acquireWireBuffer() in the .ino
+    
+    printf("mode: %s, sensor %s\n\n", USE_WEBHOOK ? "webhook" : "direct HTTP",
+           USE_SENSOR_INTERRUPT ? "A_FULL interrupt" : "polled");
+    fflush(stdout);
+    
+    bool ok = testQueues(items);
+    ok = testFirmware(cycles) && ok;
+    
+    hostRemoveLogDirectory();
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    fflush(stdout);
+    
+    // The firmware's threads run until reset: leave without joining them
+    _exit(ok ? 0 : 1);
+}
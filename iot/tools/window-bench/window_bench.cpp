@@ -0,0 +1,200 @@
+/*
+ * window_bench.cpp - Host Benchmark for the SpO2 Sample Window
+ *
+ * Times one window update - the SPO2_HOP_SIZE new samples that slide the
+ * SpO2 window on, and the copies made before the algorithm can read it -
+ * both ways the firmware has kept the window:
+ *   shifting - SensorManager's former redBuffer/irBuffer: the oldest
+ *              SPO2_HOP_SIZE samples are shifted out of both arrays at the
+ *              start of each hop, and maxim_heart_rate_and_oxygen_saturation()
+ *              then loaded the raw window again into its global an_x/an_y
+ *   ring     - SampleWindow (src/sample_window.cpp): each sample overwrites
+ *              the oldest in place, and the algorithm reads the ring where
+ *              it lies (maxim_heart_rate_and_oxygen_saturation_ring())
+ * For scale it also times the algorithm itself over one window, which both
+ * ways run. The samples are the host HAL's MAX30102 with a finger on.
+ *
+ * Cycles are the x86 time-stamp counter (on other hosts, nanoseconds),
+ * per window update: the best of 5 runs over -n windows each, each run
+ * timed as a whole. It
+ * exits non-zero if the two windows ever hold different samples.
+ *
+ * BUILD (from iot/tools/window-bench; or every tool at once, see iot/host/CMakeLists.txt):
+ *   g++ -std=c++17 -O2 -DARDUINO=100 -I../../host -I../../src -I../../lib/SparkFun-MAX3010x/src \
+ *       window_bench.cpp ../../src/sample_window.cpp ../../lib/SparkFun-MAX3010x/src/spo2_algorithm.cpp \
+ *       -pthread -o window-bench
+ *
+ * USAGE:
+ *   ./window-bench [-n windows]     (default 100000)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycles"
+static inline uint64_t cycles() { return __rdtsc(); }
+#else
+#define CYCLE_UNIT "ns"
+static inline uint64_t cycles() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+#include "config.h"
+#include "sample_window.h"
+#include "spo2_algorithm.h"
+
+static const int RUNS = 5;
+
+// Keep the compiler from dropping stores nobody reads
+static inline void keep(const void *data) {
+    asm volatile("" : : "r"(data) : "memory");
+}
+
+/*
+ * ShiftWindow - The window as SensorManager kept it before SampleWindow
+ * (collectInitialBuffer() / updateBuffer()), with the algorithm's reload.
+ */
+struct ShiftWindow {
+    uint32_t red[SPO2_WINDOW_SIZE];
+    uint32_t ir[SPO2_WINDOW_SIZE];
+    int index = 0;
+    bool filled = false;
+    
+    int32_t x[SPO2_WINDOW_SIZE];    // The algorithm's an_x / an_y
+    int32_t y[SPO2_WINDOW_SIZE];
+    
+    // Returns true when a window is ready, as SampleWindow::push()
+    bool push(uint32_t redValue, uint32_t irValue) {
+        if (filled && index == SPO2_WINDOW_SIZE - SPO2_HOP_SIZE) {
+            for (int i = SPO2_HOP_SIZE; i < SPO2_WINDOW_SIZE; i++) {
+                red[i - SPO2_HOP_SIZE] = red[i];
+                ir[i - SPO2_HOP_SIZE] = ir[i];
+            }
+        }
+        red[index] = redValue;
+        ir[index] = irValue;
+        index++;
+        if (index < SPO2_WINDOW_SIZE) return false;
+    
+        filled = true;
+        index = SPO2_WINDOW_SIZE - SPO2_HOP_SIZE;
+        return true;
+    }
+    
+    // "load raw value again for SPO2 calculation"
+    void reload() {
+        for (int k = 0; k < SPO2_WINDOW_SIZE; k++) {
+            x[k] = ir[k];
+            y[k] = red[k];
+        }
+        keep(x);
+        keep(y);
+    }
+};
+
+// One 18-bit value from FIFO_DATA
+static uint32_t readValue() {
+    uint32_t value = 0;
+    for (int i = 0; i < 3; i++) value = (value << 8) | hostSensor.read(0x07);
+    return value & 0x3FFFF;
+}
+
+// Best mean over RUNS runs of each window's cycles
+static double best(double runs[RUNS]) {
+    double result = runs[0];
+    for (int r = 1; r < RUNS; r++) result = min(result, runs[r]);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    long windows = 100000;
+    if (argc == 3 && strcmp(argv[1], "-n") == 0 && atol(argv[2]) > 0) {
+        windows = atol(argv[2]);
+    } else if (argc != 1) {
+        fprintf(stderr, "usage: %s [-n windows]\n", argv[0]);
+        return 2;
+    }
+    
+    // Two minutes of samples, used round and round
+    std::vector<uint32_t> redSamples, irSamples;
+    hostSensor.fingerOn = true;
+    for (int i = 0; i < 120 * 25; i++) {
+        hostAdvance(HostSensor::SAMPLE_PERIOD);
+        redSamples.push_back(readValue());
+        irSamples.push_back(readValue());
+    }
+    size_t total = redSamples.size();
+    
+    // The two windows must hold the same samples at every update
+    ShiftWindow shifting;
+    SampleWindow ring;
+    long mismatches = 0;
+    for (size_t i = 0; i < total; i++) {
+        bool shiftReady = shifting.push(redSamples[i], irSamples[i]);
+        bool ringReady = ring.push(redSamples[i], irSamples[i]);
+        if (shiftReady != ringReady) mismatches++;
+        if (!ringReady) continue;
+        for (int k = 0; k < ring.getSize(); k++) {
+            int index = (ring.getStart() + k) % ring.getSize();
+            if (ring.getRed()[index] != shifting.red[k] || ring.getIR()[index] != shifting.ir[k]) mismatches++;
+        }
+    }
+    
+    double shiftRuns[RUNS], ringRuns[RUNS], algorithmRuns[RUNS];
+    for (int r = 0; r < RUNS; r++) {
+        size_t next = 0;
+        uint64_t start = cycles();
+        for (long w = 0; w < windows; w++) {
+            bool ready;
+            do {
+                ready = shifting.push(redSamples[next], irSamples[next]);
+                if (++next == total) next = 0;
+            } while (!ready);
+            shifting.reload();
+        }
+        shiftRuns[r] = (double)(cycles() - start) / windows;
+    
+        next = 0;
+        start = cycles();
+        for (long w = 0; w < windows; w++) {
+            bool ready;
+            do {
+                ready = ring.push(redSamples[next], irSamples[next]);
+                if (++next == total) next = 0;
+            } while (!ready);
+            keep(ring.getRed());
+            keep(ring.getIR());
+        }
+        ringRuns[r] = (double)(cycles() - start) / windows;
+    
+        // The algorithm is far slower, so a tenth as many windows
+        long algorithmWindows = windows / 10 > 0 ? windows / 10 : 1;
+        int32_t spo2, heartRate;
+        int8_t spo2Valid, heartRateValid;
+        start = cycles();
+        for (long w = 0; w < algorithmWindows; w++) {
+            maxim_heart_rate_and_oxygen_saturation_ring(ring.getIR(), ring.getRed(), ring.getSize(), ring.getStart(),
+                                                        &spo2, &spo2Valid, &heartRate, &heartRateValid);
+            keep(&spo2);
+            keep(&heartRate);
+        }
+        algorithmRuns[r] = (double)(cycles() - start) / algorithmWindows;
+    }
+    
+    printf("window %d samples, hop %d, %ld windows x %d runs\n", SPO2_WINDOW_SIZE, SPO2_HOP_SIZE, windows, RUNS);
+    printf("  %-40s %10s\n", "per window update", CYCLE_UNIT);
+    printf("  %-40s %10.0f\n", "shifting (shift + an_x/an_y reload)", best(shiftRuns));
+    printf("  %-40s %10.0f\n", "ring (SampleWindow, read in place)", best(ringRuns));
+    printf("  %-40s %10.1fx\n", "speedup", best(shiftRuns) / best(ringRuns));
+    printf("  %-40s %10.0f\n", "algorithm over the window (both)", best(algorithmRuns));
+    printf("windows that differ: %ld\n", mismatches);
+    return mismatches == 0 ? 0 : 1;
+}